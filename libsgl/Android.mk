@@ -25,6 +25,7 @@ LOCAL_SRC_FILES:= \
 	glesMatrix.cpp \
 	glesPixel.cpp \
 	glesTex.cpp \
+	fgletc1.cpp \
 	fglmatrix.cpp \
 	fglframebuffer.cpp \
 	fglsurface.cpp
@@ -40,7 +40,7 @@
 /** Number of supported light sources */
 #define FGL_MAX_LIGHTS			8
 /** Number of supported user clip planes */
-#define FGL_MAX_CLIP_PLANES		1
+#define FGL_MAX_CLIP_PLANES		3
 /** Modelview matrix stack depth */
 #define FGL_MAX_MODELVIEW_STACK_DEPTH	16
 /** Projection matrix stack depth */
@@ -61,6 +61,22 @@
 #define FGL_MIN_LINE_WIDTH		(1.0f)
 /** Maximal line width of line rendering. */
 #define FGL_MAX_LINE_WIDTH		(128.0f)
+/** Maximal vertex count of a draw that can be merged with other draws */
+#define FGL_DRAW_QUEUE_MAX_DRAW		64
+/** Size of vertex storage of draw queue (in bytes) */
+#define FGL_DRAW_QUEUE_SIZE		(32*1024)
+/** Log hardware session, draw and lock counts on every frame */
+//#define FGL_DRAW_QUEUE_STATS
+/** Transcode ETC1 textures to S3TC, if the error introduced is acceptable */
+#define FGL_ETC1_TO_S3TC
+/** Maximal mean squared error of color components accepted for transcoding */
+#define FGL_ETC1_MAX_ERROR		32
+/** Minimal texel count of ETC1 image to be processed by multiple threads */
+#define FGL_ETC1_THREAD_MIN_TEXELS	(128*128)
+/** Maximal number of threads processing single ETC1 image */
+#define FGL_ETC1_MAX_THREADS		4
+/** Log throughput of every processed ETC1 image (see fglGetETC1Stats()) */
+//#define FGL_ETC1_STATS
 
 /** Compiler hint to evaluate given condition as likely to happen. */
 #define likely(x)       __builtin_expect((x),1)
@@ -366,10 +366,12 @@ class FGLImageSurface : public FGLSurface {
 	EGLImageKHR		image;
 	android_native_buffer_t	*buffer;
 	const private_handle_t	*handle;
+	bool			swWrite;
 
 public:
 	FGLImageSurface(EGLClientBuffer img) :
-		image(0)
+		image(0),
+		swWrite(true)
 	{
 		android_native_buffer_t *b = (android_native_buffer_t *)img;
 
@@ -399,6 +401,7 @@ public:
 		image	= img;
 		buffer	= b;
 		handle	= hnd;
+		swWrite	= !!(b->usage & GRALLOC_USAGE_SW_WRITE_MASK);
 	}
 
 	virtual ~FGLImageSurface() {}
@@ -407,6 +410,10 @@ public:
 	{
 		struct pmem_region region;
 
+		/* Buffers filled only by hardware (e.g. video) are never dirty */
+		if (!swWrite)
+			return;
+
 		region.offset	= 0;
 		region.len	= size;
 
@@ -1167,6 +1174,13 @@ EGLImageKHR eglCreateImageKHR(EGLDisplay dpy, EGLContext ctx,
 	case HAL_PIXEL_FORMAT_RGBA_4444:
 		pixelFormat = FGL_PIXFMT_RGBA4444;
 		break;
+	/* Packed YUV formats converted to RGB by texture unit */
+	case HAL_PIXEL_FORMAT_YCbCr_422_I:
+		pixelFormat = FGL_PIXFMT_VY1UY0;
+		break;
+	case HAL_PIXEL_FORMAT_CbYCrY_422_I:
+		pixelFormat = FGL_PIXFMT_Y1VY0U;
+		break;
 	default:
 		setError(EGL_BAD_PARAMETER);
 		return EGL_NO_IMAGE_KHR;
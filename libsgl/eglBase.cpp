@@ -50,6 +50,7 @@
 #include "libfimg/fimg.h"
 #include "fglsurface.h"
 #include "glesFramebuffer.h"
+#include "fgletc1.h"
 
 /** Major version of implemented EGL specification. */
 #define FGL_EGL_MAJOR		1
@@ -120,7 +121,7 @@ EGLAPI EGLint EGLAPIENTRY eglGetError(void)
 	if(unlikely(eglErrorKey == (pthread_key_t)-1))
 		return EGL_SUCCESS;
 
-	EGLint error = (EGLint)pthread_getspecific(eglErrorKey);
+	EGLint error = (EGLint)(intptr_t)pthread_getspecific(eglErrorKey);
 	pthread_setspecific(eglErrorKey, (void *)EGL_SUCCESS);
 	return error;
 }
@@ -138,7 +139,7 @@ void fglEGLSetError(EGLint error)
 		pthread_mutex_unlock(&eglErrorKeyMutex);
 	}
 
-	pthread_setspecific(eglErrorKey, (void *)error);
+	pthread_setspecific(eglErrorKey, (void *)(intptr_t)error);
 }
 
 /*
@@ -203,6 +204,7 @@ EGLAPI EGLBoolean EGLAPIENTRY eglTerminate(EGLDisplay dpy)
 		goto finish;
 
 	display.initialized = EGL_FALSE;
+	fglTerminateETC1();
 
 finish:
 	pthread_mutex_unlock(&display.lock);
@@ -673,7 +675,7 @@ EGLAPI EGLBoolean EGLAPIENTRY eglGetConfigAttrib(EGLDisplay dpy,
 		return EGL_FALSE;
 	}
 
-	if (!fglGetConfigAttrib((uint32_t)config, attribute, value))
+	if (!fglGetConfigAttrib((uint32_t)(uintptr_t)config, attribute, value))
 		return EGL_FALSE;
 
 	return EGL_TRUE;
@@ -741,7 +743,7 @@ public:
 EGLAPI EGLSurface EGLAPIENTRY eglCreateWindowSurface(EGLDisplay dpy,
 	EGLConfig config, EGLNativeWindowType win, const EGLint *attrib_list)
 {
-	uint32_t configID = (uint32_t)config;
+	uint32_t configID = (uint32_t)(uintptr_t)config;
 
 	if (!fglEGLValidateDisplay(dpy)) {
 		setError(EGL_BAD_DISPLAY);
@@ -785,7 +787,7 @@ EGLAPI EGLSurface EGLAPIENTRY eglCreateWindowSurface(EGLDisplay dpy,
 EGLAPI EGLSurface EGLAPIENTRY eglCreatePbufferSurface(EGLDisplay dpy,
 				EGLConfig config, const EGLint *attrib_list)
 {
-	uint32_t configID = (uint32_t)config;
+	uint32_t configID = (uint32_t)(uintptr_t)config;
 
 	if (!fglEGLValidateDisplay(dpy)) {
 		setError(EGL_BAD_DISPLAY);
@@ -1038,6 +1040,7 @@ EGLAPI EGLBoolean EGLAPIENTRY eglSwapInterval(EGLDisplay dpy, EGLint interval)
 
 extern FGLContext *fglCreateContext(void);
 extern void fglDestroyContext(FGLContext *ctx);
+extern void fglEndFrame(FGLContext *ctx);
 
 EGLAPI EGLContext EGLAPIENTRY eglCreateContext(EGLDisplay dpy,
 				EGLConfig config, EGLContext share_context,
@@ -1097,6 +1100,9 @@ static void fglUnbindContext(FGLContext *c)
 	/* Make sure all the work finished */
 	glFinish();
 
+	/* Let other clients use the hardware */
+	fimgReleaseHardware(c->fimg);
+
 	/* Mark the context as not current anymore */
 	c->egl.flags &= ~FGL_IS_CURRENT;
 
@@ -1281,7 +1287,7 @@ EGLAPI EGLBoolean EGLAPIENTRY eglQueryContext(EGLDisplay dpy, EGLContext ctx,
 		 * Returns the ID of the EGL frame buffer configuration with
 		 * respect to which the context was created.
 		 */
-		*value = (EGLint)c->egl.config;
+		*value = (EGLint)(intptr_t)c->egl.config;
 		break;
 	default:
 		setError(EGL_BAD_ATTRIBUTE);
@@ -1323,8 +1329,11 @@ EGLAPI EGLBoolean EGLAPIENTRY eglSwapBuffers(EGLDisplay dpy, EGLSurface surface)
 
 	/* Flush the context attached to the surface if it's current */
 	FGLContext *ctx = getGlThreadSpecific();
-	if ((FGLContext *)d->ctx == ctx)
+	if ((FGLContext *)d->ctx == ctx) {
 		glFinish();
+		fglEndFrame(ctx);
+		fimgReleaseHardware(ctx->fimg);
+	}
 
 	/* post the surface */
 	if (!d->swapBuffers())
@@ -79,7 +79,7 @@ struct FGLExtensionMap {
  */
 static inline bool fglEGLValidateDisplay(EGLDisplay dpy)
 {
-	return (uint32_t)dpy == FGL_DISPLAY_MAGIC;
+	return (uintptr_t)dpy == FGL_DISPLAY_MAGIC;
 }
 
 extern void fglEGLSetError(EGLint error);
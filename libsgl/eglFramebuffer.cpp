@@ -644,7 +644,7 @@ FGLRenderSurface *platformCreateWindowSurface(EGLDisplay dpy,
 		EGLNativeWindowType window)
 {
 	fb_var_screeninfo vinfo;
-	int fd = (int)window;
+	int fd = (intptr_t)window;
 
 	if (ioctl(fd, FBIOGET_VSCREENINFO, &vinfo) < 0) {
 		LOGE("%s: Invalid native window handle specified", __func__);
@@ -23,8 +23,13 @@
 #define _LIBSGL_FGLBUFFEROBJECT_
 
 #include <cstdlib>
+#include <cstring>
 #include <GLES/gl.h>
 #include "fglobject.h"
+#include "libfimg/fimg.h"
+
+/** Number of index partitions cached per buffer object. */
+#define FGL_BUFFER_PARTITIONS	4
 
 struct FGLBuffer;
 
@@ -69,13 +74,36 @@ public:
 	}
 };
 
+/** Index partition cached for a range of an element array buffer. */
+struct FGLBufferPartition {
+	/** Offset of first index inside the buffer. */
+	intptr_t offset;
+	/** Index count. */
+	GLsizei count;
+	/** Index type. */
+	GLenum type;
+	/** Primitive type (as passed to libfimg). */
+	uint32_t mode;
+	/** Partition created by libfimg (NULL if the slot is free). */
+	fimgIndexPartition *partition;
+};
+
 /** A class representing OpenGL ES buffer object. */
 struct FGLBuffer {
 	void *memory;
 	int size;
 	GLenum usage;
 	unsigned int name;
+	/** Generation number, changed whenever buffer contents change. */
+	unsigned int generation;
 	FGLObject<FGLBuffer, FGLBufferObjectBinding> object;
+	/** Index partitions of static element arrays sourced from the buffer. */
+	FGLBufferPartition partitions[FGL_BUFFER_PARTITIONS];
+	/** Slot to be replaced by next cached partition. */
+	unsigned int nextPartition;
+
+	/** Last generation number assigned to any buffer. */
+	static unsigned int lastGeneration;
 
 	/**
 	 * Class constructor. Creates buffer object of given name.
@@ -86,7 +114,12 @@ struct FGLBuffer {
 		size(0),
 		usage(GL_STATIC_DRAW),
 		name(name),
-		object(this) {};
+		generation(__sync_add_and_fetch(&lastGeneration, 1)),
+		object(this),
+		nextPartition(0)
+	{
+		memset(partitions, 0, sizeof(partitions));
+	}
 
 	/**
 	 * Class destructor.
@@ -107,6 +140,8 @@ struct FGLBuffer {
 		if (size == s)
 			return 0;
 
+		freePartitions();
+
 		if (size)
 			free(memory);
 
@@ -126,6 +161,8 @@ struct FGLBuffer {
 	/** Frees existing backing storage of the buffer. */
 	void destroy()
 	{
+		freePartitions();
+
 		if (unlikely(!isValid()))
 			return;
 
@@ -144,10 +181,10 @@ struct FGLBuffer {
 		if (unlikely(!isValid()))
 			return 0;
 
-		if (unlikely((int)offset >= size))
+		if (unlikely((intptr_t)offset >= size))
 			return 0;
 
-		return (const GLvoid *)((uint8_t *)memory + (int)offset);
+		return (const GLvoid *)((uint8_t *)memory + (intptr_t)offset);
 	}
 
 	/**
@@ -163,6 +200,87 @@ struct FGLBuffer {
 		return (const GLvoid *)((uint8_t *)address - (uint8_t *)memory);
 	}
 
+	/**
+	 * Marks buffer contents as modified.
+	 * Generation numbers are unique across all buffers, so data derived
+	 * from buffer contents can be identified by generation number alone.
+	 */
+	inline void touch(void)
+	{
+		generation = __sync_add_and_fetch(&lastGeneration, 1);
+		freePartitions();
+	}
+
+	/**
+	 * Looks up index partition cached for given range of the buffer.
+	 * @param offset Offset of first index inside the buffer.
+	 * @param count Index count.
+	 * @param type Index type.
+	 * @param mode Primitive type.
+	 * @return Cached partition or NULL if not found.
+	 */
+	fimgIndexPartition *getPartition(intptr_t offset, GLsizei count,
+						GLenum type, uint32_t mode)
+	{
+		for (int i = 0; i < FGL_BUFFER_PARTITIONS; ++i) {
+			FGLBufferPartition *p = &partitions[i];
+
+			if (p->partition && p->offset == offset
+			    && p->count == count && p->type == type
+			    && p->mode == mode)
+				return p->partition;
+		}
+
+		return 0;
+	}
+
+	/**
+	 * Caches index partition for given range of the buffer.
+	 * Existing partition of the same range is replaced, otherwise slots
+	 * are reused in round robin order.
+	 * @param offset Offset of first index inside the buffer.
+	 * @param count Index count.
+	 * @param type Index type.
+	 * @param mode Primitive type.
+	 * @param partition Partition to cache (owned by the buffer from now).
+	 */
+	void setPartition(intptr_t offset, GLsizei count, GLenum type,
+				uint32_t mode, fimgIndexPartition *partition)
+	{
+		FGLBufferPartition *p = 0;
+
+		for (int i = 0; i < FGL_BUFFER_PARTITIONS; ++i) {
+			if (partitions[i].partition && partitions[i].offset == offset
+			    && partitions[i].count == count
+			    && partitions[i].type == type
+			    && partitions[i].mode == mode) {
+				p = &partitions[i];
+				break;
+			}
+		}
+
+		if (!p) {
+			p = &partitions[nextPartition];
+			nextPartition = (nextPartition + 1) % FGL_BUFFER_PARTITIONS;
+		}
+
+		fimgDestroyIndexPartition(p->partition);
+		p->offset = offset;
+		p->count = count;
+		p->type = type;
+		p->mode = mode;
+		p->partition = partition;
+	}
+
+	/** Frees all cached index partitions. */
+	void freePartitions(void)
+	{
+		for (int i = 0; i < FGL_BUFFER_PARTITIONS; ++i) {
+			fimgDestroyIndexPartition(partitions[i].partition);
+			partitions[i].partition = 0;
+		}
+	}
+
 	/**
 	 * Checks if the buffer is valid.
 	 * A buffer is considered valid if it has allocated backing storage.
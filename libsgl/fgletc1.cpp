@@ -0,0 +1,766 @@
+/*
+ * libsgl/fgletc1.cpp
+ *
+ * SAMSUNG S3C6410 FIMG-3DSE (PROPER) OPENGL ES IMPLEMENTATION
+ *
+ * Copyrights:	2010 by Tomasz Figa < tomasz.figa at gmail.com >
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cstring>
+#include <cmath>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <EGL/egl.h>
+#include "platform.h"
+#include "common.h"
+#include "fgletc1.h"
+
+/*
+	ETC1 decoding
+*/
+
+/** Intensity modifiers of ETC1 codewords, for each pixel index value. */
+static const int fglETC1Modifiers[8][4] = {
+	{  2,   8,  -2,   -8 },
+	{  5,  17,  -5,  -17 },
+	{  9,  29,  -9,  -29 },
+	{ 13,  42, -13,  -42 },
+	{ 18,  60, -18,  -60 },
+	{ 24,  80, -24,  -80 },
+	{ 33, 106, -33, -106 },
+	{ 47, 183, -47, -183 }
+};
+
+/**
+ * Clamps integer value to range of color component.
+ * @param val Value to clamp.
+ * @return Value clamped to <0, 255> range.
+ */
+static inline uint8_t fglClampColor(int val)
+{
+	if (val < 0)
+		return 0;
+	if (val > 255)
+		return 255;
+	return val;
+}
+
+/**
+ * Unpacks ETC1 block into colors of both subblocks and texel indices.
+ * Each texel of the block uses one of only eight colors, which allows
+ * converting the colors once per block instead of once per texel.
+ * @param block ETC1 block.
+ * @param colors Array of 8 RGB888 colors to fill (4 for each subblock).
+ * @param indices Array of 16 color indices to fill (in row-major order).
+ */
+static void fglUnpackETC1Block(const uint8_t *block,
+				uint8_t colors[8][3], uint8_t indices[16])
+{
+	int base[2][3];
+
+	if (block[3] & 2) {
+		/* Differential mode, 555 base color and 333 delta */
+		for (int c = 0; c < 3; ++c) {
+			int col = block[c] >> 3;
+			int col2 = (col + ((block[c] & 7) ^ 4) - 4) & 0x1f;
+
+			base[0][c] = (col << 3) | (col >> 2);
+			base[1][c] = (col2 << 3) | (col2 >> 2);
+		}
+	} else {
+		/* Individual mode, two 444 base colors */
+		for (int c = 0; c < 3; ++c) {
+			base[0][c] = 17*(block[c] >> 4);
+			base[1][c] = 17*(block[c] & 0xf);
+		}
+	}
+
+	const int *mod0 = fglETC1Modifiers[block[3] >> 5];
+	const int *mod1 = fglETC1Modifiers[(block[3] >> 2) & 7];
+
+	for (int i = 0; i < 4; ++i) {
+		for (int c = 0; c < 3; ++c) {
+			colors[i][c] = fglClampColor(base[0][c] + mod0[i]);
+			colors[4 + i][c] = fglClampColor(base[1][c] + mod1[i]);
+		}
+	}
+
+	/* Pixel indices are stored in column-major order */
+	unsigned msb = (block[4] << 8) | block[5];
+	unsigned lsb = (block[6] << 8) | block[7];
+	bool flip = block[3] & 1;
+
+	for (unsigned x = 0; x < 4; ++x) {
+		for (unsigned y = 0; y < 4; ++y) {
+			unsigned i = 4*x + y;
+			unsigned idx = (((msb >> i) & 1) << 1) | ((lsb >> i) & 1);
+			unsigned sub = flip ? (y >= 2) : (x >= 2);
+
+			indices[4*y + x] = 4*sub + idx;
+		}
+	}
+}
+
+/*
+	DXT1 encoding
+*/
+
+/**
+ * Packs RGB888 color into RGB565 with rounding.
+ * @param rgb Color components.
+ * @return Packed RGB565 color.
+ */
+static inline uint16_t fglQuantizeRGB565(const int *rgb)
+{
+	int r = (rgb[0]*31 + 127) / 255;
+	int g = (rgb[1]*63 + 127) / 255;
+	int b = (rgb[2]*31 + 127) / 255;
+
+	return (r << 11) | (g << 5) | b;
+}
+
+/**
+ * Expands RGB565 color into RGB888 components.
+ * @param color Packed RGB565 color.
+ * @param rgb Array of 3 color components to fill.
+ */
+static inline void fglExpandRGB565(uint16_t color, int *rgb)
+{
+	int r = color >> 11;
+	int g = (color >> 5) & 0x3f;
+	int b = color & 0x1f;
+
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+/**
+ * Chooses DXT1 color indices of texels for given endpoints.
+ * Four color mode is always used, so endpoints are ordered accordingly.
+ * @param c Pointer to array of two endpoints (reordered if needed).
+ * @param texels Block texels.
+ * @param mask Bit mask of texels counted in the error.
+ * @param indices Array of 16 indices to fill.
+ * @return Sum of squared errors of texels in the mask.
+ */
+static unsigned fglFitDXT1(uint16_t *c, const uint8_t texels[16][3],
+					unsigned mask, uint8_t indices[16])
+{
+	int palette[4][3];
+
+	if (c[0] < c[1]) {
+		uint16_t tmp = c[0];
+		c[0] = c[1];
+		c[1] = tmp;
+	}
+
+	fglExpandRGB565(c[0], palette[0]);
+	fglExpandRGB565(c[1], palette[1]);
+	for (int i = 0; i < 3; ++i) {
+		palette[2][i] = (2*palette[0][i] + palette[1][i]) / 3;
+		palette[3][i] = (palette[0][i] + 2*palette[1][i]) / 3;
+	}
+
+	/* Equal endpoints would select three color mode */
+	unsigned entries = (c[0] == c[1]) ? 1 : 4;
+	unsigned error = 0;
+
+	for (int t = 0; t < 16; ++t) {
+		unsigned best = ~0U;
+
+		for (unsigned e = 0; e < entries; ++e) {
+			int dr = texels[t][0] - palette[e][0];
+			int dg = texels[t][1] - palette[e][1];
+			int db = texels[t][2] - palette[e][2];
+			unsigned dist = dr*dr + dg*dg + db*db;
+
+			if (dist < best) {
+				best = dist;
+				indices[t] = e;
+			}
+		}
+
+		if (mask & (1 << t))
+			error += best;
+	}
+
+	return error;
+}
+
+/**
+ * Encodes block of texels as DXT1 block.
+ * Endpoints are chosen along principal axis of texel colors and then
+ * refined once using least squares fit to chosen indices.
+ * @param dst Destination DXT1 block.
+ * @param texels Block texels.
+ * @param mask Bit mask of texels counted in the error.
+ * @return Sum of squared errors of texels in the mask.
+ */
+static unsigned fglEncodeDXT1Block(uint8_t *dst,
+				const uint8_t texels[16][3], unsigned mask)
+{
+	int mean[3] = { 0, 0, 0 };
+	int minCol[3] = { 255, 255, 255 };
+	int maxCol[3] = { 0, 0, 0 };
+
+	for (int t = 0; t < 16; ++t) {
+		for (int c = 0; c < 3; ++c) {
+			mean[c] += texels[t][c];
+			minCol[c] = min<int>(minCol[c], texels[t][c]);
+			maxCol[c] = max<int>(maxCol[c], texels[t][c]);
+		}
+	}
+
+	for (int c = 0; c < 3; ++c)
+		mean[c] = (mean[c] + 8) / 16;
+
+	/* Covariance matrix (xx, xy, xz, yy, yz, zz) */
+	int cov[6] = { 0, 0, 0, 0, 0, 0 };
+
+	for (int t = 0; t < 16; ++t) {
+		int r = texels[t][0] - mean[0];
+		int g = texels[t][1] - mean[1];
+		int b = texels[t][2] - mean[2];
+
+		cov[0] += r*r;
+		cov[1] += r*g;
+		cov[2] += r*b;
+		cov[3] += g*g;
+		cov[4] += g*b;
+		cov[5] += b*b;
+	}
+
+	/* Principal axis by power iteration */
+	float axis[3];
+
+	for (int c = 0; c < 3; ++c)
+		axis[c] = maxCol[c] - minCol[c];
+
+	for (int iter = 0; iter < 4; ++iter) {
+		float r = axis[0]*cov[0] + axis[1]*cov[1] + axis[2]*cov[2];
+		float g = axis[0]*cov[1] + axis[1]*cov[3] + axis[2]*cov[4];
+		float b = axis[0]*cov[2] + axis[1]*cov[4] + axis[2]*cov[5];
+		float norm = max(max(fabsf(r), fabsf(g)), fabsf(b));
+
+		if (norm < 1.0f)
+			break;
+
+		axis[0] = r / norm;
+		axis[1] = g / norm;
+		axis[2] = b / norm;
+	}
+
+	/* Endpoints are texels with extreme projections */
+	float minDot = 1e30f;
+	float maxDot = -1e30f;
+	int minTexel = 0;
+	int maxTexel = 0;
+
+	for (int t = 0; t < 16; ++t) {
+		float dot = texels[t][0]*axis[0] + texels[t][1]*axis[1]
+							+ texels[t][2]*axis[2];
+
+		if (dot < minDot) {
+			minDot = dot;
+			minTexel = t;
+		}
+
+		if (dot > maxDot) {
+			maxDot = dot;
+			maxTexel = t;
+		}
+	}
+
+	int end[2][3];
+	uint16_t c[2];
+	uint8_t indices[16];
+
+	for (int i = 0; i < 3; ++i) {
+		end[0][i] = texels[maxTexel][i];
+		end[1][i] = texels[minTexel][i];
+	}
+
+	c[0] = fglQuantizeRGB565(end[0]);
+	c[1] = fglQuantizeRGB565(end[1]);
+	unsigned error = fglFitDXT1(c, texels, mask, indices);
+
+	/* Least squares refinement of endpoints for chosen indices */
+	static const int weights[4] = { 3, 0, 2, 1 };
+	int aa = 0, bb = 0, ab = 0;
+	int ax[3] = { 0, 0, 0 };
+	int bx[3] = { 0, 0, 0 };
+
+	for (int t = 0; t < 16; ++t) {
+		int a = weights[indices[t]];
+		int b = 3 - a;
+
+		aa += a*a;
+		bb += b*b;
+		ab += a*b;
+		for (int i = 0; i < 3; ++i) {
+			ax[i] += a*texels[t][i];
+			bx[i] += b*texels[t][i];
+		}
+	}
+
+	int det = aa*bb - ab*ab;
+	if (error && det) {
+		uint16_t rc[2];
+		uint8_t rindices[16];
+
+		for (int i = 0; i < 3; ++i) {
+			end[0][i] = fglClampColor(3*(ax[i]*bb - bx[i]*ab) / det);
+			end[1][i] = fglClampColor(3*(bx[i]*aa - ax[i]*ab) / det);
+		}
+
+		rc[0] = fglQuantizeRGB565(end[0]);
+		rc[1] = fglQuantizeRGB565(end[1]);
+		unsigned rerror = fglFitDXT1(rc, texels, mask, rindices);
+
+		if (rerror < error) {
+			error = rerror;
+			c[0] = rc[0];
+			c[1] = rc[1];
+			memcpy(indices, rindices, sizeof(indices));
+		}
+	}
+
+	uint32_t lookup = 0;
+	for (int t = 0; t < 16; ++t)
+		lookup |= indices[t] << (2*t);
+
+	dst[0] = c[0];
+	dst[1] = c[0] >> 8;
+	dst[2] = c[1];
+	dst[3] = c[1] >> 8;
+	dst[4] = lookup;
+	dst[5] = lookup >> 8;
+	dst[6] = lookup >> 16;
+	dst[7] = lookup >> 24;
+
+	return error;
+}
+
+/*
+	Workers
+*/
+
+/** A range of block rows of ETC1 image processed by single thread. */
+struct FGLETC1Job {
+	/** ETC1 image data. */
+	const uint8_t *src;
+	/** Destination buffer. */
+	void *dst;
+	/** Image width. */
+	unsigned width;
+	/** Image height. */
+	unsigned height;
+	/** First block row to process. */
+	unsigned firstRow;
+	/** Block row after the last one to process. */
+	unsigned endRow;
+	/** Limit of sum of squared errors (transcoding only). */
+	uint64_t maxError;
+	/** Sum of squared errors of processed texels (transcoding only). */
+	uint64_t error;
+	/** Flag shared by all jobs indicating that transcoding failed. */
+	volatile bool *failed;
+};
+
+/**
+ * Decodes block rows of ETC1 image into RGB565 pixels.
+ * @param arg Job descriptor.
+ * @return Always NULL.
+ */
+static void *fglDecodeETC1Rows(void *arg)
+{
+	FGLETC1Job *job = (FGLETC1Job *)arg;
+	unsigned blocksW = (job->width + 3) / 4;
+	const uint8_t *src = job->src + 8*job->firstRow*blocksW;
+	uint16_t *dst = (uint16_t *)job->dst;
+
+	for (unsigned by = job->firstRow; by < job->endRow; ++by) {
+		unsigned y = 4*by;
+		unsigned bh = min(4U, job->height - y);
+
+		for (unsigned bx = 0; bx < blocksW; ++bx, src += 8) {
+			uint8_t colors[8][3];
+			uint8_t indices[16];
+			uint16_t packed[8];
+
+			fglUnpackETC1Block(src, colors, indices);
+
+			for (int i = 0; i < 8; ++i)
+				packed[i] = ((colors[i][0] >> 3) << 11)
+						| ((colors[i][1] >> 2) << 5)
+						| (colors[i][2] >> 3);
+
+			unsigned x = 4*bx;
+			unsigned bw = min(4U, job->width - x);
+			uint16_t *line = dst + y*job->width + x;
+
+			for (unsigned j = 0; j < bh; ++j) {
+				for (unsigned i = 0; i < bw; ++i)
+					line[i] = packed[indices[4*j + i]];
+				line += job->width;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Transcodes block rows of ETC1 image into DXT1 blocks.
+ * @param arg Job descriptor.
+ * @return Always NULL.
+ */
+static void *fglTranscodeETC1Rows(void *arg)
+{
+	FGLETC1Job *job = (FGLETC1Job *)arg;
+	unsigned blocksW = (job->width + 3) / 4;
+	const uint8_t *src = job->src + 8*job->firstRow*blocksW;
+	uint8_t *dst = (uint8_t *)job->dst + 8*job->firstRow*blocksW;
+
+	for (unsigned by = job->firstRow; by < job->endRow; ++by) {
+		unsigned bh = min(4U, job->height - 4*by);
+
+		if (*job->failed)
+			break;
+
+		for (unsigned bx = 0; bx < blocksW; ++bx) {
+			uint8_t colors[8][3];
+			uint8_t indices[16];
+			uint8_t texels[16][3];
+			unsigned bw = min(4U, job->width - 4*bx);
+			unsigned mask = 0;
+
+			fglUnpackETC1Block(src, colors, indices);
+
+			for (int t = 0; t < 16; ++t)
+				memcpy(texels[t], colors[indices[t]], 3);
+
+			/* Only texels inside the image are counted */
+			for (unsigned j = 0; j < bh; ++j)
+				mask |= ((1 << bw) - 1) << (4*j);
+
+			job->error += fglEncodeDXT1Block(dst, texels, mask);
+			src += 8;
+			dst += 8;
+		}
+
+		if (job->maxError && job->error > job->maxError) {
+			*job->failed = true;
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/** Pool of worker threads sharing block rows of large images. */
+struct FGLETC1Pool {
+	/** Lock protecting the pool. */
+	pthread_mutex_t lock;
+	/** Condition signalled when new jobs are posted. */
+	pthread_cond_t work;
+	/** Condition signalled when the last posted job is finished. */
+	pthread_cond_t done;
+	/** Lock held by the thread using the pool. */
+	pthread_mutex_t user;
+	/** Function processing a range of block rows. */
+	void *(*func)(void *);
+	/** Posted jobs. */
+	FGLETC1Job *jobs;
+	/** Number of posted jobs. */
+	unsigned count;
+	/** Index of the first job not taken yet. */
+	unsigned next;
+	/** Number of jobs not finished yet. */
+	unsigned pending;
+	/** Number of started worker threads. */
+	unsigned threads;
+	/** Set to make worker threads exit. */
+	bool stop;
+	/** Started worker threads. */
+	pthread_t workers[FGL_ETC1_MAX_THREADS - 1];
+};
+
+static FGLETC1Pool fglETC1Pool = {
+	PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+	PTHREAD_MUTEX_INITIALIZER,
+	NULL, NULL, 0, 0, 0, 0, false
+};
+
+/**
+ * Takes posted jobs until all of them are taken.
+ * (Must be called with pool lock held.)
+ * @param pool Worker pool.
+ */
+static void fglTakeETC1Jobs(FGLETC1Pool *pool)
+{
+	while (pool->next < pool->count) {
+		FGLETC1Job *job = &pool->jobs[pool->next++];
+
+		pthread_mutex_unlock(&pool->lock);
+		pool->func(job);
+		pthread_mutex_lock(&pool->lock);
+
+		if (!--pool->pending)
+			pthread_cond_signal(&pool->done);
+	}
+}
+
+/**
+ * Main loop of worker thread, processing posted jobs until the pool
+ * is stopped.
+ * @param arg Worker pool.
+ * @return NULL.
+ */
+static void *fglETC1Worker(void *arg)
+{
+	FGLETC1Pool *pool = (FGLETC1Pool *)arg;
+
+	pthread_mutex_lock(&pool->lock);
+
+	for (;;) {
+		while (!pool->stop && pool->next >= pool->count)
+			pthread_cond_wait(&pool->work, &pool->lock);
+
+		if (pool->stop)
+			break;
+
+		fglTakeETC1Jobs(pool);
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+/**
+ * Runs job over all block rows of an image, splitting large images
+ * between worker threads. Workers are started on first use and kept
+ * for further images. The calling thread takes jobs as well, so images
+ * are still processed if workers can not be started or the pool is used
+ * by another thread.
+ * @param func Function processing a range of block rows.
+ * @param job Job descriptor for whole image. Returns sum of errors.
+ * @return Number of jobs the image was split into.
+ */
+static unsigned fglRunETC1Job(void *(*func)(void *), FGLETC1Job *job)
+{
+	FGLETC1Pool *pool = &fglETC1Pool;
+	FGLETC1Job jobs[FGL_ETC1_MAX_THREADS];
+	unsigned rows = (job->height + 3) / 4;
+	unsigned count = 1;
+
+	if (job->width*job->height >= FGL_ETC1_THREAD_MIN_TEXELS) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		if (cpus > 1)
+			count = min<unsigned>(cpus, FGL_ETC1_MAX_THREADS);
+		count = min(count, rows);
+	}
+
+	if (count == 1 || pthread_mutex_trylock(&pool->user)) {
+		func(job);
+		return 1;
+	}
+
+	for (unsigned i = 0; i < count; ++i) {
+		jobs[i] = *job;
+		jobs[i].firstRow = rows*i / count;
+		jobs[i].endRow = rows*(i + 1) / count;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+
+	while (pool->threads < count - 1) {
+		if (pthread_create(&pool->workers[pool->threads],
+						NULL, fglETC1Worker, pool))
+			break;
+		++pool->threads;
+	}
+
+	pool->func = func;
+	pool->jobs = jobs;
+	pool->count = count;
+	pool->next = 0;
+	pool->pending = count;
+	pthread_cond_broadcast(&pool->work);
+
+	fglTakeETC1Jobs(pool);
+	while (pool->pending)
+		pthread_cond_wait(&pool->done, &pool->lock);
+
+	pool->count = 0;
+	pool->next = 0;
+	pool->jobs = NULL;
+
+	pthread_mutex_unlock(&pool->lock);
+	pthread_mutex_unlock(&pool->user);
+
+	job->error = 0;
+	for (unsigned i = 0; i < count; ++i)
+		job->error += jobs[i].error;
+
+	return count;
+}
+
+void fglTerminateETC1(void)
+{
+	FGLETC1Pool *pool = &fglETC1Pool;
+
+	/* Wait for the thread using the pool, if any */
+	pthread_mutex_lock(&pool->user);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (unsigned i = 0; i < pool->threads; ++i)
+		pthread_join(pool->workers[i], NULL);
+
+	pool->threads = 0;
+	pool->stop = false;
+
+	pthread_mutex_unlock(&pool->user);
+}
+
+/*
+	Statistics
+*/
+
+static FGLETC1Stats fglETC1Stats;
+static pthread_mutex_t fglETC1StatsLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Gets current time for throughput statistics.
+ * @return Monotonic time in microseconds.
+ */
+static inline uint64_t fglETC1Time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Accounts processed ETC1 image in statistics.
+ * @param counter Counter of image type to increment (in fglETC1Stats).
+ * @param what Description of the operation.
+ * @param width Image width.
+ * @param height Image height.
+ * @param start Time when processing started.
+ * @param jobs Number of jobs the image was split into.
+ */
+static void fglCountETC1Image(unsigned *counter,
+			const char *what, unsigned width, unsigned height,
+			uint64_t start, unsigned jobs)
+{
+	uint64_t time = max<uint64_t>(fglETC1Time() - start, 1);
+
+	pthread_mutex_lock(&fglETC1StatsLock);
+	++*counter;
+	fglETC1Stats.pixels += width*height;
+	fglETC1Stats.time += time;
+	pthread_mutex_unlock(&fglETC1StatsLock);
+
+#ifdef FGL_ETC1_STATS
+	/* Pixels per microsecond are megapixels per second */
+	uint64_t rate = 100ULL*width*height / time;
+
+	LOGD("ETC1: %s %ux%u image in %llu us (%llu.%02llu MPixel/s, "
+		"%u threads)", what, width, height, (unsigned long long)time,
+		(unsigned long long)rate / 100, (unsigned long long)rate % 100,
+		jobs);
+#else
+	(void)what;
+	(void)jobs;
+#endif
+}
+
+void fglGetETC1Stats(FGLETC1Stats *stats)
+{
+	pthread_mutex_lock(&fglETC1StatsLock);
+	*stats = fglETC1Stats;
+	pthread_mutex_unlock(&fglETC1StatsLock);
+}
+
+void fglDecodeETC1(uint16_t *dst, const uint8_t *src,
+					unsigned width, unsigned height)
+{
+	volatile bool failed = false;
+	FGLETC1Job job;
+
+	job.src = src;
+	job.dst = dst;
+	job.width = width;
+	job.height = height;
+	job.firstRow = 0;
+	job.endRow = (height + 3) / 4;
+	job.maxError = 0;
+	job.error = 0;
+	job.failed = &failed;
+
+	uint64_t start = fglETC1Time();
+	unsigned jobs = fglRunETC1Job(fglDecodeETC1Rows, &job);
+	fglCountETC1Image(&fglETC1Stats.decoded, "decoded",
+					width, height, start, jobs);
+}
+
+bool fglTranscodeETC1(uint8_t *dst, const uint8_t *src,
+			unsigned width, unsigned height, unsigned maxError)
+{
+	volatile bool failed = false;
+	FGLETC1Job job;
+
+	job.src = src;
+	job.dst = dst;
+	job.width = width;
+	job.height = height;
+	job.firstRow = 0;
+	job.endRow = (height + 3) / 4;
+	job.maxError = 3ULL*maxError*width*height;
+	job.error = 0;
+	job.failed = &failed;
+
+	uint64_t start = fglETC1Time();
+	unsigned jobs = fglRunETC1Job(fglTranscodeETC1Rows, &job);
+	if (job.maxError && job.error > job.maxError)
+		failed = true;
+
+	if (failed)
+		fglCountETC1Image(&fglETC1Stats.rejected,
+				"rejected transcoding of", width, height,
+				start, jobs);
+	else
+		fglCountETC1Image(&fglETC1Stats.transcoded, "transcoded",
+					width, height, start, jobs);
+
+	return !failed;
+}
@@ -0,0 +1,78 @@
+/*
+ * libsgl/fgletc1.h
+ *
+ * SAMSUNG S3C6410 FIMG-3DSE (PROPER) OPENGL ES IMPLEMENTATION
+ *
+ * Copyrights:	2010 by Tomasz Figa < tomasz.figa at gmail.com >
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LIBSGL_FGLETC1_H_
+#define _LIBSGL_FGLETC1_H_
+
+#include <stdint.h>
+
+/** ETC1 image processing statistics. */
+struct FGLETC1Stats {
+	/** Number of decoded images. */
+	unsigned decoded;
+	/** Number of transcoded images. */
+	unsigned transcoded;
+	/** Number of images with too high transcoding error. */
+	unsigned rejected;
+	/** Number of processed pixels. */
+	uint64_t pixels;
+	/** Processing time in microseconds (pixels/time gives MPixel/s). */
+	uint64_t time;
+};
+
+/**
+ * Decodes ETC1 image into RGB565 pixels.
+ * @param dst Destination buffer (width*height pixels, no padding).
+ * @param src ETC1 image data.
+ * @param width Image width.
+ * @param height Image height.
+ */
+extern void fglDecodeETC1(uint16_t *dst, const uint8_t *src,
+					unsigned width, unsigned height);
+
+/**
+ * Transcodes ETC1 image into S3TC (DXT1) image.
+ * Transcoding is aborted as soon as mean squared error of color components
+ * is known to exceed given limit.
+ * @param dst Destination buffer (of the same size as the source).
+ * @param src ETC1 image data.
+ * @param width Image width.
+ * @param height Image height.
+ * @param maxError Maximal accepted mean squared error (zero for no limit).
+ * @return True if the image has been transcoded, otherwise false.
+ */
+extern bool fglTranscodeETC1(uint8_t *dst, const uint8_t *src,
+			unsigned width, unsigned height, unsigned maxError);
+
+/**
+ * Stops worker threads processing large ETC1 images.
+ * Waits for image being processed, if any. Workers are started again
+ * when another large image is processed.
+ */
+extern void fglTerminateETC1(void);
+
+/**
+ * Retrieves statistics of all ETC1 images processed so far.
+ * @param stats Structure to fill with statistics.
+ */
+extern void fglGetETC1Stats(FGLETC1Stats *stats);
+
+#endif /* _LIBSGL_FGLETC1_H_ */
@@ -55,6 +55,11 @@ bool FGLFramebuffer::checkAttachment(FGLAttachmentIndex index,
 	if (fba->width <= 0 || fba->height <= 0)
 		return false;
 
+	/* YUV textures can be only sampled */
+	if (index == FGL_ATTACHMENT_COLOR && fba->pixFormat >= FGL_PIXFMT_Y1VY0U
+	    && fba->pixFormat <= FGL_PIXFMT_UY1VY0)
+		return false;
+
 	return true;
 }
 
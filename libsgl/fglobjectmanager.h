@@ -69,7 +69,7 @@ public:
 		write = size;
 
 		for(unsigned i = 0; i < size; i++) {
-			pool[i] = (T *)i;
+			pool[i] = (T *)(intptr_t)i;
 			owners[i] = 0;
 			unused[i] = i + 1;
 		}
@@ -134,7 +134,7 @@ public:
 			return -1;
 		}
 
-		unsigned pos = (unsigned)pool[name - 1];
+		unsigned pos = (unsigned)(intptr_t)pool[name - 1];
 
 		--write;
 		unused[pos] = unused[write];
@@ -28,6 +28,7 @@
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <errno.h>
+#include <pthread.h>
 #include <unistd.h>
 
 #include <linux/android_pmem.h>
@@ -47,6 +48,44 @@
  * Surfaces
  */
 
+#ifdef FIMG_SOFTWARE_BACKEND
+/**
+ * Next fake physical address given to local surfaces.
+ * Software backend never dereferences physical addresses, so they only
+ * need to be unique. Start at S3C6410 DRAM base to look realistic in traces.
+ */
+static intptr_t fglNextPhysAddr = 0x50000000;
+static pthread_mutex_t fglPhysAddrMutex = PTHREAD_MUTEX_INITIALIZER;
+
+FGLLocalSurface::FGLLocalSurface(unsigned long req_size)
+	: fd(-1)
+{
+	unsigned long page_size = getpagesize();
+
+	/* Round up to page size */
+	size = (req_size + page_size - 1) & ~(page_size - 1);
+
+	/* Use anonymous shared memory instead of PMEM */
+	fd = open("/dev/zero", O_RDWR, 0);
+	if(fd < 0) {
+		LOGE("EGL: Could not open /dev/zero (%s)", strerror(errno));
+		return;
+	}
+
+	vaddr = mmap(NULL, size, PROT_WRITE | PROT_READ, MAP_SHARED, fd, 0);
+	if (vaddr == MAP_FAILED) {
+		LOGE("EGL: Buffer allocation failed (%s)", strerror(errno));
+		close(fd);
+		fd = -1;
+		return;
+	}
+
+	pthread_mutex_lock(&fglPhysAddrMutex);
+	paddr = fglNextPhysAddr;
+	fglNextPhysAddr += size;
+	pthread_mutex_unlock(&fglPhysAddrMutex);
+}
+#else
 FGLLocalSurface::FGLLocalSurface(unsigned long req_size)
 	: fd(-1)
 {
@@ -87,6 +126,7 @@ err_mmap:
 	/* Allocation failed */
 	fd = -1;
 }
+#endif
 
 FGLLocalSurface::~FGLLocalSurface()
 {
@@ -109,6 +149,7 @@ int FGLLocalSurface::unlock(void)
 
 void FGLLocalSurface::flush(void)
 {
+#ifndef FIMG_SOFTWARE_BACKEND
 	struct pmem_region region;
 
 	region.offset = 0;
@@ -116,6 +157,7 @@ void FGLLocalSurface::flush(void)
 
 	if (ioctl(fd, PMEM_CACHE_FLUSH, &region) != 0)
 		LOGW("Could not flush PMEM surface %d", fd);
+#endif
 }
 
 FGLExternalSurface::FGLExternalSurface(void *v, intptr_t p, size_t s)
@@ -50,7 +50,7 @@ GL_API GLenum GL_APIENTRY glGetError (void)
 	if(unlikely(glErrorKey == (pthread_key_t)-1))
 		return GL_NO_ERROR;
 
-	GLenum error = (GLenum)pthread_getspecific(glErrorKey);
+	GLenum error = (GLenum)(intptr_t)pthread_getspecific(glErrorKey);
 	pthread_setspecific(glErrorKey, (void *)GL_NO_ERROR);
 	return error;
 }
@@ -144,6 +144,7 @@ GL_API void GL_APIENTRY glMultiTexCoord4x (GLenum target,
 
 /** Buffer object namespace manager. */
 FGLObjectManager<FGLBuffer, FGL_MAX_BUFFER_OBJECTS> fglBufferObjects;
+unsigned int FGLBuffer::lastGeneration = 0;
 
 GL_API void GL_APIENTRY glGenBuffers (GLsizei n, GLuint *buffers)
 {
@@ -271,6 +272,7 @@ GL_API void GL_APIENTRY glBufferData (GLenum target, GLsizeiptr size,
 		return;
 	}
 	buf->usage = usage;
+	buf->touch();
 
 	if (data != 0)
 		memcpy(buf->memory, data, size);
@@ -308,6 +310,7 @@ GL_API void GL_APIENTRY glBufferSubData (GLenum target, GLintptr offset,
 	}
 
 	memcpy((uint8_t *)buf->memory + offset, data, size);
+	buf->touch();
 }
 
 GL_API GLboolean GL_APIENTRY glIsBuffer (GLuint buffer)
@@ -347,9 +350,6 @@ static inline void fglSetupAttribute(FGLContext *ctx, GLint idx, GLint size,
 	ctx->array[idx].stride	= (stride) ? stride : width;
 	ctx->array[idx].width	= width;
 	ctx->array[idx].pointer	= pointer;
-
-	if(ctx->array[idx].enabled)
-		fimgSetAttribute(ctx->fimg, idx, type, size);
 }
 
 GL_API void GL_APIENTRY glVertexPointer (GLint size, GLenum type,
@@ -565,7 +565,6 @@ GL_API void GL_APIENTRY glTexCoordPointer (GLint size, GLenum type,
 static void fglEnableClientState(FGLContext *ctx, GLint idx)
 {
 	ctx->array[idx].enabled = GL_TRUE;
-	fimgSetAttribute(ctx->fimg, idx, ctx->array[idx].type, ctx->array[idx].size);
 }
 
 GL_API void GL_APIENTRY glEnableClientState (GLenum array)
@@ -611,7 +610,6 @@ static const GLint fglDefaultAttribSize[4 + FGL_MAX_TEXTURE_UNITS] = {
 static void fglDisableClientState(FGLContext *ctx, GLint idx)
 {
 	ctx->array[idx].enabled = GL_FALSE;
-	fimgSetAttribute(ctx->fimg, idx, FGHI_ATTRIB_DT_FLOAT, fglDefaultAttribSize[idx]);
 }
 
 GL_API void GL_APIENTRY glDisableClientState (GLenum array)
@@ -708,6 +706,7 @@ static inline void fglSetupMatrices(FGLContext *ctx)
 		light = &ctx->matrix.stack[FGL_MATRIX_MODELVIEW_INVERSE].top();
 
 		fimgLoadMatrix(ctx->fimg, FGFP_MATRIX_LIGHTING, light->data);
+		fimgLoadMatrix(ctx->fimg, FGFP_MATRIX_MODELVIEW, modview->data);
 
 		/* Mark transformation matrices as clean */
 		ctx->matrix.dirty[FGL_MATRIX_MODELVIEW] = GL_FALSE;
@@ -733,10 +732,12 @@ static inline void fglSetupMatrices(FGLContext *ctx)
  * texture units using libfimg, manages texture surface flushing and
  * libfimg texture cache invalidation.
  * @param ctx Rendering context.
+ * @return Bit mask of texture units used for rendering.
  */
-static inline void fglSetupTextures(FGLContext *ctx)
+static inline uint32_t fglSetupTextures(FGLContext *ctx)
 {
 	bool flush = false;
+	uint32_t mask = 0;
 	int i = FGL_MAX_TEXTURE_UNITS - 1;
 
 	do {
@@ -767,16 +768,78 @@ static inline void fglSetupTextures(FGLContext *ctx)
 					i, ctx->texture[i].fglFunc);
 
 		ctx->busyTexture[i] = tex;
+		mask |= 1 << i;
 	} while (i--);
 
 	if (flush)
 		fimgInvalidateTextureCache(ctx->fimg);
+
+	return mask;
+}
+
+/**
+ * Sets up vertex attributes for rendering.
+ * Only enabled vertex arrays and texture coordinates of used texture units
+ * are sent to the hardware, packed in order of attribute indices. Remaining
+ * attributes are passed to the vertex shader as constants. Position is
+ * always sent, as a constant attribute if its array is disabled.
+ * @param ctx Rendering context.
+ * @param arrays Array of attribute array descriptors to fill.
+ * @param first Index of first vertex.
+ * @param texMask Bit mask of texture units used for rendering.
+ * @return Bit mask of attributes sent to the hardware.
+ */
+static uint32_t fglSetupAttributes(FGLContext *ctx, fimgArray *arrays,
+						GLint first, uint32_t texMask)
+{
+	uint32_t mask = 0;
+	int count = 0;
+
+	for (int i = 0; i < (4 + FGL_MAX_TEXTURE_UNITS); ++i) {
+		FGLArrayState *array = &ctx->array[i];
+		bool enabled = array->enabled;
+
+		if (i >= FGL_ARRAY_TEXTURE
+		    && !(texMask & (1 << (i - FGL_ARRAY_TEXTURE))))
+			enabled = false;
+
+		if (!enabled && i != FGL_ARRAY_VERTEX) {
+			fimgCompatSetAttribConst(ctx->fimg, i, ctx->vertex[i]);
+			continue;
+		}
+
+		if (enabled) {
+			arrays[count].pointer	=
+					(const uint8_t *)array->pointer
+					+ first*array->stride;
+			arrays[count].stride	= array->stride;
+			arrays[count].width	= array->width;
+			fimgSetAttribute(ctx->fimg, count,
+						array->type, array->size);
+		} else {
+			arrays[count].pointer	= &ctx->vertex[i];
+			arrays[count].stride	= 0;
+			arrays[count].width	= 16;
+			fimgSetAttribute(ctx->fimg, count,
+				FGHI_ATTRIB_DT_FLOAT, fglDefaultAttribSize[i]);
+		}
+
+		mask |= 1 << i;
+		++count;
+	}
+
+	fimgCompatSetAttribMask(ctx->fimg, mask);
+	fimgSetAttribCount(ctx->fimg, count);
+
+	return mask;
 }
 
 static void fglSetScissor(FGLContext *ctx, GLint x, GLint y,
 						GLsizei width, GLsizei height);
 static void fglSetBlending(FGLContext *ctx);
 static void fglSetColorMask(FGLContext *ctx);
+static void fglUpdateFog(FGLContext *ctx);
+static void fglEndDrawTex(FGLContext *ctx);
 
 /**
  * Sets up framebuffer for rendering.
@@ -870,6 +933,340 @@ static inline int fglSetupFramebuffer(FGLContext *ctx)
 	return 0;
 }
 
+/**
+ * Prepares vertex stream cache key for a draw call.
+ * Only draws sourcing all enabled arrays from GL_STATIC_DRAW buffer objects
+ * can use the cache, as client memory can change without notice.
+ * @param ctx Rendering context.
+ * @param key Key to fill.
+ * @param mode Primitive type.
+ * @param count Vertex count.
+ * @param mask Bit mask of attributes sent to the hardware.
+ * @return True if the draw can use vertex stream cache, otherwise false.
+ */
+static bool fglSetupStreamKey(FGLContext *ctx, fimgStreamKey *key,
+				uint32_t mode, uint32_t count, uint32_t mask)
+{
+	bool hasArray = false;
+	int slot = 0;
+
+	memset(key, 0, sizeof(*key));
+	key->mode = mode;
+	key->count = count;
+
+	for (int i = 0; i < (4 + FGL_MAX_TEXTURE_UNITS); ++i) {
+		FGLArrayState *array = &ctx->array[i];
+
+		if (!(mask & (1 << i)))
+			continue;
+
+		if (!array->enabled) {
+			key->array[slot++].width = 16;
+			continue;
+		}
+
+		FGLBuffer *buf = array->buffer;
+		if (!buf || !buf->isValid() || buf->usage != GL_STATIC_DRAW)
+			return false;
+
+		key->array[slot].generation = buf->generation;
+		key->array[slot].offset =
+				(intptr_t)buf->getOffset(array->pointer);
+		key->array[slot].stride = array->stride;
+		key->array[slot].width = array->width;
+		++slot;
+		hasArray = true;
+	}
+
+	key->numAttribs = slot;
+
+	return hasArray;
+}
+
+/*
+ * Draw queue
+ *
+ * Small draws are not submitted to the hardware immediately. Their vertex
+ * data is copied to the draw queue instead, so consecutive draws can be
+ * merged into single hardware session. Any GL call other than a draw call
+ * submits the queue (see getContext()), so all queued draws share pipeline,
+ * texture and framebuffer state.
+ */
+
+/**
+ * Gets primitive type used to queue draws of given primitive type.
+ * Strips and fans are queued as lists, so they can be merged.
+ * @param mode Primitive type.
+ * @return Primitive type of the queue.
+ */
+static inline uint32_t fglQueueMode(uint32_t mode)
+{
+	switch (mode) {
+	case FGPE_LINE_STRIP:
+	case FGPE_LINES:
+		return FGPE_LINES;
+	case FGPE_TRIANGLE_STRIP:
+	case FGPE_TRIANGLE_FAN:
+	case FGPE_TRIANGLES:
+		return FGPE_TRIANGLES;
+	default:
+		return mode;
+	}
+}
+
+/**
+ * Calculates vertex count of a draw after conversion to queue primitive type.
+ * @param mode Primitive type.
+ * @param count Vertex count.
+ * @return Vertex count after conversion.
+ */
+static inline uint32_t fglQueueCount(uint32_t mode, uint32_t count)
+{
+	switch (mode) {
+	case FGPE_LINE_STRIP:
+		return 2*(count - 1);
+	case FGPE_TRIANGLE_STRIP:
+	case FGPE_TRIANGLE_FAN:
+		return 3*(count - 2);
+	default:
+		return count;
+	}
+}
+
+/**
+ * Maps vertex of converted draw to vertex of original draw.
+ * @param mode Primitive type of original draw.
+ * @param vertex Vertex number after conversion.
+ * @return Vertex number in original draw.
+ */
+static inline uint32_t fglQueueVertex(uint32_t mode, uint32_t vertex)
+{
+	uint32_t prim, i;
+
+	switch (mode) {
+	case FGPE_LINE_STRIP:
+		return vertex / 2 + vertex % 2;
+	case FGPE_TRIANGLE_STRIP:
+		prim = vertex / 3;
+		i = vertex % 3;
+		if (i == 2)
+			return prim + 2;
+		/* Keep winding of odd triangles */
+		return prim + ((prim & 1) ^ i);
+	case FGPE_TRIANGLE_FAN:
+		prim = vertex / 3;
+		i = vertex % 3;
+		return i ? prim + i : 0;
+	default:
+		return vertex;
+	}
+}
+
+/**
+ * Submits all queued draws to the hardware as single draw, keeping
+ * hardware state used by queued draws.
+ * @param ctx Rendering context.
+ */
+static void fglSubmitDrawQueue(FGLContext *ctx)
+{
+	FGLDrawQueue *queue = &ctx->drawQueue;
+
+	if (!queue->count)
+		return;
+
+	fimgDrawArrays(ctx->fimg, queue->mode, queue->arrays, queue->count);
+	queue->count = 0;
+}
+
+/**
+ * Submits all queued draws to the hardware as single draw.
+ * @param ctx Rendering context.
+ */
+void fglFlushDrawQueue(FGLContext *ctx)
+{
+	fglSubmitDrawQueue(ctx);
+
+	if (ctx->drawQueue.drawTex)
+		fglEndDrawTex(ctx);
+}
+
+/**
+ * Checks whether queued draws use the same attribute layout as a draw.
+ * @param queue Draw queue.
+ * @param arrays Array of attribute array descriptors of the draw.
+ * @param numArrays Number of attribute arrays of the draw.
+ * @return True if the layout is the same, otherwise false.
+ */
+static bool fglQueueMatches(FGLDrawQueue *queue,
+				const fimgArray *arrays, int numArrays)
+{
+	if (queue->numArrays != numArrays)
+		return false;
+
+	for (int i = 0; i < numArrays; ++i) {
+		if (queue->arrays[i].width != arrays[i].width)
+			return false;
+		if (!queue->arrays[i].stride != !arrays[i].stride)
+			return false;
+		if (!arrays[i].stride
+		    && queue->arrays[i].pointer != arrays[i].pointer)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Prepares empty draw queue to store vertices with given attribute layout.
+ * @param queue Draw queue.
+ * @param arrays Array of attribute array descriptors of the draw.
+ * @param numArrays Number of attribute arrays of the draw.
+ * @return Zero on success, negative on error.
+ */
+static int fglQueueSetup(FGLDrawQueue *queue,
+				const fimgArray *arrays, int numArrays)
+{
+	uint32_t size = 0;
+
+	if (!queue->data) {
+		queue->data = (uint8_t *)malloc(FGL_DRAW_QUEUE_SIZE);
+		if (!queue->data)
+			return -1;
+	}
+
+	for (int i = 0; i < numArrays; ++i)
+		if (arrays[i].stride)
+			size += (arrays[i].width + 3) & ~3;
+
+	queue->maxCount = FGL_DRAW_QUEUE_SIZE / (size ? size : 1);
+
+	uint8_t *data = queue->data;
+	for (int i = 0; i < numArrays; ++i) {
+		queue->arrays[i] = arrays[i];
+		if (!arrays[i].stride)
+			continue;
+		queue->arrays[i].pointer = data;
+		queue->arrays[i].stride = (arrays[i].width + 3) & ~3;
+		data += queue->maxCount * queue->arrays[i].stride;
+	}
+
+	queue->numArrays = numArrays;
+
+	return 0;
+}
+
+/**
+ * Appends a draw to the draw queue.
+ * Vertex data is copied, as client memory can change after the call.
+ * Draws that cannot be queued must be drawn directly by the caller,
+ * after submitting the queue.
+ * @param ctx Rendering context.
+ * @param mode Primitive type.
+ * @param arrays Array of attribute array descriptors.
+ * @param mask Bit mask of attributes sent to the hardware.
+ * @param count Vertex count.
+ * @param indices Pointer to vertex indices or NULL for non-indexed draw.
+ * @param type Type of vertex indices (zero for non-indexed draw).
+ * @return True if the draw has been queued, otherwise false.
+ */
+static bool fglQueueDraw(FGLContext *ctx, uint32_t mode, fimgArray *arrays,
+				uint32_t mask, uint32_t count,
+				const GLvoid *indices, GLenum type)
+{
+	FGLDrawQueue *queue = &ctx->drawQueue;
+	int numArrays = __builtin_popcount(mask);
+	uint32_t queueMode = fglQueueMode(mode);
+	uint32_t queueCount = fglQueueCount(mode, count);
+
+	if (count > FGL_DRAW_QUEUE_MAX_DRAW)
+		return false;
+
+	if (indices && type != GL_UNSIGNED_BYTE && type != GL_UNSIGNED_SHORT)
+		return false;
+
+	if (queue->count && (queue->mode != queueMode
+	    || queue->count + queueCount > queue->maxCount
+	    || !fglQueueMatches(queue, arrays, numArrays)))
+		fglSubmitDrawQueue(ctx);
+
+	if (!queue->count) {
+		if (fglQueueSetup(queue, arrays, numArrays))
+			return false;
+		if (queueCount > queue->maxCount)
+			return false;
+		queue->mode = queueMode;
+	}
+
+	const uint8_t *indices8 = (const uint8_t *)indices;
+	const uint16_t *indices16 = (const uint16_t *)indices;
+
+	for (int i = 0; i < numArrays; ++i) {
+		const fimgArray *src = &arrays[i];
+		fimgArray *dst = &queue->arrays[i];
+
+		if (!src->stride)
+			continue;
+
+		uint8_t *data = (uint8_t *)dst->pointer
+						+ queue->count * dst->stride;
+
+		for (uint32_t v = 0; v < queueCount; ++v) {
+			uint32_t vertex = fglQueueVertex(mode, v);
+
+			if (type == GL_UNSIGNED_BYTE)
+				vertex = indices8[vertex];
+			else if (type == GL_UNSIGNED_SHORT)
+				vertex = indices16[vertex];
+
+			memcpy(data, (const uint8_t *)src->pointer
+						+ vertex * src->stride,
+						src->width);
+			data += dst->stride;
+		}
+	}
+
+	queue->count += queueCount;
+
+	return true;
+}
+
+/**
+ * Finishes statistics of current frame and starts a new frame.
+ * @param ctx Rendering context.
+ */
+void fglEndFrame(FGLContext *ctx)
+{
+	FGLDrawQueue *queue = &ctx->drawQueue;
+	unsigned int sessions = fimgGetSessionCount(ctx->fimg);
+
+	queue->stats.sessions = sessions - queue->frameStart;
+	queue->stats.draws = queue->draws;
+	queue->stats.totalSessions += queue->stats.sessions;
+	queue->stats.totalDraws += queue->stats.draws;
+	queue->frameStart = sessions;
+	queue->draws = 0;
+
+#ifdef FGL_DRAW_QUEUE_STATS
+	fimgLockStats lock;
+
+	fimgGetLockStats(ctx->fimg, &lock);
+	LOGD("Frame: %u draw calls, %u hardware sessions, "
+		"%u lock acquisitions and %u restores in last second",
+		queue->stats.draws, queue->stats.sessions,
+		lock.acquisitions, lock.restores);
+#endif
+}
+
+/**
+ * Retrieves draw merging statistics.
+ * @param ctx Rendering context.
+ * @param stats Structure to fill with statistics.
+ */
+void fglGetDrawQueueStats(FGLContext *ctx, FGLDrawQueueStats *stats)
+{
+	*stats = ctx->drawQueue.stats;
+}
+
 GL_API void GL_APIENTRY glDrawArrays (GLenum mode, GLint first, GLsizei count)
 {
 	uint32_t fglMode;
@@ -880,31 +1277,20 @@ GL_API void GL_APIENTRY glDrawArrays (GLenum mode, GLint first, GLsizei count)
 	}
 
 	fimgArray arrays[4 + FGL_MAX_TEXTURE_UNITS];
-	FGLContext *ctx = getContext();
+	FGLContext *ctx = getDrawContext();
+
+	/* Queued screen space rectangles use different hardware state */
+	if (ctx->drawQueue.drawTex)
+		fglFlushDrawQueue(ctx);
 
 	if (fglSetupFramebuffer(ctx)) {
 		setError(GL_INVALID_FRAMEBUFFER_OPERATION_OES);
 		return;
 	}
 
-	for(int i = 0; i < (4 + FGL_MAX_TEXTURE_UNITS); ++i) {
-		if(ctx->array[i].enabled) {
-			arrays[i].pointer	=
-					(const uint8_t *)ctx->array[i].pointer
-					+ first*ctx->array[i].stride;
-			arrays[i].stride	= ctx->array[i].stride;
-			arrays[i].width		= ctx->array[i].width;
-		} else {
-			arrays[i].pointer	= &ctx->vertex[i];
-			arrays[i].stride	= 0;
-			arrays[i].width		= 16;
-		}
-	}
-
 	fglSetupMatrices(ctx);
-	fglSetupTextures(ctx);
-
-	fimgSetAttribCount(ctx->fimg, 4 + FGL_MAX_TEXTURE_UNITS);
+	uint32_t texMask = fglSetupTextures(ctx);
+	uint32_t attribMask = fglSetupAttributes(ctx, arrays, first, texMask);
 
 	switch (mode) {
 	case GL_POINTS:
@@ -950,8 +1336,22 @@ GL_API void GL_APIENTRY glDrawArrays (GLenum mode, GLint first, GLsizei count)
 	}
 
 	ctx->finished = false;
+	++ctx->drawQueue.draws;
+
+	fimgStreamKey key;
+	bool cached = fglSetupStreamKey(ctx, &key, fglMode, count, attribMask);
+	if (!cached && mode != GL_LINE_LOOP
+	    && fglQueueDraw(ctx, fglMode, arrays, attribMask, count, 0, 0))
+		return;
 
-	fimgDrawArrays(ctx->fimg, fglMode, arrays, count);
+	fglFlushDrawQueue(ctx);
+
+	if (cached) {
+		key.first = first;
+		fimgDrawArraysCached(ctx->fimg, fglMode, arrays, count, &key);
+	} else {
+		fimgDrawArrays(ctx->fimg, fglMode, arrays, count);
+	}
 
 	if (mode == GL_LINE_LOOP) {
 	/*
@@ -965,37 +1365,81 @@ GL_API void GL_APIENTRY glDrawArrays (GLenum mode, GLint first, GLsizei count)
 	}
 }
 
+/**
+ * Draws elements sourced from static element array buffer using index
+ * partition cached on the buffer, creating the partition if needed.
+ * @param ctx Rendering context.
+ * @param buf Element array buffer.
+ * @param mode Primitive type.
+ * @param arrays Array of attribute array descriptors.
+ * @param count Index count.
+ * @param type Index type.
+ * @param offset Offset of first index inside the buffer.
+ * @param indices Pointer to first index.
+ * @param key Vertex stream key if vertex data is sourced from static
+ * buffers only, otherwise NULL.
+ * @return True if the draw has been done, otherwise false.
+ */
+static bool fglDrawElementsPartitioned(FGLContext *ctx, FGLBuffer *buf,
+			uint32_t mode, fimgArray *arrays, GLsizei count,
+			GLenum type, const GLvoid *offset, const GLvoid *indices,
+			const fimgStreamKey *key)
+{
+	fimgIndexPartition *partition;
+
+	partition = buf->getPartition((intptr_t)offset, count, type, mode);
+	if (partition && !fimgDrawElementsPartitioned(ctx->fimg,
+						arrays, partition, key))
+		return true;
+
+	switch (type) {
+	case GL_UNSIGNED_BYTE:
+		partition = fimgCreateIndexPartitionUByte(ctx->fimg, mode,
+				arrays, count, (const uint8_t *)indices);
+		break;
+	case GL_UNSIGNED_SHORT:
+		partition = fimgCreateIndexPartitionUShort(ctx->fimg, mode,
+				arrays, count, (const uint16_t *)indices);
+		break;
+	default:
+		return false;
+	}
+
+	if (!partition)
+		return false;
+
+	buf->setPartition((intptr_t)offset, count, type, mode, partition);
+	fimgDrawElementsPartitioned(ctx->fimg, arrays, partition, key);
+
+	return true;
+}
+
 GL_API void GL_APIENTRY glDrawElements (GLenum mode, GLsizei count, GLenum type,
 							const GLvoid *indices)
 {
 	uint32_t fglMode;
 	fimgArray arrays[4 + FGL_MAX_TEXTURE_UNITS];
-	FGLContext *ctx = getContext();
+	FGLContext *ctx = getDrawContext();
+
+	/* Queued screen space rectangles use different hardware state */
+	if (ctx->drawQueue.drawTex)
+		fglFlushDrawQueue(ctx);
 
 	if (fglSetupFramebuffer(ctx)) {
 		setError(GL_INVALID_FRAMEBUFFER_OPERATION_OES);
 		return;
 	}
 
-	if(ctx->elementArrayBuffer.isBound())
-		indices = ctx->elementArrayBuffer.get()->getAddress(indices);
-
-	for(int i = 0; i < (4 + FGL_MAX_TEXTURE_UNITS); ++i) {
-		if(ctx->array[i].enabled) {
-			arrays[i].pointer	= ctx->array[i].pointer;
-			arrays[i].stride	= ctx->array[i].stride;
-			arrays[i].width		= ctx->array[i].width;
-		} else {
-			arrays[i].pointer	= &ctx->vertex[i];
-			arrays[i].stride	= 0;
-			arrays[i].width		= 16;
-		}
+	FGLBuffer *indexBuffer = 0;
+	const GLvoid *indexOffset = indices;
+	if(ctx->elementArrayBuffer.isBound()) {
+		indexBuffer = ctx->elementArrayBuffer.get();
+		indices = indexBuffer->getAddress(indices);
 	}
 
 	fglSetupMatrices(ctx);
-	fglSetupTextures(ctx);
-
-	fimgSetAttribCount(ctx->fimg, 4 + FGL_MAX_TEXTURE_UNITS);
+	uint32_t texMask = fglSetupTextures(ctx);
+	uint32_t attribMask = fglSetupAttributes(ctx, arrays, 0, texMask);
 
 	switch (mode) {
 	case GL_POINTS:
@@ -1041,12 +1485,44 @@ GL_API void GL_APIENTRY glDrawElements (GLenum mode, GLsizei count, GLenum type,
 	}
 
 	ctx->finished = false;
+	++ctx->drawQueue.draws;
+
+	bool staticIndices = indexBuffer && indexBuffer->isValid()
+			&& indexBuffer->usage == GL_STATIC_DRAW;
+
+	if (!staticIndices && mode != GL_LINE_LOOP
+	    && fglQueueDraw(ctx, fglMode, arrays, attribMask,
+						count, indices, type))
+		return;
+
+	fglFlushDrawQueue(ctx);
+
+	fimgStreamKey key;
+	bool cached = staticIndices
+			&& fglSetupStreamKey(ctx, &key, fglMode, count, attribMask);
+	if (cached) {
+		key.indexType = (type == GL_UNSIGNED_BYTE)
+			? FIMG_STREAM_INDEX_UBYTE : FIMG_STREAM_INDEX_USHORT;
+		key.indexGeneration = indexBuffer->generation;
+		key.indexOffset = (intptr_t)indexOffset;
+	}
+
+	if (mode != GL_LINE_LOOP && staticIndices
+	    && fglDrawElementsPartitioned(ctx, indexBuffer, fglMode, arrays,
+				count, type, indexOffset, indices,
+				cached ? &key : 0))
+		return;
 
 	switch (type) {
 	case GL_UNSIGNED_BYTE: {
 		const uint8_t *indices8 = (const uint8_t *)indices;
-		fimgDrawElementsUByteIdx(ctx->fimg, fglMode, arrays,
+		if (cached) {
+			fimgDrawElementsUByteIdxCached(ctx->fimg, fglMode,
+						arrays, count, indices8, &key);
+		} else {
+			fimgDrawElementsUByteIdx(ctx->fimg, fglMode, arrays,
 							count, indices8);
+		}
 		if (mode == GL_LINE_LOOP) {
 		/*
 		 * Line loops have to be emulated using line strips,
@@ -1063,8 +1539,13 @@ GL_API void GL_APIENTRY glDrawElements (GLenum mode, GLsizei count, GLenum type,
 	}
 	case GL_UNSIGNED_SHORT: {
 		const uint16_t *indices16 = (const uint16_t *)indices;
-		fimgDrawElementsUShortIdx(ctx->fimg, fglMode, arrays,
+		if (cached) {
+			fimgDrawElementsUShortIdxCached(ctx->fimg, fglMode,
+						arrays, count, indices16, &key);
+		} else {
+			fimgDrawElementsUShortIdx(ctx->fimg, fglMode, arrays,
 							count, indices16);
+		}
 		if (mode == GL_LINE_LOOP) {
 		/*
 		 * Line loops have to be emulated using line strips,
@@ -1088,50 +1569,61 @@ GL_API void GL_APIENTRY glDrawElements (GLenum mode, GLsizei count, GLenum type,
 	Draw texture
 */
 
+/**
+ * Prepares the hardware for drawing screen space rectangles.
+ * Transformation matrices are left intact, as dedicated shader program
+ * passes window coordinates through.
+ * @param ctx Rendering context.
+ */
+static void fglBeginDrawTex(FGLContext *ctx)
+{
+	fimgSetViewportBypass(ctx->fimg);
+	fimgSetFaceCullEnable(ctx->fimg, 0);
+	fimgCompatSetScreenSpace(ctx->fimg, 1);
+
+	ctx->drawQueue.drawTex = true;
+}
+
+/**
+ * Restores hardware state changed for drawing screen space rectangles.
+ * @param ctx Rendering context.
+ */
+static void fglEndDrawTex(FGLContext *ctx)
+{
+	fimgSetDepthRange(ctx->fimg, ctx->viewport.zNear, ctx->viewport.zFar);
+	fimgSetViewportParams(ctx->fimg, ctx->viewport.x, ctx->viewport.y,
+				ctx->viewport.width, ctx->viewport.height);
+	fimgSetFaceCullEnable(ctx->fimg, ctx->enable.cullFace);
+	fimgCompatSetScreenSpace(ctx->fimg, 0);
+
+	ctx->drawQueue.drawTex = false;
+}
+
+/*
+ * Consecutive glDrawTex calls are merged using the draw queue. Hardware
+ * state for screen space drawing is set up by the first of them and
+ * restored when the queue is submitted.
+ */
+
 GL_API void GL_APIENTRY glDrawTexfOES (GLfloat x, GLfloat y, GLfloat z, GLfloat width, GLfloat height)
 {
-	FGLContext *ctx = getContext();
-	GLboolean arrayEnabled[4 + FGL_MAX_TEXTURE_UNITS];
+	FGLContext *ctx = getDrawContext();
 	GLfloat vertices[3*4];
 	GLfloat texcoords[2][2*4];
 
+	if (!ctx->drawQueue.drawTex)
+		fglFlushDrawQueue(ctx);
+
 	if (fglSetupFramebuffer(ctx)) {
 		setError(GL_INVALID_FRAMEBUFFER_OPERATION_OES);
 		return;
 	}
 
-	/* Save current state and prepare to drawing */
+	if (!ctx->drawQueue.drawTex)
+		fglBeginDrawTex(ctx);
 
-	GLint viewportX = ctx->viewport.x;
-	GLint viewportY = ctx->viewport.y;
-	GLsizei viewportW = ctx->viewport.width;
-	GLsizei viewportH = ctx->viewport.height;
 	GLfloat zNear = ctx->viewport.zNear;
 	GLfloat zFar = ctx->viewport.zFar;
-
-	fimgSetViewportBypass(ctx->fimg);
-	fimgSetFaceCullEnable(ctx->fimg, 0);
-
-	for (int i = 0; i < 4 + FGL_MAX_TEXTURE_UNITS; i++) {
-		arrayEnabled[i] = ctx->array[i].enabled;
-		fglDisableClientState(ctx, i);
-	}
-
-	/* TODO: Replace this with dedicated shader or conditional operation */
-	FGLmatrix *matrix = &ctx->matrix.transformMatrix;
-	matrix->identity();
-
-	fimgLoadMatrix(ctx->fimg, FGFP_MATRIX_TRANSFORM, matrix->data);
-	fimgLoadMatrix(ctx->fimg, FGFP_MATRIX_LIGHTING, matrix->data);
-	ctx->matrix.dirty[FGL_MATRIX_MODELVIEW] = 1;
-	fimgLoadMatrix(ctx->fimg, FGFP_MATRIX_TEXTURE(0), matrix->data);
-	ctx->matrix.dirty[FGL_MATRIX_TEXTURE(0)] = 1;
-	fimgLoadMatrix(ctx->fimg, FGFP_MATRIX_TEXTURE(1), matrix->data);
-	ctx->matrix.dirty[FGL_MATRIX_TEXTURE(1)] = 1;
-
-	// fimgCompatLightingEnable(ctx->fimg, 0);
-	/* End of TODO */
-
 	float zD;
 
 	if (z <= 0)
@@ -1157,33 +1649,26 @@ GL_API void GL_APIENTRY glDrawTexfOES (GLfloat x, GLfloat y, GLfloat z, GLfloat
 	/* Proceed with drawing */
 
 	fimgArray arrays[4 + FGL_MAX_TEXTURE_UNITS];
+	uint32_t texMask = fglSetupTextures(ctx);
+	uint32_t attribMask = 1 << FGL_ARRAY_VERTEX;
+	int count = 0;
 
-	arrays[FGL_ARRAY_VERTEX].pointer	= vertices;
-	arrays[FGL_ARRAY_VERTEX].stride		= 12;
-	arrays[FGL_ARRAY_VERTEX].width		= 12;
-	fimgSetAttribute(ctx->fimg, FGL_ARRAY_VERTEX, FGHI_ATTRIB_DT_FLOAT, 3);
+	arrays[count].pointer	= vertices;
+	arrays[count].stride	= 12;
+	arrays[count].width	= 12;
+	fimgSetAttribute(ctx->fimg, count++, FGHI_ATTRIB_DT_FLOAT, 3);
 
-	for (int i = FGL_ARRAY_NORMAL;
-	     i < FGL_ARRAY_TEXTURE + FGL_MAX_TEXTURE_UNITS; i++) {
-		arrays[i].pointer	= &ctx->vertex[i];
-		arrays[i].stride	= 0;
-		arrays[i].width		= 16;
-	}
+	for (int i = FGL_ARRAY_NORMAL; i < FGL_ARRAY_TEXTURE; i++)
+		fimgCompatSetAttribConst(ctx->fimg, i, ctx->vertex[i]);
 
 	for (int i = 0; i < FGL_MAX_TEXTURE_UNITS; i++) {
-		FGLTexture *tex;
-		bool enabled = ctx->textureExternal[i].enabled;
+		FGLTexture *tex = ctx->busyTexture[i];
 
-		if (enabled)
-			tex = ctx->textureExternal[i].getTexture();
-
-		if (!enabled) {
-			tex = ctx->texture[i].getTexture();
-			enabled = ctx->texture[i].enabled;
-		}
-
-		if (!enabled || !tex->isComplete())
+		if (!(texMask & (1 << i))) {
+			fimgCompatSetAttribConst(ctx->fimg, FGL_ARRAY_TEXTURE(i),
+					ctx->vertex[FGL_ARRAY_TEXTURE(i)]);
 			continue;
+		}
 
 		if (!tex->invReady) {
 			tex->invWidth = 1.0f/tex->width;
@@ -1200,33 +1685,26 @@ GL_API void GL_APIENTRY glDrawTexfOES (GLfloat x, GLfloat y, GLfloat z, GLfloat
 		texcoords[i][ 6] = tex->invWidth*(tex->cropRect[0] + tex->cropRect[2]);
 		texcoords[i][ 7] = tex->invHeight*tex->cropRect[1];
 
-		arrays[FGL_ARRAY_TEXTURE(i)].pointer	= texcoords[i];
-		arrays[FGL_ARRAY_TEXTURE(i)].stride	= 8;
-		arrays[FGL_ARRAY_TEXTURE(i)].width	= 8;
+		arrays[count].pointer	= texcoords[i];
+		arrays[count].stride	= 8;
+		arrays[count].width	= 8;
+		fimgSetAttribute(ctx->fimg, count++, FGHI_ATTRIB_DT_FLOAT, 2);
 
-		fimgSetAttribute(ctx->fimg, FGL_ARRAY_TEXTURE(i), FGHI_ATTRIB_DT_FLOAT, 2);
+		attribMask |= 1 << FGL_ARRAY_TEXTURE(i);
 	}
 
-	fglSetupTextures(ctx);
-
-	fimgSetAttribCount(ctx->fimg, 4 + FGL_MAX_TEXTURE_UNITS);
+	fimgCompatSetAttribMask(ctx->fimg, attribMask);
+	fimgSetAttribCount(ctx->fimg, count);
 
 	ctx->finished = false;
+	++ctx->drawQueue.draws;
 
-	fimgDrawArrays(ctx->fimg, FGPE_TRIANGLE_STRIP, arrays, 4);
-
-	/* Restore previous state */
-
-	for (int i = 0; i < 4 + FGL_MAX_TEXTURE_UNITS; i++) {
-		if (arrayEnabled[i])
-			fglEnableClientState(ctx, i);
-		else
-			fglDisableClientState(ctx, i);
-	}
+	if (fglQueueDraw(ctx, FGPE_TRIANGLE_STRIP, arrays, attribMask, 4, 0, 0))
+		return;
 
-	fimgSetDepthRange(ctx->fimg, zNear, zFar);
-	fimgSetViewportParams(ctx->fimg, viewportX, viewportY, viewportW, viewportH);
-	fimgSetFaceCullEnable(ctx->fimg, ctx->enable.cullFace);
+	fglSubmitDrawQueue(ctx);
+	fimgDrawArrays(ctx->fimg, FGPE_TRIANGLE_STRIP, arrays, 4);
+	fglEndDrawTex(ctx);
 }
 
 GL_API void GL_APIENTRY glDrawTexsOES (GLshort x, GLshort y, GLshort z, GLshort width, GLshort height)
@@ -1994,6 +2472,9 @@ static inline void fglSet(GLenum cap, bool state)
 		ctx->enable.colorLogicOp = state;
 		break;
 	case GL_LIGHTING:
+		fimgCompatSetLightingEnable(ctx->fimg, state);
+		ctx->enable.lighting = state;
+		break;
 	case GL_LIGHT0:
 	case GL_LIGHT1:
 	case GL_LIGHT2:
@@ -2002,9 +2483,40 @@ static inline void fglSet(GLenum cap, bool state)
 	case GL_LIGHT5:
 	case GL_LIGHT6:
 	case GL_LIGHT7:
+		fimgCompatSetLightEnable(ctx->fimg, cap - GL_LIGHT0, state);
+		if (state)
+			ctx->enable.light |= 1 << (cap - GL_LIGHT0);
+		else
+			ctx->enable.light &= ~(1 << (cap - GL_LIGHT0));
+		break;
 	case GL_NORMALIZE:
+		ctx->enable.normalize = state;
+		fimgCompatSetNormalize(ctx->fimg,
+			ctx->enable.normalize || ctx->enable.rescaleNormal);
+		break;
+	case GL_RESCALE_NORMAL:
+		/* Implemented as normalization, same result for unit normals */
+		ctx->enable.rescaleNormal = state;
+		fimgCompatSetNormalize(ctx->fimg,
+			ctx->enable.normalize || ctx->enable.rescaleNormal);
+		break;
 	case GL_COLOR_MATERIAL:
+		fimgCompatSetColorMaterial(ctx->fimg, state);
+		ctx->enable.colorMaterial = state;
+		break;
 	case GL_FOG:
+		ctx->enable.fog = state;
+		fglUpdateFog(ctx);
+		break;
+	case GL_CLIP_PLANE0:
+	case GL_CLIP_PLANE1:
+	case GL_CLIP_PLANE2:
+		fimgCompatSetClipPlaneEnable(ctx->fimg, cap - GL_CLIP_PLANE0, state);
+		if (state)
+			ctx->enable.clipPlane |= 1 << (cap - GL_CLIP_PLANE0);
+		else
+			ctx->enable.clipPlane &= ~(1 << (cap - GL_CLIP_PLANE0));
+		break;
 	case GL_POINT_SMOOTH:
 	case GL_LINE_SMOOTH:
 	case GL_MULTISAMPLE:
@@ -2031,7 +2543,8 @@ GL_API void GL_APIENTRY glDisable (GLenum cap)
 
 GL_API void GL_APIENTRY glFlush (void)
 {
-	/* Nothing to do here */
+	/* Submit queued draws, if any */
+	fglFlushDrawQueue(getDrawContext());
 }
 
 GL_API void GL_APIENTRY glFinish (void)
@@ -2050,104 +2563,409 @@ GL_API void GL_APIENTRY glFinish (void)
 }
 
 /*
-	Stubs
+	Lighting
 */
 
-GL_API void GL_APIENTRY glClipPlanef (GLenum plane, const GLfloat *equation)
+GL_API void GL_APIENTRY glLightModelfv (GLenum pname, const GLfloat *params)
 {
-	FUNC_UNIMPLEMENTED;
+	FGLContext *ctx = getContext();
+
+	switch (pname) {
+	case GL_LIGHT_MODEL_AMBIENT:
+		memcpy(ctx->lighting.ambient, params, 4*sizeof(GLfloat));
+		fimgCompatSetLightModelAmbient(ctx->fimg, ctx->lighting.ambient);
+		break;
+	case GL_LIGHT_MODEL_TWO_SIDE:
+		ctx->lighting.twoSide = (*params < 0.0f || *params > 0.0f);
+		break;
+	default:
+		setError(GL_INVALID_ENUM);
+		LOGD("Invalid enum: %x", pname);
+	}
 }
 
-GL_API void GL_APIENTRY glClipPlanex (GLenum plane, const GLfixed *equation)
+GL_API void GL_APIENTRY glLightModelf (GLenum pname, GLfloat param)
 {
-	FUNC_UNIMPLEMENTED;
+	if (pname != GL_LIGHT_MODEL_TWO_SIDE) {
+		setError(GL_INVALID_ENUM);
+		return;
+	}
+
+	glLightModelfv(pname, &param);
 }
 
-GL_API void GL_APIENTRY glFogf (GLenum pname, GLfloat param)
+GL_API void GL_APIENTRY glLightModelxv (GLenum pname, const GLfixed *params)
 {
-	FUNC_UNIMPLEMENTED;
+	GLfloat fparams[4];
+
+	switch (pname) {
+	case GL_LIGHT_MODEL_AMBIENT:
+		for (int i = 0; i < 4; ++i)
+			fparams[i] = floatFromFixed(params[i]);
+		break;
+	default:
+		fparams[0] = floatFromFixed(*params);
+	}
+
+	glLightModelfv(pname, fparams);
 }
 
-GL_API void GL_APIENTRY glFogfv (GLenum pname, const GLfloat *params)
+GL_API void GL_APIENTRY glLightModelx (GLenum pname, GLfixed param)
 {
-	FUNC_UNIMPLEMENTED;
+	glLightModelf(pname, floatFromFixed(param));
 }
 
-GL_API void GL_APIENTRY glFogx (GLenum pname, GLfixed param)
+/**
+ * Transforms vector by upper left 3x3 part of given matrix.
+ * @param m Column-major matrix.
+ * @param dst Destination vector.
+ * @param src Source vector.
+ */
+static inline void fglTransformVector3(const GLfloat *m,
+					GLfloat *dst, const GLfloat *src)
 {
-	FUNC_UNIMPLEMENTED;
+	for (int i = 0; i < 3; ++i)
+		dst[i] = m[i]*src[0] + m[4 + i]*src[1] + m[8 + i]*src[2];
 }
 
-GL_API void GL_APIENTRY glFogxv (GLenum pname, const GLfixed *params)
+GL_API void GL_APIENTRY glLightfv (GLenum light, GLenum pname,
+							const GLfloat *params)
 {
-	FUNC_UNIMPLEMENTED;
+	if (light < GL_LIGHT0 || light >= GL_LIGHT0 + FGL_MAX_LIGHTS) {
+		setError(GL_INVALID_ENUM);
+		return;
+	}
+
+	FGLContext *ctx = getContext();
+	fimgLight *lgt = &ctx->lighting.light[light - GL_LIGHT0];
+	const GLfloat *m = ctx->matrix.stack[FGL_MATRIX_MODELVIEW].top().data;
+
+	switch (pname) {
+	case GL_AMBIENT:
+		memcpy(lgt->ambient, params, 4*sizeof(GLfloat));
+		break;
+	case GL_DIFFUSE:
+		memcpy(lgt->diffuse, params, 4*sizeof(GLfloat));
+		break;
+	case GL_SPECULAR:
+		memcpy(lgt->specular, params, 4*sizeof(GLfloat));
+		break;
+	case GL_POSITION:
+		/* Stored in eye coordinates */
+		fglTransformVector3(m, lgt->position, params);
+		for (int i = 0; i < 3; ++i)
+			lgt->position[i] += m[12 + i]*params[3];
+		lgt->position[3] = m[3]*params[0] + m[7]*params[1]
+					+ m[11]*params[2] + m[15]*params[3];
+		break;
+	case GL_SPOT_DIRECTION:
+		fglTransformVector3(m, lgt->spotDirection, params);
+		break;
+	case GL_SPOT_EXPONENT:
+		if (*params < 0.0f || *params > 128.0f) {
+			setError(GL_INVALID_VALUE);
+			return;
+		}
+		lgt->spotExponent = *params;
+		break;
+	case GL_SPOT_CUTOFF:
+		/* Valid values are [0, 90] and 180 (uniform distribution) */
+		if (*params < 0.0f || (*params > 90.0f && *params < 180.0f)
+		    || *params > 180.0f) {
+			setError(GL_INVALID_VALUE);
+			return;
+		}
+		lgt->spotCutoff = *params;
+		break;
+	case GL_CONSTANT_ATTENUATION:
+	case GL_LINEAR_ATTENUATION:
+	case GL_QUADRATIC_ATTENUATION:
+		if (*params < 0.0f) {
+			setError(GL_INVALID_VALUE);
+			return;
+		}
+		lgt->attenuation[pname - GL_CONSTANT_ATTENUATION] = *params;
+		break;
+	default:
+		setError(GL_INVALID_ENUM);
+		LOGD("Invalid enum: %x", pname);
+		return;
+	}
+
+	fimgCompatSetLight(ctx->fimg, light - GL_LIGHT0, lgt);
 }
 
-GL_API void GL_APIENTRY glHint (GLenum target, GLenum mode)
+GL_API void GL_APIENTRY glLightf (GLenum light, GLenum pname, GLfloat param)
 {
-	FUNC_UNIMPLEMENTED;
+	switch (pname) {
+	case GL_SPOT_EXPONENT:
+	case GL_SPOT_CUTOFF:
+	case GL_CONSTANT_ATTENUATION:
+	case GL_LINEAR_ATTENUATION:
+	case GL_QUADRATIC_ATTENUATION:
+		glLightfv(light, pname, &param);
+		break;
+	default:
+		setError(GL_INVALID_ENUM);
+		LOGD("Invalid enum: %x", pname);
+	}
 }
 
-GL_API void GL_APIENTRY glLightModelf (GLenum pname, GLfloat param)
+GL_API void GL_APIENTRY glLightxv (GLenum light, GLenum pname,
+							const GLfixed *params)
 {
-	FUNC_UNIMPLEMENTED;
+	GLfloat fparams[4];
+	int count;
+
+	switch (pname) {
+	case GL_AMBIENT:
+	case GL_DIFFUSE:
+	case GL_SPECULAR:
+	case GL_POSITION:
+		count = 4;
+		break;
+	case GL_SPOT_DIRECTION:
+		count = 3;
+		break;
+	default:
+		count = 1;
+	}
+
+	for (int i = 0; i < count; ++i)
+		fparams[i] = floatFromFixed(params[i]);
+
+	glLightfv(light, pname, fparams);
 }
 
-GL_API void GL_APIENTRY glLightModelfv (GLenum pname, const GLfloat *params)
+GL_API void GL_APIENTRY glLightx (GLenum light, GLenum pname, GLfixed param)
 {
-	FUNC_UNIMPLEMENTED;
+	glLightf(light, pname, floatFromFixed(param));
 }
 
-GL_API void GL_APIENTRY glLightModelx (GLenum pname, GLfixed param)
+GL_API void GL_APIENTRY glMaterialfv (GLenum face, GLenum pname,
+							const GLfloat *params)
 {
-	FUNC_UNIMPLEMENTED;
+	if (face != GL_FRONT_AND_BACK) {
+		setError(GL_INVALID_ENUM);
+		return;
+	}
+
+	FGLContext *ctx = getContext();
+	fimgMaterial *mat = &ctx->lighting.material;
+
+	switch (pname) {
+	case GL_AMBIENT:
+		memcpy(mat->ambient, params, 4*sizeof(GLfloat));
+		break;
+	case GL_DIFFUSE:
+		memcpy(mat->diffuse, params, 4*sizeof(GLfloat));
+		break;
+	case GL_AMBIENT_AND_DIFFUSE:
+		memcpy(mat->ambient, params, 4*sizeof(GLfloat));
+		memcpy(mat->diffuse, params, 4*sizeof(GLfloat));
+		break;
+	case GL_SPECULAR:
+		memcpy(mat->specular, params, 4*sizeof(GLfloat));
+		break;
+	case GL_EMISSION:
+		memcpy(mat->emission, params, 4*sizeof(GLfloat));
+		break;
+	case GL_SHININESS:
+		if (*params < 0.0f || *params > 128.0f) {
+			setError(GL_INVALID_VALUE);
+			return;
+		}
+		mat->shininess = *params;
+		break;
+	default:
+		setError(GL_INVALID_ENUM);
+		LOGD("Invalid enum: %x", pname);
+		return;
+	}
+
+	fimgCompatSetMaterial(ctx->fimg, mat);
 }
 
-GL_API void GL_APIENTRY glLightModelxv (GLenum pname, const GLfixed *params)
+GL_API void GL_APIENTRY glMaterialf (GLenum face, GLenum pname, GLfloat param)
 {
-	FUNC_UNIMPLEMENTED;
+	if (pname != GL_SHININESS) {
+		setError(GL_INVALID_ENUM);
+		return;
+	}
+
+	glMaterialfv(face, pname, &param);
 }
 
-GL_API void GL_APIENTRY glLightf (GLenum light, GLenum pname, GLfloat param)
+GL_API void GL_APIENTRY glMaterialxv (GLenum face, GLenum pname,
+							const GLfixed *params)
 {
-	FUNC_UNIMPLEMENTED;
+	GLfloat fparams[4];
+	int count = (pname == GL_SHININESS) ? 1 : 4;
+
+	for (int i = 0; i < count; ++i)
+		fparams[i] = floatFromFixed(params[i]);
+
+	glMaterialfv(face, pname, fparams);
 }
 
-GL_API void GL_APIENTRY glLightfv (GLenum light, GLenum pname,
-							const GLfloat *params)
+GL_API void GL_APIENTRY glMaterialx (GLenum face, GLenum pname, GLfixed param)
 {
-	FUNC_UNIMPLEMENTED;
+	glMaterialf(face, pname, floatFromFixed(param));
 }
 
-GL_API void GL_APIENTRY glLightx (GLenum light, GLenum pname, GLfixed param)
+/*
+	Fog
+*/
+
+/**
+ * Passes fog mode and parameters to libfimg.
+ * @param ctx Rendering context.
+ */
+static void fglUpdateFog(FGLContext *ctx)
+{
+	fimgFogMode mode = FGFP_FOG_NONE;
+
+	if (ctx->enable.fog) {
+		switch (ctx->fog.mode) {
+		case GL_LINEAR:
+			mode = FGFP_FOG_LINEAR;
+			break;
+		case GL_EXP:
+			mode = FGFP_FOG_EXP;
+			break;
+		case GL_EXP2:
+			mode = FGFP_FOG_EXP2;
+			break;
+		}
+	}
+
+	fimgCompatSetFog(ctx->fimg, mode,
+			ctx->fog.density, ctx->fog.start, ctx->fog.end);
+}
+
+GL_API void GL_APIENTRY glFogfv (GLenum pname, const GLfloat *params)
 {
-	FUNC_UNIMPLEMENTED;
+	FGLContext *ctx = getContext();
+
+	switch (pname) {
+	case GL_FOG_MODE:
+		switch ((GLenum)*params) {
+		case GL_LINEAR:
+		case GL_EXP:
+		case GL_EXP2:
+			ctx->fog.mode = (GLenum)*params;
+			break;
+		default:
+			setError(GL_INVALID_ENUM);
+			return;
+		}
+		break;
+	case GL_FOG_DENSITY:
+		if (*params < 0.0f) {
+			setError(GL_INVALID_VALUE);
+			return;
+		}
+		ctx->fog.density = *params;
+		break;
+	case GL_FOG_START:
+		ctx->fog.start = *params;
+		break;
+	case GL_FOG_END:
+		ctx->fog.end = *params;
+		break;
+	case GL_FOG_COLOR:
+		for (int i = 0; i < 4; ++i)
+			ctx->fog.color[i] = clampFloat(params[i]);
+		fimgCompatSetFogColor(ctx->fimg, ctx->fog.color);
+		return;
+	default:
+		setError(GL_INVALID_ENUM);
+		LOGD("Invalid enum: %x", pname);
+		return;
+	}
+
+	fglUpdateFog(ctx);
 }
 
-GL_API void GL_APIENTRY glLightxv (GLenum light, GLenum pname,
-							const GLfixed *params)
+GL_API void GL_APIENTRY glFogf (GLenum pname, GLfloat param)
 {
-	FUNC_UNIMPLEMENTED;
+	if (pname == GL_FOG_COLOR) {
+		setError(GL_INVALID_ENUM);
+		return;
+	}
+
+	glFogfv(pname, &param);
 }
 
-GL_API void GL_APIENTRY glMaterialf (GLenum face, GLenum pname, GLfloat param)
+GL_API void GL_APIENTRY glFogxv (GLenum pname, const GLfixed *params)
 {
-	FUNC_UNIMPLEMENTED;
+	GLfloat fparams[4];
+
+	switch (pname) {
+	case GL_FOG_MODE:
+		/* Mode is passed as enum value, not as fixed point number */
+		fparams[0] = *params;
+		break;
+	case GL_FOG_COLOR:
+		for (int i = 0; i < 4; ++i)
+			fparams[i] = floatFromFixed(params[i]);
+		break;
+	default:
+		fparams[0] = floatFromFixed(*params);
+	}
+
+	glFogfv(pname, fparams);
 }
 
-GL_API void GL_APIENTRY glMaterialfv (GLenum face, GLenum pname,
-							const GLfloat *params)
+GL_API void GL_APIENTRY glFogx (GLenum pname, GLfixed param)
 {
-	FUNC_UNIMPLEMENTED;
+	if (pname == GL_FOG_COLOR) {
+		setError(GL_INVALID_ENUM);
+		return;
+	}
+
+	glFogxv(pname, &param);
 }
 
-GL_API void GL_APIENTRY glMaterialx (GLenum face, GLenum pname, GLfixed param)
+/*
+	Clip planes
+*/
+
+GL_API void GL_APIENTRY glClipPlanef (GLenum plane, const GLfloat *equation)
 {
-	FUNC_UNIMPLEMENTED;
+	if (plane < GL_CLIP_PLANE0 || plane >= GL_CLIP_PLANE0 + FGL_MAX_CLIP_PLANES) {
+		setError(GL_INVALID_ENUM);
+		return;
+	}
+
+	FGLContext *ctx = getContext();
+	GLfloat *eq = ctx->clipPlane[plane - GL_CLIP_PLANE0];
+	const GLfloat *inv =
+		ctx->matrix.stack[FGL_MATRIX_MODELVIEW_INVERSE].top().data;
+
+	/* Stored in eye coordinates (multiplied by inverse of modelview) */
+	for (int i = 0; i < 4; ++i)
+		eq[i] = equation[0]*inv[4*i] + equation[1]*inv[4*i + 1]
+			+ equation[2]*inv[4*i + 2] + equation[3]*inv[4*i + 3];
+
+	fimgCompatSetClipPlane(ctx->fimg, plane - GL_CLIP_PLANE0, eq);
 }
 
-GL_API void GL_APIENTRY glMaterialxv (GLenum face, GLenum pname,
-							const GLfixed *params)
+GL_API void GL_APIENTRY glClipPlanex (GLenum plane, const GLfixed *equation)
+{
+	GLfloat fequation[4];
+
+	for (int i = 0; i < 4; ++i)
+		fequation[i] = floatFromFixed(equation[i]);
+
+	glClipPlanef(plane, fequation);
+}
+
+/*
+	Stubs
+*/
+
+GL_API void GL_APIENTRY glHint (GLenum target, GLenum mode)
 {
 	FUNC_UNIMPLEMENTED;
 }
@@ -2195,10 +3013,6 @@ FGLContext *fglCreateContext(void)
 		return NULL;
 	}
 
-	for(int i = 0; i < 4 + FGL_MAX_TEXTURE_UNITS; i++)
-		fimgSetAttribute(ctx->fimg, i, FGHI_ATTRIB_DT_FLOAT,
-						fglDefaultAttribSize[i]);
-
 	return ctx;
 }
 
@@ -2213,11 +3027,18 @@ extern FGLObjectManager<FGLRenderbuffer, FGL_MAX_RENDERBUFFER_OBJECTS> fglRender
  */
 void fglDestroyContext(FGLContext *ctx)
 {
+	FGLDrawQueueStats stats;
+
+	fglGetDrawQueueStats(ctx, &stats);
+	LOGD("Draw queue: %u draw calls in %u hardware sessions",
+				stats.totalDraws, stats.totalSessions);
+
 	fglBufferObjects.clean(ctx);
 	fglTextureObjects.clean(ctx);
 	fglFramebufferObjects.clean(ctx);
 	fglRenderbufferObjects.clean(ctx);
 
+	free(ctx->drawQueue.data);
 	fimgDestroyContext(ctx->fimg);
 	delete ctx;
 }
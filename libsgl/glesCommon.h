@@ -76,9 +76,40 @@ static inline GLint unitFromTextureEnum(GLenum texture)
 	Context management
 */
 
+extern void fglFlushDrawQueue(FGLContext *ctx);
+extern void fglGetDrawQueueStats(FGLContext *ctx, FGLDrawQueueStats *stats);
+
+/**
+ * \fn getDrawContext
+ * Gets pointer to current rendering context without submitting queued draws.
+ * Only draw calls, which can be merged with queued draws, may use it.
+ * @return Current rendering context or NULL if there is no current context.
+ */
+
+#ifdef GLES_DEBUG
+#define getDrawContext() ( \
+	LOGD("%s called getDrawContext()", __func__), \
+	_getDrawContext())
+static inline FGLContext *_getDrawContext(void)
+#else
+static inline FGLContext *getDrawContext(void)
+#endif
+{
+	FGLContext *ctx = getGlThreadSpecific();
+
+	if(!ctx) {
+		LOGE("GL context is NULL!");
+		exit(EINVAL);
+	}
+
+	return ctx;
+}
+
 /**
  * \fn getContext
  * Gets pointer to current rendering context.
+ * Any queued draws are submitted to the hardware first, so the caller
+ * is free to modify rendering state.
  * @return Current rendering context or NULL if there is no current context.
  */
 
@@ -91,12 +122,10 @@ static inline FGLContext *_getContext(void)
 static inline FGLContext *getContext(void)
 #endif
 {
-	FGLContext *ctx = getGlThreadSpecific();
+	FGLContext *ctx = getDrawContext();
 
-	if(!ctx) {
-		LOGE("GL context is NULL!");
-		exit(EINVAL);
-	}
+	if (unlikely(ctx->drawQueue.count))
+		fglFlushDrawQueue(ctx);
 
 	return ctx;
 }
@@ -134,10 +163,10 @@ static inline void setError(GLenum error)
 		pthread_mutex_unlock(&glErrorKeyMutex);
 		errorCode = GL_NO_ERROR;
 	} else {
-		errorCode = (GLenum)pthread_getspecific(glErrorKey);
+		errorCode = (GLenum)(intptr_t)pthread_getspecific(glErrorKey);
 	}
 
-	pthread_setspecific(glErrorKey, (void *)error);
+	pthread_setspecific(glErrorKey, (void *)(intptr_t)error);
 
 	if(errorCode == GL_NO_ERROR)
 		errorCode = error;
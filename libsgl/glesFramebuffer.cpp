@@ -160,6 +160,11 @@ GL_API void GL_APIENTRY glDeleteRenderbuffersOES (GLsizei n, const GLuint* rende
 	if (n <= 0)
 		return;
 
+	/* Queued draws might use the objects */
+	FGLContext *ctx = getGlThreadSpecific();
+	if (ctx)
+		fglFlushDrawQueue(ctx);
+
 	do {
 		name = *renderbuffers;
 		renderbuffers++;
@@ -399,6 +404,11 @@ GL_API void GL_APIENTRY glDeleteFramebuffersOES (GLsizei n, const GLuint* frameb
 	if (n <= 0)
 		return;
 
+	/* Queued draws might use the objects */
+	FGLContext *ctx = getGlThreadSpecific();
+	if (ctx)
+		fglFlushDrawQueue(ctx);
+
 	while(n--) {
 		name = *framebuffers;
 		framebuffers++;
@@ -51,6 +51,8 @@ static char const * const gExtensionsString =
 	"GL_OES_fixed_point "
 	"GL_OES_single_precision "
 	"GL_OES_read_format "
+	"GL_OES_compressed_paletted_texture "
+	"GL_OES_compressed_ETC1_RGB8_texture "
 	"GL_OES_matrix_get "
 	"GL_OES_draw_texture "
 	"GL_OES_EGL_image "
@@ -63,11 +65,28 @@ static char const * const gExtensionsString =
 	"GL_OES_depth24 "
 	"GL_OES_stencil8 "
 	"GL_EXT_texture_format_BGRA8888 "
+	"GL_EXT_texture_compression_dxt1 "
+	"GL_EXT_texture_compression_s3tc "
 	"GL_ARB_texture_non_power_of_two"
 ;
 
 /** Compressed texture formats supported by this OpenGL ES implementation. */
 static const GLint fglCompressedTextureFormats[] = {
+	GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+	GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
+	GL_COMPRESSED_RGBA_S3TC_DXT3_EXT,
+	GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+	GL_PALETTE4_RGB8_OES,
+	GL_PALETTE4_RGBA8_OES,
+	GL_PALETTE4_R5_G6_B5_OES,
+	GL_PALETTE4_RGBA4_OES,
+	GL_PALETTE4_RGB5_A1_OES,
+	GL_PALETTE8_RGB8_OES,
+	GL_PALETTE8_RGBA8_OES,
+	GL_PALETTE8_R5_G6_B5_OES,
+	GL_PALETTE8_RGBA4_OES,
+	GL_PALETTE8_RGB5_A1_OES,
+	GL_ETC1_RGB8_OES
 };
 
 /** Pixel format supported by this OpenGL ES implementation. */
@@ -82,8 +101,8 @@ const FGLPixelFormat FGLPixelFormat::table[] = {
 		0,
 		0,
 		0,
-		-1,
-		-1,
+		-1U,
+		-1U,
 		0
 	},
 
@@ -246,7 +265,7 @@ const FGLPixelFormat FGLPixelFormat::table[] = {
 		0,
 		2,
 		FGTU_TSTA_TEXTURE_FORMAT_4444,
-		-1,
+		-1U,
 		FGL_PIX_ALPHA_LSB
 	},
 	/*
@@ -263,7 +282,7 @@ const FGLPixelFormat FGLPixelFormat::table[] = {
 		0,
 		2,
 		FGTU_TSTA_TEXTURE_FORMAT_1555,
-		-1,
+		-1U,
 		FGL_PIX_ALPHA_LSB
 	},
 	/*
@@ -280,7 +299,7 @@ const FGLPixelFormat FGLPixelFormat::table[] = {
 		0,
 		2,
 		FGTU_TSTA_TEXTURE_FORMAT_DEPTHCOMP16,
-		-1,
+		-1U,
 		0
 	},
 	/*
@@ -297,7 +316,7 @@ const FGLPixelFormat FGLPixelFormat::table[] = {
 		0,
 		2,
 		FGTU_TSTA_TEXTURE_FORMAT_88,
-		-1,
+		-1U,
 		0
 	},
 	/*
@@ -314,7 +333,7 @@ const FGLPixelFormat FGLPixelFormat::table[] = {
 		0,
 		1,
 		FGTU_TSTA_TEXTURE_FORMAT_8,
-		-1,
+		-1U,
 		0
 	},
 
@@ -336,7 +355,7 @@ const FGLPixelFormat FGLPixelFormat::table[] = {
 		0,
 		0,
 		FGTU_TSTA_TEXTURE_FORMAT_1BPP,
-		-1,
+		-1U,
 		0
 	},
 	/*
@@ -353,7 +372,7 @@ const FGLPixelFormat FGLPixelFormat::table[] = {
 		0,
 		0,
 		FGTU_TSTA_TEXTURE_FORMAT_2BPP,
-		-1,
+		-1U,
 		0
 	},
 	/*
@@ -370,7 +389,7 @@ const FGLPixelFormat FGLPixelFormat::table[] = {
 		0,
 		0,
 		FGTU_TSTA_TEXTURE_FORMAT_4BPP,
-		-1,
+		-1U,
 		0
 	},
 	/*
@@ -387,7 +406,7 @@ const FGLPixelFormat FGLPixelFormat::table[] = {
 		0,
 		0,
 		FGTU_TSTA_TEXTURE_FORMAT_8BPP,
-		-1,
+		-1U,
 		0
 	},
 	/*
@@ -404,12 +423,13 @@ const FGLPixelFormat FGLPixelFormat::table[] = {
 		0,
 		0,
 		FGTU_TSTA_TEXTURE_FORMAT_S3TC,
-		-1,
+		-1U,
 		0
 	},
 
 	/*
 	 * YUV formats follow
+	 * (two texels share chroma components of single 32-bit word)
 	 */
 
 	/*
@@ -424,9 +444,9 @@ const FGLPixelFormat FGLPixelFormat::table[] = {
 		{ { 8, 8 }, { 0, 8 }, { 24, 8 }, { 16, 8 } },
 		0,
 		0,
-		4,
+		2,
 		FGTU_TSTA_TEXTURE_FORMAT_Y1VY0U,
-		-1,
+		-1U,
 		0
 	},
 	/*
@@ -441,9 +461,9 @@ const FGLPixelFormat FGLPixelFormat::table[] = {
 		{ { 0, 8 }, { 8, 8 }, { 16, 8 }, { 24, 8 } },
 		0,
 		0,
-		4,
+		2,
 		FGTU_TSTA_TEXTURE_FORMAT_VY1UY0,
-		-1,
+		-1U,
 		0
 	},
 	/*
@@ -458,9 +478,9 @@ const FGLPixelFormat FGLPixelFormat::table[] = {
 		{ { 8, 8 }, { 16, 8 }, { 24, 8 }, { 0, 8 } },
 		0,
 		0,
-		4,
+		2,
 		FGTU_TSTA_TEXTURE_FORMAT_Y1UY0V,
-		-1,
+		-1U,
 		0
 	},
 	/*
@@ -475,9 +495,9 @@ const FGLPixelFormat FGLPixelFormat::table[] = {
 		{ { 0, 8 }, { 24, 8 }, { 16, 8 }, { 8, 8 } },
 		0,
 		0,
-		4,
+		2,
 		FGTU_TSTA_TEXTURE_FORMAT_UY1VY0,
-		-1,
+		-1U,
 		0
 	},
 };
@@ -957,6 +977,36 @@ void fglGetState(FGLContext *ctx, GLenum pname, FGLStateGetter &state)
 	case GL_MAX_LIGHTS:
 		state.putInteger(FGL_MAX_LIGHTS);
 		break;
+	case GL_LIGHT_MODEL_AMBIENT:
+		state.putNormalized(ctx->lighting.ambient[0]);
+		state.putNormalized(ctx->lighting.ambient[1]);
+		state.putNormalized(ctx->lighting.ambient[2]);
+		state.putNormalized(ctx->lighting.ambient[3]);
+		break;
+	case GL_LIGHT_MODEL_TWO_SIDE:
+		state.putBoolean(ctx->lighting.twoSide);
+		break;
+	case GL_MAX_CLIP_PLANES:
+		state.putInteger(FGL_MAX_CLIP_PLANES);
+		break;
+	case GL_FOG_MODE:
+		state.putEnum(ctx->fog.mode);
+		break;
+	case GL_FOG_DENSITY:
+		state.putFloat(ctx->fog.density);
+		break;
+	case GL_FOG_START:
+		state.putFloat(ctx->fog.start);
+		break;
+	case GL_FOG_END:
+		state.putFloat(ctx->fog.end);
+		break;
+	case GL_FOG_COLOR:
+		state.putNormalized(ctx->fog.color[0]);
+		state.putNormalized(ctx->fog.color[1]);
+		state.putNormalized(ctx->fog.color[2]);
+		state.putNormalized(ctx->fog.color[3]);
+		break;
 	case GL_SAMPLE_BUFFERS :
 		state.putInteger(0);
 		break;
@@ -1101,6 +1151,22 @@ void fglGetState(FGLContext *ctx, GLenum pname, FGLStateGetter &state)
 	case GL_BLEND:
 	case GL_DITHER:
 	case GL_COLOR_LOGIC_OP:
+	case GL_LIGHTING:
+	case GL_LIGHT0:
+	case GL_LIGHT1:
+	case GL_LIGHT2:
+	case GL_LIGHT3:
+	case GL_LIGHT4:
+	case GL_LIGHT5:
+	case GL_LIGHT6:
+	case GL_LIGHT7:
+	case GL_NORMALIZE:
+	case GL_RESCALE_NORMAL:
+	case GL_COLOR_MATERIAL:
+	case GL_FOG:
+	case GL_CLIP_PLANE0:
+	case GL_CLIP_PLANE1:
+	case GL_CLIP_PLANE2:
 	case GL_VERTEX_ARRAY:
 	case GL_NORMAL_ARRAY:
 	case GL_COLOR_ARRAY:
@@ -1208,6 +1274,29 @@ GL_API GLboolean GL_APIENTRY glIsEnabled (GLenum cap)
 		return ctx->enable.dither;
 	case GL_COLOR_LOGIC_OP:
 		return ctx->enable.colorLogicOp;
+	case GL_LIGHTING:
+		return ctx->enable.lighting;
+	case GL_LIGHT0:
+	case GL_LIGHT1:
+	case GL_LIGHT2:
+	case GL_LIGHT3:
+	case GL_LIGHT4:
+	case GL_LIGHT5:
+	case GL_LIGHT6:
+	case GL_LIGHT7:
+		return (ctx->enable.light >> (cap - GL_LIGHT0)) & 1;
+	case GL_NORMALIZE:
+		return ctx->enable.normalize;
+	case GL_RESCALE_NORMAL:
+		return ctx->enable.rescaleNormal;
+	case GL_COLOR_MATERIAL:
+		return ctx->enable.colorMaterial;
+	case GL_FOG:
+		return ctx->enable.fog;
+	case GL_CLIP_PLANE0:
+	case GL_CLIP_PLANE1:
+	case GL_CLIP_PLANE2:
+		return (ctx->enable.clipPlane >> (cap - GL_CLIP_PLANE0)) & 1;
 	case GL_VERTEX_ARRAY:
 		return ctx->array[FGL_ARRAY_VERTEX].enabled;
 	case GL_NORMAL_ARRAY:
@@ -1264,28 +1353,160 @@ GL_API void GL_APIENTRY glGetBufferParameteriv (GLenum target,
 	}
 }
 
-/*
- * Stubs
+/**
+ * Retrieves parameter of light source.
+ * @param ctx Rendering context.
+ * @param light Light source.
+ * @param pname Parameter to retrieve.
+ * @param state State query response container.
  */
+static void fglGetLight(FGLContext *ctx, GLenum light, GLenum pname,
+							FGLStateGetter &state)
+{
+	if (light < GL_LIGHT0 || light >= GL_LIGHT0 + FGL_MAX_LIGHTS) {
+		setError(GL_INVALID_ENUM);
+		return;
+	}
 
-GL_API void GL_APIENTRY glGetClipPlanef (GLenum pname, GLfloat eqn[4])
+	const fimgLight *lgt = &ctx->lighting.light[light - GL_LIGHT0];
+
+	switch (pname) {
+	case GL_AMBIENT:
+		state.putFloats(lgt->ambient, 4);
+		break;
+	case GL_DIFFUSE:
+		state.putFloats(lgt->diffuse, 4);
+		break;
+	case GL_SPECULAR:
+		state.putFloats(lgt->specular, 4);
+		break;
+	case GL_POSITION:
+		state.putFloats(lgt->position, 4);
+		break;
+	case GL_SPOT_DIRECTION:
+		state.putFloats(lgt->spotDirection, 3);
+		break;
+	case GL_SPOT_EXPONENT:
+		state.putFloat(lgt->spotExponent);
+		break;
+	case GL_SPOT_CUTOFF:
+		state.putFloat(lgt->spotCutoff);
+		break;
+	case GL_CONSTANT_ATTENUATION:
+	case GL_LINEAR_ATTENUATION:
+	case GL_QUADRATIC_ATTENUATION:
+		state.putFloat(lgt->attenuation[pname - GL_CONSTANT_ATTENUATION]);
+		break;
+	default:
+		setError(GL_INVALID_ENUM);
+		LOGD("Invalid enum: %x", pname);
+	}
+}
+
+GL_API void GL_APIENTRY glGetLightfv (GLenum light, GLenum pname,
+							GLfloat *params)
 {
-	FUNC_UNIMPLEMENTED;
+	FGLContext *ctx = getContext();
+	FGLFloatGetter state(params);
+
+	fglGetLight(ctx, light, pname, state);
 }
 
-GL_API void GL_APIENTRY glGetClipPlanex (GLenum pname, GLfixed eqn[4])
+GL_API void GL_APIENTRY glGetLightxv (GLenum light, GLenum pname,
+							GLfixed *params)
 {
-	FUNC_UNIMPLEMENTED;
+	FGLContext *ctx = getContext();
+	FGLFixedGetter state(params);
+
+	fglGetLight(ctx, light, pname, state);
 }
 
-GL_API void GL_APIENTRY glGetLightfv (GLenum light, GLenum pname,
-							GLfloat *params)
+/**
+ * Retrieves material parameter.
+ * @param ctx Rendering context.
+ * @param face Material face (both faces share the same material).
+ * @param pname Parameter to retrieve.
+ * @param state State query response container.
+ */
+static void fglGetMaterial(FGLContext *ctx, GLenum face, GLenum pname,
+							FGLStateGetter &state)
 {
-	FUNC_UNIMPLEMENTED;
+	if (face != GL_FRONT && face != GL_BACK) {
+		setError(GL_INVALID_ENUM);
+		return;
+	}
+
+	const fimgMaterial *mat = &ctx->lighting.material;
+
+	switch (pname) {
+	case GL_AMBIENT:
+		state.putFloats(mat->ambient, 4);
+		break;
+	case GL_DIFFUSE:
+		state.putFloats(mat->diffuse, 4);
+		break;
+	case GL_SPECULAR:
+		state.putFloats(mat->specular, 4);
+		break;
+	case GL_EMISSION:
+		state.putFloats(mat->emission, 4);
+		break;
+	case GL_SHININESS:
+		state.putFloat(mat->shininess);
+		break;
+	default:
+		setError(GL_INVALID_ENUM);
+		LOGD("Invalid enum: %x", pname);
+	}
 }
 
 GL_API void GL_APIENTRY glGetMaterialfv (GLenum face, GLenum pname,
 							GLfloat *params)
 {
-	FUNC_UNIMPLEMENTED;
+	FGLContext *ctx = getContext();
+	FGLFloatGetter state(params);
+
+	fglGetMaterial(ctx, face, pname, state);
+}
+
+GL_API void GL_APIENTRY glGetMaterialxv (GLenum face, GLenum pname,
+							GLfixed *params)
+{
+	FGLContext *ctx = getContext();
+	FGLFixedGetter state(params);
+
+	fglGetMaterial(ctx, face, pname, state);
+}
+
+/**
+ * Retrieves equation of user clip plane.
+ * @param ctx Rendering context.
+ * @param plane Clip plane.
+ * @param state State query response container.
+ */
+static void fglGetClipPlane(FGLContext *ctx, GLenum plane,
+							FGLStateGetter &state)
+{
+	if (plane < GL_CLIP_PLANE0 || plane >= GL_CLIP_PLANE0 + FGL_MAX_CLIP_PLANES) {
+		setError(GL_INVALID_ENUM);
+		return;
+	}
+
+	state.putFloats(ctx->clipPlane[plane - GL_CLIP_PLANE0], 4);
+}
+
+GL_API void GL_APIENTRY glGetClipPlanef (GLenum pname, GLfloat eqn[4])
+{
+	FGLContext *ctx = getContext();
+	FGLFloatGetter state(eqn);
+
+	fglGetClipPlane(ctx, pname, state);
+}
+
+GL_API void GL_APIENTRY glGetClipPlanex (GLenum pname, GLfixed eqn[4])
+{
+	FGLContext *ctx = getContext();
+	FGLFixedGetter state(eqn);
+
+	fglGetClipPlane(ctx, pname, state);
 }
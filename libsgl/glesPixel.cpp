@@ -341,8 +341,8 @@ static void burstCopy16(void *dst, const void *src, unsigned len)
 {
 	const uint8_t *s = (const uint8_t *)src;
 	uint8_t *d = (uint8_t *)dst;
-	unsigned srcAlign = (4 - (unsigned)src % 4) % 4;
-	unsigned dstAlign = (4 - (unsigned)dst % 4) % 4;
+	unsigned srcAlign = (4 - (uintptr_t)src % 4) % 4;
+	unsigned dstAlign = (4 - (uintptr_t)dst % 4) % 4;
 
 	if (srcAlign != dstAlign)
 		return fallbackCopy(d, s, len);
@@ -357,13 +357,11 @@ static void burstCopy16(void *dst, const void *src, unsigned len)
 		len -= srcAlign;
 	}
 
-	while (len >= 16) {
-		asm(	"ldmia %0!, {r0-r3}\n"
-			"stmia %1!, {r0-r3}\n"
-			: "=r"(s), "=r"(d)
-			: "0"(s), "1"(d)
-			: "r0", "r1", "r2", "r3");
-		len -= 16;
+	if (len >= 16) {
+		fimgKernels->copy16(d, s, len / 16);
+		s += len & ~15;
+		d += len & ~15;
+		len %= 16;
 	}
 
 	if (len)
@@ -557,35 +555,6 @@ static void *fillSingle32(void *buf, uint32_t val, size_t cnt)
 	return buf32;
 }
 
-/**
- * 32-byte wide optimized buffer fill by 32-bit pattern.
- * @param buf Destination buffer.
- * @param val Fill value.
- * @param cnt Number of 32-byte blocks to set.
- */
-static void *fillBurst32(void *buf, uint32_t val, size_t cnt)
-{
-	asm volatile (
-		"mov r0, %1\n\t"
-		"mov r1, %1\n\t"
-		"mov r2, %1\n\t"
-		"mov r3, %1\n\t"
-		"mov r4, %1\n\t"
-		"mov r5, %1\n\t"
-		"mov r6, %1\n\t"
-		"mov r7, %1\n\t"
-		"1:\n\t"
-		"stmia %0!, {r0-r7}\n\t"
-		"subs %2, %2, $1\n\t"
-		"bne 1b\n\t"
-		: "+r"(buf)
-		: "r"(val), "r"(cnt)
-		: "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7"
-	);
-
-	return buf;
-}
-
 /**
  * 32-bit by 32-bit buffer fill with masking.
  * @param buf Destination buffer.
@@ -607,45 +576,6 @@ static void *fillSingle32masked(void *buf, uint32_t val, uint32_t mask, size_t c
 	return buf32;
 }
 
-/**
- * 32-byte wide optimized buffer fill by 32-bit pattern with masking.
- * @param buf Destination buffer.
- * @param val Fill value.
- * @param mask Bit mask of bits to preserve.
- * @param cnt Number of 32-byte blocks to set.
- */
-static void *fillBurst32masked(void *buf, uint32_t val, uint32_t mask, size_t cnt)
-{
-	asm volatile (
-		"1:\n\t"
-		"ldmia %0, {r0-r7}\n\t"
-		"and r0, r0, %2\n\t"
-		"and r1, r1, %2\n\t"
-		"and r2, r2, %2\n\t"
-		"and r3, r3, %2\n\t"
-		"and r4, r4, %2\n\t"
-		"and r5, r5, %2\n\t"
-		"and r6, r6, %2\n\t"
-		"and r7, r7, %2\n\t"
-		"orr r0, r0, %1\n\t"
-		"orr r1, r1, %1\n\t"
-		"orr r2, r2, %1\n\t"
-		"orr r3, r3, %1\n\t"
-		"orr r4, r4, %1\n\t"
-		"orr r5, r5, %1\n\t"
-		"orr r6, r6, %1\n\t"
-		"orr r7, r7, %1\n\t"
-		"stmia %0!, {r0-r7}\n\t"
-		"subs %3, %3, $1\n\t"
-		"bne 1b\n\t"
-		: "+r"(buf)
-		: "r"(val), "r"(mask), "r"(cnt)
-		: "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7"
-	);
-
-	return buf;
-}
-
 /**
  * Fills given buffer with 32-bit values.
  * @param buf Buffer to fill.
@@ -669,7 +599,7 @@ static void fill32(void *buf, uint32_t val, size_t cnt)
 	}
 
 	if(cnt / 8)
-		buf32 = (uint32_t *)fillBurst32(buf32, val, cnt / 8);
+		buf32 = (uint32_t *)fimgKernels->fill32(buf32, val, cnt / 8);
 
 	if(cnt % 8)
 		fillSingle32(buf32, val, cnt % 8);
@@ -702,7 +632,8 @@ static void fill32masked(void *buf, uint32_t val, uint32_t mask, size_t cnt)
 	}
 
 	if(cnt / 8)
-		buf32 = (uint32_t *)fillBurst32masked(buf32, val, mask, cnt / 8);
+		buf32 = (uint32_t *)fimgKernels->fill32masked(buf32, val,
+							mask, cnt / 8);
 
 	if(cnt % 8)
 		fillSingle32masked(buf32, val, mask, cnt % 8);
@@ -731,7 +662,8 @@ static void fill16(void *buf, uint16_t val, size_t cnt)
 	}
 
 	if(cnt / 16)
-		buf16 = (uint16_t *)fillBurst32(buf16, (val << 16) | val, cnt / 16);
+		buf16 = (uint16_t *)fimgKernels->fill32(buf16,
+						(val << 16) | val, cnt / 16);
 
 	if(cnt % 16)
 		fillSingle16(buf16, val, cnt % 16);
@@ -764,8 +696,8 @@ static void fill16masked(void *buf, uint16_t val, uint16_t mask, size_t cnt)
 	}
 
 	if(cnt / 16)
-		buf16 = (uint16_t *)fillBurst32masked(buf16, (val << 16) | val,
-						(mask << 16) | mask, cnt / 16);
+		buf16 = (uint16_t *)fimgKernels->fill32masked(buf16,
+				(val << 16) | val, (mask << 16) | mask, cnt / 16);
 
 	if(cnt % 16)
 		fillSingle16masked(buf16, val, mask, cnt % 16);
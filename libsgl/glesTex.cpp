@@ -34,6 +34,7 @@
 #include "glesCommon.h"
 #include "fglobjectmanager.h"
 #include "fglimage.h"
+#include "fgletc1.h"
 #include "libfimg/fimg.h"
 
 /*
@@ -73,6 +74,11 @@ GL_API void GL_APIENTRY glDeleteTextures (GLsizei n, const GLuint *textures)
 	if(n <= 0)
 		return;
 
+	/* Queued draws might use the objects */
+	FGLContext *ctx = getGlThreadSpecific();
+	if (ctx)
+		fglFlushDrawQueue(ctx);
+
 	do {
 		name = *textures;
 		textures++;
@@ -184,363 +190,118 @@ static int fglGetFormatInfo(GLenum format, GLenum type, bool *conv)
 }
 
 /**
- * Scales source image by factor of two in both dimensions. (RGB565 variant)
- * @param dstData Destination image buffer.
- * @param srcData Source image buffer.
- * @param w Source image width (assumed to be greater or equal 2).
- * @param h Source image height (assumed to be greater or equal 2).
- */
-static void fglDownscaleBy2RGB565(void *dstData, const void *srcData,
-				  unsigned int w, unsigned int h)
-{
-	const uint16_t *src = (const uint16_t *)srcData;
-	uint16_t *dst = (uint16_t *)dstData;
-	const uint32_t mask = 0x07e0f81f;
-	unsigned int srcW = w;
-
-	w /= 2;
-	h /= 2;
-
-	if (!w || !h) {
-		/* 1D textures need special handling */
-		for (unsigned int x = 0; x < (w + h); ++x) {
-			uint32_t grb, rgb;
-			uint32_t p00 = src[2 * x];
-			uint32_t p10 = src[2 * x + 1];
-
-			p00 = (p00 | (p00 << 16)) & mask;
-			p10 = (p10 | (p10 << 16)) & mask;
-
-			grb = ((p00 + p10) >> 1) & mask;
-			rgb = (grb & 0xffff) | (grb >> 16);
-
-			dst[x] = rgb;
-		}
-
-		return;
-	}
-
-	for (unsigned int y = 0; y < h; ++y) {
-		for (unsigned int x = 0; x < w; ++x) {
-			uint32_t grb, rgb;
-			uint32_t p00 = src[2 * x];
-			uint32_t p10 = src[2 * x + 1];
-			uint32_t p01 = src[2 * x + srcW];
-			uint32_t p11 = src[2 * x + srcW + 1];
-
-			p00 = (p00 | (p00 << 16)) & mask;
-			p01 = (p01 | (p01 << 16)) & mask;
-			p10 = (p10 | (p10 << 16)) & mask;
-			p11 = (p11 | (p11 << 16)) & mask;
-
-			grb = ((p00 + p10 + p01 + p11) >> 2) & mask;
-			rgb = (grb & 0xffff) | (grb >> 16);
-
-			dst[x] = rgb;
-		}
-
-		src += 2 * srcW;
-		dst += w;
-	}
-}
-
-/**
- * Scales source image by factor of two in both dimensions. (RGBA5551 variant)
- * @param dstData Destination image buffer.
- * @param srcData Source image buffer.
- * @param w Source image width (assumed to be greater or equal 2).
- * @param h Source image height (assumed to be greater or equal 2).
- */
-static void fglDownscaleBy2RGBA5551(void *dstData, const void *srcData,
-				   unsigned int w, unsigned int h)
-{
-	const uint16_t *src = (const uint16_t *)srcData;
-	uint16_t *dst = (uint16_t *)dstData;
-	const uint32_t mask = 0xF83E07C1;
-	unsigned int srcW = w;
-
-	w /= 2;
-	h /= 2;
-
-	if (!w || !h) {
-		/* 1D textures need special handling */
-		for (unsigned int x = 0; x < (w + h); ++x) {
-			uint32_t grb, rgb;
-			uint32_t p00 = src[2 * x];
-			uint32_t p10 = src[2 * x + 1];
-
-			p00 = (p00 | (p00 << 16)) & mask;
-			p10 = (p10 | (p10 << 16)) & mask;
-
-			grb = ((p00 + p10) >> 1) & mask;
-			rgb = (grb & 0xffff) | (grb >> 16);
-
-			dst[x] = rgb;
-		}
-
-		return;
-	}
-
-	for (unsigned int y = 0; y < h; ++y) {
-		for (unsigned int x = 0; x < w; ++x) {
-			uint32_t grb, rgb;
-			uint32_t p00 = src[2 * x];
-			uint32_t p10 = src[2 * x + 1];
-			uint32_t p01 = src[2 * x + srcW];
-			uint32_t p11 = src[2 * x + srcW + 1];
-
-			p00 = (p00 | (p00 << 16)) & mask;
-			p01 = (p01 | (p01 << 16)) & mask;
-			p10 = (p10 | (p10 << 16)) & mask;
-			p11 = (p11 | (p11 << 16)) & mask;
-
-			grb = ((p00 + p10 + p01 + p11) >> 2) & mask;
-			rgb = (grb & 0xffff) | (grb >> 16);
-
-			dst[x] = rgb;
-		}
-
-		src += 2 * srcW;
-		dst += w;
-	}
-}
-
-/**
- * Scales source image by factor of two in both dimensions. (ARGB8888 variant)
- * @param dstData Destination image buffer.
- * @param srcData Source image buffer.
- * @param w Source image width (assumed to be greater or equal 2).
- * @param h Source image height (assumed to be greater or equal 2).
- */
-static void fglDownscaleBy2ARGB8888(void *dstData, const void *srcData,
-				    unsigned int w, unsigned int h)
-{
-	uint32_t const * src = (uint32_t const *)srcData;
-	uint32_t* dst = (uint32_t*)dstData;
-	unsigned int srcW = w;
-
-	w /= 2;
-	h /= 2;
-
-	if (!w || !h) {
-		/* 1D textures need special handling */
-		for (unsigned int x = 0; x < (w + h); ++x) {
-			uint32_t rgba;
-			uint32_t p00 = src[2 * x];
-			uint32_t p10 = src[2 * x + 1];
-			uint32_t rb00 = p00 & 0x00FF00FF;
-			uint32_t rb10 = p10 & 0x00FF00FF;
-			uint32_t ga00 = (p00 >> 8) & 0x00FF00FF;
-			uint32_t ga10 = (p10 >> 8) & 0x00FF00FF;
-			uint32_t rb = (rb00 + rb10) >> 1;
-			uint32_t ga = (ga00 + ga10) >> 1;
-
-			rgba = (rb & 0x00FF00FF) | ((ga & 0x00FF00FF) << 8);
-			dst[x] = rgba;
-		}
-
-		return;
-	}
-
-	for (unsigned int y = 0; y < h; ++y) {
-		for (unsigned int x = 0; x < w ; ++x) {
-			uint32_t rgba;
-			uint32_t p00 = src[2 * x];
-			uint32_t p10 = src[2 * x + 1];
-			uint32_t p01 = src[2 * x + srcW];
-			uint32_t p11 = src[2 * x + srcW + 1];
-			uint32_t rb00 = p00 & 0x00FF00FF;
-			uint32_t rb01 = p01 & 0x00FF00FF;
-			uint32_t rb10 = p10 & 0x00FF00FF;
-			uint32_t rb11 = p11 & 0x00FF00FF;
-			uint32_t ga00 = (p00 >> 8) & 0x00FF00FF;
-			uint32_t ga01 = (p01 >> 8) & 0x00FF00FF;
-			uint32_t ga10 = (p10 >> 8) & 0x00FF00FF;
-			uint32_t ga11 = (p11 >> 8) & 0x00FF00FF;
-			uint32_t rb = (rb00 + rb01 + rb10 + rb11) >> 2;
-			uint32_t ga = (ga00 + ga01 + ga10 + ga11) >> 2;
-
-			rgba = (rb & 0x00FF00FF) | ((ga & 0x00FF00FF) << 8);
-			dst[x] = rgba;
-		}
-
-		src += 2 * srcW;
-		dst += w;
-	}
-}
-
-/**
- * Scales source image by factor of two in both dimensions. (AL88 variant)
- * @param dstData Destination image buffer.
- * @param srcData Source image buffer.
- * @param w Source image width (assumed to be greater or equal 2).
- * @param h Source image height (assumed to be greater or equal 2).
+ * Scales region of mipmap level by factor of two in both dimensions.
+ * @param pixFormat Internal pixel format index.
+ * @param dstData Buffer of next mipmap level.
+ * @param srcData Buffer of current mipmap level.
+ * @param w Current level width (assumed to be greater or equal 2
+ * in at least one dimension).
+ * @param h Current level height.
+ * @param x0 Left edge of region in next level.
+ * @param y0 Top edge of region in next level.
+ * @param x1 Right edge (exclusive) of region in next level.
+ * @param y1 Bottom edge (exclusive) of region in next level.
+ * @return True on success, false if pixel format is not supported.
  */
-static void fglDownscaleBy2AL88(void *dstData, const void *srcData,
-				unsigned int w, unsigned int h)
+static bool fglDownscaleBy2(uint32_t pixFormat, void *dstData,
+				const void *srcData, unsigned int w,
+				unsigned int h, unsigned int x0, unsigned int y0,
+				unsigned int x1, unsigned int y1)
 {
-	uint8_t const * src = (uint8_t const *)srcData;
-	uint8_t* dst = (uint8_t*)dstData;
-	unsigned int srcW = w;
-
-	w /= 2;
-	h /= 2;
-
-	srcW *= 2;
-
-	if (!w || !h) {
-		/* 1D textures need special handling */
-		for (unsigned int x = 0; x < (w + h); ++x) {
-			uint32_t p00 = src[4 * x];
-			uint32_t p10 = src[4 * x + 2];
-
-			dst[2 * x] = (p00 + p10) >> 1;
-
-			p00 = src[1 + 4 * x];
-			p10 = src[1 + 4 * x + 2];
-
-			dst[2 * x + 1] = (p00 + p10) >> 1;
-		}
-
-		return;
+	uint32_t mask0 = 0, mask1 = 0;
+	unsigned int comps = 0;
+	unsigned int bpp;
+
+	switch (pixFormat) {
+	case FGL_PIXFMT_RGB565:
+		mask0 = 0xf81f;
+		mask1 = 0x07e0;
+		break;
+	case FGL_PIXFMT_RGBA5551:
+		mask0 = 0xf83e;
+		mask1 = 0x07c1;
+		break;
+	case FGL_PIXFMT_RGBA4444:
+		mask0 = 0xf0f0;
+		mask1 = 0x0f0f;
+		break;
+	case FGL_PIXFMT_XRGB8888:
+	case FGL_PIXFMT_ARGB8888:
+	case FGL_PIXFMT_XBGR8888:
+	case FGL_PIXFMT_ABGR8888:
+		comps = 4;
+		break;
+	case FGL_PIXFMT_AL88:
+		comps = 2;
+		break;
+	case FGL_PIXFMT_L8:
+		comps = 1;
+		break;
+	default:
+		return false;
 	}
 
-	for (unsigned int y = 0; y < h; ++y) {
-		for (unsigned int x = 0; x < w; ++x) {
-			uint32_t p00 = src[4 * x];
-			uint32_t p10 = src[4 * x + 2];
-			uint32_t p01 = src[4 * x + srcW];
-			uint32_t p11 = src[4 * x + srcW + 2];
-
-			dst[2 * x] = (p00 + p10 + p01 + p11) >> 2;
-
-			p00 = src[1 + 4 * x];
-			p10 = src[1 + 4 * x + 2];
-			p01 = src[1 + 4 * x + srcW];
-			p11 = src[1 + 4 * x + srcW + 2];
-
-			dst[2 * x + 1] = (p00 + p10 + p01 + p11) >> 2;
-		}
-
-		src += 2 * srcW;
-		dst += 2 * w;
-	}
-}
+	const uint8_t *src = (const uint8_t *)srcData;
+	uint8_t *dst = (uint8_t *)dstData;
+	unsigned int srcStride;
 
-/**
- * Scales source image by factor of two in both dimensions. (L8 variant)
- * @param dstData Destination image buffer.
- * @param srcData Source image buffer.
- * @param w Source image width (assumed to be greater or equal 2).
- * @param h Source image height (assumed to be greater or equal 2).
- */
-static void fglDownscaleBy2L8(void *dstData, const void *srcData,
-			      unsigned int w, unsigned int h)
-{
-	uint8_t const * src = (uint8_t const *)srcData;
-	uint8_t* dst = (uint8_t*)dstData;
-	unsigned int srcW = w;
+	bpp = FGLPixelFormat::get(pixFormat)->pixelSize;
+	srcStride = w * bpp;
 
 	w /= 2;
 	h /= 2;
 
 	if (!w || !h) {
 		/* 1D textures need special handling */
-		for (unsigned int x = 0; x < (w + h); ++x) {
-			uint32_t p00 = src[2 * x];
-			uint32_t p10 = src[2 * x + 1];
-
-			dst[x] = (p00 + p10) >> 1;
-		}
-
-		return;
-	}
-
-	for (unsigned int y = 0; y < h; ++y) {
-		for (unsigned int x = 0; x < w; ++x) {
-			uint32_t p00 = src[2 * x];
-			uint32_t p10 = src[2 * x + 1];
-			uint32_t p01 = src[2 * x + srcW];
-			uint32_t p11 = src[2 * x + srcW + 1];
-
-			dst[x] = (p00 + p10 + p01 + p11) >> 2;
+		if (!w) {
+			x0 = y0;
+			x1 = y1;
 		}
-
-		src += 2 * srcW;
-		dst += w;
+		y0 = 0;
+		y1 = 1;
+		w = 1;
+		srcStride = 0;
 	}
-}
-
-/**
- * Scales source image by factor of two in both dimensions. (RGBA4444 variant)
- * @param dstData Destination image buffer.
- * @param srcData Source image buffer.
- * @param w Source image width (assumed to be greater or equal 2).
- * @param h Source image height (assumed to be greater or equal 2).
- */
-static void fglDownscaleBy2RGBA4444(void *dstData, const void *srcData,
-				    unsigned int w, unsigned int h)
-{
-	uint16_t const * src = (uint16_t const *)srcData;
-	uint16_t* dst = (uint16_t*)dstData;
-	unsigned int srcW = w;
-
-	w /= 2;
-	h /= 2;
-
-	if (!w || !h) {
-		/* 1D textures need special handling */
-		for (unsigned int x = 0; x < (w + h); ++x) {
-			uint32_t rbga, rgba;
-			uint32_t p00 = src[2 * x];
-			uint32_t p10 = src[2 * x + 1];
-
-			p00 = ((p00 << 12) & 0x0F0F0000) | (p00 & 0x0F0F);
-			p10 = ((p10 << 12) & 0x0F0F0000) | (p10 & 0x0F0F);
 
-			rbga = (p00 + p10) >> 1;
-			rgba = (rbga & 0x0F0F) | ((rbga >> 12) & 0xF0F0);
+	dst += (y0 * w + x0) * bpp;
+	src += 2 * (y0 * srcStride + x0 * bpp);
 
-			dst[x] = rgba;
-		}
+	for (unsigned int y = y0; y < y1; ++y) {
+		if (comps)
+			fimgKernels->downscale8(dst, src, src + srcStride,
+							x1 - x0, comps);
+		else
+			fimgKernels->downscale16(dst, src, src + srcStride,
+							x1 - x0, mask0, mask1);
 
-		return;
+		src += 2 * srcStride;
+		dst += w * bpp;
 	}
 
-	for (unsigned int y = 0; y < h; ++y) {
-		for (unsigned int x = 0; x < w; ++x) {
-			uint32_t rbga, rgba;
-			uint32_t p00 = src[2 * x];
-			uint32_t p10 = src[2 * x + 1];
-			uint32_t p01 = src[2 * x + srcW];
-			uint32_t p11 = src[2 * x + srcW + 1];
-
-			p00 = ((p00 << 12) & 0x0F0F0000) | (p00 & 0x0F0F);
-			p10 = ((p10 << 12) & 0x0F0F0000) | (p10 & 0x0F0F);
-			p01 = ((p01 << 12) & 0x0F0F0000) | (p01 & 0x0F0F);
-			p11 = ((p11 << 12) & 0x0F0F0000) | (p11 & 0x0F0F);
-
-			rbga = (p00 + p10 + p01 + p11) >> 2;
-			rgba = (rbga & 0x0F0F) | ((rbga >> 12) & 0xF0F0);
-
-			dst[x] = rgba;
-		}
-
-		src += 2 * srcW;
-		dst += w;
-	}
+	return true;
 }
 
 /**
  * Generates mipmaps for given texture.
+ * Only the part of mipmap chain depending on given region of base level
+ * is updated.
  * @param obj Texture to generate mipmaps for.
+ * @param baseLevel Level to generate next levels from.
+ * @param x Left edge of modified region of base level.
+ * @param y Top edge of modified region of base level.
+ * @param width Width of modified region of base level.
+ * @param height Height of modified region of base level.
  */
-static void fglGenerateMipmaps(FGLTexture *obj, unsigned int baseLevel)
+static void fglGenerateMipmaps(FGLTexture *obj, unsigned int baseLevel,
+				unsigned int x, unsigned int y,
+				unsigned int width, unsigned int height)
 {
 	const FGLPixelFormat *pix = FGLPixelFormat::get(obj->pixFormat);
 	void *curLevel, *nextLevel;
 	unsigned int w = obj->width;
 	unsigned int h = obj->height;
+	unsigned int x1 = x + width;
+	unsigned int y1 = y + height;
 	unsigned int offset;
 
 	offset = fimgGetTexMipmapOffset(obj->fimg, baseLevel);
@@ -556,34 +317,21 @@ static void fglGenerateMipmaps(FGLTexture *obj, unsigned int baseLevel)
 		if (!h)
 			h = 1;
 
+		/* Region of next level affected by the change */
+		x /= 2;
+		y /= 2;
+		x1 = min((x1 + 1) / 2, max(w / 2, 1U));
+		y1 = min((y1 + 1) / 2, max(h / 2, 1U));
+		if (x >= x1 || y >= y1)
+			break;
+
 		offset = fimgGetTexMipmapOffset(obj->fimg, level + 1);
 		curLevel = nextLevel;
 		nextLevel = (uint8_t *)obj->surface->vaddr
 						+ pix->pixelSize*offset;
 
-		switch (obj->pixFormat) {
-		case FGL_PIXFMT_RGB565:
-			fglDownscaleBy2RGB565(nextLevel, curLevel, w, h);
-			break;
-		case FGL_PIXFMT_RGBA5551:
-			fglDownscaleBy2RGBA5551(nextLevel, curLevel, w, h);
-			break;
-		case FGL_PIXFMT_XRGB8888:
-		case FGL_PIXFMT_ARGB8888:
-		case FGL_PIXFMT_XBGR8888:
-		case FGL_PIXFMT_ABGR8888:
-			fglDownscaleBy2ARGB8888(nextLevel, curLevel, w, h);
-			break;
-		case FGL_PIXFMT_AL88:
-			fglDownscaleBy2AL88(nextLevel, curLevel, w, h);
-			break;
-		case FGL_PIXFMT_L8:
-			fglDownscaleBy2L8(nextLevel, curLevel, w, h);
-			break;
-		case FGL_PIXFMT_RGBA4444:
-			fglDownscaleBy2RGBA4444(nextLevel, curLevel, w, h);
-			break;
-		default:
+		if (!fglDownscaleBy2(obj->pixFormat, nextLevel, curLevel,
+							w, h, x, y, x1, y1)) {
 			LOGE("Unsupported format (%d)", obj->pixFormat);
 			return;
 		}
@@ -593,6 +341,47 @@ static void fglGenerateMipmaps(FGLTexture *obj, unsigned int baseLevel)
 	}
 }
 
+/**
+ * Calculates number of texels taken by mipmap level in texture memory.
+ * @param pixFormat Internal pixel format index.
+ * @param width Mipmap level width.
+ * @param height Mipmap level height.
+ * @return Number of texels.
+ */
+static inline size_t fglLevelTexels(uint32_t pixFormat,
+					unsigned int width, unsigned int height)
+{
+	switch (pixFormat) {
+	case FGL_PIXFMT_S3TC:
+		/* Made of whole 4x4 blocks */
+		return ((width + 3) & ~3) * ((height + 3) & ~3);
+	case FGL_PIXFMT_4BPP:
+		/* Must start at byte boundary */
+		return (width * height + 1) & ~1;
+	default:
+		return width * height;
+	}
+}
+
+/**
+ * Calculates size of texture data in memory.
+ * @param pixFormat Internal pixel format index.
+ * @param texels Number of texels.
+ * @return Size in bytes.
+ */
+static inline size_t fglTextureDataSize(uint32_t pixFormat, size_t texels)
+{
+	switch (pixFormat) {
+	case FGL_PIXFMT_S3TC:
+	case FGL_PIXFMT_4BPP:
+		return texels / 2;
+	case FGL_PIXFMT_8BPP:
+		return texels;
+	default:
+		return texels * FGLPixelFormat::get(pixFormat)->pixelSize;
+	}
+}
+
 /**
  * Calculates texture mipmap parameters and total size in memory.
  * @param obj Texture to process.
@@ -607,7 +396,7 @@ static size_t fglCalculateMipmaps(FGLTexture *obj, unsigned int width,
 	size_t offset, size;
 	unsigned int lvl, check;
 
-	size = width * height;
+	size = fglLevelTexels(obj->pixFormat, width, height);
 	offset = 0;
 	check = max(width, height);
 	lvl = 0;
@@ -631,13 +420,75 @@ static size_t fglCalculateMipmaps(FGLTexture *obj, unsigned int width,
 		if (height >= 2)
 			height /= 2;
 
-		size = width * height;
+		size = fglLevelTexels(obj->pixFormat, width, height);
 	} while (1);
 
 	obj->maxLevel = lvl;
 	return offset;
 }
 
+/**
+ * Allocates texture memory for new base level image.
+ * Current surface is reused if its size is close enough to requested one.
+ * @param obj Texture object.
+ * @param size Texture size in bytes.
+ * @return Zero on success, negative on failure.
+ */
+static int fglAllocateTexture(FGLTexture *obj, uint32_t size)
+{
+	if (obj->surface) {
+		int32_t delta = obj->surface->size - size;
+		if (delta < 0 || delta > 16384) {
+			delete obj->surface;
+			obj->surface = 0;
+		}
+	}
+
+	/* (Re)allocate the texture if needed */
+	if (!obj->surface) {
+		obj->surface = new FGLLocalSurface(size);
+		if(!obj->surface || !obj->surface->isValid()) {
+			delete obj->surface;
+			obj->surface = 0;
+			obj->width = 0;
+			obj->height = 0;
+			obj->format = 0;
+			obj->type = 0;
+			obj->pixFormat = 0;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Allocates texture memory for base level of compressed image
+ * and sets up hardware texture.
+ * @param obj Texture object with pixel format already set.
+ * @param width Width of base level.
+ * @param height Height of base level.
+ * @return Zero on success, negative on failure.
+ */
+static int fglSetupCompressedTexture(FGLTexture *obj,
+					unsigned width, unsigned height)
+{
+	const FGLPixelFormat *pix = FGLPixelFormat::get(obj->pixFormat);
+
+	/* Calculate mipmaps */
+	uint32_t size = fglTextureDataSize(obj->pixFormat,
+			fglCalculateMipmaps(obj, width, height, pix->pixelSize));
+
+	if (fglAllocateTexture(obj, size))
+		return -1;
+
+	fimgInitTexture(obj->fimg, pix->flags,
+					pix->texFormat, obj->surface->paddr);
+	fimgSetTex2DSize(obj->fimg, width, height, obj->maxLevel);
+
+	return 0;
+}
+
 /**
  * Copies texture image from client buffer to texture memory.
  * Direct copy (fastest) variant.
@@ -913,7 +764,8 @@ GL_API void GL_APIENTRY glTexImage2D (GLenum target, GLint level,
 			}
 
 			if (obj->genMipmap)
-				fglGenerateMipmaps(obj, level);
+				fglGenerateMipmaps(obj, level,
+							0, 0, width, height);
 
 			obj->dirty = true;
 		}
@@ -949,6 +801,7 @@ GL_API void GL_APIENTRY glTexImage2D (GLenum target, GLint level,
 	obj->type = type;
 	obj->pixFormat = pixFormat;
 	obj->convert = convert;
+	obj->compressed = false;
 	obj->mask = 0;
 	if (pix->pixFormat != (uint32_t)-1)
 		obj->mask = BIT_VAL(FGL_ATTACHMENT_COLOR);
@@ -963,28 +816,9 @@ GL_API void GL_APIENTRY glTexImage2D (GLenum target, GLint level,
 	uint32_t size = pix->pixelSize*fglCalculateMipmaps(obj,
 						width, height, pix->pixelSize);
 
-	if (obj->surface) {
-		int32_t delta = obj->surface->size - size;
-		if (delta < 0 || delta > 16384) {
-			delete obj->surface;
-			obj->surface = 0;
-		}
-	}
-
-	/* (Re)allocate the texture if needed */
-	if (!obj->surface) {
-		obj->surface = new FGLLocalSurface(size);
-		if(!obj->surface || !obj->surface->isValid()) {
-			delete obj->surface;
-			obj->surface = 0;
-			obj->width = 0;
-			obj->height = 0;
-			obj->format = 0;
-			obj->type = 0;
-			obj->pixFormat = 0;
-			setError(GL_OUT_OF_MEMORY);
-			return;
-		}
+	if (fglAllocateTexture(obj, size)) {
+		setError(GL_OUT_OF_MEMORY);
+		return;
 	}
 
 	fimgInitTexture(obj->fimg, pix->flags,
@@ -1005,7 +839,7 @@ GL_API void GL_APIENTRY glTexImage2D (GLenum target, GLint level,
 		}
 
 		if (obj->genMipmap)
-			fglGenerateMipmaps(obj, 0);
+			fglGenerateMipmaps(obj, 0, 0, 0, width, height);
 
 		obj->dirty = true;
 	}
@@ -1192,7 +1026,7 @@ GL_API void GL_APIENTRY glTexSubImage2D (GLenum target, GLint level,
 		return;
 	}
 
-	if (!obj->surface) {
+	if (!obj->surface || obj->compressed) {
 		setError(GL_INVALID_OPERATION);
 		return;
 	}
@@ -1246,23 +1080,605 @@ GL_API void GL_APIENTRY glTexSubImage2D (GLenum target, GLint level,
 			ctx->unpackAlignment, xoffset, yoffset, width, height);
 
 	if (obj->genMipmap)
-		fglGenerateMipmaps(obj, level);
+		fglGenerateMipmaps(obj, level, xoffset, yoffset, width, height);
 
 	obj->dirty = true;
 }
 
-GL_API void GL_APIENTRY glCompressedTexImage2D (GLenum target, GLint level,
-		GLenum internalformat, GLsizei width, GLsizei height,
-		GLint border, GLsizei imageSize, const GLvoid *data)
+/** Parameters of paletted formats (OES_compressed_paletted_texture). */
+struct FGLPaletteFormat {
+	/** Size of texel index in bits. */
+	unsigned int bits;
+	/** Size of palette entry in bytes. */
+	unsigned int entrySize;
+	/** Palette entry format for libfimg. */
+	unsigned int palFormat;
+};
+
+/** Paletted formats, in order of GLES enums starting at GL_PALETTE4_RGB8_OES. */
+static const FGLPaletteFormat fglPaletteFormats[] = {
+	{ 4, 3, FGTU_TSTA_PAL_TEX_FORMAT_8888 },	/* GL_PALETTE4_RGB8_OES */
+	{ 4, 4, FGTU_TSTA_PAL_TEX_FORMAT_8888 },	/* GL_PALETTE4_RGBA8_OES */
+	{ 4, 2, FGTU_TSTA_PAL_TEX_FORMAT_565 },		/* GL_PALETTE4_R5_G6_B5_OES */
+	{ 4, 2, FGTU_TSTA_PAL_TEX_FORMAT_4444 },	/* GL_PALETTE4_RGBA4_OES */
+	{ 4, 2, FGTU_TSTA_PAL_TEX_FORMAT_1555 },	/* GL_PALETTE4_RGB5_A1_OES */
+	{ 8, 3, FGTU_TSTA_PAL_TEX_FORMAT_8888 },	/* GL_PALETTE8_RGB8_OES */
+	{ 8, 4, FGTU_TSTA_PAL_TEX_FORMAT_8888 },	/* GL_PALETTE8_RGBA8_OES */
+	{ 8, 2, FGTU_TSTA_PAL_TEX_FORMAT_565 },		/* GL_PALETTE8_R5_G6_B5_OES */
+	{ 8, 2, FGTU_TSTA_PAL_TEX_FORMAT_4444 },	/* GL_PALETTE8_RGBA4_OES */
+	{ 8, 2, FGTU_TSTA_PAL_TEX_FORMAT_1555 },	/* GL_PALETTE8_RGB5_A1_OES */
+};
+
+/**
+ * Gets parameters of paletted format.
+ * @param format Compressed GLES format.
+ * @return Pointer to format parameters or NULL if not a paletted format.
+ */
+static inline const FGLPaletteFormat *fglGetPaletteFormat(GLenum format)
 {
-	FUNC_UNIMPLEMENTED;
+	if (format < GL_PALETTE4_RGB8_OES || format > GL_PALETTE8_RGB5_A1_OES)
+		return NULL;
+
+	return &fglPaletteFormats[format - GL_PALETTE4_RGB8_OES];
 }
 
-GL_API void GL_APIENTRY glCompressedTexSubImage2D (GLenum target, GLint level,
-		GLint xoffset, GLint yoffset, GLsizei width, GLsizei height,
-		GLenum format, GLsizei imageSize, const GLvoid *data)
+/**
+ * Determines format information for specified compressed GLES format.
+ * @param format Compressed GLES format.
+ * @param conv Pointer pointing where to store flag indicating whether this
+ * format needs to be decompressed.
+ * @return Internal pixel format index.
+ */
+static int fglGetCompressedFormatInfo(GLenum format, bool *conv)
 {
-	FUNC_UNIMPLEMENTED;
+	*conv = 0;
+	switch (format) {
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+		return FGL_PIXFMT_S3TC;
+	case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+		/* Not supported by the hardware, needs decompression */
+		*conv = 1;
+		return FGL_PIXFMT_ARGB8888;
+	case GL_ETC1_RGB8_OES:
+		/* Not supported by the hardware, decoded or transcoded */
+		*conv = 1;
+		return FGL_PIXFMT_RGB565;
+	case GL_PALETTE4_RGB8_OES:
+	case GL_PALETTE4_RGBA8_OES:
+	case GL_PALETTE4_R5_G6_B5_OES:
+	case GL_PALETTE4_RGBA4_OES:
+	case GL_PALETTE4_RGB5_A1_OES:
+		return FGL_PIXFMT_4BPP;
+	case GL_PALETTE8_RGB8_OES:
+	case GL_PALETTE8_RGBA8_OES:
+	case GL_PALETTE8_R5_G6_B5_OES:
+	case GL_PALETTE8_RGBA4_OES:
+	case GL_PALETTE8_RGB5_A1_OES:
+		return FGL_PIXFMT_8BPP;
+	default:
+		return -1;
+	}
+}
+
+/**
+ * Calculates size of compressed image.
+ * @param format Compressed GLES format.
+ * @param width Image width.
+ * @param height Image height.
+ * @param levels Number of mipmap levels included (paletted formats only).
+ * @return Size of image data in bytes.
+ */
+static size_t fglCompressedImageSize(GLenum format,
+			unsigned width, unsigned height, unsigned levels)
+{
+	const FGLPaletteFormat *pal = fglGetPaletteFormat(format);
+
+	if (pal) {
+		size_t size = pal->entrySize << pal->bits;
+
+		do {
+			size += (width*height*pal->bits + 7) / 8;
+			width = max(width / 2, 1U);
+			height = max(height / 2, 1U);
+		} while (--levels);
+
+		return size;
+	}
+
+	size_t blocks = ((width + 3) / 4) * ((height + 3) / 4);
+
+	switch (format) {
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+	case GL_ETC1_RGB8_OES:
+		return 8*blocks;
+	default:
+		return 16*blocks;
+	}
+}
+
+/**
+ * Expands RGB565 color of S3TC block into components.
+ * @param color Packed RGB565 color.
+ * @param rgb Array of 3 color components to fill.
+ */
+static inline void fglUnpackRGB565(uint16_t color, unsigned *rgb)
+{
+	unsigned r = (color >> 11) & 0x1f;
+	unsigned g = (color >> 5) & 0x3f;
+	unsigned b = color & 0x1f;
+
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+/**
+ * Decodes single DXT3 or DXT5 block into ARGB8888 pixels.
+ * @param dst Array of 16 pixels to fill.
+ * @param block Compressed block.
+ * @param format Compressed GLES format.
+ */
+static void fglDecodeS3TCBlock(uint32_t *dst, const uint8_t *block,
+								GLenum format)
+{
+	uint8_t alpha[16];
+
+	if (format == GL_COMPRESSED_RGBA_S3TC_DXT3_EXT) {
+		/* Explicit 4-bit alpha */
+		for (int i = 0; i < 16; ++i) {
+			unsigned a = (block[i / 2] >> (4 * (i & 1))) & 0xf;
+			alpha[i] = a | (a << 4);
+		}
+	} else {
+		/* Alpha interpolated from two endpoints */
+		unsigned a0 = block[0];
+		unsigned a1 = block[1];
+		uint8_t lut[8];
+
+		lut[0] = a0;
+		lut[1] = a1;
+		if (a0 > a1) {
+			for (int i = 1; i < 7; ++i)
+				lut[i + 1] = ((7 - i)*a0 + i*a1) / 7;
+		} else {
+			for (int i = 1; i < 5; ++i)
+				lut[i + 1] = ((5 - i)*a0 + i*a1) / 5;
+			lut[6] = 0;
+			lut[7] = 255;
+		}
+
+		uint64_t bits = 0;
+		for (int i = 0; i < 6; ++i)
+			bits |= (uint64_t)block[2 + i] << (8 * i);
+
+		for (int i = 0; i < 16; ++i)
+			alpha[i] = lut[(bits >> (3 * i)) & 7];
+	}
+
+	/* Color block always uses four color mode here */
+	const uint8_t *color = block + 8;
+	unsigned c[4][3];
+
+	fglUnpackRGB565(color[0] | (color[1] << 8), c[0]);
+	fglUnpackRGB565(color[2] | (color[3] << 8), c[1]);
+	for (int i = 0; i < 3; ++i) {
+		c[2][i] = (2*c[0][i] + c[1][i]) / 3;
+		c[3][i] = (c[0][i] + 2*c[1][i]) / 3;
+	}
+
+	uint32_t lookup = color[4] | (color[5] << 8)
+				| (color[6] << 16) | (color[7] << 24);
+
+	for (int i = 0; i < 16; ++i) {
+		const unsigned *rgb = c[(lookup >> (2 * i)) & 3];
+		dst[i] = fglPackARGB8888(rgb[0], rgb[1], rgb[2], alpha[i]);
+	}
+}
+
+/**
+ * Copies compressed texture image from client buffer to texture memory.
+ * Images in formats supported by the hardware are copied as they are,
+ * other formats are decompressed.
+ * @param obj Texture object.
+ * @param level Mipmap level.
+ * @param data Client buffer.
+ * @param x Left-most coordinate of the region (multiple of 4).
+ * @param y Bottom-most coordinate of the region (multiple of 4).
+ * @param w Width of the region.
+ * @param h Height of the region.
+ */
+static void fglLoadCompressedTexture(FGLTexture *obj, unsigned level,
+			const GLvoid *data, unsigned x, unsigned y,
+			unsigned w, unsigned h)
+{
+	unsigned offset = fimgGetTexMipmapOffset(obj->fimg, level);
+
+	unsigned width = obj->width >> level;
+	if (!width)
+		width = 1;
+
+	unsigned height = obj->height >> level;
+	if (!height)
+		height = 1;
+
+	const uint8_t *src8 = (const uint8_t *)data;
+	unsigned blocksW = (w + 3) / 4;
+	unsigned blocksH = (h + 3) / 4;
+
+	if (obj->format == GL_ETC1_RGB8_OES) {
+		/* Whole images only */
+		uint8_t *dst8 = (uint8_t *)obj->surface->vaddr
+				+ fglTextureDataSize(obj->pixFormat, offset);
+
+		if (obj->pixFormat == FGL_PIXFMT_S3TC)
+			fglTranscodeETC1(dst8, src8, width, height, 0);
+		else
+			fglDecodeETC1((uint16_t *)dst8, src8, width, height);
+
+		return;
+	}
+
+	if (!obj->convert) {
+		size_t stride = 8*((width + 3) / 4);
+		size_t line = 8*blocksW;
+		uint8_t *dst8 = (uint8_t *)obj->surface->vaddr
+				+ fglTextureDataSize(obj->pixFormat, offset)
+				+ (y / 4)*stride + 8*(x / 4);
+
+		do {
+			memcpy(dst8, src8, line);
+			src8 += line;
+			dst8 += stride;
+		} while (--blocksH);
+
+		return;
+	}
+
+	uint32_t *dst32 = (uint32_t *)obj->surface->vaddr + offset;
+	uint32_t pixels[16];
+
+	for (unsigned by = 0; by < blocksH; ++by) {
+		for (unsigned bx = 0; bx < blocksW; ++bx) {
+			fglDecodeS3TCBlock(pixels, src8, obj->format);
+			src8 += 16;
+
+			unsigned px = x + 4*bx;
+			unsigned py = y + 4*by;
+			unsigned bw = min(4U, width - px);
+			unsigned bh = min(4U, height - py);
+
+			for (unsigned j = 0; j < bh; ++j)
+				memcpy(dst32 + (py + j)*width + px,
+					pixels + 4*j, 4*bw);
+		}
+	}
+}
+
+/**
+ * Copies paletted texture image from client buffer to texture memory.
+ * Texel indices are copied as they are, except 4-bit ones, which GL packs
+ * with the first texel in the high nibble, while the hardware, as for all
+ * its formats, expects the first texel in the least significant bits.
+ * Palette is converted to format of the hardware and stored in libfimg
+ * texture object.
+ * @param obj Texture object.
+ * @param levels Number of mipmap levels included in the image.
+ * @param data Client buffer.
+ * @return Zero on success, negative on failure.
+ */
+static int fglLoadPalettedTexture(FGLTexture *obj, unsigned levels,
+							const GLvoid *data)
+{
+	const FGLPaletteFormat *pal = fglGetPaletteFormat(obj->format);
+	const uint8_t *src8 = (const uint8_t *)data;
+	unsigned count = 1 << pal->bits;
+	uint32_t palette[FGTU_MAX_PALETTE_SIZE];
+
+	for (unsigned i = 0; i < count; ++i) {
+		uint16_t color;
+
+		switch (pal->entrySize) {
+		case 3:
+			palette[i] = fglPackARGB8888(src8[0],
+						src8[1], src8[2], 255);
+			break;
+		case 4:
+			palette[i] = fglPackARGB8888(src8[0],
+						src8[1], src8[2], src8[3]);
+			break;
+		default:
+			memcpy(&color, src8, sizeof(color));
+			/* Alpha goes to most significant bits */
+			if (pal->palFormat == FGTU_TSTA_PAL_TEX_FORMAT_4444)
+				color = (color >> 4) | (color << 12);
+			else if (pal->palFormat == FGTU_TSTA_PAL_TEX_FORMAT_1555)
+				color = (color >> 1) | (color << 15);
+			palette[i] = color;
+		}
+
+		src8 += pal->entrySize;
+	}
+
+	if (fimgSetTexPalette(obj->fimg, pal->palFormat, palette, count))
+		return -1;
+
+	unsigned width = obj->width;
+	unsigned height = obj->height;
+
+	for (unsigned level = 0; level < levels; ++level) {
+		unsigned offset = fimgGetTexMipmapOffset(obj->fimg, level);
+		size_t size = (width*height*pal->bits + 7) / 8;
+
+		uint8_t *dst8 = (uint8_t *)obj->surface->vaddr
+				+ fglTextureDataSize(obj->pixFormat, offset);
+
+		if (pal->bits == 4) {
+			for (size_t i = 0; i < size; ++i)
+				dst8[i] = (src8[i] >> 4) | (src8[i] << 4);
+		} else {
+			memcpy(dst8, src8, size);
+		}
+
+		src8 += size;
+		width = max(width / 2, 1U);
+		height = max(height / 2, 1U);
+	}
+
+	return 0;
+}
+
+GL_API void GL_APIENTRY glCompressedTexImage2D (GLenum target, GLint level,
+		GLenum internalformat, GLsizei width, GLsizei height,
+		GLint border, GLsizei imageSize, const GLvoid *data)
+{
+	/* Check conditions required by specification */
+	if (target != GL_TEXTURE_2D) {
+		setError(GL_INVALID_ENUM);
+		return;
+	}
+
+	bool convert;
+	int pixFormat = fglGetCompressedFormatInfo(internalformat, &convert);
+	if (pixFormat < 0) {
+		setError(GL_INVALID_ENUM);
+		return;
+	}
+
+	if (width < 0 || height < 0) {
+		setError(GL_INVALID_VALUE);
+		return;
+	}
+
+	/*
+	 * Paletted images contain all their mipmap levels,
+	 * with level being negated index of the last one.
+	 */
+	bool paletted = !!fglGetPaletteFormat(internalformat);
+	unsigned levels = 1;
+
+	if (paletted) {
+		unsigned maxLevels = 1;
+		for (GLsizei check = max(width, height); check > 1; check /= 2)
+			++maxLevels;
+
+		levels = 1 - level;
+		if (level > 0 || levels > maxLevels) {
+			setError(GL_INVALID_VALUE);
+			return;
+		}
+
+		level = 0;
+	} else if (level < 0) {
+		setError(GL_INVALID_VALUE);
+		return;
+	}
+
+	if (border != 0) {
+		setError(GL_INVALID_VALUE);
+		return;
+	}
+
+	if ((size_t)imageSize != fglCompressedImageSize(internalformat,
+						width, height, levels)) {
+		setError(GL_INVALID_VALUE);
+		return;
+	}
+
+	FGLContext *ctx = getContext();
+	FGLTexture *obj = ctx->texture[ctx->activeTexture].getTexture();
+
+	/* Mipmap image specification */
+	if (level > 0) {
+		if (obj->eglImage) {
+			setError(GL_INVALID_OPERATION);
+			return;
+		}
+
+		GLint mipmapW, mipmapH;
+
+		mipmapW = obj->width >> level;
+		if (!mipmapW)
+			mipmapW = 1;
+
+		mipmapH = obj->height >> level;
+		if (!mipmapH)
+			mipmapH = 1;
+
+		if (!obj->surface || !obj->compressed) {
+			/* Mipmaps can be specified only if base level exists */
+			setError(GL_INVALID_OPERATION);
+			return;
+		}
+
+		/* Check dimensions */
+		if (level > obj->maxLevel
+		    || mipmapW != width || mipmapH != height) {
+			/* Invalid size */
+			setError(GL_INVALID_VALUE);
+			return;
+		}
+
+		/* Check format */
+		if (obj->format != internalformat) {
+			/* Must be the same format as base level */
+			setError(GL_INVALID_ENUM);
+			return;
+		}
+
+		if (data != NULL) {
+			fglWaitForTexture(ctx, obj);
+			fglLoadCompressedTexture(obj, level, data,
+							0, 0, width, height);
+			obj->dirty = true;
+		}
+
+		return;
+	}
+
+	/* Base image specification */
+#ifdef FGL_ETC1_TO_S3TC
+	/* Try to keep ETC1 images compressed, falling back to decoding */
+	int decodedFormat = pixFormat;
+	bool transcode = internalformat == GL_ETC1_RGB8_OES && data != NULL;
+	if (transcode)
+		pixFormat = FGL_PIXFMT_S3TC;
+#endif
+
+	fglWaitForTexture(ctx, obj);
+
+	if (obj->eglImage) {
+		obj->eglImage->disconnect();
+		obj->eglImage = 0;
+		obj->surface = 0;
+	}
+
+	if (width != obj->width || height != obj->height
+	    || (uint32_t)pixFormat != obj->pixFormat)
+		obj->markFramebufferDirty();
+
+	obj->invReady = false;
+	obj->width = width;
+	obj->height = height;
+	obj->format = internalformat;
+	obj->type = 0;
+	obj->pixFormat = pixFormat;
+	obj->convert = convert;
+	obj->compressed = true;
+	obj->mask = 0;
+
+	if (!width || !height) {
+		delete obj->surface;
+		obj->surface = 0;
+		return;
+	}
+
+	if (fglSetupCompressedTexture(obj, width, height)) {
+		setError(GL_OUT_OF_MEMORY);
+		return;
+	}
+
+	if (data == NULL)
+		return;
+
+#ifdef FGL_ETC1_TO_S3TC
+	if (transcode) {
+		if (fglTranscodeETC1((uint8_t *)obj->surface->vaddr,
+					(const uint8_t *)data, width, height,
+					FGL_ETC1_MAX_ERROR)) {
+			obj->dirty = true;
+			return;
+		}
+
+		/* Quality of S3TC is too low, decode the image instead */
+		obj->pixFormat = decodedFormat;
+		obj->markFramebufferDirty();
+		if (fglSetupCompressedTexture(obj, width, height)) {
+			setError(GL_OUT_OF_MEMORY);
+			return;
+		}
+	}
+#endif
+
+	if (paletted) {
+		if (fglLoadPalettedTexture(obj, levels, data)) {
+			setError(GL_OUT_OF_MEMORY);
+			return;
+		}
+	} else {
+		fglLoadCompressedTexture(obj, 0, data, 0, 0, width, height);
+	}
+
+	obj->dirty = true;
+}
+
+GL_API void GL_APIENTRY glCompressedTexSubImage2D (GLenum target, GLint level,
+		GLint xoffset, GLint yoffset, GLsizei width, GLsizei height,
+		GLenum format, GLsizei imageSize, const GLvoid *data)
+{
+	if (target != GL_TEXTURE_2D) {
+		setError(GL_INVALID_ENUM);
+		return;
+	}
+
+	FGLContext *ctx = getContext();
+	FGLTexture *obj = ctx->texture[ctx->activeTexture].getTexture();
+
+	/* Paletted and ETC1 images can not be modified */
+	if (!obj->surface || !obj->compressed || obj->format != format
+	    || fglGetPaletteFormat(format) || format == GL_ETC1_RGB8_OES) {
+		setError(GL_INVALID_OPERATION);
+		return;
+	}
+
+	if (level < 0 || level > obj->maxLevel) {
+		setError(GL_INVALID_VALUE);
+		return;
+	}
+
+	GLint mipmapW, mipmapH;
+
+	mipmapW = obj->width >> level;
+	if (!mipmapW)
+		mipmapW = 1;
+
+	mipmapH = obj->height >> level;
+	if (!mipmapH)
+		mipmapH = 1;
+
+	if (xoffset < 0 || yoffset < 0 || width < 0 || height < 0) {
+		setError(GL_INVALID_VALUE);
+		return;
+	}
+
+	if (xoffset + width > mipmapW || yoffset + height > mipmapH) {
+		setError(GL_INVALID_VALUE);
+		return;
+	}
+
+	/* Only whole blocks can be replaced */
+	if ((xoffset & 3) || (yoffset & 3)
+	    || ((width & 3) && xoffset + width != mipmapW)
+	    || ((height & 3) && yoffset + height != mipmapH)) {
+		setError(GL_INVALID_OPERATION);
+		return;
+	}
+
+	if ((size_t)imageSize != fglCompressedImageSize(format,
+							width, height, 1)) {
+		setError(GL_INVALID_VALUE);
+		return;
+	}
+
+	if (!data || !width || !height)
+		return;
+
+	fglWaitForTexture(ctx, obj);
+	fglLoadCompressedTexture(obj, level, data,
+					xoffset, yoffset, width, height);
+	obj->dirty = true;
 }
 
 GL_API void GL_APIENTRY glCopyTexImage2D (GLenum target, GLint level,
@@ -1317,6 +1733,7 @@ GL_API void GL_APIENTRY glEGLImageTargetTexture2DOES (GLenum target,
 	tex->type	= cfg->readType;
 	tex->pixFormat	= image->pixelFormat;
 	tex->convert	= 0;
+	tex->compressed	= 0;
 	tex->maxLevel	= 0;
 	tex->dirty	= true;
 	tex->width	= image->width;
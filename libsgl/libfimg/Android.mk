@@ -14,8 +14,13 @@ LOCAL_SRC_FILES := \
 	fragment.c \
 	global.c \
 	host.c \
+	kernels.c \
+	lock.c \
 	primitive.c \
 	raster.c \
+	shadercache.c \
+	stream.c \
+	swbackend.c \
 	system.c \
 	texture.c \
 	dump.c
@@ -25,6 +25,7 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <math.h>
 #include "fimg_private.h"
 #include "shaders/vert.h"
 #include "shaders/frag.h"
@@ -54,10 +55,30 @@
 #define FGPS_ATTRIB_NUM		(0x4c810)
 #define FGPS_IBSTATUS		(0x4c814)
 
+#define FGFP_CONST_ZERO		(0)
+#define FGFP_CONST_ONE		(1)
 #define FGFP_TEXENV(unit)	(4 + 2*(unit))
 #define FGFP_COMBSCALE(unit)	(5 + 2*(unit))
+#define FGFP_FOGCOLOR		(4 + 2*FIMG_NUM_TEXTURE_UNITS)
 
-#define MAX_INSTR		(64)
+#define MAX_INSTR		(FIMG_MAX_PS_INSTR)
+/* Lighting blocks of all light sources need more than MAX_INSTR */
+#define MAX_VS_INSTR		(FIMG_MAX_VS_INSTR)
+
+/* Vertex shader registers used to feed constant attributes */
+#define FGVS_ATTRIB_CONST(attrib)	(20 + (attrib))
+#define FGVS_ATTRIB_TEMP(attrib)	(16 + (attrib))
+
+/* Vertex shader constants used by lighting (see shaders/vert.asm) */
+#define FGVS_LIGHT_CONST		(29)
+#define FGVS_LIGHT_SOURCE_SIZE		(7)
+#define FGVS_LIGHT_SOURCE(light)	(33 + FGVS_LIGHT_SOURCE_SIZE*(light))
+#define FGVS_LIGHT_CONST_NUM		\
+	(FGVS_LIGHT_SOURCE(FIMG_NUM_LIGHTS) - FGVS_LIGHT_CONST)
+
+/* Vertex shader constants used by fog and clip planes */
+#define FGVS_FOG_CONST			FGVS_LIGHT_SOURCE(FIMG_NUM_LIGHTS)
+#define FGVS_CLIP_PLANE(plane)		(FGVS_FOG_CONST + 1 + (plane))
 
 typedef union {
 	uint32_t val;
@@ -196,63 +217,76 @@ typedef struct __attribute__ ((__packed__)) _fimgShaderInstruction {
 typedef struct opcodeInfo {
 	uint8_t type;
 	uint8_t srcCount;
+	uint8_t flags;
 } fimgOpcodeInfo;
 
+/* Each destination component depends only on the same source components */
+#define OP_FLAG_PER_COMPONENT	(1 << 0)
+/* Instruction has effects other than writing its destination register */
+#define OP_FLAG_SIDE_EFFECTS	(1 << 1)
+
 enum fimgOpcode {
-	OP_NOP = 0,
-	OP_MOV,
-	OP_MOVA,
-	OP_MOVC,
-	OP_ADD,
-	OP_MUL,
-	OP_MUL_LIT,
-	OP_DP3,
-	OP_DP4,
-	OP_DPH,
-	OP_DST,
-	OP_EXP,
-	OP_EXP_LIT,
-	OP_LOG,
-	OP_LOG_LIT,
-	OP_RCP,
-	OP_RSQ,
-	OP_DP2ADD,
-	OP_RSVD_13,
-	OP_MAX,
-	OP_MIN,
-	OP_SGE,
-	OP_SLT,
-	OP_SETP_EQ,
-	OP_SETP_GE,
-	OP_SETP_GT,
-	OP_SETP_NE,
-	OP_CMP,
-	OP_MAD,
-	OP_FRC,
-	OP_RSVD_1F,
-	OP_TEXLD,
-	OP_CUBEDIR,
-	OP_MAXCOMP,
-	OP_TEXLDC,
-	OP_RSVD_24,
-	OP_RSVD_25,
-	OP_RSVD_26,
-	OP_TEXKILL,
-	OP_MOVIPS,
-	OP_ADDI,
-	OP_B,
-	OP_BF,
-	OP_RSVD_32,
-	OP_RSVD_33,
-	OP_BP,
-	OP_BFP,
-	OP_BZP,
-	OP_RSVD_37,
-	OP_CALL,
-	OP_CALLNZ,
-	OP_RSVD_3A,
-	OP_RSVD_3B,
-	OP_RET
+	OP_NOP		= 0x00,
+	OP_MOV		= 0x01,
+	OP_MOVA		= 0x02,
+	OP_MOVC		= 0x03,
+	OP_ADD		= 0x04,
+	OP_RSVD_05	= 0x05,
+	OP_MUL		= 0x06,
+	OP_MUL_LIT	= 0x07,
+	OP_DP3		= 0x08,
+	OP_DP4		= 0x09,
+	OP_DPH		= 0x0a,
+	OP_DST		= 0x0b,
+	OP_EXP		= 0x0c,
+	OP_EXP_LIT	= 0x0d,
+	OP_LOG		= 0x0e,
+	OP_LOG_LIT	= 0x0f,
+	OP_RCP		= 0x10,
+	OP_RSQ		= 0x11,
+	OP_DP2ADD	= 0x12,
+	OP_RSVD_13	= 0x13,
+	OP_MAX		= 0x14,
+	OP_MIN		= 0x15,
+	OP_SGE		= 0x16,
+	OP_SLT		= 0x17,
+	OP_SETP_EQ	= 0x18,
+	OP_SETP_GE	= 0x19,
+	OP_SETP_GT	= 0x1a,
+	OP_SETP_NE	= 0x1b,
+	OP_CMP		= 0x1c,
+	OP_MAD		= 0x1d,
+	OP_FRC		= 0x1e,
+	OP_RSVD_1F	= 0x1f,
+	OP_TEXLD	= 0x20,
+	OP_CUBEDIR	= 0x21,
+	OP_MAXCOMP	= 0x22,
+	OP_TEXLDC	= 0x23,
+	OP_RSVD_24	= 0x24,
+	OP_RSVD_25	= 0x25,
+	OP_RSVD_26	= 0x26,
+	OP_TEXKILL	= 0x27,
+	OP_MOVIPS	= 0x28,
+	OP_ADDI		= 0x29,
+	OP_RSVD_2A	= 0x2a,
+	OP_RSVD_2B	= 0x2b,
+	OP_RSVD_2C	= 0x2c,
+	OP_RSVD_2D	= 0x2d,
+	OP_RSVD_2E	= 0x2e,
+	OP_RSVD_2F	= 0x2f,
+	OP_B		= 0x30,
+	OP_BF		= 0x31,
+	OP_RSVD_32	= 0x32,
+	OP_RSVD_33	= 0x33,
+	OP_BP		= 0x34,
+	OP_BFP		= 0x35,
+	OP_BZP		= 0x36,
+	OP_RSVD_37	= 0x37,
+	OP_CALL		= 0x38,
+	OP_CALLNZ	= 0x39,
+	OP_RSVD_3A	= 0x3a,
+	OP_RSVD_3B	= 0x3b,
+	OP_RET		= 0x3c
 };
 
 enum fimgOpcodeType {
@@ -264,13 +298,56 @@ enum fimgOpcodeType {
 
 static const struct shaderBlock vertexConstFloat = SHADER_BLOCK(vert_cfloat);
 static const struct shaderBlock vertexHeader = SHADER_BLOCK(vert_header);
+static const struct shaderBlock vertexColor = SHADER_BLOCK(vert_color);
 static const struct shaderBlock vertexFooter = SHADER_BLOCK(vert_footer);
+static const struct shaderBlock vertexEyePos = SHADER_BLOCK(vert_eyepos);
+static const struct shaderBlock screenHeader = SHADER_BLOCK(vert_screen_header);
+
+static const struct shaderBlock lightHeader = SHADER_BLOCK(vert_light_header);
+static const struct shaderBlock lightNormalize =
+					SHADER_BLOCK(vert_light_normalize);
+static const struct shaderBlock lightFooter[] = {
+	SHADER_BLOCK(vert_light_footer),
+	SHADER_BLOCK(vert_light_footer_cm)
+};
+
+/* Blocks written for light 0 and relocated for other lights */
+static const struct shaderBlock lightDirectional[] = {
+	SHADER_BLOCK(vert_light_dir),
+	SHADER_BLOCK(vert_light_dir_spec)
+};
+
+static const struct shaderBlock lightPoint[] = {
+	SHADER_BLOCK(vert_light_point),
+	SHADER_BLOCK(vert_light_atten),
+	SHADER_BLOCK(vert_light_spot),
+	SHADER_BLOCK(vert_light_point_end),
+	SHADER_BLOCK(vert_light_point_spec)
+};
 
 static const struct shaderBlock texcoordTransform[] = {
 	SHADER_BLOCK(vert_texture0),
 	SHADER_BLOCK(vert_texture1)
 };
 
+static const struct shaderBlock screenTexcoord[] = {
+	SHADER_BLOCK(vert_screen_texture0),
+	SHADER_BLOCK(vert_screen_texture1)
+};
+
+/* Indexed by fog mode - 1 */
+static const struct shaderBlock fogFactor[] = {
+	SHADER_BLOCK(vert_fog_linear),
+	SHADER_BLOCK(vert_fog_exp),
+	SHADER_BLOCK(vert_fog_exp2)
+};
+
+static const struct shaderBlock clipDistance[] = {
+	SHADER_BLOCK(vert_clip0),
+	SHADER_BLOCK(vert_clip1),
+	SHADER_BLOCK(vert_clip2)
+};
+
 static const struct shaderBlock pixelConstFloat = SHADER_BLOCK(frag_cfloat);
 static const struct shaderBlock pixelHeader = SHADER_BLOCK(frag_header);
 static const struct shaderBlock pixelFooter = SHADER_BLOCK(frag_footer);
@@ -360,6 +437,13 @@ static const struct shaderBlock combine_a = SHADER_BLOCK(frag_combine_a);
 static const struct shaderBlock combine_u = SHADER_BLOCK(frag_combine_uni);
 static const struct shaderBlock tex_swap = SHADER_BLOCK(frag_tex_swap);
 static const struct shaderBlock out_swap = SHADER_BLOCK(frag_out_swap);
+static const struct shaderBlock fogBlend = SHADER_BLOCK(frag_fog);
+
+static const struct shaderBlock clipKill[] = {
+	SHADER_BLOCK(frag_clip0),
+	SHADER_BLOCK(frag_clip1),
+	SHADER_BLOCK(frag_clip2)
+};
 
 #ifndef FIMG_BYPASS_SHADER_OPTIMIZER
 static fimgOpcodeInfo opcodeMap[64] = {
@@ -370,6 +454,7 @@ static fimgOpcodeInfo opcodeMap[64] = {
 	[OP_MOV] = {
 		.type		= OP_TYPE_MOVE,
 		.srcCount	= 1,
+		.flags		= OP_FLAG_PER_COMPONENT,
 	},
 	[OP_MOVA] = {
 		.type		= OP_TYPE_NORMAL,
@@ -382,10 +467,16 @@ static fimgOpcodeInfo opcodeMap[64] = {
 	[OP_ADD] = {
 		.type		= OP_TYPE_NORMAL,
 		.srcCount	= 2,
+		.flags		= OP_FLAG_PER_COMPONENT,
+	},
+	[OP_RSVD_05] = {
+		.type		= OP_TYPE_RESERVED,
+		.srcCount	= 0,
 	},
 	[OP_MUL] = {
 		.type		= OP_TYPE_NORMAL,
 		.srcCount	= 2,
+		.flags		= OP_FLAG_PER_COMPONENT,
 	},
 	[OP_MUL_LIT] = {
 		.type		= OP_TYPE_NORMAL,
@@ -442,18 +533,22 @@ static fimgOpcodeInfo opcodeMap[64] = {
 	[OP_MAX] = {
 		.type		= OP_TYPE_NORMAL,
 		.srcCount	= 2,
+		.flags		= OP_FLAG_PER_COMPONENT,
 	},
 	[OP_MIN] = {
 		.type		= OP_TYPE_NORMAL,
 		.srcCount	= 2,
+		.flags		= OP_FLAG_PER_COMPONENT,
 	},
 	[OP_SGE] = {
 		.type		= OP_TYPE_NORMAL,
 		.srcCount	= 2,
+		.flags		= OP_FLAG_PER_COMPONENT,
 	},
 	[OP_SLT] = {
 		.type		= OP_TYPE_NORMAL,
 		.srcCount	= 2,
+		.flags		= OP_FLAG_PER_COMPONENT,
 	},
 	[OP_SETP_EQ] = {
 		.type		= OP_TYPE_NORMAL,
@@ -474,14 +569,17 @@ static fimgOpcodeInfo opcodeMap[64] = {
 	[OP_CMP] = {
 		.type		= OP_TYPE_NORMAL,
 		.srcCount	= 3,
+		.flags		= OP_FLAG_PER_COMPONENT,
 	},
 	[OP_MAD] = {
 		.type		= OP_TYPE_NORMAL,
 		.srcCount	= 3,
+		.flags		= OP_FLAG_PER_COMPONENT,
 	},
 	[OP_FRC] = {
 		.type		= OP_TYPE_NORMAL,
 		.srcCount	= 1,
+		.flags		= OP_FLAG_PER_COMPONENT,
 	},
 	[OP_RSVD_1F] = {
 		.type		= OP_TYPE_RESERVED,
@@ -518,6 +616,7 @@ static fimgOpcodeInfo opcodeMap[64] = {
 	[OP_TEXKILL] = {
 		.type		= OP_TYPE_NORMAL,
 		.srcCount	= 1,
+		.flags		= OP_FLAG_SIDE_EFFECTS,
 	},
 	[OP_MOVIPS] = {
 		.type		= OP_TYPE_NORMAL,
@@ -527,6 +626,30 @@ static fimgOpcodeInfo opcodeMap[64] = {
 		.type		= OP_TYPE_NORMAL,
 		.srcCount	= 2,
 	},
+	[OP_RSVD_2A] = {
+		.type		= OP_TYPE_RESERVED,
+		.srcCount	= 0,
+	},
+	[OP_RSVD_2B] = {
+		.type		= OP_TYPE_RESERVED,
+		.srcCount	= 0,
+	},
+	[OP_RSVD_2C] = {
+		.type		= OP_TYPE_RESERVED,
+		.srcCount	= 0,
+	},
+	[OP_RSVD_2D] = {
+		.type		= OP_TYPE_RESERVED,
+		.srcCount	= 0,
+	},
+	[OP_RSVD_2E] = {
+		.type		= OP_TYPE_RESERVED,
+		.srcCount	= 0,
+	},
+	[OP_RSVD_2F] = {
+		.type		= OP_TYPE_RESERVED,
+		.srcCount	= 0,
+	},
 	[OP_B] = {
 		.type		= OP_TYPE_FLOW,
 		.srcCount	= 0,
@@ -677,7 +800,7 @@ static inline void setPixelShaderAttribCount(fimgContext *ctx, uint32_t count)
 {
 	fimgWrite(ctx, count, FGPS_ATTRIB_NUM);
 
-	while (fimgRead(ctx, FGPS_IBSTATUS) & 1);
+	fimgWaitForClear(ctx, FGPS_IBSTATUS, 1);
 }
 
 /**
@@ -704,21 +827,8 @@ static inline void setPixelShaderRange(fimgContext *ctx,
 static void loadPSConstFloat(fimgContext *ctx, const float *pfData,
 								uint32_t slot)
 {
-	const uint32_t *data = (const uint32_t *)pfData;
-	volatile uint32_t *reg = (volatile uint32_t *)(ctx->base
-						+ FGPS_CFLOAT_START + 16*slot);
-#if 0
-	asm ( 	"ldmia %0!, {r0-r3}"
-		"stmia %1!, {r0-r3}"
-		: "=r"(data), "=r"(reg)
-		: "0"(data), "1"(reg)
-		: "r0", "r1", "r2", "r3");
-#else
-	*(reg++) = *(data++);
-	*(reg++) = *(data++);
-	*(reg++) = *(data++);
-	*(reg++) = *(data++);
-#endif
+	fimgWriteBlock(ctx, (const uint32_t *)pfData,
+					FGPS_CFLOAT_START + 16*slot, 4);
 }
 
 /**
@@ -729,24 +839,8 @@ static void loadPSConstFloat(fimgContext *ctx, const float *pfData,
  */
 static void loadVSMatrix(fimgContext *ctx, const float *pfData, uint32_t slot)
 {
-	uint32_t i;
-	const uint32_t *data = (const uint32_t *)pfData;
-	volatile uint32_t *reg = (volatile uint32_t *)(ctx->base
-						+ FGVS_CFLOAT_START + 16*slot);
-	for (i = 0; i < 4; i++) {
-#if 0
-		asm ( 	"ldmia %0!, {r0-r3}"
-			"stmia %1!, {r0-r3}"
-			: "=r"(data), "=r"(reg)
-			: "0"(data), "1"(reg)
-			: "r0", "r1", "r2", "r3");
-#else
-		*(reg++) = *(data++);
-		*(reg++) = *(data++);
-		*(reg++) = *(data++);
-		*(reg++) = *(data++);
-#endif
-	}
+	fimgWriteBlock(ctx, (const uint32_t *)pfData,
+					FGVS_CFLOAT_START + 16*slot, 16);
 }
 
 /*
@@ -777,15 +871,520 @@ static inline uint8_t mergeSwizzle(uint8_t a, uint8_t b)
 
 	return swizzle;
 }
+
+/** Marker of instructions to be removed from optimized program. */
+#define INSTR_REMOVED		0xdeadc0de
+
+struct srcOperand {
+	uint8_t regnum;
+	uint8_t regtype;
+	uint8_t swizzle;
+	uint8_t modifier;
+	uint8_t ar;
+	uint8_t extnum;
+};
+
+/**
+ * Retrieves source operand of shader instruction.
+ * @param instr Shader instruction.
+ * @param src Index of source operand.
+ * @param op Structure to fill with operand description.
+ */
+static void getOperand(const fimgShaderInstruction *instr,
+				unsigned int src, struct srcOperand *op)
+{
+	op->extnum = 0;
+
+	switch (src) {
+	case 0:
+		op->regnum = instr->src0_regnum;
+		op->regtype = instr->src0_regtype;
+		op->swizzle = instr->src0_swizzle;
+		op->modifier = instr->src0_modifier;
+		op->ar = instr->src0_ar;
+		op->extnum = instr->src0_extnum;
+		break;
+	case 1:
+		op->regnum = instr->src1_regnum;
+		op->regtype = instr->src1_regtype;
+		op->swizzle = instr->src1_swizzle;
+		op->modifier = instr->src1_modifier;
+		op->ar = instr->src1_ar;
+		break;
+	default:
+		op->regnum = instr->src2_regnum;
+		op->regtype = instr->src2_regtype;
+		op->swizzle = instr->src2_swizzle;
+		op->modifier = instr->src2_modifier;
+		op->ar = instr->src2_ar;
+		break;
+	}
+}
+
+/**
+ * Replaces source operand of shader instruction.
+ * (Operands using relative addressing can be only stored in their
+ * original slots.)
+ * @param instr Shader instruction.
+ * @param src Index of source operand.
+ * @param op Operand description.
+ */
+static void setOperand(fimgShaderInstruction *instr,
+				unsigned int src, const struct srcOperand *op)
+{
+	switch (src) {
+	case 0:
+		instr->src0_regnum = op->regnum;
+		instr->src0_regtype = op->regtype;
+		instr->src0_swizzle = op->swizzle;
+		instr->src0_modifier = op->modifier;
+		instr->src0_ar = op->ar;
+		instr->src0_extnum = op->extnum;
+		break;
+	case 1:
+		instr->src1_regnum = op->regnum;
+		instr->src1_regtype = op->regtype;
+		instr->src1_swizzle = op->swizzle;
+		instr->src1_modifier = op->modifier;
+		instr->src1_ar = op->ar;
+		break;
+	default:
+		instr->src2_regnum = op->regnum;
+		instr->src2_regtype = op->regtype;
+		instr->src2_swizzle = op->swizzle;
+		instr->src2_modifier = op->modifier;
+		instr->src2_ar = op->ar;
+		break;
+	}
+}
+
+/**
+ * Checks whether source operand reads one of given constant registers.
+ * @param op Operand description.
+ * @param consts Mask of constant registers.
+ * @return Non-zero if the operand reads one of the registers unmodified.
+ */
+static inline int isConstOperand(const struct srcOperand *op, uint32_t consts)
+{
+	return op->regtype == REG_SRC_C && !op->modifier && !op->ar
+		&& !op->extnum && (consts & (1 << op->regnum));
+}
+
+/**
+ * Checks whether operand can be moved to another source slot.
+ * @param op Operand description.
+ * @return Non-zero if the operand can be moved.
+ */
+static inline int isMovableOperand(const struct srcOperand *op)
+{
+	return !op->ar && !op->extnum;
+}
+
+/**
+ * Simplifies arithmetic instruction with operands of known constant value.
+ * @param instr Shader instruction.
+ * @param ones Mask of constant registers containing 1.0 in all components.
+ * @param zeros Mask of constant registers containing 0.0 in all components.
+ * @return Non-zero if the instruction has been simplified.
+ */
+static int foldConstants(fimgShaderInstruction *instr,
+					uint32_t ones, uint32_t zeros)
+{
+	struct srcOperand op[3];
+
+	switch (instr->opcode) {
+	case OP_MAD:
+		getOperand(instr, 0, &op[0]);
+		getOperand(instr, 1, &op[1]);
+		getOperand(instr, 2, &op[2]);
+
+		/* a * b + 0 = a * b */
+		if (isConstOperand(&op[2], zeros)) {
+			instr->opcode = OP_MUL;
+			return 1;
+		}
+
+		/* a * 1 + c = a + c */
+		if (isConstOperand(&op[1], ones) && isMovableOperand(&op[2])) {
+			setOperand(instr, 1, &op[2]);
+			instr->opcode = OP_ADD;
+			return 1;
+		}
+
+		/* 1 * b + c = b + c */
+		if (isConstOperand(&op[0], ones) && isMovableOperand(&op[1])
+		    && isMovableOperand(&op[2])) {
+			setOperand(instr, 0, &op[1]);
+			setOperand(instr, 1, &op[2]);
+			instr->opcode = OP_ADD;
+			return 1;
+		}
+
+		return 0;
+	case OP_MUL:
+		getOperand(instr, 0, &op[0]);
+		getOperand(instr, 1, &op[1]);
+
+		/* a * 1 = a */
+		if (isConstOperand(&op[1], ones)) {
+			instr->opcode = OP_MOV;
+			return 1;
+		}
+
+		/* 1 * b = b */
+		if (isConstOperand(&op[0], ones) && isMovableOperand(&op[1])) {
+			setOperand(instr, 0, &op[1]);
+			instr->opcode = OP_MOV;
+			return 1;
+		}
+
+		return 0;
+	case OP_ADD:
+		getOperand(instr, 0, &op[0]);
+		getOperand(instr, 1, &op[1]);
+
+		/* a + 0 = a */
+		if (isConstOperand(&op[1], zeros)) {
+			instr->opcode = OP_MOV;
+			return 1;
+		}
+
+		/* 0 + b = b */
+		if (isConstOperand(&op[0], zeros) && isMovableOperand(&op[1])) {
+			setOperand(instr, 0, &op[1]);
+			instr->opcode = OP_MOV;
+			return 1;
+		}
+
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Calculates mask of source components selected by swizzle.
+ * @param swizzle Source swizzle.
+ * @param mask Mask of destination components.
+ * @return Mask of source components.
+ */
+static inline uint32_t swizzleMask(uint8_t swizzle, uint32_t mask)
+{
+	uint32_t comps = 0;
+
+	while (mask) {
+		if (mask & 1)
+			comps |= 1 << (swizzle & 3);
+		mask >>= 1;
+		swizzle >>= 2;
+	}
+
+	return comps;
+}
+
+/**
+ * Calculates mask of temporary register components read by instruction.
+ * @param instr Shader instruction.
+ * @param reg Index of temporary register.
+ * @return Mask of components read (all when using relative addressing).
+ */
+static uint32_t readMask(const fimgShaderInstruction *instr, uint32_t reg)
+{
+	const fimgOpcodeInfo *info = &opcodeMap[instr->opcode];
+	uint32_t destMask = 0xf;
+	uint32_t comps = 0;
+	struct srcOperand op;
+	unsigned int src;
+
+	if (info->flags & OP_FLAG_PER_COMPONENT)
+		destMask = instr->dest_mask;
+
+	for (src = 0; src < info->srcCount; ++src) {
+		getOperand(instr, src, &op);
+		if (op.regtype != REG_SRC_R)
+			continue;
+		if (op.ar)
+			return 0xf;
+		if (op.regnum == reg)
+			comps |= swizzleMask(op.swizzle, destMask);
+	}
+
+	return comps;
+}
+
+/**
+ * Checks whether instruction writes only to a temporary register.
+ * @param instr Shader instruction.
+ * @return Non-zero if the instruction can be removed when its result is unused.
+ */
+static inline int writesTemporary(const fimgShaderInstruction *instr)
+{
+	const fimgOpcodeInfo *info = &opcodeMap[instr->opcode];
+
+	return info->type > OP_TYPE_FLOW && !(info->flags & OP_FLAG_SIDE_EFFECTS)
+		&& instr->dest_regtype == REG_DST_R && !instr->dest_a;
+}
+
+/**
+ * Checks whether components of temporary register are read before being
+ * overwritten.
+ * @param instr First instruction to check.
+ * @param end Pointer to memory after last instruction of shader program.
+ * @param reg Index of temporary register.
+ * @param mask Mask of components to check.
+ * @return Non-zero if any of the components is read.
+ */
+static int isLive(const fimgShaderInstruction *instr,
+		const fimgShaderInstruction *end, uint32_t reg, uint32_t mask)
+{
+	for (; instr < end && mask; ++instr) {
+		if (instr->reserved == INSTR_REMOVED)
+			continue;
+		if (readMask(instr, reg) & mask)
+			return 1;
+		if (writesTemporary(instr) && instr->dest_regnum == reg)
+			mask &= ~instr->dest_mask;
+	}
+
+	/* Temporary registers are not preserved after program end */
+	return 0;
+}
+
+/**
+ * Checks whether shader program is a straight sequence of instructions.
+ * @param start Pointer to first instruction of shader program.
+ * @param end Pointer to memory after last instruction of shader program.
+ * @return Non-zero if the program contains no branches or calls.
+ */
+static int isStraightLine(const fimgShaderInstruction *start,
+					const fimgShaderInstruction *end)
+{
+	const fimgShaderInstruction *instr;
+
+	for (instr = start; instr < end; ++instr)
+		if (opcodeMap[instr->opcode].type == OP_TYPE_FLOW
+		    && instr->opcode != OP_RET)
+			return 0;
+
+	return 1;
+}
+
+/**
+ * Fuses multiplications with following additions of their results into
+ * multiply-add instructions.
+ * @param start Pointer to first instruction of shader program.
+ * @param end Pointer to memory after last instruction of shader program.
+ */
+static void fuseMultiplyAdd(fimgShaderInstruction *start,
+					fimgShaderInstruction *end)
+{
+	fimgShaderInstruction *mul;
+	fimgShaderInstruction *add;
+	struct srcOperand op[3];
+	struct srcOperand tmp;
+	uint32_t reg, mask, i;
+
+	for (mul = start; mul < end; ++mul) {
+		if (mul->reserved == INSTR_REMOVED || mul->opcode != OP_MUL
+		    || !writesTemporary(mul) || mul->dest_modifier)
+			continue;
+
+		getOperand(mul, 0, &op[0]);
+		getOperand(mul, 1, &op[1]);
+		if (!isMovableOperand(&op[0]) || !isMovableOperand(&op[1]))
+			continue;
+
+		/* Find first reader of the product, operands must stay intact */
+		reg = mul->dest_regnum;
+		for (add = mul + 1; add < end; ++add) {
+			if (add->reserved == INSTR_REMOVED)
+				continue;
+			if (readMask(add, reg))
+				break;
+			if (opcodeMap[add->opcode].type <= OP_TYPE_FLOW
+			    || add->dest_regtype != REG_DST_R)
+				continue;
+			if (add->dest_regnum == reg
+			    || (op[0].regtype == REG_SRC_R
+			    && add->dest_regnum == op[0].regnum)
+			    || (op[1].regtype == REG_SRC_R
+			    && add->dest_regnum == op[1].regnum))
+				break;
+		}
+
+		if (add == end || add->opcode != OP_ADD)
+			continue;
+
+		/* Product must be read once, unmodified, as one of operands */
+		getOperand(add, 0, &tmp);
+		getOperand(add, 1, &op[2]);
+		if (op[2].regtype == REG_SRC_R && op[2].regnum == reg) {
+			struct srcOperand swap = tmp;
+			tmp = op[2];
+			op[2] = swap;
+		}
+
+		if (tmp.regtype != REG_SRC_R || tmp.regnum != reg || tmp.modifier
+		    || tmp.ar || (op[2].regtype == REG_SRC_R && op[2].regnum == reg)
+		    || !isMovableOperand(&op[2]))
+			continue;
+
+		/* All read components must come from the multiplication */
+		if (swizzleMask(tmp.swizzle, add->dest_mask) & ~mul->dest_mask)
+			continue;
+
+		mask = mul->dest_mask;
+		if (add->dest_regtype == REG_DST_R && add->dest_regnum == reg)
+			mask &= ~add->dest_mask;
+		if (isLive(add + 1, end, reg, mask))
+			continue;
+
+		/* Hardware reads at most one register of each other bank */
+		for (i = 0; i < 3; ++i)
+			if (op[i].regtype != REG_SRC_R
+			    && (op[i].regtype == op[(i + 1) % 3].regtype
+			    || op[i].regtype == op[(i + 2) % 3].regtype))
+				break;
+		if (i < 3)
+			continue;
+
+		op[0].swizzle = mergeSwizzle(op[0].swizzle, tmp.swizzle);
+		op[1].swizzle = mergeSwizzle(op[1].swizzle, tmp.swizzle);
+
+		setOperand(add, 0, &op[0]);
+		setOperand(add, 1, &op[1]);
+		setOperand(add, 2, &op[2]);
+		add->opcode = OP_MAD;
+
+		mul->reserved = INSTR_REMOVED;
+	}
+}
+
+/**
+ * Makes instructions write their results directly to destinations of
+ * following moves of the results.
+ * @param start Pointer to first instruction of shader program.
+ * @param end Pointer to memory after last instruction of shader program.
+ */
+static void coalesceMoves(fimgShaderInstruction *start,
+					fimgShaderInstruction *end)
+{
+	fimgShaderInstruction *mov;
+	fimgShaderInstruction *prev;
+	uint32_t comp;
+
+	for (mov = start + 1; mov < end; ++mov) {
+		if (mov->reserved == INSTR_REMOVED || mov->opcode != OP_MOV
+		    || mov->src0_regtype != REG_SRC_R || mov->src0_modifier
+		    || mov->src0_ar || mov->dest_a)
+			continue;
+
+		/* Moved components must stay in place */
+		for (comp = 0; comp < 4; ++comp)
+			if ((mov->dest_mask & (1 << comp))
+			    && ((mov->src0_swizzle >> 2*comp) & 3) != comp)
+				break;
+		if (comp < 4)
+			continue;
+
+		prev = mov;
+		while (--prev > start && prev->reserved == INSTR_REMOVED)
+			continue;
+		if (prev->reserved == INSTR_REMOVED)
+			continue;
+
+		if (!writesTemporary(prev)
+		    || !(opcodeMap[prev->opcode].flags & OP_FLAG_PER_COMPONENT)
+		    || prev->dest_regnum != mov->src0_regnum
+		    || (mov->dest_mask & ~prev->dest_mask))
+			continue;
+
+		if (prev->dest_modifier && mov->dest_modifier
+		    && prev->dest_modifier != mov->dest_modifier)
+			continue;
+
+		if (isLive(mov + 1, end, prev->dest_regnum, prev->dest_mask))
+			continue;
+
+		prev->dest_regnum = mov->dest_regnum;
+		prev->dest_regtype = mov->dest_regtype;
+		prev->dest_mask = mov->dest_mask;
+		prev->dest_modifier |= mov->dest_modifier;
+
+		mov->reserved = INSTR_REMOVED;
+	}
+}
+
+/**
+ * Removes instructions writing temporary register components that are
+ * never read afterwards.
+ * @param start Pointer to first instruction of shader program.
+ * @param end Pointer to memory after last instruction of shader program.
+ */
+static void eliminateDeadCode(fimgShaderInstruction *start,
+					fimgShaderInstruction *end)
+{
+	fimgShaderInstruction *instr = end;
+	uint8_t live[32];
+	uint32_t reg;
+
+	/* Temporary registers are not preserved after program end */
+	memset(live, 0, sizeof(live));
+
+	while (instr-- > start) {
+		if (instr->reserved == INSTR_REMOVED)
+			continue;
+
+		if (writesTemporary(instr)) {
+			if (!(live[instr->dest_regnum] & instr->dest_mask)) {
+				instr->reserved = INSTR_REMOVED;
+				continue;
+			}
+			live[instr->dest_regnum] &= ~instr->dest_mask;
+		}
+
+		for (reg = 0; reg < 32; ++reg)
+			live[reg] |= readMask(instr, reg);
+	}
+}
+
+/**
+ * Removes instructions marked for removal and updates 3-source
+ * instruction flags of remaining ones.
+ * @param start Pointer to first instruction of shader program.
+ * @param end Pointer to memory after last instruction of shader program.
+ * @return Pointer to memory after last remaining instruction.
+ */
+static fimgShaderInstruction *removeInstructions(fimgShaderInstruction *start,
+						fimgShaderInstruction *end)
+{
+	fimgShaderInstruction *instrPtr = start;
+	fimgShaderInstruction *instr;
+
+	for (instr = start; instr < end; ++instr) {
+		if (instr->reserved == INSTR_REMOVED)
+			continue;
+		*instrPtr = *instr;
+		instrPtr->next_3src = 0;
+		if (opcodeMap[instr->opcode].srcCount == 3 && instrPtr > start)
+			(instrPtr - 1)->next_3src = 1;
+		++instrPtr;
+	}
+
+	return instrPtr;
+}
 #endif
 
 /**
  * Performs low level optimization of shader program.
  * @param start Pointer to first instruction of shader program.
  * @param end Pointer to memory after last instruction of shader program.
+ * @param ones Mask of constant registers containing 1.0 in all components.
+ * @param zeros Mask of constant registers containing 0.0 in all components.
  * @return Number of instructions in optimized shader program.
  */
-static uint32_t optimizeShader(uint32_t *start, uint32_t *end)
+static uint32_t optimizeShader(uint32_t *start, uint32_t *end,
+					uint32_t ones, uint32_t zeros)
 {
 #ifdef FIMG_BYPASS_SHADER_OPTIMIZER
 	return (end - start) / 4;
@@ -796,13 +1395,12 @@ static uint32_t optimizeShader(uint32_t *start, uint32_t *end)
 	fimgShaderInstruction *instrStart = (fimgShaderInstruction *)start;
 	fimgShaderInstruction *instrEnd = (fimgShaderInstruction *)end;
 	fimgShaderInstruction *instr;
-	fimgShaderInstruction *instrPtr;
 
 	/* State initialization */
 	memset(deps, 0, sizeof(deps));
 	memset(map, 0, sizeof(map));
 
-	/* Optimization pass */
+	/* Copy propagation pass */
 	for (instr = instrStart; instr < instrEnd; ++instr) {
 		fimgOpcodeInfo *info = &opcodeMap[instr->opcode];
 		uint32_t depMask;
@@ -937,6 +1535,10 @@ static uint32_t optimizeShader(uint32_t *start, uint32_t *end)
 			break;
 		}
 
+		/* Propagated constants might make the instruction simpler */
+		while (foldConstants(instr, ones, zeros))
+			info = &opcodeMap[instr->opcode];
+
 		if (info->type <= OP_TYPE_FLOW || instr->dest_regtype != REG_DST_R)
 			continue;
 
@@ -944,8 +1546,9 @@ static uint32_t optimizeShader(uint32_t *start, uint32_t *end)
 			fimgShaderInstruction *mov =
 				instrStart + map[instr->dest_regnum].movInstr;
 
-			/* Instructions with non-zero here will be removed */
-			mov->reserved = 0xdeadc0de;
+			/* Partial write leaves components set by the mov */
+			if (instr->dest_mask == 0xf)
+				mov->reserved = INSTR_REMOVED;
 
 			if (map[instr->dest_regnum].srcRegType == REG_SRC_R)
 				deps[map[instr->dest_regnum].srcRegNum] &= ~(1 << instr->dest_regnum);
@@ -985,20 +1588,19 @@ static uint32_t optimizeShader(uint32_t *start, uint32_t *end)
 		if (!map[reg].flags)
 			continue;
 		fimgShaderInstruction *mov = instrStart + map[reg].movInstr;
-		mov->reserved = 0xdeadc0de;
+		mov->reserved = INSTR_REMOVED;
 	}
-
-	/* Done, remove unused instructions and return */
-	instrPtr = instrStart;
-	for (instr = instrStart; instr < instrEnd; ++instr) {
-		if (instr->reserved == 0xdeadc0de)
-			continue;
-		if (opcodeMap[instr->opcode].srcCount == 3)
-			(instr - 1)->next_3src = 1;
-		*(instrPtr++) = *instr;
+	instrEnd = removeInstructions(instrStart, instrEnd);
+
+	/* Passes below need to know all possible paths through the program */
+	if (isStraightLine(instrStart, instrEnd)) {
+		fuseMultiplyAdd(instrStart, instrEnd);
+		coalesceMoves(instrStart, instrEnd);
+		eliminateDeadCode(instrStart, instrEnd);
+		instrEnd = removeInstructions(instrStart, instrEnd);
 	}
 
-	return instrPtr - instrStart;
+	return instrEnd - instrStart;
 #endif /* FIMG_BYPASS_SHADER_OPTIMIZER */
 }
 
@@ -1007,53 +1609,344 @@ static uint32_t optimizeShader(uint32_t *start, uint32_t *end)
  */
 
 /**
- * Calculates pointer to selected slot of selected shader cache buffer.
- * @param buf Shader cache buffer.
- * @param slot Index of program slot.
- * @return Pointer to selected slot.
+ * Remaps single source operand reading vertex shader input.
+ * @param mask Mask of inputs fed from vertex arrays.
+ * @param type Register type of the operand.
+ * @param num Register number of the operand.
+ * @param temp Non-zero if constant must be read through temporary register.
+ * @param temps Mask of constant inputs read through temporary registers.
  */
-static inline uint32_t *shaderSlotAddr(uint32_t *buf, uint32_t slot)
+static inline void remapVertexInput(uint32_t mask, uint32_t *type,
+				uint32_t *num, int temp, uint32_t *temps)
 {
-	return buf
-		+ slot*MAX_INSTR*sizeof(fimgShaderInstruction)/sizeof(uint32_t);
+	uint32_t attrib = *num;
+
+	if (*type != REG_SRC_V)
+		return;
+
+	if (mask & (1 << attrib)) {
+		/* Arrays are packed in order of attribute indices */
+		*num = 0;
+		while (attrib--)
+			*num += (mask >> attrib) & 1;
+		return;
+	}
+
+	if (temp) {
+		*type = REG_SRC_R;
+		*num = FGVS_ATTRIB_TEMP(attrib);
+		*temps |= 1 << attrib;
+		return;
+	}
+
+	*type = REG_SRC_C;
+	*num = FGVS_ATTRIB_CONST(attrib);
 }
 
 /**
- * Builds vertex shader program according to current pipeline configuration
- * and stores it in selected slot of vertex shader cache.
- * @param ctx Hardware context.
- * @param slot Slot index.
+ * Checks if source operand will read a constant register after remapping.
+ * @param mask Mask of inputs fed from vertex arrays.
+ * @param type Register type of the operand.
+ * @param num Register number of the operand.
+ * @return 1 if the operand reads a constant, 0 otherwise.
  */
-static void buildVertexShader(fimgContext *ctx, uint32_t slot)
+static inline int isConstInput(uint32_t mask, uint32_t type, uint32_t num)
 {
-	uint32_t unit;
-	uint32_t *addr;
-	uint32_t *start;
+	if (type == REG_SRC_C)
+		return 1;
 
-	if (!ctx->compat.vshaderBuf) {
-		ctx->compat.vshaderBuf = malloc(VS_CACHE_SIZE * MAX_INSTR * sizeof(fimgShaderInstruction));
-		if (!ctx->compat.vshaderBuf) {
-			LOGE("Failed to allocate memory for shader buffer, terminating.");
-			exit(1);
+	return type == REG_SRC_V && !(mask & (1 << num));
+}
+
+/**
+ * Remaps vertex shader inputs to attributes actually sent by host interface.
+ * Inputs fed from vertex arrays are renumbered to consecutive input
+ * registers, while the remaining ones are read from constant registers.
+ * As an instruction can not read two different constant registers, such
+ * constants are copied to temporary registers at the beginning of the
+ * program.
+ * @param start Pointer to first instruction of shader program.
+ * @param end Pointer to memory after last instruction of shader program.
+ * @param mask Mask of inputs fed from vertex arrays.
+ * @return Pointer to memory after last instruction of remapped program.
+ */
+static uint32_t *remapVertexInputs(uint32_t *start, uint32_t *end,
+								uint32_t mask)
+{
+	fimgShaderInstruction *instrStart = (fimgShaderInstruction *)start;
+	fimgShaderInstruction *instrEnd = (fimgShaderInstruction *)end;
+	fimgShaderInstruction *instr;
+	uint32_t temps = 0;
+	uint32_t attrib;
+	uint32_t count;
+
+	for (instr = instrStart; instr < instrEnd; ++instr) {
+		uint32_t type, num;
+		int temp;
+
+		temp = isConstInput(mask, instr->src0_regtype, instr->src0_regnum)
+			+ isConstInput(mask, instr->src1_regtype, instr->src1_regnum)
+			+ isConstInput(mask, instr->src2_regtype, instr->src2_regnum)
+			> 1;
+
+		type = instr->src0_regtype;
+		num = instr->src0_regnum;
+		remapVertexInput(mask, &type, &num, temp, &temps);
+		instr->src0_regtype = type;
+		instr->src0_regnum = num;
+
+		type = instr->src1_regtype;
+		num = instr->src1_regnum;
+		remapVertexInput(mask, &type, &num, temp, &temps);
+		instr->src1_regtype = type;
+		instr->src1_regnum = num;
+
+		type = instr->src2_regtype;
+		num = instr->src2_regnum;
+		remapVertexInput(mask, &type, &num, temp, &temps);
+		instr->src2_regtype = type;
+		instr->src2_regnum = num;
+	}
+
+	if (!temps)
+		return end;
+
+	count = 0;
+	for (attrib = 0; attrib < FIMG_ATTRIB_NUM; ++attrib)
+		count += (temps >> attrib) & 1;
+
+	memmove(instrStart + count, instrStart,
+				(instrEnd - instrStart) * sizeof(*instr));
+
+	instr = instrStart;
+	for (attrib = 0; attrib < FIMG_ATTRIB_NUM; ++attrib) {
+		if (!(temps & (1 << attrib)))
+			continue;
+
+		memset(instr, 0, sizeof(*instr));
+		instr->opcode = OP_MOV;
+		instr->dest_regtype = REG_DST_R;
+		instr->dest_regnum = FGVS_ATTRIB_TEMP(attrib);
+		instr->dest_mask = 0xf;
+		instr->src0_regtype = REG_SRC_C;
+		instr->src0_regnum = FGVS_ATTRIB_CONST(attrib);
+		instr->src0_swizzle = SWIZZLE(0, 1, 2, 3);
+		++instr;
+	}
+
+	return (uint32_t *)(instrEnd + count);
+}
+
+/**
+ * Loads shader block written for light 0, relocating light source constants
+ * to the ones of selected light. Light source constants are read only
+ * through first source operand, which can address all constant registers.
+ * @param blk Shader block.
+ * @param addr Destination address.
+ * @param light Index of light source.
+ * @return Number of words written.
+ */
+static uint32_t loadLightBlock(const struct shaderBlock *blk,
+					uint32_t *addr, uint32_t light)
+{
+	fimgShaderInstruction *instr = (fimgShaderInstruction *)addr;
+	uint32_t len = loadShaderBlock(blk, addr);
+	uint32_t i, num;
+
+	for (i = 0; i < blk->len; ++i, ++instr) {
+		if (instr->src0_regtype != REG_SRC_C)
+			continue;
+
+		num = instr->src0_regnum | (instr->src0_extnum << 5);
+		if (num < FGVS_LIGHT_SOURCE(0) || num >= FGVS_LIGHT_SOURCE(1))
+			continue;
+
+		num += FGVS_LIGHT_SOURCE(light) - FGVS_LIGHT_SOURCE(0);
+		instr->src0_regnum = num & 0x1f;
+		instr->src0_extnum = num >> 5;
+	}
+
+	return len;
+}
+
+/**
+ * Checks whether generated vertex shader needs eye space vertex position.
+ * @param key Vertex shader program key.
+ * @return Non-zero if eye space position is needed, otherwise zero.
+ */
+static int needsEyePosition(const uint32_t *key)
+{
+	uint32_t light;
+
+	if (FGFP_BITFIELD_GET(key[0], VS_FOG))
+		return 1;
+
+	if (key[0] & FGFP_VS_CLIP_EN_ALL_MASK)
+		return 1;
+
+	if (!FGFP_BITFIELD_GET(key[0], VS_LIGHTING))
+		return 0;
+
+	for (light = 0; light < FIMG_NUM_LIGHTS; ++light)
+		if (FGFP_BITFIELD_GET_IDX(key[1], LIGHT_TYPE, light)
+							>= FGFP_LIGHT_POINT)
+			return 1;
+
+	return 0;
+}
+
+/**
+ * Generates lighting code specialized for enabled light sources.
+ * Eye space vertex position must be already computed if any point
+ * light source is enabled.
+ * @param addr Destination address.
+ * @param vs Vertex shader state word of program key.
+ * @param lights Light source state word of program key.
+ * @return Pointer to memory after generated code.
+ */
+static uint32_t *buildLighting(uint32_t *addr, uint32_t vs, uint32_t lights)
+{
+	uint32_t light, type;
+
+	addr += loadShaderBlock(&lightHeader, addr);
+
+	if (FGFP_BITFIELD_GET(vs, VS_NORMALIZE))
+		addr += loadShaderBlock(&lightNormalize, addr);
+
+	for (light = 0; light < FIMG_NUM_LIGHTS; ++light) {
+		type = FGFP_BITFIELD_GET_IDX(lights, LIGHT_TYPE, light);
+
+		switch (type) {
+		case FGFP_LIGHT_NONE:
+			continue;
+		case FGFP_LIGHT_DIRECTIONAL:
+			addr += loadLightBlock(&lightDirectional[0], addr, light);
+			if (FGFP_BITFIELD_GET_IDX(lights, LIGHT_SPEC, light))
+				addr += loadLightBlock(&lightDirectional[1],
+								addr, light);
+			continue;
 		}
+
+		addr += loadLightBlock(&lightPoint[0], addr, light);
+		if (FGFP_BITFIELD_GET_IDX(lights, LIGHT_ATTEN, light))
+			addr += loadLightBlock(&lightPoint[1], addr, light);
+		if (type == FGFP_LIGHT_SPOT)
+			addr += loadLightBlock(&lightPoint[2], addr, light);
+		addr += loadShaderBlock(&lightPoint[3], addr);
+		if (FGFP_BITFIELD_GET_IDX(lights, LIGHT_SPEC, light))
+			addr += loadLightBlock(&lightPoint[4], addr, light);
 	}
-	start = addr = shaderSlotAddr(ctx->compat.vshaderBuf, slot);
+
+	addr += loadShaderBlock(
+		&lightFooter[FGFP_BITFIELD_GET(vs, VS_COLOR_MATERIAL)], addr);
+
+	return addr;
+}
+
+/**
+ * Generates code transforming vertices given in object coordinates.
+ * @param addr Destination address.
+ * @param key Vertex shader program key.
+ * @return Pointer to memory after generated code.
+ */
+static uint32_t *buildTransformed(uint32_t *addr, const uint32_t *key)
+{
+	uint32_t unit, plane, fog;
 
 	addr += loadShaderBlock(&vertexHeader, addr);
 
+	if (needsEyePosition(key))
+		addr += loadShaderBlock(&vertexEyePos, addr);
+
+	if (FGFP_BITFIELD_GET(key[0], VS_LIGHTING))
+		addr = buildLighting(addr, key[0], key[1]);
+	else
+		addr += loadShaderBlock(&vertexColor, addr);
+
 	for (unit = 0; unit < FIMG_NUM_TEXTURE_UNITS; unit++) {
-		if (!FGFP_BITFIELD_GET_IDX(ctx->compat.vsState.vs, VS_TEX_EN, unit))
+		if (!FGFP_BITFIELD_GET_IDX(key[0], VS_TEX_EN, unit))
 			continue;
 
 		addr += loadShaderBlock(&texcoordTransform[unit], addr);
 	}
 
+	fog = FGFP_BITFIELD_GET(key[0], VS_FOG);
+	if (fog != FGFP_FOG_NONE)
+		addr += loadShaderBlock(&fogFactor[fog - 1], addr);
+
+	for (plane = 0; plane < FIMG_NUM_CLIP_PLANES; ++plane)
+		if (FGFP_BITFIELD_GET_IDX(key[0], VS_CLIP_EN, plane))
+			addr += loadShaderBlock(&clipDistance[plane], addr);
+
+	return addr;
+}
+
+/**
+ * Generates code passing through vertices given in window coordinates.
+ * @param addr Destination address.
+ * @param vs Vertex shader state word of program key.
+ * @return Pointer to memory after generated code.
+ */
+static uint32_t *buildScreenSpace(uint32_t *addr, uint32_t vs)
+{
+	uint32_t unit;
+
+	addr += loadShaderBlock(&screenHeader, addr);
+
+	for (unit = 0; unit < FIMG_NUM_TEXTURE_UNITS; unit++) {
+		if (!FGFP_BITFIELD_GET_IDX(vs, VS_TEX_EN, unit))
+			continue;
+
+		addr += loadShaderBlock(&screenTexcoord[unit], addr);
+	}
+
+	return addr;
+}
+
+/**
+ * Builds vertex shader program according to current pipeline configuration
+ * and stores it in vertex shader cache.
+ * @param ctx Hardware context.
+ * @param key Vertex shader program key.
+ * @return Pointer to cached program.
+ */
+static fimgShaderProgram *buildVertexShader(fimgContext *ctx,
+							const uint32_t *key)
+{
+	fimgShaderProgram *prog;
+	uint32_t *addr;
+	uint32_t *start;
+
+	if (!ctx->compat.vshaderBuf) {
+		ctx->compat.vshaderBuf = malloc(MAX_VS_INSTR * sizeof(fimgShaderInstruction));
+		if (!ctx->compat.vshaderBuf) {
+			LOGE("Failed to allocate memory for shader buffer, terminating.");
+			exit(1);
+		}
+	}
+	start = addr = ctx->compat.vshaderBuf;
+
+	if (FGFP_BITFIELD_GET(key[0], VS_SCREEN_SPACE))
+		addr = buildScreenSpace(addr, key[0]);
+	else
+		addr = buildTransformed(addr, key);
+
 	addr += loadShaderBlock(&vertexFooter, addr);
 
-	FGFP_BITFIELD_SET(ctx->compat.vsState.vs, VS_INVALID, 0);
+	addr = remapVertexInputs(start, addr,
+			FGFP_BITFIELD_GET(ctx->compat.vsState.vs, VS_ATTRIB_EN));
+
+	ctx->compat.vsCache.stats.builtInstr += (addr - start) / 4;
+	ctx->compat.vsCache.stats.optimizedInstr += (addr - start) / 4;
+
+	prog = fimgShaderCacheInsert(&ctx->compat.vsCache, key,
+						start, (addr - start) / 4);
+	if (!prog) {
+		LOGE("Failed to allocate memory for shader program, terminating.");
+		exit(1);
+	}
 
-	ctx->compat.vertexShaders[slot].instrCount = (addr - start) / 4;
-	ctx->compat.vertexShaders[slot].state = ctx->compat.vsState;
+	return prog;
 }
 
 /**
@@ -1062,58 +1955,58 @@ static void buildVertexShader(fimgContext *ctx, uint32_t slot)
  */
 static void loadVertexShader(fimgContext *ctx)
 {
-	volatile uint32_t *reg;
-	struct shaderBlock blk;
-	uint32_t slot = ctx->compat.curVsNum;
-	struct fimgVertexShaderProgram *vs = &ctx->compat.vertexShaders[slot];
+	fimgShaderCache *cache = &ctx->compat.vsCache;
+	fimgShaderProgram *vs = cache->current;
+
+	if (fimgShaderMakeResident(cache, vs)) {
 #ifdef FIMG_DYNSHADER_DEBUG
-	LOGD("Loading optimized shader");
+		LOGD("Loading optimized shader");
 #endif
-	reg = (volatile uint32_t *)(ctx->base + FGVS_INSTMEM_START);
-	blk.data = shaderSlotAddr(ctx->compat.vshaderBuf, slot);
-	blk.len = vs->instrCount;
-	loadShaderBlock(&blk, reg);
+		fimgWriteBlock(ctx, vs->code,
+			FGVS_INSTMEM_START + 16*vs->memStart, 4*vs->instrCount);
+	}
 
-	setVertexShaderRange(ctx, 0, vs->instrCount - 1);
+	setVertexShaderRange(ctx, vs->memStart,
+					vs->memStart + vs->instrCount - 1);
+
+	if (!cache->mem.constLoaded) {
 #ifdef FIMG_DYNSHADER_DEBUG
-	LOGD("Loading const float");
+		LOGD("Loading const float");
 #endif
-	reg = (volatile uint32_t *)(ctx->base + FGVS_CFLOAT_START);
-	loadShaderBlock(&vertexConstFloat, reg);
+		fimgWriteBlock(ctx, vertexConstFloat.data,
+				FGVS_CFLOAT_START, 4*vertexConstFloat.len);
+		cache->mem.constLoaded = 1;
+	}
 #ifdef FIMG_DYNSHADER_DEBUG
 	LOGD("Loaded pixel shader");
 #endif
 }
 
 /**
- * Builds pixel shader program according to current pipeline configuration
- * and stores it in selected slot of pixel shader cache.
+ * Generates unoptimized pixel shader program according to current pipeline
+ * configuration.
  * @param ctx Hardware context.
- * @param slot Slot index.
+ * @param key Pixel shader program key.
+ * @param addr Buffer for program code (MAX_INSTR instructions).
+ * @param ones Mask of constant registers containing 1.0 in all components,
+ * updated with combiner scales known to be 1.0.
+ * @return Pointer to memory after last generated instruction.
  */
-static void buildPixelShader(fimgContext *ctx, uint32_t slot)
+static uint32_t *generatePixelShader(fimgContext *ctx, const uint32_t *key,
+					uint32_t *addr, uint32_t *ones)
 {
-	uint32_t unit, arg;
-	uint32_t *addr;
-	uint32_t *start;
-	uint32_t instrCount;
-#ifdef FIMG_DYNSHADER_DEBUG
-	LOGD("Loading pixel shader");
-#endif
-	if (!ctx->compat.pshaderBuf) {
-		ctx->compat.pshaderBuf = malloc(PS_CACHE_SIZE * MAX_INSTR * sizeof(fimgShaderInstruction));
-		if (!ctx->compat.pshaderBuf) {
-			LOGE("Failed to allocate memory for shader buffer, terminating.");
-			exit(1);
-		}
-	}
-	start = addr = shaderSlotAddr(ctx->compat.pshaderBuf, slot);
+	uint32_t unit, arg, plane;
 
 #ifdef FIMG_DYNSHADER_DEBUG
 	LOGD("Generating basic shader code");
 #endif
 	addr += loadShaderBlock(&pixelHeader, addr);
 
+	for (plane = 0; plane < FIMG_NUM_CLIP_PLANES; ++plane)
+		if (FGFP_BITFIELD_GET_IDX(key[FIMG_NUM_TEXTURE_UNITS],
+							PS_CLIP_EN, plane))
+			addr += loadShaderBlock(&clipKill[plane], addr);
+
 	for (unit = 0; unit < FIMG_NUM_TEXTURE_UNITS; unit++) {
 		uint32_t reg = ctx->compat.psState.tex[unit];
 		if (!FGFP_BITFIELD_GET(reg, TEX_MODE))
@@ -1127,6 +2020,9 @@ static void buildPixelShader(fimgContext *ctx, uint32_t slot)
 		if (FGFP_BITFIELD_GET(reg, TEX_MODE) != FGFP_TEXFUNC_COMBINE)
 			continue;
 
+		if (FGFP_BITFIELD_GET(reg, TEX_SCALE_ONE))
+			*ones |= 1 << FGFP_COMBSCALE(unit);
+
 		for (arg = 0; arg < 3; arg++) {
 			addr += loadShaderBlock(&combineArg[arg]
 					[FGFP_BITFIELD_GET_IDX(reg, TEX_COMBC_SRC, arg)], addr);
@@ -1156,19 +2052,64 @@ static void buildPixelShader(fimgContext *ctx, uint32_t slot)
 		addr += loadShaderBlock(&combine_a, addr);
 	}
 
-	if (FGFP_BITFIELD_GET(ctx->compat.psState.ps, PS_SWAP))
+	if (FGFP_BITFIELD_GET(key[FIMG_NUM_TEXTURE_UNITS], PS_FOG))
+		addr += loadShaderBlock(&fogBlend, addr);
+
+	if (FGFP_BITFIELD_GET(key[FIMG_NUM_TEXTURE_UNITS], PS_SWAP))
 		addr += loadShaderBlock(&out_swap, addr);
 
 	addr += loadShaderBlock(&pixelFooter, addr);
+
+	return addr;
+}
+
+/**
+ * Builds pixel shader program according to current pipeline configuration
+ * and stores it in pixel shader cache.
+ * @param ctx Hardware context.
+ * @param key Pixel shader program key.
+ * @return Pointer to cached program.
+ */
+static fimgShaderProgram *buildPixelShader(fimgContext *ctx,
+							const uint32_t *key)
+{
+	fimgShaderProgram *prog;
+	uint32_t *addr;
+	uint32_t *start;
+	uint32_t instrCount;
+	uint32_t ones = 1 << FGFP_CONST_ONE;
 #ifdef FIMG_DYNSHADER_DEBUG
-	LOGD("Optimizing pixel shader");
+	LOGD("Loading pixel shader");
 #endif
-	instrCount = optimizeShader(start, addr);
+	if (!ctx->compat.pshaderBuf) {
+		ctx->compat.pshaderBuf = malloc(MAX_INSTR * sizeof(fimgShaderInstruction));
+		if (!ctx->compat.pshaderBuf) {
+			LOGE("Failed to allocate memory for shader buffer, terminating.");
+			exit(1);
+		}
+	}
+	start = ctx->compat.pshaderBuf;
 
-	FGFP_BITFIELD_SET(ctx->compat.psState.ps, PS_INVALID, 0);
+	addr = generatePixelShader(ctx, key, start, &ones);
+#ifdef FIMG_DYNSHADER_DEBUG
+	LOGD("Optimizing pixel shader");
+#endif
+	instrCount = optimizeShader(start, addr, ones, 1 << FGFP_CONST_ZERO);
+#ifdef FIMG_DYNSHADER_DEBUG
+	LOGD("Optimized pixel shader from %u to %u instructions",
+			(uint32_t)(addr - start) / 4, instrCount);
+#endif
+	ctx->compat.psCache.stats.builtInstr += (addr - start) / 4;
+	ctx->compat.psCache.stats.optimizedInstr += instrCount;
+
+	prog = fimgShaderCacheInsert(&ctx->compat.psCache, key,
+							start, instrCount);
+	if (!prog) {
+		LOGE("Failed to allocate memory for shader program, terminating.");
+		exit(1);
+	}
 
-	ctx->compat.pixelShaders[slot].instrCount = instrCount;
-	ctx->compat.pixelShaders[slot].state = ctx->compat.psState;
+	return prog;
 }
 
 /**
@@ -1177,113 +2118,177 @@ static void buildPixelShader(fimgContext *ctx, uint32_t slot)
  */
 static void loadPixelShader(fimgContext *ctx)
 {
-	volatile uint32_t *reg;
-	struct shaderBlock blk;
-	uint32_t slot = ctx->compat.curPsNum;
-	struct fimgPixelShaderProgram *ps = &ctx->compat.pixelShaders[slot];
+	fimgShaderCache *cache = &ctx->compat.psCache;
+	fimgShaderProgram *ps = cache->current;
+
+	if (fimgShaderMakeResident(cache, ps)) {
 #ifdef FIMG_DYNSHADER_DEBUG
-	LOGD("Loading optimized shader");
+		LOGD("Loading optimized shader");
 #endif
-	reg = (volatile uint32_t *)(ctx->base + FGPS_INSTMEM_START);
-	blk.data = shaderSlotAddr(ctx->compat.pshaderBuf, slot);
-	blk.len = ps->instrCount;
-	loadShaderBlock(&blk, reg);
+		fimgWriteBlock(ctx, ps->code,
+			FGPS_INSTMEM_START + 16*ps->memStart, 4*ps->instrCount);
+	}
+
+	setPixelShaderRange(ctx, ps->memStart,
+					ps->memStart + ps->instrCount - 1);
 
-	setPixelShaderRange(ctx, 0, ps->instrCount - 1);
+	if (!cache->mem.constLoaded) {
 #ifdef FIMG_DYNSHADER_DEBUG
-	LOGD("Loading const float");
+		LOGD("Loading const float");
 #endif
-	reg = (volatile uint32_t *)(ctx->base + FGPS_CFLOAT_START);
-	loadShaderBlock(&pixelConstFloat, reg);
+		fimgWriteBlock(ctx, pixelConstFloat.data,
+				FGPS_CFLOAT_START, 4*pixelConstFloat.len);
+		cache->mem.constLoaded = 1;
+	}
 #ifdef FIMG_DYNSHADER_DEBUG
 	LOGD("Loaded pixel shader");
 #endif
 }
 
+#ifdef FIMG_SHADER_DISK_CACHE
 /**
- * Compares two vertex shader configurations.
- * @param ctx Hardware context.
- * @param a First vertex shader configuration.
- * @param b Second vertex shader configuration.
- * @return 0 if equal, non-zero otherwise.
+ * Version of shader code generator and optimizer.
+ * Must be increased on any change affecting generated programs.
  */
-static int compareVertexShaders(fimgContext *ctx,
-			fimgVertexShaderState *a, fimgVertexShaderState *b)
-{
-	return a->val[0] != b->val[0];
-}
+#define FIMG_SHADER_GENERATOR_VERSION	5
 
 /**
- * Compares two pixel shader configurations.
- * @param ctx Hardware context.
- * @param a First pixel shader configuration.
- * @param b Second pixel shader configuration.
- * @return 0 if equal, non-zero otherwise.
+ * Updates hash with contents of shader blocks.
+ * @param hash Initial hash value.
+ * @param blk Array of shader blocks.
+ * @param count Number of shader blocks.
+ * @return Hash value.
  */
-static int comparePixelShaders(fimgContext *ctx,
-			fimgPixelShaderState *a, fimgPixelShaderState *b)
+static uint32_t hashShaderBlocks(uint32_t hash,
+			const struct shaderBlock *blk, unsigned int count)
 {
 	unsigned int i;
 
-	for (i = 0; i < NELEM(a->val); ++i)
-		if ((a->val[i] ^ b->val[i]) & ctx->compat.psMask[i])
-			return 1;
+	while (count--) {
+		for (i = 0; i < 4*blk->len; ++i) {
+			hash ^= blk->data[i];
+			hash *= 16777619U;
+		}
+		hash ^= blk->len;
+		hash *= 16777619U;
+		++blk;
+	}
 
-	return 0;
+	return hash;
 }
 
 /**
- * Validates vertex shader program and rebuilds it if needed.
- * @param ctx Hardware context.
+ * Calculates identifier of shader blocks and code generator, which
+ * programs stored in persistent shader cache must match.
+ * @return Build identifier.
  */
-static void validateVertexShader(fimgContext *ctx)
+static uint32_t shaderBuildId(void)
 {
+	uint32_t hash = 2166136261U;
 	unsigned int i;
-	int ret;
-#ifdef FIMG_SHADER_CACHE_STATS
-	if (++ctx->compat.vsStatsCounter == 128) {
-		LOGD("Vertex shader cache stats:");
-		LOGD("Same hits: %d\n", ctx->compat.vsSameHits);
-		LOGD("Cache hits: %d\n", ctx->compat.vsCacheHits);
-		LOGD("Misses: %d\n", ctx->compat.vsMisses);
-		ctx->compat.vsSameHits = 0;
-		ctx->compat.vsCacheHits = 0;
-		ctx->compat.vsMisses = 0;
-		ctx->compat.vsStatsCounter = 0;
-	}
-#endif
-	ret = compareVertexShaders(ctx, &ctx->compat.vsState,
-			&ctx->compat.vertexShaders[ctx->compat.curVsNum].state);
-	if (!ret) {
-#ifdef FIMG_SHADER_CACHE_STATS
-		++ctx->compat.vsSameHits;
+
+	hash ^= FIMG_SHADER_GENERATOR_VERSION;
+	hash *= 16777619U;
+#ifdef FIMG_BYPASS_SHADER_OPTIMIZER
+	hash = ~hash;
 #endif
-		return;
+	hash = hashShaderBlocks(hash, &vertexConstFloat, 1);
+	hash = hashShaderBlocks(hash, &vertexHeader, 1);
+	hash = hashShaderBlocks(hash, &vertexColor, 1);
+	hash = hashShaderBlocks(hash, &vertexFooter, 1);
+	hash = hashShaderBlocks(hash, &vertexEyePos, 1);
+	hash = hashShaderBlocks(hash, &screenHeader, 1);
+	hash = hashShaderBlocks(hash, screenTexcoord, NELEM(screenTexcoord));
+	hash = hashShaderBlocks(hash, texcoordTransform,
+						NELEM(texcoordTransform));
+	hash = hashShaderBlocks(hash, &lightHeader, 1);
+	hash = hashShaderBlocks(hash, &lightNormalize, 1);
+	hash = hashShaderBlocks(hash, lightFooter, NELEM(lightFooter));
+	hash = hashShaderBlocks(hash, lightDirectional, NELEM(lightDirectional));
+	hash = hashShaderBlocks(hash, lightPoint, NELEM(lightPoint));
+	hash = hashShaderBlocks(hash, fogFactor, NELEM(fogFactor));
+	hash = hashShaderBlocks(hash, clipDistance, NELEM(clipDistance));
+	hash = hashShaderBlocks(hash, &pixelConstFloat, 1);
+	hash = hashShaderBlocks(hash, &pixelHeader, 1);
+	hash = hashShaderBlocks(hash, &pixelFooter, 1);
+	hash = hashShaderBlocks(hash, textureUnit, NELEM(textureUnit));
+	hash = hashShaderBlocks(hash, textureFunc, NELEM(textureFunc));
+	hash = hashShaderBlocks(hash, combineFunc, NELEM(combineFunc));
+	for (i = 0; i < 3; ++i) {
+		hash = hashShaderBlocks(hash, combineArg[i], 4);
+		hash = hashShaderBlocks(hash, combineArgMod[i], 4);
 	}
+	hash = hashShaderBlocks(hash, &combine_c, 1);
+	hash = hashShaderBlocks(hash, &combine_a, 1);
+	hash = hashShaderBlocks(hash, &combine_u, 1);
+	hash = hashShaderBlocks(hash, &tex_swap, 1);
+	hash = hashShaderBlocks(hash, &out_swap, 1);
+	hash = hashShaderBlocks(hash, &fogBlend, 1);
+	hash = hashShaderBlocks(hash, clipKill, NELEM(clipKill));
+
+	return hash;
+}
+#endif
+
+/**
+ * Validates shader program against current pipeline state and selects
+ * matching program from shader cache, building it if needed.
+ * @param ctx Hardware context.
+ * @param cache Shader program cache.
+ * @param key Shader program key of current pipeline state.
+ * @param build Function building program for current pipeline state.
+ * @return Zero if current program was kept, non-zero if it changed.
+ */
+static int validateShader(fimgContext *ctx, fimgShaderCache *cache,
+		const uint32_t *key,
+		fimgShaderProgram *(*build)(fimgContext *, const uint32_t *))
+{
+	fimgShaderProgram *prog = cache->current;
 
-	ctx->compat.vshaderLoaded = 0;
+	if (prog && !memcmp(prog->key, key, sizeof(prog->key))) {
+		++cache->stats.sameHits;
+		return 0;
+	}
 
-	for (i = 0; i < VS_CACHE_SIZE; ++i) {
-		if (i == ctx->compat.curVsNum)
-			continue;
-		ret = compareVertexShaders(ctx, &ctx->compat.vsState,
-					&ctx->compat.vertexShaders[i].state);
-		if (!ret) {
-#ifdef FIMG_SHADER_CACHE_STATS
-			++ctx->compat.vsCacheHits;
-#endif
-			ctx->compat.curVsNum = i;
-			return;
-		}
+	prog = fimgShaderCacheLookup(cache, key);
+#ifdef FIMG_SHADER_DISK_CACHE
+	if (!prog)
+		prog = fimgShaderDiskCacheLookup(ctx, cache, key);
+	if (!prog) {
+		prog = build(ctx, key);
+		ctx->compat.diskCache.dirty = 1;
 	}
-#ifdef FIMG_SHADER_CACHE_STATS
-	++ctx->compat.vsMisses;
+#else
+	if (!prog)
+		prog = build(ctx, key);
 #endif
-	i = ctx->compat.vsEvictCounter++;
-	ctx->compat.vsEvictCounter %= VS_CACHE_SIZE;
 
-	buildVertexShader(ctx, i);
-	ctx->compat.curVsNum = i;
+	cache->current = prog;
+	return 1;
+}
+
+/**
+ * Validates vertex shader program and rebuilds it if needed.
+ * @param ctx Hardware context.
+ */
+static void validateVertexShader(fimgContext *ctx)
+{
+	uint32_t key[FIMG_SHADER_KEY_LEN];
+
+	memset(key, 0, sizeof(key));
+	key[0] = ctx->compat.vsState.vs;
+
+	/* Screen space program depends only on enabled inputs and outputs */
+	if (FGFP_BITFIELD_GET(key[0], VS_SCREEN_SPACE))
+		key[0] &= FGFP_VS_SCREEN_SPACE_MASK | FGFP_VS_ATTRIB_EN_MASK
+						| FGFP_VS_TEX_EN_ALL_MASK;
+	else if (FGFP_BITFIELD_GET(key[0], VS_LIGHTING))
+		key[1] = ctx->compat.vsState.light;
+	else
+		key[0] &= ~(FGFP_VS_COLOR_MATERIAL_MASK | FGFP_VS_NORMALIZE_MASK);
+
+	if (validateShader(ctx, &ctx->compat.vsCache, key, buildVertexShader))
+		ctx->compat.vshaderLoaded = 0;
 }
 
 /**
@@ -1292,52 +2297,176 @@ static void validateVertexShader(fimgContext *ctx)
  */
 static void validatePixelShader(fimgContext *ctx)
 {
+	uint32_t key[FIMG_SHADER_KEY_LEN];
 	unsigned int i;
-	int ret;
-#ifdef FIMG_SHADER_CACHE_STATS
-	if (++ctx->compat.psStatsCounter == 128) {
-		LOGD("Pixel shader cache stats:");
-		LOGD("Same hits: %d\n", ctx->compat.psSameHits);
-		LOGD("Cache hits: %d\n", ctx->compat.psCacheHits);
-		LOGD("Misses: %d\n", ctx->compat.psMisses);
-		ctx->compat.psSameHits = 0;
-		ctx->compat.psCacheHits = 0;
-		ctx->compat.psMisses = 0;
-		ctx->compat.psStatsCounter = 0;
+
+	for (i = 0; i < FIMG_SHADER_KEY_LEN; ++i)
+		key[i] = ctx->compat.psState.val[i] & ctx->compat.psMask[i];
+
+	/* No eye space varyings are available in screen space mode */
+	if (FGFP_BITFIELD_GET(ctx->compat.vsState.vs, VS_SCREEN_SPACE))
+		key[FIMG_NUM_TEXTURE_UNITS] &=
+				~(FGFP_PS_FOG_MASK | FGFP_PS_CLIP_EN_ALL_MASK);
+
+	if (validateShader(ctx, &ctx->compat.psCache, key, buildPixelShader))
+		ctx->compat.pshaderLoaded = 0;
+}
+
+/**
+ * Checks whether two floating point values are equal by comparing their bit
+ * patterns. Zeros of both signs are equal. Used for parameters compared
+ * against exact values specified by the API, like default light parameters.
+ * @param a First value.
+ * @param b Second value.
+ * @return Non-zero if the values are equal, zero otherwise.
+ */
+static inline int floatEqual(float a, float b)
+{
+	uint32_t ua, ub;
+
+	memcpy(&ua, &a, sizeof(ua));
+	memcpy(&ub, &b, sizeof(ub));
+
+	return ua == ub || !((ua | ub) << 1);
+}
+
+/**
+ * Updates pixel shader state bit telling whether combiner scale factors
+ * of selected texture unit are all equal to 1.0, which allows the pixel
+ * shader optimizer to drop scaling.
+ * @param ctx Hardware context.
+ * @param unit Index of texture unit.
+ */
+static void updateScaleState(fimgContext *ctx, uint32_t unit)
+{
+	const float *scale = ctx->compat.texture[unit].scale;
+	uint32_t one = floatEqual(scale[0], 1.0f) && floatEqual(scale[1], 1.0f)
+			&& floatEqual(scale[2], 1.0f)
+			&& floatEqual(scale[3], 1.0f);
+
+	FGFP_BITFIELD_SET(ctx->compat.psState.tex[unit], TEX_SCALE_ONE, one);
+}
+
+/**
+ * Updates vertex shader state of selected light source.
+ * @param ctx Hardware context.
+ * @param light Index of light source.
+ */
+static void updateLightState(fimgContext *ctx, uint32_t light)
+{
+	const fimgLight *params = &ctx->compat.light[light];
+	const float *spec = ctx->compat.material.specular;
+	const float *atten = params->attenuation;
+	uint32_t type = FGFP_LIGHT_NONE;
+	uint32_t attenuated = 0;
+	uint32_t specular = 0;
+
+	if (ctx->compat.lightEnable & (1 << light)) {
+		/* Spotlight is ignored for directional lights */
+		if (floatEqual(params->position[3], 0.0f))
+			type = FGFP_LIGHT_DIRECTIONAL;
+		else if (!floatEqual(params->spotCutoff, 180.0f))
+			type = FGFP_LIGHT_SPOT;
+		else
+			type = FGFP_LIGHT_POINT;
+
+		attenuated = type != FGFP_LIGHT_DIRECTIONAL
+				&& (!floatEqual(atten[0], 1.0f)
+				|| !floatEqual(atten[1], 0.0f)
+				|| !floatEqual(atten[2], 0.0f));
+		specular = !floatEqual(params->specular[0] * spec[0], 0.0f)
+			|| !floatEqual(params->specular[1] * spec[1], 0.0f)
+			|| !floatEqual(params->specular[2] * spec[2], 0.0f);
 	}
-#endif
-	ret = comparePixelShaders(ctx, &ctx->compat.psState,
-			&ctx->compat.pixelShaders[ctx->compat.curPsNum].state);
-	if (!ret) {
-#ifdef FIMG_SHADER_CACHE_STATS
-		++ctx->compat.psSameHits;
-#endif
+
+	FGFP_BITFIELD_SET_IDX(ctx->compat.vsState.light, LIGHT_TYPE, light, type);
+	FGFP_BITFIELD_SET_IDX(ctx->compat.vsState.light, LIGHT_ATTEN,
+							light, attenuated);
+	FGFP_BITFIELD_SET_IDX(ctx->compat.vsState.light, LIGHT_SPEC,
+							light, specular);
+}
+
+/**
+ * Normalizes three component vector.
+ * @param dst Destination vector.
+ * @param src Source vector.
+ */
+static void normalize3(float *dst, const float *src)
+{
+	float len = sqrtf(src[0]*src[0] + src[1]*src[1] + src[2]*src[2]);
+
+	if (floatEqual(len, 0.0f)) {
+		dst[0] = dst[1] = dst[2] = 0.0f;
 		return;
 	}
 
-	ctx->compat.pshaderLoaded = 0;
+	dst[0] = src[0] / len;
+	dst[1] = src[1] / len;
+	dst[2] = src[2] / len;
+}
 
-	for (i = 0; i < PS_CACHE_SIZE; ++i) {
-		if (i == ctx->compat.curPsNum)
-			continue;
-		ret = comparePixelShaders(ctx, &ctx->compat.psState,
-					&ctx->compat.pixelShaders[i].state);
-		if (!ret) {
-#ifdef FIMG_SHADER_CACHE_STATS
-			++ctx->compat.psCacheHits;
-#endif
-			ctx->compat.curPsNum = i;
-			return;
+/**
+ * Calculates lighting constants from light source and material parameters
+ * and loads them into vertex shader const float registers.
+ * @param ctx Hardware context.
+ */
+static void loadLightConst(fimgContext *ctx)
+{
+	float c[FGVS_LIGHT_CONST_NUM][4];
+	const fimgMaterial *mat = &ctx->compat.material;
+	const float *scene = ctx->compat.sceneAmbient;
+	int cm = FGFP_BITFIELD_GET(ctx->compat.vsState.vs, VS_COLOR_MATERIAL);
+	uint32_t light, i;
+
+	memset(c, 0, sizeof(c));
+
+	c[0][1] = 1.0f;
+	c[0][2] = 1.0e-20f;
+
+	/* With color material, ambient and diffuse are multiplied in shader */
+	for (i = 0; i < 3; ++i) {
+		c[1][i] = mat->emission[i];
+		if (cm)
+			c[2][i] = scene[i];
+		else
+			c[1][i] += scene[i] * mat->ambient[i];
+	}
+	c[1][3] = mat->diffuse[3];
+	c[3][0] = mat->shininess;
+
+	for (light = 0; light < FIMG_NUM_LIGHTS; ++light) {
+		const fimgLight *params = &ctx->compat.light[light];
+		float (*lc)[4] = &c[FGVS_LIGHT_SOURCE(light) - FGVS_LIGHT_CONST];
+
+		if (!floatEqual(params->position[3], 0.0f)) {
+			for (i = 0; i < 3; ++i)
+				lc[0][i] = params->position[i] / params->position[3];
+		} else {
+			normalize3(lc[0], params->position);
+			lc[6][0] = lc[0][0];
+			lc[6][1] = lc[0][1];
+			lc[6][2] = lc[0][2] + 1.0f;
+			normalize3(lc[6], lc[6]);
+		}
+
+		for (i = 0; i < 3; ++i) {
+			lc[1][i] = params->ambient[i];
+			lc[2][i] = params->diffuse[i];
+			if (!cm) {
+				lc[1][i] *= mat->ambient[i];
+				lc[2][i] *= mat->diffuse[i];
+			}
+			lc[3][i] = params->specular[i] * mat->specular[i];
+			lc[4][i] = params->attenuation[i];
 		}
+
+		normalize3(lc[5], params->spotDirection);
+		lc[5][3] = cosf(params->spotCutoff * (float)M_PI / 180.0f);
+		lc[6][3] = params->spotExponent;
 	}
-#ifdef FIMG_SHADER_CACHE_STATS
-	++ctx->compat.psMisses;
-#endif
-	i = ctx->compat.psEvictCounter++;
-	ctx->compat.psEvictCounter %= PS_CACHE_SIZE;
 
-	buildPixelShader(ctx, i);
-	ctx->compat.curPsNum = i;
+	fimgWriteBlock(ctx, (const uint32_t *)c,
+		FGVS_CFLOAT_START + 16*FGVS_LIGHT_CONST, 4*FGVS_LIGHT_CONST_NUM);
 }
 
 /*
@@ -1458,6 +2587,7 @@ void fimgCompatSetColorScale(fimgContext *ctx, uint32_t unit, float scale)
 	ctx->compat.texture[unit].scale[2] = scale;
 
 	ctx->compat.texture[unit].dirty = 1;
+	updateScaleState(ctx, unit);
 }
 
 /**
@@ -1471,6 +2601,7 @@ void fimgCompatSetAlphaScale(fimgContext *ctx, uint32_t unit, float scale)
 	ctx->compat.texture[unit].scale[3] = scale;
 
 	ctx->compat.texture[unit].dirty = 1;
+	updateScaleState(ctx, unit);
 }
 
 /**
@@ -1507,13 +2638,225 @@ void fimgCompatSetupTexture(fimgContext *ctx, fimgTexture *tex, uint32_t unit)
 				TEX_SWAP, !!(tex->reserved2 & FGTU_TEX_BGR));
 }
 
+/**
+ * Selects vertex shader inputs fed from vertex arrays.
+ * Vertex arrays are expected to be sent by host interface in order of
+ * attribute indices, while inputs not in the mask are read from constants
+ * set with fimgCompatSetAttribConst().
+ * @param ctx Hardware context.
+ * @param mask Bit mask of attribute indices fed from vertex arrays.
+ */
+void fimgCompatSetAttribMask(fimgContext *ctx, uint32_t mask)
+{
+	FGFP_BITFIELD_SET(ctx->compat.vsState.vs, VS_ATTRIB_EN, mask);
+}
+
+/**
+ * Sets constant value of vertex shader input not fed from vertex array.
+ * @param ctx Hardware context.
+ * @param attrib Attribute index.
+ * @param value Pointer to four float components of the value.
+ */
+void fimgCompatSetAttribConst(fimgContext *ctx, uint32_t attrib,
+							const float *value)
+{
+	if (!memcmp(ctx->compat.attribConst[attrib], value, 4*sizeof(float)))
+		return;
+
+	memcpy(ctx->compat.attribConst[attrib], value, 4*sizeof(float));
+	ctx->compat.attribConstDirty |= 1 << attrib;
+}
+
+/**
+ * Enables or disables vertex lighting.
+ * @param ctx Hardware context.
+ * @param enable Non-zero to enable lighting.
+ */
+void fimgCompatSetLightingEnable(fimgContext *ctx, int enable)
+{
+	FGFP_BITFIELD_SET(ctx->compat.vsState.vs, VS_LIGHTING, !!enable);
+}
+
+/**
+ * Enables or disables selected light source.
+ * @param ctx Hardware context.
+ * @param light Index of light source.
+ * @param enable Non-zero to enable the light source.
+ */
+void fimgCompatSetLightEnable(fimgContext *ctx, uint32_t light, int enable)
+{
+	if (enable)
+		ctx->compat.lightEnable |= 1 << light;
+	else
+		ctx->compat.lightEnable &= ~(1 << light);
+
+	updateLightState(ctx, light);
+}
+
+/**
+ * Sets parameters of selected light source.
+ * @param ctx Hardware context.
+ * @param light Index of light source.
+ * @param params Light source parameters (in eye coordinates).
+ */
+void fimgCompatSetLight(fimgContext *ctx, uint32_t light,
+						const fimgLight *params)
+{
+	ctx->compat.light[light] = *params;
+	ctx->compat.lightDirty = 1;
+	updateLightState(ctx, light);
+}
+
+/**
+ * Sets material parameters used for lighting.
+ * @param ctx Hardware context.
+ * @param params Material parameters.
+ */
+void fimgCompatSetMaterial(fimgContext *ctx, const fimgMaterial *params)
+{
+	uint32_t light;
+
+	ctx->compat.material = *params;
+	ctx->compat.lightDirty = 1;
+
+	/* Specular terms depend on material specular color */
+	for (light = 0; light < FIMG_NUM_LIGHTS; ++light)
+		updateLightState(ctx, light);
+}
+
+/**
+ * Sets ambient color of the scene.
+ * @param ctx Hardware context.
+ * @param color Pointer to four float components of the color.
+ */
+void fimgCompatSetLightModelAmbient(fimgContext *ctx, const float *color)
+{
+	memcpy(ctx->compat.sceneAmbient, color, 4*sizeof(float));
+	ctx->compat.lightDirty = 1;
+}
+
+/**
+ * Enables or disables tracking of ambient and diffuse material colors
+ * by vertex color.
+ * @param ctx Hardware context.
+ * @param enable Non-zero to enable color material.
+ */
+void fimgCompatSetColorMaterial(fimgContext *ctx, int enable)
+{
+	FGFP_BITFIELD_SET(ctx->compat.vsState.vs, VS_COLOR_MATERIAL, !!enable);
+	ctx->compat.lightDirty = 1;
+}
+
+/**
+ * Enables or disables normalization of transformed normals.
+ * @param ctx Hardware context.
+ * @param enable Non-zero to enable normalization.
+ */
+void fimgCompatSetNormalize(fimgContext *ctx, int enable)
+{
+	FGFP_BITFIELD_SET(ctx->compat.vsState.vs, VS_NORMALIZE, !!enable);
+}
+
+/**
+ * Sets fog mode and parameters of fog factor equation.
+ * @param ctx Hardware context.
+ * @param mode Fog mode (FGFP_FOG_NONE disables fog).
+ * @param density Fog density used by exponential modes.
+ * @param start Fog start distance used by linear mode.
+ * @param end Fog end distance used by linear mode.
+ */
+void fimgCompatSetFog(fimgContext *ctx, fimgFogMode mode,
+				float density, float start, float end)
+{
+	float *params = ctx->compat.fogParams;
+
+	FGFP_BITFIELD_SET(ctx->compat.vsState.vs, VS_FOG, mode);
+	FGFP_BITFIELD_SET(ctx->compat.psState.ps, PS_FOG,
+						mode != FGFP_FOG_NONE);
+
+	/* Coefficients of fog factor computed by shaders/vert.asm */
+	switch (mode) {
+	case FGFP_FOG_LINEAR:
+		if (!floatEqual(end, start)) {
+			params[0] = -1.0f / (end - start);
+			params[1] = end / (end - start);
+		} else {
+			params[0] = 0.0f;
+			params[1] = 1.0f;
+		}
+		break;
+	case FGFP_FOG_EXP:
+		params[0] = -density * (float)M_LOG2E;
+		params[1] = 0.0f;
+		break;
+	case FGFP_FOG_EXP2:
+		params[0] = density;
+		params[1] = -(float)M_LOG2E;
+		break;
+	default:
+		return;
+	}
+
+	ctx->compat.fogDirty = 1;
+}
+
+/**
+ * Sets color of fog.
+ * @param ctx Hardware context.
+ * @param color Pointer to four float components of the color.
+ */
+void fimgCompatSetFogColor(fimgContext *ctx, const float *color)
+{
+	memcpy(ctx->compat.fogColor, color, 4*sizeof(float));
+	ctx->compat.fogColorDirty = 1;
+}
+
+/**
+ * Enables or disables selected user clip plane.
+ * @param ctx Hardware context.
+ * @param plane Index of clip plane.
+ * @param enable Non-zero to enable the clip plane.
+ */
+void fimgCompatSetClipPlaneEnable(fimgContext *ctx, uint32_t plane, int enable)
+{
+	FGFP_BITFIELD_SET_IDX(ctx->compat.vsState.vs, VS_CLIP_EN, plane, !!enable);
+	FGFP_BITFIELD_SET_IDX(ctx->compat.psState.ps, PS_CLIP_EN, plane, !!enable);
+}
+
+/**
+ * Sets equation of selected user clip plane.
+ * @param ctx Hardware context.
+ * @param plane Index of clip plane.
+ * @param equation Pointer to four plane equation coefficients
+ * (in eye coordinates).
+ */
+void fimgCompatSetClipPlane(fimgContext *ctx, uint32_t plane,
+							const float *equation)
+{
+	memcpy(ctx->compat.clipPlane[plane], equation, 4*sizeof(float));
+	ctx->compat.clipPlaneDirty |= 1 << plane;
+}
+
+/**
+ * Enables or disables screen space mode, used to draw rectangles given
+ * in window coordinates (glDrawTex). Vertex positions and texture
+ * coordinates are passed through without transformation and lighting,
+ * fog and clip planes are ignored, without modifying their state.
+ * @param ctx Hardware context.
+ * @param enable Non-zero to enable screen space mode.
+ */
+void fimgCompatSetScreenSpace(fimgContext *ctx, int enable)
+{
+	FGFP_BITFIELD_SET(ctx->compat.vsState.vs, VS_SCREEN_SPACE, !!enable);
+}
+
 /**
  * Initializes hardware context of fixed pipeline emulation block.
  * @param ctx Hardware context.
  */
 void fimgCreateCompatContext(fimgContext *ctx)
 {
-	uint32_t unit;
+	uint32_t unit, i;
 	fimgTextureCompat *texture;
 
 	texture = ctx->compat.texture;
@@ -1536,6 +2879,7 @@ void fimgCreateCompatContext(fimgContext *ctx)
 		FGFP_BITFIELD_SET_IDX(reg, TEX_COMBA_MOD, 1, FGFP_COMBARG_SRC_ALPHA & 1);
 		FGFP_BITFIELD_SET_IDX(reg, TEX_COMBA_SRC, 2, FGFP_COMBARG_CONST);
 		FGFP_BITFIELD_SET_IDX(reg, TEX_COMBA_MOD, 2, FGFP_COMBARG_SRC_ALPHA & 1);
+		FGFP_BITFIELD_SET(reg, TEX_SCALE_ONE, 1U);
 
 		ctx->compat.texture[unit].scale[0] = 1.0;
 		ctx->compat.texture[unit].scale[1] = 1.0;
@@ -1545,15 +2889,67 @@ void fimgCreateCompatContext(fimgContext *ctx)
 		ctx->compat.psState.tex[unit] = reg;
 	}
 
-	for (unit = 0; unit < VS_CACHE_SIZE; ++unit)
-		FGFP_BITFIELD_SET(ctx->compat.vertexShaders[unit].state.vs,
-								VS_INVALID, 1);
+	FGFP_BITFIELD_SET(ctx->compat.vsState.vs, VS_ATTRIB_EN,
+						(1 << FIMG_ATTRIB_NUM) - 1);
+	ctx->compat.attribConstDirty = (1 << FIMG_ATTRIB_NUM) - 1;
+
+	for (i = 0; i < FIMG_NUM_LIGHTS; ++i) {
+		fimgLight *light = &ctx->compat.light[i];
+		float value = (i == 0) ? 1.0f : 0.0f;
+
+		memset(light, 0, sizeof(*light));
+		light->ambient[3] = 1.0f;
+		light->diffuse[0] = light->diffuse[1] = light->diffuse[2] = value;
+		light->diffuse[3] = 1.0f;
+		light->specular[0] = light->specular[1] = light->specular[2] = value;
+		light->specular[3] = 1.0f;
+		light->position[2] = 1.0f;
+		light->spotDirection[2] = -1.0f;
+		light->spotCutoff = 180.0f;
+		light->attenuation[0] = 1.0f;
+	}
 
-	for (unit = 0; unit < PS_CACHE_SIZE; ++unit)
-		FGFP_BITFIELD_SET(ctx->compat.pixelShaders[unit].state.ps,
-								PS_INVALID, 1);
+	memset(&ctx->compat.material, 0, sizeof(ctx->compat.material));
+	for (i = 0; i < 3; ++i) {
+		ctx->compat.material.ambient[i] = 0.2f;
+		ctx->compat.material.diffuse[i] = 0.8f;
+		ctx->compat.sceneAmbient[i] = 0.2f;
+	}
+	ctx->compat.material.ambient[3] = 1.0f;
+	ctx->compat.material.diffuse[3] = 1.0f;
+	ctx->compat.material.specular[3] = 1.0f;
+	ctx->compat.material.emission[3] = 1.0f;
+	ctx->compat.sceneAmbient[3] = 1.0f;
+	ctx->compat.lightDirty = 1;
+
+	ctx->compat.fogParams[0] = -1.0f;
+	ctx->compat.fogParams[1] = 1.0f;
+	ctx->compat.fogDirty = 1;
+	ctx->compat.fogColorDirty = 1;
+	ctx->compat.clipPlaneDirty = (1 << FIMG_NUM_CLIP_PLANES) - 1;
 
 	ctx->compat.psMask[FIMG_NUM_TEXTURE_UNITS] = 0xffffffff;
+
+	fimgCreateShaderCache(&ctx->compat.vsCache, FIMG_SHADER_VERTEX);
+	fimgCreateShaderCache(&ctx->compat.psCache, FIMG_SHADER_PIXEL);
+#ifdef FIMG_SHADER_DISK_CACHE
+	fimgOpenShaderDiskCache(ctx, shaderBuildId());
+#endif
+}
+
+/**
+ * Frees resources of fixed pipeline compatibility block.
+ * @param ctx Hardware context.
+ */
+void fimgDestroyCompatContext(fimgContext *ctx)
+{
+#ifdef FIMG_SHADER_DISK_CACHE
+	fimgCloseShaderDiskCache(ctx);
+#endif
+	fimgDestroyShaderCache(&ctx->compat.vsCache);
+	fimgDestroyShaderCache(&ctx->compat.psCache);
+	free(ctx->compat.vshaderBuf);
+	free(ctx->compat.pshaderBuf);
 }
 
 /**
@@ -1570,14 +2966,54 @@ void fimgCompatFlush(fimgContext *ctx)
 		loadVertexShader(ctx);
 		setVertexShaderAttribCount(ctx, ctx->numAttribs);
 		ctx->compat.vshaderLoaded = 1;
+		ctx->touched |= FIMG_BLOCK_VSHADER;
 	}
 
-	for (i = 0; i < 2 + FIMG_NUM_TEXTURE_UNITS; i++) {
+	for (i = 0; i < FGFP_MATRIX_NUM; i++) {
 		if (!ctx->compat.matrixDirty[i] || ctx->compat.matrix[i] == NULL)
 			continue;
 
 		loadVSMatrix(ctx, ctx->compat.matrix[i], 4*i);
 		ctx->compat.matrixDirty[i] = 0;
+		ctx->touched |= FIMG_BLOCK_VSHADER;
+	}
+
+	for (i = 0; ctx->compat.attribConstDirty; ++i) {
+		if (!(ctx->compat.attribConstDirty & (1 << i)))
+			continue;
+
+		fimgWriteBlock(ctx, (const uint32_t *)ctx->compat.attribConst[i],
+				FGVS_CFLOAT_START + 16*FGVS_ATTRIB_CONST(i), 4);
+		ctx->compat.attribConstDirty &= ~(1 << i);
+		ctx->touched |= FIMG_BLOCK_VSHADER;
+	}
+
+	if (ctx->compat.lightDirty
+	    && FGFP_BITFIELD_GET(ctx->compat.vsState.vs, VS_LIGHTING)) {
+		loadLightConst(ctx);
+		ctx->compat.lightDirty = 0;
+		ctx->touched |= FIMG_BLOCK_VSHADER;
+	}
+
+	if (ctx->compat.fogDirty
+	    && FGFP_BITFIELD_GET(ctx->compat.vsState.vs, VS_FOG)) {
+		fimgWriteBlock(ctx, (const uint32_t *)ctx->compat.fogParams,
+				FGVS_CFLOAT_START + 16*FGVS_FOG_CONST, 4);
+		ctx->compat.fogDirty = 0;
+		ctx->touched |= FIMG_BLOCK_VSHADER;
+	}
+
+	for (i = 0; i < FIMG_NUM_CLIP_PLANES; ++i) {
+		if (!(ctx->compat.clipPlaneDirty & (1 << i)))
+			continue;
+
+		if (!FGFP_BITFIELD_GET_IDX(ctx->compat.vsState.vs, VS_CLIP_EN, i))
+			continue;
+
+		fimgWriteBlock(ctx, (const uint32_t *)ctx->compat.clipPlane[i],
+				FGVS_CFLOAT_START + 16*FGVS_CLIP_PLANE(i), 4);
+		ctx->compat.clipPlaneDirty &= ~(1 << i);
+		ctx->touched |= FIMG_BLOCK_VSHADER;
 	}
 
 	validatePixelShader(ctx);
@@ -1613,9 +3049,21 @@ void fimgCompatFlush(fimgContext *ctx)
 		ctx->compat.texture[i].dirty = 0;
 	}
 
+	if (ctx->compat.fogColorDirty
+	    && FGFP_BITFIELD_GET(ctx->compat.psState.ps, PS_FOG)) {
+		if (!psStopped) {
+			setPixelShaderState(ctx, 0);
+			psStopped = 1;
+		}
+
+		loadPSConstFloat(ctx, ctx->compat.fogColor, FGFP_FOGCOLOR);
+		ctx->compat.fogColorDirty = 0;
+	}
+
 	if (psStopped) {
 		setPixelShaderAttribCount(ctx, FIMG_ATTRIB_NUM - 1);
 		setPixelShaderState(ctx, 1);
+		ctx->touched |= FIMG_BLOCK_PSHADER;
 	}
 }
 
@@ -1634,17 +3082,30 @@ void fimgLoadMatrix(fimgContext *ctx, uint32_t matrix, const float *pfData)
 /**
  * Restores fixed pipeline compatibility block context.
  * @param ctx Hardware context.
+ * @param blocks Bit mask of hardware blocks to restore (FIMG_BLOCK_*).
  */
-void fimgRestoreCompatState(fimgContext *ctx)
+void fimgRestoreCompatState(fimgContext *ctx, uint32_t blocks)
 {
 	uint32_t i;
 
-	for (i = 0; i < 2 + FIMG_NUM_TEXTURE_UNITS; i++)
-		ctx->compat.matrixDirty[i] = 1;
+	if (blocks & FIMG_BLOCK_VSHADER) {
+		for (i = 0; i < FGFP_MATRIX_NUM; i++)
+			ctx->compat.matrixDirty[i] = 1;
 
-	for (i = 0; i < FIMG_NUM_TEXTURE_UNITS; i++)
-		ctx->compat.texture[i].dirty = 1;
+		ctx->compat.attribConstDirty = (1 << FIMG_ATTRIB_NUM) - 1;
+		ctx->compat.lightDirty = 1;
+		ctx->compat.fogDirty = 1;
+		ctx->compat.clipPlaneDirty = (1 << FIMG_NUM_CLIP_PLANES) - 1;
+		ctx->compat.vshaderLoaded = 0;
+		fimgResetShaderMemory(&ctx->compat.vsCache);
+	}
 
-	ctx->compat.vshaderLoaded = 0;
-	ctx->compat.pshaderLoaded = 0;
+	if (blocks & FIMG_BLOCK_PSHADER) {
+		for (i = 0; i < FIMG_NUM_TEXTURE_UNITS; i++)
+			ctx->compat.texture[i].dirty = 1;
+
+		ctx->compat.fogColorDirty = 1;
+		ctx->compat.pshaderLoaded = 0;
+		fimgResetShaderMemory(&ctx->compat.psCache);
+	}
 }
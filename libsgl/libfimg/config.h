@@ -25,6 +25,9 @@
 /* Workaround for rasterizer bug. */
 #define FIMG_INTERPOLATION_WORKAROUND
 
+/* Let the hardware fetch indexed vertices instead of expanding indices */
+#define FIMG_INDEXED_FETCH
+
 /* Use fixed pipeline emulation */
 #define FIMG_FIXED_PIPELINE
 
@@ -37,6 +40,32 @@
 /* Dump file path */
 #define FIMG_DUMP_FILE_PATH	"/tmp"
 
+/* Emulate the hardware in process memory instead of using /dev/s3c-g3d */
+//#define FIMG_SOFTWARE_BACKEND
+
+/* Keep hardware lock between sessions until swap, idle timeout or contention */
+#define FIMG_LAZY_LOCK
+
+/* Time after which idle retained hardware lock is released (in ms) */
+#define FIMG_LAZY_LOCK_TIMEOUT	10
+
+/* Time since acquisition after which retained lock is released (in ms) */
+#define FIMG_LAZY_LOCK_MAX_HOLD	32
+
+/* Number of register reads before a hardware wait gives the CPU away */
+#define FIMG_WAIT_SPIN_COUNT	64
+
+/*
+ * File tracking which client's state is loaded in each block, mapped shared
+ * by all clients. Android has no /dev/shm, so the file lives in a directory
+ * that init.rc must create writable by the group of G3D device.
+ */
+#ifdef FGL_PLATFORM_ANDROID
+#define FIMG_SHARED_STATE_FILE	"/data/misc/fimg/state"
+#else
+#define FIMG_SHARED_STATE_FILE	"/dev/shm/fimg-state"
+#endif
+
 /* Map/unmap memory when locking/unlocking */
 //#define FIMG_DEBUG_IOMEM_ACCESS
 
@@ -46,8 +75,18 @@
 /* Dump generated shaders */
 //#define FIMG_DYNSHADER_DEBUG
 
-/* Show shader cache hit/miss statistics in log */
-//#define FIMG_SHADER_CACHE_STATS
+/* Keep generated shader programs in a file between runs */
+#define FIMG_SHADER_DISK_CACHE
+
+/*
+ * Directory of shader cache file (overridden by FIMG_SHADER_CACHE_DIR
+ * environment variable). It must be private to the user running the driver.
+ * The file is not used if no directory is configured.
+ */
+//#define FIMG_SHADER_CACHE_DIR	"/data/local/fimg"
+
+/* Maximal size of shader cache file (in bytes) */
+#define FIMG_SHADER_CACHE_MAX_SIZE	(64*1024)
 
 /* Disable shader optimizer */
 //#define FIMG_BYPASS_SHADER_OPTIMIZER
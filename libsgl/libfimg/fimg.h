@@ -26,6 +26,7 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 #include "config.h"
 
@@ -68,6 +69,18 @@ typedef struct _fimgContext fimgContext;
 	FGHI_PIPELINE_TRI_ENG | FGHI_PIPELINE_RA_ENG | FGHI_PIPELINE_PSHADER | \
 	FGHI_PIPELINE_PER_FRAG )
 
+/** Hardware wait statistics. */
+typedef struct {
+	/** Number of waits finished while spinning. */
+	unsigned int spins;
+	/** Number of waits that had to block or sleep. */
+	unsigned int sleeps;
+	/** Time spent spinning (in ns). */
+	uint64_t spinTime;
+	/** Time spent blocked or sleeping (in ns). */
+	uint64_t sleepTime;
+} fimgWaitStats;
+
 /* Functions */
 uint32_t fimgGetPipelineStatus(fimgContext *ctx);
 int fimgFlush(fimgContext *ctx);
@@ -79,6 +92,8 @@ int fimgFlushCache(fimgContext *ctx,
 int fimgWaitForCacheFlush(fimgContext *ctx,
 				unsigned int ccflush, unsigned int zcflush);
 void fimgFinish(fimgContext *ctx);
+unsigned int fimgGetSessionCount(fimgContext *ctx);
+void fimgGetWaitStats(fimgContext *ctx, fimgWaitStats *stats);
 void fimgSoftReset(fimgContext *ctx);
 void fimgGetVersion(fimgContext *ctx, int *major, int *minor, int *rev);
 
@@ -140,6 +155,91 @@ void fimgSetAttribute(fimgContext *ctx,
 		      unsigned int numComp);
 void fimgSetAttribCount(fimgContext *ctx, unsigned char count);
 
+/*
+ * Vertex stream cache
+ */
+
+/** Index types of cached vertex streams. */
+enum {
+	FIMG_STREAM_INDEX_NONE = 0,	/**< Non-indexed draw. */
+	FIMG_STREAM_INDEX_UBYTE,	/**< uint8_t indices. */
+	FIMG_STREAM_INDEX_USHORT	/**< uint16_t indices. */
+};
+
+/**
+ * Key identifying packed vertex stream in vertex stream cache.
+ * Source buffers are identified by generation numbers, which must change
+ * every time contents of the buffer change and must never be reused for
+ * another buffer. Unused fields must be zeroed.
+ */
+typedef struct {
+	/** Primitive type. */
+	uint32_t mode;
+	/** Index of first vertex (non-indexed draws only). */
+	uint32_t first;
+	/** Vertex count. */
+	uint32_t count;
+	/** Index type (FIMG_STREAM_INDEX_*). */
+	uint32_t indexType;
+	/** Generation of index buffer. */
+	uint32_t indexGeneration;
+	/** Offset of indices inside index buffer. */
+	uint32_t indexOffset;
+	/** Number of attributes. */
+	uint32_t numAttribs;
+	/** Sources of vertex attributes. */
+	struct {
+		/** Generation of source buffer (0 for constant attribute). */
+		uint32_t generation;
+		/** Offset of attribute data inside source buffer. */
+		uint32_t offset;
+		/** Stride of single vertex. */
+		uint16_t stride;
+		/** Width of single vertex. */
+		uint16_t width;
+	} array[FIMG_ATTRIB_NUM];
+} fimgStreamKey;
+
+/** Vertex stream cache statistics. */
+typedef struct {
+	/** Number of draws served from the cache. */
+	unsigned int hits;
+	/** Number of draws that had to pack vertex data. */
+	unsigned int misses;
+	/** Number of streams evicted to stay within budget. */
+	unsigned int evictions;
+	/** Number of cached streams. */
+	unsigned int entries;
+	/** Memory used by cached streams (in bytes). */
+	size_t size;
+	/** Memory budget of the cache (in bytes). */
+	size_t budget;
+} fimgStreamCacheStats;
+
+void fimgDrawArraysCached(fimgContext *ctx, unsigned int mode,
+	fimgArray *arrays, unsigned int count, const fimgStreamKey *key);
+void fimgDrawElementsUByteIdxCached(fimgContext *ctx, unsigned int mode,
+	fimgArray *arrays, unsigned int count, const uint8_t *indices,
+	const fimgStreamKey *key);
+void fimgDrawElementsUShortIdxCached(fimgContext *ctx, unsigned int mode,
+	fimgArray *arrays, unsigned int count, const uint16_t *indices,
+	const fimgStreamKey *key);
+void fimgSetStreamCacheBudget(fimgContext *ctx, size_t budget);
+void fimgGetStreamCacheStats(fimgContext *ctx, fimgStreamCacheStats *stats);
+
+/** Index array split into batches of compact vertex ranges. */
+typedef struct _fimgIndexPartition fimgIndexPartition;
+
+fimgIndexPartition *fimgCreateIndexPartitionUByte(fimgContext *ctx,
+	unsigned int mode, fimgArray *arrays, unsigned int count,
+	const uint8_t *indices);
+fimgIndexPartition *fimgCreateIndexPartitionUShort(fimgContext *ctx,
+	unsigned int mode, fimgArray *arrays, unsigned int count,
+	const uint16_t *indices);
+int fimgDrawElementsPartitioned(fimgContext *ctx, fimgArray *arrays,
+	fimgIndexPartition *partition, const fimgStreamKey *key);
+void fimgDestroyIndexPartition(fimgIndexPartition *partition);
+
 /*
  * Primitive Engine
  */
@@ -216,6 +316,8 @@ int fimgLoadPShader(fimgContext *ctx,
 
 /** Max. mipmap level supported by FIMG-3DSE. */
 #define FGTU_MAX_MIPMAP_LEVEL	11
+/** Number of entries in texture palette memory of FIMG-3DSE. */
+#define FGTU_MAX_PALETTE_SIZE	256
 
 /* Type definitions */
 
@@ -331,6 +433,8 @@ void fimgSetTexMagFilter(fimgTexture *texture, unsigned mode);
 void fimgSetTexMipmap(fimgTexture *texture, unsigned mode);
 void fimgSetTexCoordSys(fimgTexture *texture, unsigned mode);
 void fimgInvalidateTextureCache(fimgContext *ctx);
+int fimgSetTexPalette(fimgTexture *texture, unsigned int format,
+			const uint32_t *palette, unsigned int count);
 
 /*
  * OpenGL 1.1 compatibility
@@ -340,11 +444,16 @@ void fimgInvalidateTextureCache(fimgContext *ctx);
 
 #define FIMG_NUM_TEXTURE_UNITS	2
 
+#define FIMG_NUM_LIGHTS		8
+
+#define FIMG_NUM_CLIP_PLANES	3
+
 /** Transformation matrices */
 typedef enum {
 	FGFP_MATRIX_TRANSFORM = 0,
 	FGFP_MATRIX_LIGHTING,
-	FGFP_MATRIX_TEXTURE
+	FGFP_MATRIX_TEXTURE,
+	FGFP_MATRIX_MODELVIEW = FGFP_MATRIX_TEXTURE + FIMG_NUM_TEXTURE_UNITS
 } fimgMatrix;
 /**
  * Returns index of texture coordinate matrix of given texture unit.
@@ -352,6 +461,8 @@ typedef enum {
  * @return Index of matrix.
  */
 #define FGFP_MATRIX_TEXTURE(i)	(FGFP_MATRIX_TEXTURE + (i))
+/** Number of matrices used by fixed pipeline emulation. */
+#define FGFP_MATRIX_NUM		(FGFP_MATRIX_MODELVIEW + 1)
 
 /** Texturing functions. */
 typedef enum {
@@ -411,6 +522,88 @@ void fimgCompatSetAlphaScale(fimgContext *ctx, uint32_t unit, float scale);
 void fimgCompatSetEnvColor(fimgContext *ctx, uint32_t unit,
 					float r, float g, float b, float a);
 void fimgCompatSetupTexture(fimgContext *ctx, fimgTexture *tex, uint32_t unit);
+void fimgCompatSetAttribMask(fimgContext *ctx, uint32_t mask);
+void fimgCompatSetAttribConst(fimgContext *ctx, uint32_t attrib,
+							const float *value);
+
+/** Light source parameters (in eye coordinates). */
+typedef struct {
+	float ambient[4];
+	float diffuse[4];
+	float specular[4];
+	/** Position (w != 0) or direction (w == 0). */
+	float position[4];
+	float spotDirection[3];
+	float spotExponent;
+	/** Spot cutoff angle in degrees (180.0 disables spotlight). */
+	float spotCutoff;
+	/** Constant, linear and quadratic attenuation factors. */
+	float attenuation[3];
+} fimgLight;
+
+/** Material parameters. */
+typedef struct {
+	float ambient[4];
+	float diffuse[4];
+	float specular[4];
+	float emission[4];
+	float shininess;
+} fimgMaterial;
+
+void fimgCompatSetLightingEnable(fimgContext *ctx, int enable);
+void fimgCompatSetLightEnable(fimgContext *ctx, uint32_t light, int enable);
+void fimgCompatSetLight(fimgContext *ctx, uint32_t light,
+						const fimgLight *params);
+void fimgCompatSetMaterial(fimgContext *ctx, const fimgMaterial *params);
+void fimgCompatSetLightModelAmbient(fimgContext *ctx, const float *color);
+void fimgCompatSetColorMaterial(fimgContext *ctx, int enable);
+void fimgCompatSetNormalize(fimgContext *ctx, int enable);
+
+/** Fog modes. */
+typedef enum {
+	FGFP_FOG_NONE = 0,
+	FGFP_FOG_LINEAR,
+	FGFP_FOG_EXP,
+	FGFP_FOG_EXP2
+} fimgFogMode;
+
+void fimgCompatSetFog(fimgContext *ctx, fimgFogMode mode,
+				float density, float start, float end);
+void fimgCompatSetFogColor(fimgContext *ctx, const float *color);
+void fimgCompatSetClipPlaneEnable(fimgContext *ctx, uint32_t plane, int enable);
+void fimgCompatSetClipPlane(fimgContext *ctx, uint32_t plane,
+							const float *equation);
+void fimgCompatSetScreenSpace(fimgContext *ctx, int enable);
+
+/** Shader program cache statistics. */
+typedef struct {
+	/** Number of validations that kept current program. */
+	unsigned int sameHits;
+	/** Number of programs found in the cache. */
+	unsigned int hits;
+	/** Number of programs not found in the cache. */
+	unsigned int misses;
+	/** Number of missed programs loaded from persistent cache. */
+	unsigned int diskHits;
+	/** Number of programs evicted to stay within capacity. */
+	unsigned int evictions;
+	/** Number of programs uploaded to instruction memory. */
+	unsigned int uploads;
+	/** Number of program switches to already resident program. */
+	unsigned int residentHits;
+	/** Number of cached programs. */
+	unsigned int entries;
+	/** Maximal number of cached programs. */
+	unsigned int capacity;
+	/** Number of instructions of built programs before optimization. */
+	unsigned int builtInstr;
+	/** Number of instructions of built programs after optimization. */
+	unsigned int optimizedInstr;
+} fimgShaderCacheStats;
+
+void fimgSetShaderCacheCapacity(fimgContext *ctx, unsigned int capacity);
+void fimgGetShaderCacheStats(fimgContext *ctx, fimgShaderCacheStats *vs,
+						fimgShaderCacheStats *ps);
 
 #endif
 
@@ -567,15 +760,66 @@ void fimgSetColorBufBaseAddr(fimgContext *ctx, unsigned int addr);
 void fimgSetFrameBufSize(fimgContext *ctx,
 			unsigned int width, unsigned int height, int flipY);
 
+/*
+ * Memory kernels
+ */
+
+/** Set of optimized memory copy, fill and scaling routines. */
+typedef struct {
+	/** Name of the set. */
+	const char *name;
+	/** Copies cnt 16-byte blocks between word aligned buffers. */
+	void (*copy16)(void *dst, const void *src, unsigned int cnt);
+	/** Fills cnt 32-byte blocks of 16-byte aligned buffer with a pattern. */
+	void *(*fill32)(void *buf, uint32_t val, unsigned int cnt);
+	/** Same as fill32, but preserves bits set in mask. */
+	void *(*fill32masked)(void *buf, uint32_t val,
+					uint32_t mask, unsigned int cnt);
+	/**
+	 * Averages 2x2 blocks of pixels made of comps (1, 2 or 4) 8-bit
+	 * components, taken from two source rows, into cnt pixels.
+	 */
+	void (*downscale8)(void *dst, const void *src0, const void *src1,
+					unsigned int cnt, unsigned int comps);
+	/**
+	 * Averages 2x2 blocks of packed 16-bit pixels, taken from two source
+	 * rows, into cnt pixels. Components are split into two groups by
+	 * mask0 and mask1, components of one group must be separated by
+	 * at least two bits.
+	 */
+	void (*downscale16)(void *dst, const void *src0, const void *src1,
+				unsigned int cnt, uint32_t mask0, uint32_t mask1);
+} fimgKernelSet;
+
+/** Kernel set selected for current CPU. */
+extern const fimgKernelSet *fimgKernels;
+
+int fimgSelectKernels(const char *name);
+
 /*
  * OS support
  */
 
+/** Hardware lock statistics. */
+typedef struct {
+	/** Number of lock acquisitions in last full second. */
+	unsigned int acquisitions;
+	/** Number of context restores in last full second. */
+	unsigned int restores;
+	/** Total number of lock acquisitions. */
+	unsigned int totalAcquisitions;
+	/** Total number of context restores. */
+	unsigned int totalRestores;
+} fimgLockStats;
+
 fimgContext *fimgCreateContext(void);
 void fimgDestroyContext(fimgContext *ctx);
 void fimgRestoreContext(fimgContext *ctx);
 int fimgAcquireHardwareLock(fimgContext *ctx);
 int fimgReleaseHardwareLock(fimgContext *ctx);
+int fimgHardwareLockContended(fimgContext *ctx);
+void fimgReleaseHardware(fimgContext *ctx);
+void fimgGetLockStats(fimgContext *ctx, fimgLockStats *stats);
 int fimgDeviceOpen(fimgContext *ctx);
 void fimgDeviceClose(fimgContext *ctx);
 int fimgWaitForFlush(fimgContext *ctx, uint32_t target);
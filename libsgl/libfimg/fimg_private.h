@@ -26,6 +26,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <pthread.h>
+#include <time.h>
 #include "platform.h"
 #include "fimg.h"
 
@@ -40,6 +42,17 @@
  * Global block
  */
 
+/* Register addresses */
+#define FGGB_PIPESTATE		0x0000
+#define FGGB_CACHECTL		0x0004
+#define FGGB_RST		0x0008
+#define FGGB_VERSION		0x0010
+#define FGGB_INTPENDING		0x0040
+#define FGGB_INTMASK		0x0044
+#define FGGB_PIPEMASK		0x0048
+#define FGGB_PIPETGTSTATE	0x004c
+#define FGGB_PIPEINTSTATE	0x0050
+
 /* Type definitions */
 typedef union {
 	unsigned int val;
@@ -77,6 +90,20 @@ typedef union {
  * Host interface
  */
 
+/* Register addresses */
+#define FGHI_DWSPACE		0x8000
+#define FGHI_FIFO_ENTRY		0xc000
+#define FGHI_CONTROL		0x8008
+#define FGHI_IDXOFFSET		0x800c
+#define FGHI_VBADDR		0x8010
+#define FGHI_VB_ENTRY		0xe000
+#define FGHI_VB_END		0xf000
+
+#define FGHI_ATTRIB(i)		(0x8040 + 4*(i))
+#define FGHI_ATTRIB_VBCTRL(i)	(0x8080 + 4*(i))
+#define FGHI_ATTRIB_VBBASE(i)	(0x80c0 + 4*(i))
+
+/* Type definitions */
 typedef union {
 	unsigned int val;
 	struct {
@@ -325,20 +352,103 @@ struct _fimgTexture {
 	unsigned int baseAddr;
 	unsigned int reserved1;
 	unsigned int reserved2;
+	/* Fields below are not written to texture unit registers */
+	uint32_t *palette;
+	unsigned int paletteSize;
+	uint32_t paletteId;
 };
 
+/** Size of texture unit register block. */
+#define FGTU_TEX_REGS_SIZE	offsetof(fimgTexture, palette)
+
+void fimgRestoreTextureState(fimgContext *ctx);
+
 /*
  * Hardware context
  */
 
+/*
+ * Incremental context restore
+ */
+
+/** Hardware blocks restored independently after lock loss. */
+enum {
+	FIMG_BLOCK_HOST		= (1 << 0),
+	FIMG_BLOCK_PRIMITIVE	= (1 << 1),
+	FIMG_BLOCK_RASTER	= (1 << 2),
+	FIMG_BLOCK_FRAGMENT	= (1 << 3),
+	/** Vertex shader program and constants. */
+	FIMG_BLOCK_VSHADER	= (1 << 4),
+	/** Pixel shader program and constants. */
+	FIMG_BLOCK_PSHADER	= (1 << 5),
+	/** Texture palette memory. */
+	FIMG_BLOCK_TEXTURE	= (1 << 6),
+};
+
+#define FIMG_BLOCK_NUM		7
+#define FIMG_BLOCK_ALL		((1 << FIMG_BLOCK_NUM) - 1)
+
+#define FIMG_SHARED_STATE_MAGIC		0x46534832
+#define FIMG_SHARED_STATE_VERSION	2
+
+/** Hardware state ownership, shared by all clients of the hardware. */
+typedef struct {
+	uint32_t magic;
+	/** Layout and protocol version (FIMG_SHARED_STATE_VERSION). */
+	uint32_t version;
+	/** Incremented by each client taking the hardware from another one. */
+	uint32_t generation;
+	/** Last assigned client identifier. */
+	uint32_t lastClient;
+	/** Client whose state is currently loaded in each block. */
+	uint32_t owner[FIMG_BLOCK_NUM];
+} fimgSharedState;
+
+void fimgRestoreBlocks(fimgContext *ctx, uint32_t blocks);
+uint32_t fimgChangedBlocks(fimgContext *ctx, int ret);
+void fimgPublishBlocks(fimgContext *ctx);
+
+/*
+ * Shadow registers
+ */
+
+/** Register blocks mirrored by shadow register file (in address order). */
+enum {
+	FIMG_SHADOW_PRIMITIVE = 0,
+	FIMG_SHADOW_RASTER,
+	FIMG_SHADOW_RASTER_LOD,
+	FIMG_SHADOW_FRAGMENT,
+
+	FIMG_SHADOW_BLOCKS
+};
+
+/** Maximal number of registers in shadowed register block. */
+#define FIMG_SHADOW_BLOCK_REGS	16
+
+typedef struct {
+	/** Register values to be written to the hardware. */
+	uint32_t val[FIMG_SHADOW_BLOCKS][FIMG_SHADOW_BLOCK_REGS];
+	/** Register values last written to the hardware. */
+	uint32_t hw[FIMG_SHADOW_BLOCKS][FIMG_SHADOW_BLOCK_REGS];
+	/** Bit masks of registers with known hardware value. */
+	uint32_t valid[FIMG_SHADOW_BLOCKS];
+	/** Bit masks of registers waiting to be written. */
+	uint32_t dirty[FIMG_SHADOW_BLOCKS];
+	/** Bit mask of blocks with registers waiting to be written. */
+	uint32_t dirtyBlocks;
+} fimgShadowRegs;
+
 typedef struct {
 	unsigned int intEn;
 	unsigned int intMask;
 	unsigned int intTarget;
+	fimgWaitStats waitStats;
 } fimgGlobalContext;
 
 void fimgCreateGlobalContext(fimgContext *ctx);
 void fimgRestoreGlobalState(fimgContext *ctx);
+int fimgWaitForClear(fimgContext *ctx, uint32_t addr, uint32_t mask);
+int fimgWaitForSet(fimgContext *ctx, uint32_t addr, uint32_t mask);
 
 typedef struct {
 	fimgAttribute attrib[FIMG_ATTRIB_NUM];
@@ -351,6 +461,86 @@ typedef struct {
 void fimgCreateHostContext(fimgContext *ctx);
 void fimgRestoreHostState(fimgContext *ctx);
 
+/** Number of hash buckets of vertex stream cache. */
+#define FIMG_STREAM_CACHE_BUCKETS	64
+
+/** Single hardware batch of cached vertex stream. */
+typedef struct {
+	/** Packed vertex data in vertex buffer layout. */
+	uint8_t *data;
+	/** Size of packed vertex data (in bytes). */
+	unsigned int size;
+	/** Number of vertices in the batch. */
+	unsigned int vertices;
+	/** Vertex buffer configuration of the batch. */
+	fimgVtxBufAttrib vbctrl[FIMG_ATTRIB_NUM];
+	unsigned int vbbase[FIMG_ATTRIB_NUM];
+} fimgStreamBatch;
+
+typedef struct _fimgStream fimgStream;
+
+/** Vertex stream packed for hardware, split into batches. */
+struct _fimgStream {
+	fimgStreamKey key;
+	uint32_t hash;
+	/** Next stream in the same hash bucket. */
+	fimgStream *hashNext;
+	/** Neighbours on LRU list. */
+	fimgStream *lruPrev;
+	fimgStream *lruNext;
+	/** Memory used by the stream (in bytes). */
+	size_t size;
+	/** Set if recording failed and stream must not be used. */
+	int invalid;
+	fimgStreamBatch *batches;
+	unsigned int numBatches;
+	unsigned int maxBatches;
+};
+
+typedef struct {
+	fimgStream *hash[FIMG_STREAM_CACHE_BUCKETS];
+	/** Most recently used stream. */
+	fimgStream *lruHead;
+	/** Least recently used stream. */
+	fimgStream *lruTail;
+	fimgStreamCacheStats stats;
+} fimgStreamCache;
+
+void fimgCreateStreamCache(fimgContext *ctx);
+void fimgDestroyStreamCache(fimgContext *ctx);
+
+/** State of hardware lock retained between sessions. */
+typedef struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t watchdog;
+	int watchdogRunning;
+	int quit;
+	/** Set if the lock is held, but no session is in progress. */
+	volatile int retained;
+	/** End time of last session (in ns). */
+	uint64_t lastUse;
+	/** Time of hardware lock acquisition (in ns). */
+	uint64_t acquired;
+	/** Start time of current statistics period (in ns). */
+	uint64_t periodStart;
+	unsigned int acquisitions;
+	unsigned int restores;
+	fimgLockStats stats;
+} fimgLockState;
+
+void fimgCreateLockState(fimgContext *ctx);
+void fimgDestroyLockState(fimgContext *ctx);
+int fimgResumeHardware(fimgContext *ctx);
+void fimgRetainHardware(fimgContext *ctx);
+void fimgCountLock(fimgContext *ctx, int ret);
+fimgStream *fimgStreamCacheLookup(fimgContext *ctx, const fimgStreamKey *key);
+fimgStream *fimgCreateStream(const fimgStreamKey *key);
+void fimgDestroyStream(fimgStream *stream);
+void fimgStreamAddBatch(fimgStream *stream, fimgContext *ctx,
+							unsigned int vertices);
+void fimgStreamCacheInsert(fimgContext *ctx, fimgStream *stream);
+
 typedef struct {
 	fimgVertexContext vctx;
 	float ox;
@@ -436,10 +626,15 @@ void fimgRestoreFragmentState(fimgContext *ctx);
 #define FGFP_TEX_COMBA_MOD_MASK(i)	(0x1 << (21 + 3*(i)))
 #define FGFP_TEX_COMBA_FUNC_SHIFT	(28)
 #define FGFP_TEX_COMBA_FUNC_MASK	(0x7 << 28)
+#define FGFP_TEX_SCALE_ONE_SHIFT	(31)
+#define FGFP_TEX_SCALE_ONE_MASK		(0x1U << 31)
 #define FGFP_PS_SWAP_SHIFT		(0)
 #define FGFP_PS_SWAP_MASK		(0x1 << 0)
-#define FGFP_PS_INVALID_SHIFT		(31)
-#define FGFP_PS_INVALID_MASK		(0x1 << 31)
+#define FGFP_PS_FOG_SHIFT		(1)
+#define FGFP_PS_FOG_MASK		(0x1 << 1)
+#define FGFP_PS_CLIP_EN_SHIFT(i)	(2 + (i))
+#define FGFP_PS_CLIP_EN_MASK(i)		(0x1 << (2 + (i)))
+#define FGFP_PS_CLIP_EN_ALL_MASK	(0x7 << 2)
 
 typedef union _fimgPixelShaderState {
 	uint32_t val[FIMG_NUM_TEXTURE_UNITS + 1];
@@ -451,13 +646,44 @@ typedef union _fimgPixelShaderState {
 
 #define FGFP_VS_TEX_EN_SHIFT(i)		(i)
 #define FGFP_VS_TEX_EN_MASK(i)		(0x1 << (i))
-#define FGFP_VS_INVALID_SHIFT		(31)
-#define FGFP_VS_INVALID_MASK		(0x1 << 31)
+#define FGFP_VS_TEX_EN_ALL_MASK		((1 << FIMG_NUM_TEXTURE_UNITS) - 1)
+#define FGFP_VS_ATTRIB_EN_SHIFT		(8)
+#define FGFP_VS_ATTRIB_EN_MASK		(0x1ff << 8)
+#define FGFP_VS_LIGHTING_SHIFT		(17)
+#define FGFP_VS_LIGHTING_MASK		(0x1 << 17)
+#define FGFP_VS_COLOR_MATERIAL_SHIFT	(18)
+#define FGFP_VS_COLOR_MATERIAL_MASK	(0x1 << 18)
+#define FGFP_VS_NORMALIZE_SHIFT		(19)
+#define FGFP_VS_NORMALIZE_MASK		(0x1 << 19)
+#define FGFP_VS_FOG_SHIFT		(20)
+#define FGFP_VS_FOG_MASK		(0x3 << 20)
+#define FGFP_VS_CLIP_EN_SHIFT(i)	(22 + (i))
+#define FGFP_VS_CLIP_EN_MASK(i)		(0x1 << (22 + (i)))
+#define FGFP_VS_CLIP_EN_ALL_MASK	(0x7 << 22)
+#define FGFP_VS_SCREEN_SPACE_SHIFT	(25)
+#define FGFP_VS_SCREEN_SPACE_MASK	(0x1 << 25)
+
+#define FGFP_LIGHT_TYPE_SHIFT(i)	(4*(i))
+#define FGFP_LIGHT_TYPE_MASK(i)		(0x3 << (4*(i)))
+#define FGFP_LIGHT_ATTEN_SHIFT(i)	(2 + 4*(i))
+#define FGFP_LIGHT_ATTEN_MASK(i)	(0x1 << (2 + 4*(i)))
+#define FGFP_LIGHT_SPEC_SHIFT(i)	(3 + 4*(i))
+#define FGFP_LIGHT_SPEC_MASK(i)		(0x1 << (3 + 4*(i)))
+
+/** Types of light sources. */
+enum {
+	FGFP_LIGHT_NONE = 0,
+	FGFP_LIGHT_DIRECTIONAL,
+	FGFP_LIGHT_POINT,
+	FGFP_LIGHT_SPOT
+};
 
 typedef union _fimgVertexShaderState {
-	uint32_t val[1];
+	uint32_t val[2];
 	struct {
 		uint32_t vs;
+		/** Per light source state (FGFP_LIGHT_*). */
+		uint32_t light;
 	};
 } fimgVertexShaderState;
 
@@ -468,62 +694,151 @@ typedef struct {
 	fimgTexture *texture;
 } fimgTextureCompat;
 
-typedef struct fimgPixelShaderProgram {
+/** Number of state words identifying fixed pipeline shader program. */
+#define FIMG_SHADER_KEY_LEN		(FIMG_NUM_TEXTURE_UNITS + 1)
+/** Number of hash buckets of shader program cache. */
+#define FIMG_SHADER_CACHE_BUCKETS	32
+/** Number of instructions fitting in shader instruction memory. */
+#define FIMG_SHADER_INSTR_SLOTS		512
+/** Maximal length of generated vertex shader program (in instructions). */
+#define FIMG_MAX_VS_INSTR		FIMG_SHADER_INSTR_SLOTS
+/** Maximal length of generated pixel shader program (in instructions). */
+#define FIMG_MAX_PS_INSTR		64
+
+typedef struct _fimgShaderProgram fimgShaderProgram;
+
+/** Shader program generated for fixed pipeline state. */
+struct _fimgShaderProgram {
+	/** Pipeline state implemented by the program (unused bits cleared). */
+	uint32_t key[FIMG_SHADER_KEY_LEN];
+	uint32_t hash;
+	/** Next program in the same hash bucket. */
+	fimgShaderProgram *hashNext;
+	/** Neighbours on LRU list. */
+	fimgShaderProgram *lruPrev;
+	fimgShaderProgram *lruNext;
+	/** Location of the program in instruction memory. */
+	uint32_t memStart;
+	/** Instruction memory allocation of the program (0 if none). */
+	uint32_t memId;
 	uint32_t instrCount;
-	fimgPixelShaderState state;
-} fimgPixelShaderProgram;
+	/** Program code (4 words per instruction). */
+	uint32_t code[];
+};
 
-typedef struct fimgVertexShaderProgram {
-	uint32_t instrCount;
-	fimgVertexShaderState state;
-} fimgVertexShaderProgram;
+/** Types of fixed pipeline shader programs. */
+enum {
+	FIMG_SHADER_VERTEX = 0,
+	FIMG_SHADER_PIXEL,
 
-#define VS_CACHE_SIZE	4
-#define PS_CACHE_SIZE	8
+	FIMG_SHADER_TYPES
+};
+
+/** Residency of cached programs in shader instruction memory. */
+typedef struct {
+	/** Allocation owning each instruction slot (0 if unknown). */
+	uint32_t owner[FIMG_SHADER_INSTR_SLOTS];
+	/** First slot of next allocation. */
+	uint32_t next;
+	/** Identifier of last allocation. */
+	uint32_t lastId;
+	/** Set if constants used by shader blocks are loaded. */
+	int constLoaded;
+} fimgShaderMemory;
+
+typedef struct {
+	/** Type of cached programs (FIMG_SHADER_*). */
+	unsigned int type;
+	fimgShaderProgram *hash[FIMG_SHADER_CACHE_BUCKETS];
+	/** Most recently used program. */
+	fimgShaderProgram *lruHead;
+	/** Least recently used program. */
+	fimgShaderProgram *lruTail;
+	/** Program selected for current pipeline state. */
+	fimgShaderProgram *current;
+	fimgShaderMemory mem;
+	fimgShaderCacheStats stats;
+} fimgShaderCache;
+
+/** Persistent shader program cache file, mapped read-only. */
+typedef struct {
+	/** Identifier of shader blocks and code generator. */
+	uint32_t buildId;
+	const uint8_t *data;
+	size_t size;
+	/** Set if programs missing in the file have been generated. */
+	int dirty;
+} fimgShaderDiskCache;
+
+void fimgCreateShaderCache(fimgShaderCache *cache, unsigned int type);
+void fimgDestroyShaderCache(fimgShaderCache *cache);
+fimgShaderProgram *fimgShaderCacheLookup(fimgShaderCache *cache,
+							const uint32_t *key);
+fimgShaderProgram *fimgShaderCacheInsert(fimgShaderCache *cache,
+		const uint32_t *key, const uint32_t *code, uint32_t instrCount);
+int fimgShaderMakeResident(fimgShaderCache *cache, fimgShaderProgram *prog);
+void fimgResetShaderMemory(fimgShaderCache *cache);
+void fimgOpenShaderDiskCache(fimgContext *ctx, uint32_t buildId);
+void fimgCloseShaderDiskCache(fimgContext *ctx);
+fimgShaderProgram *fimgShaderDiskCacheLookup(fimgContext *ctx,
+				fimgShaderCache *cache, const uint32_t *key);
 
 typedef struct {
 	uint32_t		*vshaderBuf;
 	int			vshaderLoaded;
-	uint32_t		curVsNum;
-	uint32_t		vsEvictCounter;
 	fimgVertexShaderState	vsState;
-	fimgVertexShaderProgram	vertexShaders[VS_CACHE_SIZE];
-#ifdef FIMG_SHADER_CACHE_STATS
-	uint8_t			vsMisses;
-	uint8_t			vsSameHits;
-	uint8_t			vsCacheHits;
-	uint8_t			vsStatsCounter;
-#endif
+	fimgShaderCache		vsCache;
 
 	uint32_t		*pshaderBuf;
 	int			pshaderLoaded;
-	uint32_t		curPsNum;
-	uint32_t		psEvictCounter;
 	uint32_t		psMask[FIMG_NUM_TEXTURE_UNITS + 1];
 	fimgPixelShaderState	psState;
-	fimgPixelShaderProgram	pixelShaders[PS_CACHE_SIZE];
-#ifdef FIMG_SHADER_CACHE_STATS
-	uint8_t			psMisses;
-	uint8_t			psSameHits;
-	uint8_t			psCacheHits;
-	uint8_t			psStatsCounter;
-#endif
+	fimgShaderCache		psCache;
+	fimgShaderDiskCache	diskCache;
 
 	fimgTextureCompat	texture[FIMG_NUM_TEXTURE_UNITS];
 
-	int			matrixDirty[2 + FIMG_NUM_TEXTURE_UNITS];
-	const float		*matrix[2 + FIMG_NUM_TEXTURE_UNITS];
+	int			matrixDirty[FGFP_MATRIX_NUM];
+	const float		*matrix[FGFP_MATRIX_NUM];
+
+	float			attribConst[FIMG_ATTRIB_NUM][4];
+	uint32_t		attribConstDirty;
+
+	fimgLight		light[FIMG_NUM_LIGHTS];
+	uint32_t		lightEnable;
+	fimgMaterial		material;
+	float			sceneAmbient[4];
+	int			lightDirty;
+
+	float			fogParams[4];
+	float			fogColor[4];
+	int			fogDirty;
+	int			fogColorDirty;
+
+	float			clipPlane[FIMG_NUM_CLIP_PLANES][4];
+	uint32_t		clipPlaneDirty;
 } fimgCompatContext;
 
 void fimgCreateCompatContext(fimgContext *ctx);
-void fimgRestoreCompatState(fimgContext *ctx);
+void fimgDestroyCompatContext(fimgContext *ctx);
+void fimgRestoreCompatState(fimgContext *ctx, uint32_t blocks);
 void fimgCompatFlush(fimgContext *ctx);
 
 #endif
 
+#ifdef FIMG_SOFTWARE_BACKEND
+typedef struct _fimgSwBackend fimgSwBackend;
+
+void fimgSwWrite(fimgContext *ctx, unsigned int data, unsigned int addr);
+unsigned int fimgSwRead(fimgContext *ctx, unsigned int addr);
+#endif
+
 struct _fimgContext {
 	volatile char *base;
 	int fd;
+#ifdef FIMG_SOFTWARE_BACKEND
+	fimgSwBackend *sw;
+#endif
 	/* Individual contexts */
 	fimgGlobalContext global;
 	fimgHostContext host;
@@ -535,22 +850,71 @@ struct _fimgContext {
 #endif
 	/* Shared context */
 	unsigned int invalTexCache;
+	uint32_t texPaletteId;
 	unsigned int numAttribs;
 	unsigned int fbHeight;
 	unsigned int fbFlags;
 	int flipY;
-	/* Register queue */
-	unsigned int *queueStart;
-	unsigned int *queue;
-	unsigned int queueLen;
+	/* Shadow registers */
+	fimgShadowRegs shadow;
 	/* Lock state */
 	unsigned int locked;
+	unsigned int numSessions;
+	fimgLockState lock;
+	/* Incremental restore */
+	fimgSharedState *shared;
+	uint32_t sharedGeneration;
+	uint32_t clientId;
+	uint32_t touched;
 	/* Vertex data */
 	uint8_t *vertexData;
 	size_t vertexDataSize;
+	fimgStreamCache streamCache;
+	struct _fimgIndexedBatch *indexedBatch;
 };
 
 /* Registry accessors */
+#ifdef FIMG_SOFTWARE_BACKEND
+typedef union {
+	unsigned int u;
+	float f;
+} fimgSwWord;
+
+static inline void fimgWrite(fimgContext *ctx, unsigned int data, unsigned int addr)
+{
+	fimgSwWrite(ctx, data, addr);
+}
+
+static inline unsigned int fimgRead(fimgContext *ctx, unsigned int addr)
+{
+	return fimgSwRead(ctx, addr);
+}
+
+static inline void fimgWriteF(fimgContext *ctx, float data, unsigned int addr)
+{
+	fimgSwWord word;
+
+	word.f = data;
+	fimgSwWrite(ctx, word.u, addr);
+}
+
+static inline float fimgReadF(fimgContext *ctx, unsigned int addr)
+{
+	fimgSwWord word;
+
+	word.u = fimgSwRead(ctx, addr);
+	return word.f;
+}
+
+static inline void fimgWriteBlock(fimgContext *ctx, const uint32_t *data,
+					unsigned int addr, unsigned int count)
+{
+	while (count--) {
+		fimgSwWrite(ctx, *(data++), addr);
+		addr += 4;
+	}
+}
+#else
 static inline void fimgWrite(fimgContext *ctx, unsigned int data, unsigned int addr)
 {
 	volatile unsigned int *reg = (volatile unsigned int *)((volatile char *)ctx->base + addr);
@@ -607,71 +971,192 @@ static inline float fimgReadF(fimgContext *ctx, unsigned int addr)
 	return val;
 }
 
-/* Register queue */
-#define FIMG_MAX_QUEUE_LEN	64
+static inline void fimgWriteBlock(fimgContext *ctx, const uint32_t *data,
+					unsigned int addr, unsigned int count)
+{
+	volatile uint32_t *reg = (volatile uint32_t *)(ctx->base + addr);
+#ifdef FIMG_DEBUG_HW_LOCK
+	if (!ctx->locked) {
+		LOGE("Tried to access hardware registers without hw lock.");
+		return;
+	}
+#endif
+	while (count--)
+		*(reg++) = *(data++);
+	__sync_synchronize();
+}
+#endif /* FIMG_SOFTWARE_BACKEND */
+
+/* Shadow registers */
+
+/**
+ * Gets shadow register block containing given register.
+ * @param addr Register address.
+ * @return Shadow register block index or FIMG_SHADOW_BLOCKS if the register
+ * is not shadowed.
+ */
+static inline unsigned int fimgShadowBlock(unsigned int addr)
+{
+	switch (addr & ~0xfff) {
+	case 0x30000:
+		return FIMG_SHADOW_PRIMITIVE;
+	case 0x38000:
+		return FIMG_SHADOW_RASTER;
+	case 0x3c000:
+		return FIMG_SHADOW_RASTER_LOD;
+	case 0x70000:
+		return FIMG_SHADOW_FRAGMENT;
+	default:
+		LOGE("Register %05x is not shadowed.", addr);
+		return FIMG_SHADOW_BLOCKS;
+	}
+}
+
+/**
+ * Gets base address of shadow register block.
+ * @param block Shadow register block index.
+ * @return Address of first register of the block.
+ */
+static inline unsigned int fimgShadowBase(unsigned int block)
+{
+	static const unsigned int base[FIMG_SHADOW_BLOCKS] = {
+		[FIMG_SHADOW_PRIMITIVE]		= 0x30000,
+		[FIMG_SHADOW_RASTER]		= 0x38000,
+		[FIMG_SHADOW_RASTER_LOD]	= 0x3c000,
+		[FIMG_SHADOW_FRAGMENT]		= 0x70000,
+	};
+
+	return base[block];
+}
+
+/**
+ * Gets hardware block containing shadow register block.
+ * @param block Shadow register block index.
+ * @return Hardware block bit (FIMG_BLOCK_*).
+ */
+static inline uint32_t fimgShadowHwBlock(unsigned int block)
+{
+	static const uint32_t hwBlock[FIMG_SHADOW_BLOCKS] = {
+		[FIMG_SHADOW_PRIMITIVE]		= FIMG_BLOCK_PRIMITIVE,
+		[FIMG_SHADOW_RASTER]		= FIMG_BLOCK_RASTER,
+		[FIMG_SHADOW_RASTER_LOD]	= FIMG_BLOCK_RASTER,
+		[FIMG_SHADOW_FRAGMENT]		= FIMG_BLOCK_FRAGMENT,
+	};
+
+	return hwBlock[block];
+}
+
+/**
+ * Marks hardware values of shadow registers in restored blocks as unknown
+ * and drops their pending writes.
+ * @param ctx Hardware context.
+ * @param blocks Bit mask of restored hardware blocks (FIMG_BLOCK_*).
+ */
+static inline void fimgResetShadow(fimgContext *ctx, uint32_t blocks)
+{
+	fimgShadowRegs *shadow = &ctx->shadow;
+	unsigned int block;
+
+	for (block = 0; block < FIMG_SHADOW_BLOCKS; ++block) {
+		if (!(blocks & fimgShadowHwBlock(block)))
+			continue;
 
+		shadow->valid[block] = 0;
+		shadow->dirty[block] = 0;
+		shadow->dirtyBlocks &= ~(1 << block);
+	}
+}
+
+/**
+ * Writes changed shadow registers to the hardware, in address order.
+ * (Must be called with hardware lock.)
+ * @param ctx Hardware context.
+ */
 static inline void fimgQueueFlush(fimgContext *ctx)
 {
-	unsigned int cnt;
-	unsigned int *ptr;
+	fimgShadowRegs *shadow = &ctx->shadow;
+	unsigned int block, reg;
+	uint32_t dirty;
 
-	if (!ctx->queueLen)
+	if (!shadow->dirtyBlocks)
 		return;
 
-	/* Above the maximum length it's more effective to restore the whole
-	 * context than just the changed registers */
-	if (ctx->queueLen == FIMG_MAX_QUEUE_LEN) {
-		fimgRestoreContext(ctx);
-		return;
-	}
+	for (block = 0; block < FIMG_SHADOW_BLOCKS; ++block) {
+		dirty = shadow->dirty[block];
+		if (!dirty)
+			continue;
 
-	cnt = ctx->queueLen;
-	ptr = ctx->queueStart + 2;
+		shadow->valid[block] |= dirty;
+		shadow->dirty[block] = 0;
+		ctx->touched |= fimgShadowHwBlock(block);
 
-	while (cnt--) {
-		fimgWrite(ctx, ptr[1], ptr[0]);
-		ptr += 2;
+		do {
+			reg = __builtin_ctz(dirty);
+			dirty &= dirty - 1;
+
+			shadow->hw[block][reg] = shadow->val[block][reg];
+			fimgWrite(ctx, shadow->val[block][reg],
+					fimgShadowBase(block) + 4*reg);
+		} while (dirty);
 	}
 
-	ctx->queueLen = 0;
-	ctx->queue = ctx->queueStart;
-	ctx->queue[0] = 0;
+	shadow->dirtyBlocks = 0;
 }
 
+/**
+ * Stores register value in shadow register file.
+ * The value will be written to the hardware by fimgQueueFlush(), unless
+ * it is the same as the value already present in the hardware.
+ * @param ctx Hardware context.
+ * @param data Register value.
+ * @param addr Register address.
+ */
 static inline void fimgQueue(fimgContext *ctx, unsigned int data, unsigned int addr)
 {
-	if (ctx->queue[0] == addr) {
-		ctx->queue[1] = data;
+	fimgShadowRegs *shadow = &ctx->shadow;
+	unsigned int block = fimgShadowBlock(addr);
+	unsigned int reg = (addr & 0xfff) / 4;
+	uint32_t bit = 1 << reg;
+
+	if (unlikely(block == FIMG_SHADOW_BLOCKS)) {
+		/* Keep the hardware right, even if the caller is not */
+		fimgWrite(ctx, data, addr);
 		return;
 	}
 
-	/* Above the maximum length it's more effective to restore the whole
-	 * context than just the changed registers */
-	if (ctx->queueLen == FIMG_MAX_QUEUE_LEN)
+	shadow->val[block][reg] = data;
+
+	if ((shadow->valid[block] & bit) && shadow->hw[block][reg] == data) {
+		shadow->dirty[block] &= ~bit;
 		return;
+	}
 
-	ctx->queue += 2;
-	ctx->queueLen++;
-	ctx->queue[0] = addr;
-	ctx->queue[1] = data;
+	shadow->dirty[block] |= bit;
+	shadow->dirtyBlocks |= 1 << block;
 }
 
 static inline void fimgQueueF(fimgContext *ctx, float data, unsigned int addr)
 {
-	if (ctx->queue[0] == addr) {
-		((float *)ctx->queue)[1] = data;
-		return;
-	}
+	union {
+		float f;
+		unsigned int u;
+	} val;
 
-	/* Above the maximum length it's more effective to restore the whole
-	 * context than just the changed registers */
-	if (ctx->queueLen == FIMG_MAX_QUEUE_LEN)
-		return;
+	val.f = data;
+	fimgQueue(ctx, val.u, addr);
+}
+
+/**
+ * Returns current monotonic time in nanoseconds.
+ * @return Current time.
+ */
+static inline uint64_t fimgGetTime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	ctx->queue += 2;
-	ctx->queueLen++;
-	ctx->queue[0] = addr;
-	((float *)ctx->queue)[1] = data;
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
 
 /* Hardware context */
@@ -680,15 +1165,26 @@ static inline void fimgGetHardware(fimgContext *ctx)
 {
 	int ret;
 
+	++ctx->numSessions;
+
+#ifdef FIMG_LAZY_LOCK
+	if (ctx->lock.retained && fimgResumeHardware(ctx))
+		return;
+#endif
+
 	ret = fimgAcquireHardwareLock(ctx);
+	fimgCountLock(ctx, ret);
 	if (likely(!ret))
 		return;
 
 	switch (ret) {
 	case 2:
-		/* Fall through */
+		/* Hardware state has been lost */
+		fimgRestoreGlobalState(ctx);
+		/* fall through */
 	case 1:
-		fimgRestoreContext(ctx);
+		/* Another client used the hardware */
+		fimgRestoreBlocks(ctx, fimgChangedBlocks(ctx, ret));
 		break;
 	default:
 		fprintf(stderr, "FIMG: Could not acquire hardware lock");
@@ -710,7 +1206,14 @@ static inline void fimgFlushContext(fimgContext *ctx)
 
 static inline void fimgPutHardware(fimgContext *ctx)
 {
+	if (ctx->touched)
+		fimgPublishBlocks(ctx);
+
+#ifdef FIMG_LAZY_LOCK
+	fimgRetainHardware(ctx);
+#else
 	fimgReleaseHardwareLock(ctx);
+#endif
 }
 
 extern void fimgDumpState(fimgContext *ctx, unsigned mode, unsigned count, const char *func);
@@ -24,22 +24,13 @@
 #endif
 
 #include "fimg_private.h"
+#include <sched.h>
 #include <unistd.h>
 
 /*
  * Global hardware
  */
 
-#define FGGB_PIPESTATE		0x0000
-#define FGGB_CACHECTL		0x0004
-#define FGGB_RST		0x0008
-#define FGGB_VERSION		0x0010
-#define FGGB_INTPENDING		0x0040
-#define FGGB_INTMASK		0x0044
-#define FGGB_PIPEMASK		0x0048
-#define FGGB_PIPETGTSTATE	0x004c
-#define FGGB_PIPEINTSTATE	0x0050
-
 typedef union {
 	unsigned int val;
 	struct {
@@ -54,6 +45,127 @@ typedef union {
 	};
 } fimgCacheCtl;
 
+/*
+ * Adaptive waiting
+ *
+ * Most hardware operations finish within a few register reads, so waits
+ * spin for FIMG_WAIT_SPIN_COUNT reads first. Longer waits give the CPU away
+ * to the application. Pipeline flushes block in the kernel driver, which
+ * waits for pipeline interrupt. Cache and FIFO operations cannot be waited
+ * for by the kernel driver, so they are polled, yielding the CPU between
+ * reads for FIMG_WAIT_YIELD_TIME, and only then with short sleeps, which
+ * are kept well below the scheduler tick (10 ms).
+ */
+
+/** Time of polling wait yielding the CPU before it starts sleeping (in ns). */
+#define FIMG_WAIT_YIELD_TIME	1000000
+/** Initial sleep time of polling wait (in us). */
+#define FIMG_WAIT_SLEEP_MIN	20
+/** Maximal sleep time of polling wait (in us). */
+#define FIMG_WAIT_SLEEP_MAX	160
+
+/**
+ * Checks whether wait condition is met.
+ * @param val Register value.
+ * @param mask Bit mask of checked bits.
+ * @param clear Non-zero to wait for clear bits, zero to wait for any set bit.
+ * @return Non-zero if the condition is met, otherwise zero.
+ */
+static inline int waitDone(uint32_t val, uint32_t mask, int clear)
+{
+	return clear ? !(val & mask) : !!(val & mask);
+}
+
+/**
+ * Waits for state of selected bits of a register.
+ * (Must be called with hardware lock.)
+ * @param ctx Hardware context.
+ * @param addr Register address.
+ * @param mask Bit mask of checked bits.
+ * @param clear Non-zero to wait for clear bits, zero to wait for any set bit.
+ * @return 0 on success, negative on error.
+ */
+static int waitForRegister(fimgContext *ctx, uint32_t addr,
+						uint32_t mask, int clear)
+{
+	fimgWaitStats *stats = &ctx->global.waitStats;
+	unsigned int delay = FIMG_WAIT_SLEEP_MIN;
+	unsigned int spins = FIMG_WAIT_SPIN_COUNT;
+	uint64_t start, now;
+	int ret = 0;
+
+	if (waitDone(fimgRead(ctx, addr), mask, clear))
+		return 0;
+
+	start = fimgGetTime();
+
+	while (spins--) {
+		if (waitDone(fimgRead(ctx, addr), mask, clear)) {
+			stats->spinTime += fimgGetTime() - start;
+			++stats->spins;
+			return 0;
+		}
+	}
+
+	now = fimgGetTime();
+	stats->spinTime += now - start;
+	++stats->sleeps;
+
+	if (addr == FGGB_PIPESTATE && clear) {
+		ret = fimgWaitForFlush(ctx, mask);
+	} else {
+		do {
+			if (fimgGetTime() - now < FIMG_WAIT_YIELD_TIME) {
+				sched_yield();
+				continue;
+			}
+			usleep(delay);
+			if (delay < FIMG_WAIT_SLEEP_MAX)
+				delay *= 2;
+		} while (!waitDone(fimgRead(ctx, addr), mask, clear));
+	}
+
+	stats->sleepTime += fimgGetTime() - now;
+
+	return ret;
+}
+
+/**
+ * Waits until selected bits of a register get cleared.
+ * (Must be called with hardware lock.)
+ * @param ctx Hardware context.
+ * @param addr Register address.
+ * @param mask Bit mask of checked bits.
+ * @return 0 on success, negative on error.
+ */
+int fimgWaitForClear(fimgContext *ctx, uint32_t addr, uint32_t mask)
+{
+	return waitForRegister(ctx, addr, mask, 1);
+}
+
+/**
+ * Waits until any of selected bits of a register gets set.
+ * (Must be called with hardware lock.)
+ * @param ctx Hardware context.
+ * @param addr Register address.
+ * @param mask Bit mask of checked bits.
+ * @return 0 on success, negative on error.
+ */
+int fimgWaitForSet(fimgContext *ctx, uint32_t addr, uint32_t mask)
+{
+	return waitForRegister(ctx, addr, mask, 0);
+}
+
+/**
+ * Retrieves hardware wait statistics.
+ * @param ctx Hardware context.
+ * @param stats Structure to fill with statistics.
+ */
+void fimgGetWaitStats(fimgContext *ctx, fimgWaitStats *stats)
+{
+	*stats = ctx->global.waitStats;
+}
+
 /**
  * Obtains status of graphics pipeline.
  * (Must be called with hardware lock.)
@@ -73,12 +185,8 @@ uint32_t fimgGetPipelineStatus(fimgContext *ctx)
  */
 int fimgFlush(fimgContext *ctx)
 {
-	/* Return if already flushed */
-	if((fimgRead(ctx, FGGB_PIPESTATE) & FGHI_PIPELINE_ALL) == 0)
-		return 0;
-
 	/* Flush whole pipeline */
-	return fimgWaitForFlush(ctx, FGHI_PIPELINE_ALL);
+	return fimgWaitForClear(ctx, FGGB_PIPESTATE, FGHI_PIPELINE_ALL);
 }
 
 /**
@@ -90,10 +198,7 @@ int fimgFlush(fimgContext *ctx)
  */
 int fimgSelectiveFlush(fimgContext *ctx, uint32_t mask)
 {
-	if (fimgRead(ctx, FGGB_PIPESTATE) & mask)
-		return fimgWaitForFlush(ctx, mask);
-
-	return 0;
+	return fimgWaitForClear(ctx, FGGB_PIPESTATE, mask);
 }
 
 /**
@@ -116,9 +221,7 @@ int fimgInvalidateCache(fimgContext *ctx,
 
 	fimgWrite(ctx, ctl.val, FGGB_CACHECTL); // start clearing the cache
 
-	while(fimgRead(ctx, FGGB_CACHECTL) & ctl.val);
-
-	return 0;
+	return fimgWaitForClear(ctx, FGGB_CACHECTL, ctl.val);
 }
 
 /**
@@ -159,9 +262,7 @@ int fimgWaitForCacheFlush(fimgContext *ctx,
 	ctl.ccflush = ccflush;
 	ctl.zcflush = zcflush;
 
-	while(fimgRead(ctx, FGGB_CACHECTL) & ctl.val);
-
-	return 0;
+	return fimgWaitForClear(ctx, FGGB_CACHECTL, ctl.val);
 }
 
 /**
@@ -179,6 +280,17 @@ void fimgFinish(fimgContext *ctx)
 	fimgPutHardware(ctx);
 }
 
+/**
+ * Gets number of hardware sessions started in the context.
+ * Each session corresponds to single acquisition of hardware lock.
+ * @param ctx Hardware context.
+ * @return Number of sessions since context creation.
+ */
+unsigned int fimgGetSessionCount(fimgContext *ctx)
+{
+	return ctx->numSessions;
+}
+
 /**
  * Resets graphics pipeline without affecting register values.
  * (Must be called with hardware lock.)
@@ -32,17 +32,6 @@
 
 #define FGHI_FIFO_SIZE		32
 
-#define FGHI_DWSPACE		0x8000
-#define FGHI_FIFO_ENTRY		0xc000
-#define FGHI_CONTROL		0x8008
-#define FGHI_IDXOFFSET		0x800c
-#define FGHI_VBADDR		0x8010
-#define FGHI_VB_ENTRY		0xe000
-
-#define FGHI_ATTRIB(i)		(0x8040 + 4*(i))
-#define FGHI_ATTRIB_VBCTRL(i)	(0x8080 + 4*(i))
-#define FGHI_ATTRIB_VBBASE(i)	(0x80c0 + 4*(i))
-
 typedef enum {
 	FGHI_CONTROLIdxTYPE_UINT = 0,
 	FGHI_CONTROLIdxTYPE_USHORT,
@@ -97,7 +86,11 @@ static inline void setVtxBufAttrib(fimgContext *ctx, unsigned char idx,
  * BUFFERED
  */
 
-#define VERTEX_BUFFER_SIZE	(4096)
+/* Hardware vertex buffer is 4 KB, split into regions for double buffering */
+#define VERTEX_BUFFER_HW_SIZE	(4096)
+#define VERTEX_BUFFER_REGIONS	(2)
+#define VERTEX_BUFFER_SIZE	(VERTEX_BUFFER_HW_SIZE / VERTEX_BUFFER_REGIONS)
+#define VERTEX_BUFFER_BASE(region)	(VERTEX_BUFFER_SIZE*(region))
 #define VERTEX_BUFFER_CONST	(MAX_WORDS_PER_VERTEX)
 #define VERTEX_BUFFER_WORDS	(VERTEX_BUFFER_SIZE / 4 - VERTEX_BUFFER_CONST)
 
@@ -190,27 +183,25 @@ static unsigned int calculateBatchSize(fimgArray *arrays, int count)
 
 /**
  * Copies vertex data from local memory to hardware vertex buffer.
+ * Hardware vertex buffer is split into VERTEX_BUFFER_REGIONS regions,
+ * so a batch can be uploaded while the previous one is still being
+ * processed from another region.
  * @param ctx Hardware context.
+ * @param region Index of vertex buffer region to fill.
+ * @param data Packed vertex data (32-byte aligned).
+ * @param size Size of vertex data in bytes.
  */
-static void fillVertexBuffer(fimgContext *ctx)
+static void fillVertexBuffer(fimgContext *ctx, unsigned int region,
+					const uint8_t *data, unsigned int size)
 {
-	volatile uint32_t *reg =
-			(volatile uint32_t *)(ctx->base + FGHI_VB_ENTRY);
-	uint32_t *data = (uint32_t *)ctx->vertexData;
-	unsigned count = (ctx->vertexDataSize + 31) / 32;
+	unsigned count = (size + 31) / 32;
 
-	fimgWrite(ctx, 0, FGHI_VBADDR);
-
-	asm volatile (
-		"1:\n\t"
-		"ldmia %1!, {r0-r7}\n\t"
-		"stmia %0!, {r0-r7}\n\t"
-		"subs %2, %2, $1\n\t"
-		"bne 1b\n\t"
-		:
-		: "r"(reg), "r"(data), "r"(count)
-		: "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7"
-	);
+	fimgWrite(ctx, VERTEX_BUFFER_BASE(region), FGHI_VBADDR);
+#ifdef FIMG_SOFTWARE_BACKEND
+	fimgWriteBlock(ctx, (const uint32_t *)data, FGHI_VB_ENTRY, 8*count);
+#else
+	fimgKernels->copy16((void *)(ctx->base + FGHI_VB_ENTRY), data, 2*count);
+#endif
 }
 
 #define BUF_ADDR_32(buf, offs)	\
@@ -220,6 +211,146 @@ static void fillVertexBuffer(fimgContext *ctx)
 #define BUF_ADDR_8(buf, offs)	\
 			((const uint8_t *)(buf) + (offs))
 
+/*
+ * Word copy helpers
+ */
+
+/**
+ * Copies given number of words.
+ * Called with constant count, which lets the compiler unroll the copy
+ * into multiple register loads and stores (ldm/stm on ARM).
+ * @param buf Destination buffer.
+ * @param data Source data.
+ * @param words Word count.
+ * @return Pointer to first word after copied data in destination buffer.
+ */
+static inline uint32_t *copyWords(uint32_t *buf,
+					const uint32_t *data, uint32_t words)
+{
+	while (words--)
+		*(buf++) = *(data++);
+
+	return buf;
+}
+
+/**
+ * Packs word aligned attribute data (unindexed variant).
+ * Most common attribute layouts (ubyte4, float2, float3, float4) get
+ * separate loops with constant vertex size.
+ * @param buf Destination buffer.
+ * @param data Data of first vertex.
+ * @param stride Vertex stride (in bytes).
+ * @param width Attribute width (in bytes, multiple of 4).
+ * @param cnt Vertex count.
+ */
+static void packWords(uint32_t *buf, const uint8_t *data,
+				uint32_t stride, uint32_t width, int cnt)
+{
+	switch (width) {
+	case 4:
+		for (; cnt--; data += stride)
+			buf = copyWords(buf, (const uint32_t *)data, 1);
+		break;
+	case 8:
+		for (; cnt--; data += stride)
+			buf = copyWords(buf, (const uint32_t *)data, 2);
+		break;
+	case 12:
+		for (; cnt--; data += stride)
+			buf = copyWords(buf, (const uint32_t *)data, 3);
+		break;
+	case 16:
+		for (; cnt--; data += stride)
+			buf = copyWords(buf, (const uint32_t *)data, 4);
+		break;
+	default:
+		for (; cnt--; data += stride)
+			buf = copyWords(buf, (const uint32_t *)data, width / 4);
+	}
+}
+
+/**
+ * Packs word aligned attribute data (uint16_t indexed variant).
+ * @param buf Destination buffer.
+ * @param base Data of vertex 0.
+ * @param stride Vertex stride (in bytes).
+ * @param width Attribute width (in bytes, multiple of 4).
+ * @param idx Array of vertex indices.
+ * @param cnt Vertex count.
+ */
+static void packWordsIdx16(uint32_t *buf, const uint8_t *base,
+				uint32_t stride, uint32_t width,
+				const uint16_t *idx, int cnt)
+{
+	switch (width) {
+	case 4:
+		while (cnt--)
+			buf = copyWords(buf,
+				BUF_ADDR_32(base, *(idx++)*stride), 1);
+		break;
+	case 8:
+		while (cnt--)
+			buf = copyWords(buf,
+				BUF_ADDR_32(base, *(idx++)*stride), 2);
+		break;
+	case 12:
+		while (cnt--)
+			buf = copyWords(buf,
+				BUF_ADDR_32(base, *(idx++)*stride), 3);
+		break;
+	case 16:
+		while (cnt--)
+			buf = copyWords(buf,
+				BUF_ADDR_32(base, *(idx++)*stride), 4);
+		break;
+	default:
+		while (cnt--)
+			buf = copyWords(buf,
+				BUF_ADDR_32(base, *(idx++)*stride), width / 4);
+	}
+}
+
+/**
+ * Packs word aligned attribute data (uint8_t indexed variant).
+ * @param buf Destination buffer.
+ * @param base Data of vertex 0.
+ * @param stride Vertex stride (in bytes).
+ * @param width Attribute width (in bytes, multiple of 4).
+ * @param idx Array of vertex indices.
+ * @param cnt Vertex count.
+ */
+static void packWordsIdx8(uint32_t *buf, const uint8_t *base,
+				uint32_t stride, uint32_t width,
+				const uint8_t *idx, int cnt)
+{
+	switch (width) {
+	case 4:
+		while (cnt--)
+			buf = copyWords(buf,
+				BUF_ADDR_32(base, *(idx++)*stride), 1);
+		break;
+	case 8:
+		while (cnt--)
+			buf = copyWords(buf,
+				BUF_ADDR_32(base, *(idx++)*stride), 2);
+		break;
+	case 12:
+		while (cnt--)
+			buf = copyWords(buf,
+				BUF_ADDR_32(base, *(idx++)*stride), 3);
+		break;
+	case 16:
+		while (cnt--)
+			buf = copyWords(buf,
+				BUF_ADDR_32(base, *(idx++)*stride), 4);
+		break;
+	default:
+		while (cnt--)
+			buf = copyWords(buf,
+				BUF_ADDR_32(base, *(idx++)*stride), width / 4);
+	}
+}
+
 /*
  * Unindexed
  */
@@ -248,21 +379,8 @@ static uint32_t packAttribute(fimgContext *ctx, uint32_t *buf,
 	case 0:
 		/* Check if vertices are word aligned */
 		if ((uintptr_t)a->pointer % 4 == 0 && a->stride % 4 == 0) {
-			uint32_t len, srcpad = (a->stride - a->width) / 4;
-			const uint32_t *data =
-					BUF_ADDR_32(a->pointer, pos*a->stride);
-
-			while (cnt--) {
-				len = a->width;
-
-				while (len) {
-					*(buf++) = *(data++);
-					len -= 4;
-				}
-
-				data += srcpad;
-			}
-
+			packWords(buf, BUF_ADDR_8(a->pointer, pos*a->stride),
+						a->stride, a->width, cnt);
 			break;
 		}
 	/* halfwords */
@@ -315,7 +433,7 @@ static uint32_t packAttribute(fimgContext *ctx, uint32_t *buf,
 				// Up to 3 bytes left
 				if (len) {
 					word = *(data++);
-					if (len == 2)
+					if (len >= 2)
 						word |= *(data++) << 8;
 					if (len == 3)
 						word |= *(data++) << 16;
@@ -677,31 +795,8 @@ static uint32_t packAttributeIdx16(fimgContext *ctx, uint32_t *buf,
 	case 0:
 		/* Check if vertices are word aligned */
 		if ((uintptr_t)a->pointer % 4 == 0 && a->stride % 4 == 0) {
-			const uint32_t *data, *next_data;
-
-			next_data = BUF_ADDR_32(a->pointer, *(idx++)*a->stride);
-			--cnt;
-
-			while (cnt--) {
-				data = next_data;
-				next_data = BUF_ADDR_32(a->pointer,
-							*(idx++)*a->stride);
-				len = a->width;
-
-				while (len) {
-					*(buf++) = *(data++);
-					len -= 4;
-				}
-			}
-
-			data = next_data;
-			len = a->width;
-
-			while (len) {
-				*(buf++) = *(data++);
-				len -= 4;
-			}
-
+			packWordsIdx16(buf, (const uint8_t *)a->pointer,
+					a->stride, a->width, idx, cnt);
 			break;
 		}
 	/* halfwords */
@@ -741,6 +836,10 @@ static uint32_t packAttributeIdx16(fimgContext *ctx, uint32_t *buf,
 				len -= 4;
 			}
 
+			/* Single halfword left */
+			if (len)
+				*(buf++) = *(data++);
+
 			break;
 		}
 	/* bytes */
@@ -770,7 +869,7 @@ static uint32_t packAttributeIdx16(fimgContext *ctx, uint32_t *buf,
 				// Up to 3 bytes left
 				if (len) {
 					word = *(data++);
-					if (len == 2)
+					if (len >= 2)
 						word |= *(data++) << 8;
 					if (len == 3)
 						word |= *(data++) << 16;
@@ -794,7 +893,7 @@ static uint32_t packAttributeIdx16(fimgContext *ctx, uint32_t *buf,
 			// Up to 3 bytes left
 			if (len) {
 				word = *(data++);
-				if (len == 2)
+				if (len >= 2)
 					word |= *(data++) << 8;
 				if (len == 3)
 					word |= *(data++) << 16;
@@ -1112,31 +1211,8 @@ static uint32_t packAttributeIdx8(fimgContext *ctx, uint32_t *buf,
 	case 0:
 		/* Check if vertices are word aligned */
 		if ((uintptr_t)a->pointer % 4 == 0 && a->stride % 4 == 0) {
-			const uint32_t *data, *next_data;
-
-			next_data = BUF_ADDR_32(a->pointer, *(idx++)*a->stride);
-			--cnt;
-
-			while (cnt--) {
-				data = next_data;
-				next_data = BUF_ADDR_32(a->pointer,
-							*(idx++)*a->stride);
-				len = a->width;
-
-				while (len) {
-					*(buf++) = *(data++);
-					len -= 4;
-				}
-			}
-
-			data = next_data;
-			len = a->width;
-
-			while (len) {
-				*(buf++) = *(data++);
-				len -= 4;
-			}
-
+			packWordsIdx8(buf, (const uint8_t *)a->pointer,
+					a->stride, a->width, idx, cnt);
 			break;
 		}
 	/* halfwords */
@@ -1176,6 +1252,10 @@ static uint32_t packAttributeIdx8(fimgContext *ctx, uint32_t *buf,
 				len -= 4;
 			}
 
+			/* Single halfword left */
+			if (len)
+				*(buf++) = *(data++);
+
 			break;
 		}
 	/* bytes */
@@ -1205,7 +1285,7 @@ static uint32_t packAttributeIdx8(fimgContext *ctx, uint32_t *buf,
 				// Up to 3 bytes left
 				if (len) {
 					word = *(data++);
-					if (len == 2)
+					if (len >= 2)
 						word |= *(data++) << 8;
 					if (len == 3)
 						word |= *(data++) << 16;
@@ -1229,7 +1309,7 @@ static uint32_t packAttributeIdx8(fimgContext *ctx, uint32_t *buf,
 			// Up to 3 bytes left
 			if (len) {
 				word = *(data++);
-				if (len == 2)
+				if (len >= 2)
 					word |= *(data++) << 8;
 				if (len == 3)
 					word |= *(data++) << 16;
@@ -1516,185 +1596,768 @@ static uint32_t copyVerticesTrisIdx8(fimgContext *ctx, fimgArray *arrays,
 }
 
 /*
- * Primitive engine has problems with triangle strips and triangle fans,
- * so in those cases geometry must be converted to separate triangles
+ * INDEXED
+ *
+ * A partitioning pass splits index array into batches, each with its unique
+ * vertices remapped to a compact batch-local range, so every vertex is
+ * packed only once per batch. With hardware index fetch, the packed vertices
+ * are sent to vertex buffer and batch-local indices through the FIFO, so the
+ * hardware does the gather. Strips and fans are converted to separate
+ * primitives by the partitioning pass, so every batch can be drawn
+ * independently. Without index fetch, packed vertices are replicated in
+ * index order on the CPU instead.
  */
-struct primitiveHandler {
-	uint32_t (*direct)(fimgContext *, fimgArray *, uint32_t *, uint32_t *);
-	uint32_t (*indexed_8)(fimgContext *, fimgArray *,
-				const uint8_t *, uint32_t *, uint32_t *);
-	uint32_t (*indexed_16)(fimgContext *, fimgArray *,
-				const uint16_t *, uint32_t *, uint32_t *);
+
+#define INDEXED_MAX_VERTICES	(1024)
+#define INDEXED_MAX_INDICES	(3072)
+#define INDEXED_HASH_BITS	(11)
+#define INDEXED_HASH_SIZE	(1 << INDEXED_HASH_BITS)
+
+/** Working memory used to build indexed batches. */
+struct _fimgIndexedBatch {
+	/** Vertex index + 1 of each hash slot (0 if slot is free). */
+	uint32_t key[INDEXED_HASH_SIZE];
+	/** Batch-local index of each hash slot. */
+	uint16_t val[INDEXED_HASH_SIZE];
+	/** Vertex indices of batch vertices, in batch-local order. */
+	uint16_t vertices[INDEXED_MAX_VERTICES];
+	/** Batch-local indices (with room for padding halfword). */
+	uint16_t indices[INDEXED_MAX_INDICES + 1];
+	/** Number of vertices in the batch. */
+	uint32_t numVertices;
+#ifndef FIMG_INDEXED_FETCH
+	/** Single attribute of batch vertices, packed in batch-local order. */
+	uint32_t packed[VERTEX_BUFFER_WORDS];
+#endif
 };
 
-static const struct primitiveHandler primitiveHandler[FGPE_PRIMITIVE_MAX] = {
-	[FGPE_POINT_SPRITE] = {
-		.direct		= copyVertices1To1,
-		.indexed_8	= copyVertices1To1Idx8,
-		.indexed_16	= copyVertices1To1Idx16
-	},
-	[FGPE_POINTS] = {
-		.direct		= copyVertices1To1,
-		.indexed_8	= copyVertices1To1Idx8,
-		.indexed_16	= copyVertices1To1Idx16
-	},
-	[FGPE_LINE_STRIP] = {
-		.direct		= copyVerticesLinestrip,
-		.indexed_8	= copyVerticesLinestripIdx8,
-		.indexed_16	= copyVerticesLinestripIdx16
-	},
-	[FGPE_LINE_LOOP] = {
-		/*
-		 * Line loops don't go well with buffered transfers,
-		 * so let's just force higher level code to emulate them
-		 * using line strips.
-		 */
-		.direct		= 0,
-		.indexed_8	= 0,
-		.indexed_16	= 0
-	},
-	[FGPE_LINES] = {
-		.direct		= copyVerticesLines,
-		.indexed_8	= copyVerticesLinesIdx8,
-		.indexed_16	= copyVerticesLinesIdx16
-	},
-	[FGPE_TRIANGLE_STRIP] = {
-		.direct		= copyVerticesTristrip,
-		.indexed_8	= copyVerticesTristripIdx8,
-		.indexed_16	= copyVerticesTristripIdx16
-	},
-	[FGPE_TRIANGLE_FAN] = {
-		.direct		= copyVerticesTrifan,
-		.indexed_8	= copyVerticesTrifanIdx8,
-		.indexed_16	= copyVerticesTrifanIdx16
-	},
-	[FGPE_TRIANGLES] = {
-		.direct		= copyVerticesTris,
-		.indexed_8	= copyVerticesTrisIdx8,
-		.indexed_16	= copyVerticesTrisIdx16
-	},
+/** Indexed batch stored in index partition. */
+typedef struct {
+	/** Vertex indices of batch vertices, in batch-local order. */
+	uint16_t *vertices;
+	/** Batch-local indices (padded to full word). */
+	uint16_t *indices;
+	uint32_t numVertices;
+	uint32_t numIndices;
+} fimgIndexPartitionBatch;
+
+/** Index array split into indexed batches. */
+struct _fimgIndexPartition {
+	/** Primitive type used to draw the batches. */
+	unsigned int mode;
+	/** Vertex count limit used to build the batches. */
+	uint32_t maxVertices;
+	fimgIndexPartitionBatch *batches;
+	unsigned int numBatches;
+	/** Vertex data of the batches packed by last draw (NULL if none). */
+	fimgStream *stream;
 };
 
+/** State of index array scan. */
+typedef struct {
+	/** Primitive type of index array. */
+	unsigned int mode;
+	/** Array of vertex indices. */
+	const void *indices;
+	/** Non-zero if indices are of uint16_t type. */
+	int is16;
+	/** Number of next primitive to process. */
+	uint32_t prim;
+	/** Total number of primitives. */
+	uint32_t numPrims;
+} fimgIndexScan;
+
 /**
- * Sends a request to hardware to draw a sequence of vertices.
- * @param ctx Hardware context.
- * @param first Index of first vertex in vertex buffer.
- * @param count Vertex count.
+ * Returns primitive type used to draw indexed batches of given primitive
+ * type. Strips and fans are drawn as separate primitives.
+ * @param mode Primitive type.
+ * @return Primitive type to use or FGPE_PRIMITIVE_MAX if not supported.
  */
-static inline void drawAutoinc(fimgContext *ctx,
-				uint32_t first, uint32_t count)
+static inline unsigned int indexedPrimitiveMode(unsigned int mode)
 {
-	fimgWrite(ctx, count, FGHI_FIFO_ENTRY);
-	fimgWrite(ctx, first, FGHI_FIFO_ENTRY);
+	switch (mode) {
+	case FGPE_POINT_SPRITE:
+	case FGPE_POINTS:
+	case FGPE_LINES:
+	case FGPE_TRIANGLES:
+		return mode;
+	case FGPE_LINE_STRIP:
+		return FGPE_LINES;
+	case FGPE_TRIANGLE_STRIP:
+	case FGPE_TRIANGLE_FAN:
+		return FGPE_TRIANGLES;
+	default:
+		return FGPE_PRIMITIVE_MAX;
+	}
 }
 
 /**
- * Configures hardware for attributes according to attribute array descriptors.
- * @param ctx Hardware context.
- * @param arrays Array of attribute array descriptors.
+ * Returns number of vertices of single primitive for primitive types
+ * supported by indexed batches.
+ * @param mode Primitive type (as returned by indexedPrimitiveMode()).
+ * @return Vertex count of single primitive.
  */
-static void setupAttributes(fimgContext *ctx, fimgArray *arrays)
+static inline uint32_t indexedPrimitiveSize(unsigned int mode)
 {
-	fimgAttribute last;
-	unsigned int i;
+	switch (mode) {
+	case FGPE_LINES:
+		return 2;
+	case FGPE_TRIANGLES:
+		return 3;
+	default:
+		return 1;
+	}
+}
 
-	// write attribute configuration
-	for (i = 0; i < ctx->numAttribs - 1; ++i)
-		fimgWrite(ctx, ctx->host.attrib[i].val, FGHI_ATTRIB(i));
+/**
+ * Gets vertex index from uint8_t or uint16_t index array.
+ * @param indices Array of vertex indices.
+ * @param is16 Non-zero if indices are of uint16_t type.
+ * @param i Position in index array.
+ * @return Vertex index.
+ */
+static inline uint32_t getIndex(const void *indices, int is16, uint32_t i)
+{
+	if (is16)
+		return ((const uint16_t *)indices)[i];
 
-	// write the last one
-	last = ctx->host.attrib[i];
-	last.lastattr = 1;
-	fimgWrite(ctx, last.val, FGHI_ATTRIB(i));
+	return ((const uint8_t *)indices)[i];
 }
 
 /**
- * Configures hardware vertex buffer parameters.
- * @param ctx Hardware context.
+ * Initializes index array scan.
+ * @param scan Scan state.
+ * @param mode Primitive type.
+ * @param count Index count.
+ * @param indices Array of vertex indices.
+ * @param is16 Non-zero if indices are of uint16_t type.
  */
-static void setupVertexBuffer(fimgContext *ctx)
+static void initIndexScan(fimgIndexScan *scan, unsigned int mode,
+			uint32_t count, const void *indices, int is16)
 {
-	unsigned int i;
-
-	for (i = 0; i < ctx->numAttribs; i++) {
-		fimgWrite(ctx, ctx->host.vbctrl[i].val, FGHI_ATTRIB_VBCTRL(i));
-		fimgWrite(ctx, ctx->host.vbbase[i], FGHI_ATTRIB_VBBASE(i));
+	scan->mode = mode;
+	scan->indices = indices;
+	scan->is16 = is16;
+	scan->prim = 0;
+
+	switch (mode) {
+	case FGPE_LINES:
+		scan->numPrims = count / 2;
+		break;
+	case FGPE_TRIANGLES:
+		scan->numPrims = count / 3;
+		break;
+	case FGPE_LINE_STRIP:
+		scan->numPrims = (count >= 2) ? count - 1 : 0;
+		break;
+	case FGPE_TRIANGLE_STRIP:
+	case FGPE_TRIANGLE_FAN:
+		scan->numPrims = (count >= 3) ? count - 2 : 0;
+		break;
+	default:
+		scan->numPrims = count;
 	}
 }
 
 /**
- * Draws a sequence of vertices described by array descriptors.
- * @param ctx Hardware context.
- * @param mode Primitive type.
- * @param arrays Array of attribute array descriptors.
- * @param count Vertex count.
+ * Gets vertex indices of next primitive of index array scan.
+ * Order of vertices keeps winding and provoking vertex of the original
+ * primitive.
+ * @param scan Scan state.
+ * @param idx Array to store vertex indices of the primitive in.
  */
-void fimgDrawArrays(fimgContext *ctx, unsigned int mode,
-					fimgArray *arrays, unsigned int count)
+static inline void getPrimitive(fimgIndexScan *scan, uint32_t *idx)
 {
-	unsigned int copied;
-	unsigned int first = 0;
+	const void *indices = scan->indices;
+	int is16 = scan->is16;
+	uint32_t k = scan->prim++;
+
+	switch (scan->mode) {
+	case FGPE_LINES:
+		idx[0] = getIndex(indices, is16, 2*k);
+		idx[1] = getIndex(indices, is16, 2*k + 1);
+		break;
+	case FGPE_TRIANGLES:
+		idx[0] = getIndex(indices, is16, 3*k);
+		idx[1] = getIndex(indices, is16, 3*k + 1);
+		idx[2] = getIndex(indices, is16, 3*k + 2);
+		break;
+	case FGPE_LINE_STRIP:
+		idx[0] = getIndex(indices, is16, k);
+		idx[1] = getIndex(indices, is16, k + 1);
+		break;
+	case FGPE_TRIANGLE_STRIP:
+		idx[0] = getIndex(indices, is16, k + (k & 1));
+		idx[1] = getIndex(indices, is16, k + !(k & 1));
+		idx[2] = getIndex(indices, is16, k + 2);
+		break;
+	case FGPE_TRIANGLE_FAN:
+		idx[0] = getIndex(indices, is16, 0);
+		idx[1] = getIndex(indices, is16, k + 1);
+		idx[2] = getIndex(indices, is16, k + 2);
+		break;
+	default:
+		idx[0] = getIndex(indices, is16, k);
+	}
+}
 
-	if (mode >= FGPE_PRIMITIVE_MAX)
-		return;
+/**
+ * Maps vertex index to batch-local index, adding the vertex to the batch
+ * if it is not there yet.
+ * @param b Indexed batch.
+ * @param idx Vertex index.
+ * @return Batch-local index.
+ */
+static inline uint16_t mapIndex(struct _fimgIndexedBatch *b, uint32_t idx)
+{
+	uint32_t slot = (idx * 2654435761U) >> (32 - INDEXED_HASH_BITS);
 
-	if (!primitiveHandler[mode].direct) {
-		LOGE("%s: Unsupported mode %d", __func__, mode);
-		return;
+	while (b->key[slot]) {
+		if (b->key[slot] == idx + 1)
+			return b->val[slot];
+		slot = (slot + 1) & (INDEXED_HASH_SIZE - 1);
 	}
 
-	if (!ctx->vertexData) {
-		ctx->vertexData = memalign(32, VERTEX_BUFFER_SIZE);
-		if (!ctx->vertexData) {
-			LOGE("Failed to allocate vertex data buffer. Terminating.");
-			exit(ENOMEM);
-		}
-	}
+	b->key[slot] = idx + 1;
+	b->vertices[b->numVertices] = idx;
+	b->val[slot] = b->numVertices++;
 
-	/* Prepare first batch without waiting for hardware */
-	copied = primitiveHandler[mode].direct(ctx, arrays, &first, &count);
-	if (!copied)
-		return;
+	return b->val[slot];
+}
 
-	/* Get hardware */
-	fimgGetHardware(ctx);
-	fimgFlush(ctx);
-	fimgFlushContext(ctx);
-	fimgSetVertexContext(ctx, mode);
+/**
+ * Builds next indexed batch from index array scan.
+ * Batch size is limited by count of unique vertices, as only these are
+ * stored in vertex buffer.
+ * @param b Indexed batch to build.
+ * @param scan Scan state.
+ * @param maxVertices Maximum vertex count of the batch.
+ * @return Amount of batch-local indices to send to hardware.
+ */
+static uint32_t partitionIndices(struct _fimgIndexedBatch *b,
+				fimgIndexScan *scan, uint32_t maxVertices)
+{
+	uint32_t prim = indexedPrimitiveSize(indexedPrimitiveMode(scan->mode));
+	uint32_t numIndices = 0;
+	uint32_t maxIndices;
+	uint32_t idx[3];
+	uint32_t i;
 
-	setupAttributes(ctx, arrays);
-#ifdef FIMG_DUMP_STATE_BEFORE_DRAW
-	fimgDumpState(ctx, mode, count, __func__);
+	if (maxVertices > INDEXED_MAX_VERTICES)
+		maxVertices = INDEXED_MAX_VERTICES;
+
+#ifdef FIMG_INDEXED_FETCH
+	maxIndices = INDEXED_MAX_INDICES;
+#else
+	/* Every index takes a vertex buffer entry without index fetch */
+	maxIndices = maxVertices;
 #endif
 
-	do {
-		fimgSelectiveFlush(ctx, FGHI_PIPELINE_FIFO
-				| FGHI_PIPELINE_HOSTIF | FGHI_PIPELINE_HVF);
-		fillVertexBuffer(ctx);
-		setupVertexBuffer(ctx);
-		drawAutoinc(ctx, 0, copied);
-		copied = primitiveHandler[mode].direct(ctx,
-							arrays, &first, &count);
-	} while (copied);
+	memset(b->key, 0, sizeof(b->key));
+	b->numVertices = 0;
 
-	/* Release hardware */
-	fimgPutHardware(ctx);
+	while (scan->prim < scan->numPrims
+	    && b->numVertices + prim <= maxVertices
+	    && numIndices + prim <= maxIndices) {
+		getPrimitive(scan, idx);
+		for (i = 0; i < prim; ++i)
+			b->indices[numIndices++] = mapIndex(b, idx[i]);
+	}
+
+	/* Pad the last word of index list */
+	b->indices[numIndices] = 0;
+
+	return numIndices;
 }
 
+#ifdef FIMG_INDEXED_FETCH
 /**
- * Draws a sequence of vertices described by array descriptors and a sequence
- * of uint8_t indices.
+ * Prepares vertex data of indexed batch for hardware processing.
  * @param ctx Hardware context.
- * @param mode Primitive type.
  * @param arrays Array of attribute array descriptors.
- * @param count Vertex count.
- * @param indices Array of vertex indices.
+ * @param vertices Vertex indices of batch vertices.
+ * @param numVertices Vertex count.
+ * @param indices Batch-local indices (unused).
+ * @param numIndices Index count (unused).
+ * @return Amount of vertices stored in vertex buffer.
  */
-void fimgDrawElementsUByteIdx(fimgContext *ctx, unsigned int mode,
-		fimgArray *arrays, unsigned int count, const uint8_t *indices)
+static uint32_t copyVerticesIndexed(fimgContext *ctx, fimgArray *arrays,
+			const uint16_t *vertices, uint32_t numVertices,
+			const uint16_t *indices, uint32_t numIndices)
+{
+	fimgArray *a = arrays;
+	uint32_t offset = DATA_OFFSET;
+	uint8_t *buf = ctx->vertexData;
+	uint32_t i;
+
+	for (i = 0; i < ctx->numAttribs; ++i, ++a) {
+		if (!a->stride) {
+			setVtxBufAttrib(ctx, i, CONST_ADDR(i), 0, numVertices);
+			memcpy(buf + CONST_ADDR(i), a->pointer, a->width);
+			continue;
+		}
+		setVtxBufAttrib(ctx, i, offset, (a->width + 3) & ~3, numVertices);
+		offset += packAttributeIdx16(ctx, (uint32_t *)(buf + offset),
+						a, vertices, numVertices);
+	}
+
+	ctx->vertexDataSize = offset;
+
+	return numVertices;
+}
+#else
+/**
+ * Prepares vertex data of indexed batch for hardware processing.
+ * Hardware reads vertex buffer sequentially, so after packing unique
+ * vertices once, their packed words are replicated in index order.
+ * @param ctx Hardware context.
+ * @param arrays Array of attribute array descriptors.
+ * @param vertices Vertex indices of batch vertices.
+ * @param numVertices Vertex count.
+ * @param indices Batch-local indices.
+ * @param numIndices Index count.
+ * @return Amount of vertices stored in vertex buffer.
+ */
+static uint32_t copyVerticesIndexed(fimgContext *ctx, fimgArray *arrays,
+			const uint16_t *vertices, uint32_t numVertices,
+			const uint16_t *indices, uint32_t numIndices)
+{
+	uint32_t *packed = ctx->indexedBatch->packed;
+	fimgArray *a = arrays;
+	uint32_t offset = DATA_OFFSET;
+	uint8_t *buf = ctx->vertexData;
+	uint32_t *data;
+	uint32_t i, j, words;
+
+	for (i = 0; i < ctx->numAttribs; ++i, ++a) {
+		if (!a->stride) {
+			setVtxBufAttrib(ctx, i, CONST_ADDR(i), 0, numIndices);
+			memcpy(buf + CONST_ADDR(i), a->pointer, a->width);
+			continue;
+		}
+		words = (a->width + 3) / 4;
+		setVtxBufAttrib(ctx, i, offset, 4*words, numIndices);
+		packAttributeIdx16(ctx, packed, a, vertices, numVertices);
+
+		data = (uint32_t *)(buf + offset);
+		switch (words) {
+		case 1:
+			for (j = 0; j < numIndices; ++j)
+				data = copyWords(data, packed + indices[j], 1);
+			break;
+		case 2:
+			for (j = 0; j < numIndices; ++j)
+				data = copyWords(data,
+						packed + 2*indices[j], 2);
+			break;
+		case 3:
+			for (j = 0; j < numIndices; ++j)
+				data = copyWords(data,
+						packed + 3*indices[j], 3);
+			break;
+		case 4:
+			for (j = 0; j < numIndices; ++j)
+				data = copyWords(data,
+						packed + 4*indices[j], 4);
+			break;
+		default:
+			for (j = 0; j < numIndices; ++j)
+				data = copyWords(data,
+					packed + words*indices[j], words);
+		}
+		offset += 4*words*numIndices;
+	}
+
+	ctx->vertexDataSize = offset;
+
+	return numIndices;
+}
+#endif
+
+/**
+ * Allocates working memory used to build indexed batches.
+ * @param ctx Hardware context.
+ */
+static void allocIndexedBatch(fimgContext *ctx)
+{
+	if (ctx->indexedBatch)
+		return;
+
+	ctx->indexedBatch = malloc(sizeof(*ctx->indexedBatch));
+	if (!ctx->indexedBatch) {
+		LOGE("Failed to allocate index data buffer. Terminating.");
+		exit(ENOMEM);
+	}
+}
+
+/**
+ * Frees memory used by index partition.
+ * @param p Index partition.
+ */
+void fimgDestroyIndexPartition(fimgIndexPartition *p)
+{
+	unsigned int i;
+
+	if (!p)
+		return;
+
+	for (i = 0; i < p->numBatches; ++i)
+		free(p->batches[i].vertices);
+
+	fimgDestroyStream(p->stream);
+	free(p->batches);
+	free(p);
+}
+
+/**
+ * Splits index array into indexed batches for current attribute layout.
+ * @param ctx Hardware context.
+ * @param mode Primitive type.
+ * @param arrays Array of attribute array descriptors.
+ * @param count Index count.
+ * @param indices Array of vertex indices.
+ * @param is16 Non-zero if indices are of uint16_t type.
+ * @return Index partition or NULL on error.
+ */
+static fimgIndexPartition *createIndexPartition(fimgContext *ctx,
+		unsigned int mode, fimgArray *arrays, unsigned int count,
+		const void *indices, int is16)
+{
+	struct _fimgIndexedBatch *b;
+	fimgIndexPartitionBatch *batch;
+	fimgIndexPartition *p;
+	fimgIndexScan scan;
+	uint32_t numIndices;
+	unsigned int maxBatches = 0;
+
+	if (mode >= FGPE_PRIMITIVE_MAX
+	    || indexedPrimitiveMode(mode) == FGPE_PRIMITIVE_MAX)
+		return NULL;
+
+#ifndef FIMG_INDEXED_FETCH
+	/*
+	 * Strips and fans converted to separate primitives would upload up
+	 * to three times more vertices than the strip and fan paths.
+	 */
+	if (indexedPrimitiveMode(mode) != mode)
+		return NULL;
+#endif
+
+	allocIndexedBatch(ctx);
+	b = ctx->indexedBatch;
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return NULL;
+
+	p->mode = indexedPrimitiveMode(mode);
+	p->maxVertices = calculateBatchSize(arrays, ctx->numAttribs);
+
+	initIndexScan(&scan, mode, count, indices, is16);
+	while ((numIndices = partitionIndices(b, &scan, p->maxVertices))) {
+		if (p->numBatches == maxBatches) {
+			maxBatches = maxBatches ? 2*maxBatches : 4;
+			batch = realloc(p->batches, maxBatches*sizeof(*batch));
+			if (!batch)
+				goto err;
+			p->batches = batch;
+		}
+
+		batch = &p->batches[p->numBatches];
+		batch->vertices = malloc(2*(b->numVertices + numIndices + 1));
+		if (!batch->vertices)
+			goto err;
+		batch->indices = batch->vertices + b->numVertices;
+		batch->numVertices = b->numVertices;
+		batch->numIndices = numIndices;
+
+		memcpy(batch->vertices, b->vertices, 2*b->numVertices);
+		memcpy(batch->indices, b->indices, 2*(numIndices + 1));
+		++p->numBatches;
+	}
+
+	return p;
+
+err:
+	fimgDestroyIndexPartition(p);
+	return NULL;
+}
+
+/**
+ * Splits sequence of uint8_t indices into indexed batches, which can be
+ * drawn later using fimgDrawElementsPartitioned() as long as the vertex
+ * size does not grow.
+ * @param ctx Hardware context.
+ * @param mode Primitive type.
+ * @param arrays Array of attribute array descriptors.
+ * @param count Index count.
+ * @param indices Array of vertex indices.
+ * @return Index partition or NULL if not supported or on error.
+ */
+fimgIndexPartition *fimgCreateIndexPartitionUByte(fimgContext *ctx,
+		unsigned int mode, fimgArray *arrays, unsigned int count,
+		const uint8_t *indices)
+{
+	return createIndexPartition(ctx, mode, arrays, count, indices, 0);
+}
+
+/**
+ * Splits sequence of uint16_t indices into indexed batches, which can be
+ * drawn later using fimgDrawElementsPartitioned() as long as the vertex
+ * size does not grow.
+ * @param ctx Hardware context.
+ * @param mode Primitive type.
+ * @param arrays Array of attribute array descriptors.
+ * @param count Index count.
+ * @param indices Array of vertex indices.
+ * @return Index partition or NULL if not supported or on error.
+ */
+fimgIndexPartition *fimgCreateIndexPartitionUShort(fimgContext *ctx,
+		unsigned int mode, fimgArray *arrays, unsigned int count,
+		const uint16_t *indices)
+{
+	return createIndexPartition(ctx, mode, arrays, count, indices, 1);
+}
+
+
+/*
+ * Primitive engine has problems with triangle strips and triangle fans,
+ * so in those cases geometry must be converted to separate triangles
+ */
+struct primitiveHandler {
+	uint32_t (*direct)(fimgContext *, fimgArray *, uint32_t *, uint32_t *);
+	uint32_t (*indexed_8)(fimgContext *, fimgArray *,
+				const uint8_t *, uint32_t *, uint32_t *);
+	uint32_t (*indexed_16)(fimgContext *, fimgArray *,
+				const uint16_t *, uint32_t *, uint32_t *);
+};
+
+static const struct primitiveHandler primitiveHandler[FGPE_PRIMITIVE_MAX] = {
+	[FGPE_POINT_SPRITE] = {
+		.direct		= copyVertices1To1,
+		.indexed_8	= copyVertices1To1Idx8,
+		.indexed_16	= copyVertices1To1Idx16
+	},
+	[FGPE_POINTS] = {
+		.direct		= copyVertices1To1,
+		.indexed_8	= copyVertices1To1Idx8,
+		.indexed_16	= copyVertices1To1Idx16
+	},
+	[FGPE_LINE_STRIP] = {
+		.direct		= copyVerticesLinestrip,
+		.indexed_8	= copyVerticesLinestripIdx8,
+		.indexed_16	= copyVerticesLinestripIdx16
+	},
+	[FGPE_LINE_LOOP] = {
+		/*
+		 * Line loops don't go well with buffered transfers,
+		 * so let's just force higher level code to emulate them
+		 * using line strips.
+		 */
+		.direct		= 0,
+		.indexed_8	= 0,
+		.indexed_16	= 0
+	},
+	[FGPE_LINES] = {
+		.direct		= copyVerticesLines,
+		.indexed_8	= copyVerticesLinesIdx8,
+		.indexed_16	= copyVerticesLinesIdx16
+	},
+	[FGPE_TRIANGLE_STRIP] = {
+		.direct		= copyVerticesTristrip,
+		.indexed_8	= copyVerticesTristripIdx8,
+		.indexed_16	= copyVerticesTristripIdx16
+	},
+	[FGPE_TRIANGLE_FAN] = {
+		.direct		= copyVerticesTrifan,
+		.indexed_8	= copyVerticesTrifanIdx8,
+		.indexed_16	= copyVerticesTrifanIdx16
+	},
+	[FGPE_TRIANGLES] = {
+		.direct		= copyVerticesTris,
+		.indexed_8	= copyVerticesTrisIdx8,
+		.indexed_16	= copyVerticesTrisIdx16
+	},
+};
+
+/**
+ * Sends a request to hardware to draw a sequence of vertices.
+ * @param ctx Hardware context.
+ * @param first Index of first vertex in vertex buffer.
+ * @param count Vertex count.
+ */
+static inline void drawAutoinc(fimgContext *ctx,
+				uint32_t first, uint32_t count)
+{
+	fimgWrite(ctx, count, FGHI_FIFO_ENTRY);
+	fimgWrite(ctx, first, FGHI_FIFO_ENTRY);
+}
+
+#ifdef FIMG_INDEXED_FETCH
+/**
+ * Sends a request to hardware to draw a sequence of batch-local indices.
+ * Indices are sent through the FIFO as pairs of uint16_t values.
+ * @param ctx Hardware context.
+ * @param indices Array of batch-local indices (padded to full word).
+ * @param count Index count.
+ */
+static void drawIndexed(fimgContext *ctx, const uint16_t *indices,
+							uint32_t count)
+{
+	uint32_t words = (count + 1) / 2;
+	uint32_t space;
+
+	fimgWrite(ctx, count, FGHI_FIFO_ENTRY);
+
+	while (words) {
+		space = fimgRead(ctx, FGHI_DWSPACE);
+		if (!space) {
+			fimgWaitForSet(ctx, FGHI_DWSPACE, ~0U);
+			continue;
+		}
+		if (space > words)
+			space = words;
+		words -= space;
+
+		while (space--) {
+			fimgWrite(ctx, indices[0] | (indices[1] << 16),
+							FGHI_FIFO_ENTRY);
+			indices += 2;
+		}
+	}
+}
+#endif
+
+/**
+ * Configures hardware for attributes according to attribute array descriptors.
+ * @param ctx Hardware context.
+ * @param arrays Array of attribute array descriptors.
+ */
+static void setupAttributes(fimgContext *ctx, fimgArray *arrays)
+{
+	fimgAttribute last;
+	unsigned int i;
+
+	// write attribute configuration
+	for (i = 0; i < ctx->numAttribs - 1; ++i)
+		fimgWrite(ctx, ctx->host.attrib[i].val, FGHI_ATTRIB(i));
+
+	// write the last one
+	last = ctx->host.attrib[i];
+	last.lastattr = 1;
+	fimgWrite(ctx, last.val, FGHI_ATTRIB(i));
+}
+
+/**
+ * Configures hardware vertex buffer parameters.
+ * @param ctx Hardware context.
+ * @param region Index of vertex buffer region holding vertex data.
+ */
+static void setupVertexBuffer(fimgContext *ctx, unsigned int region)
+{
+	unsigned int base = VERTEX_BUFFER_BASE(region);
+	unsigned int i;
+
+	for (i = 0; i < ctx->numAttribs; i++) {
+		fimgWrite(ctx, ctx->host.vbctrl[i].val, FGHI_ATTRIB_VBCTRL(i));
+		fimgWrite(ctx, base + ctx->host.vbbase[i],
+							FGHI_ATTRIB_VBBASE(i));
+	}
+}
+
+/**
+ * Allocates vertex data buffer used to prepare batches.
+ * @param ctx Hardware context.
+ */
+static void allocVertexData(fimgContext *ctx)
+{
+	if (ctx->vertexData)
+		return;
+
+	ctx->vertexData = memalign(32, VERTEX_BUFFER_SIZE);
+	if (!ctx->vertexData) {
+		LOGE("Failed to allocate vertex data buffer. Terminating.");
+		exit(ENOMEM);
+	}
+}
+
+/**
+ * Draws a sequence of vertices described by array descriptors.
+ * @param ctx Hardware context.
+ * @param mode Primitive type.
+ * @param arrays Array of attribute array descriptors.
+ * @param count Vertex count.
+ * @param stream Vertex stream to record batches to (NULL if none).
+ */
+static void drawArrays(fimgContext *ctx, unsigned int mode,
+		fimgArray *arrays, unsigned int count, fimgStream *stream)
+{
+	unsigned int copied;
+	unsigned int first = 0;
+	unsigned int region = 0;
+
+	if (mode >= FGPE_PRIMITIVE_MAX)
+		return;
+
+	if (!primitiveHandler[mode].direct) {
+		LOGE("%s: Unsupported mode %d", __func__, mode);
+		return;
+	}
+
+	allocVertexData(ctx);
+
+	/* Prepare first batch without waiting for hardware */
+	copied = primitiveHandler[mode].direct(ctx, arrays, &first, &count);
+	if (!copied)
+		return;
+
+	/* Get hardware */
+	fimgGetHardware(ctx);
+	fimgFlush(ctx);
+	fimgFlushContext(ctx);
+	fimgSetVertexContext(ctx, mode);
+
+	setupAttributes(ctx, arrays);
+#ifdef FIMG_DUMP_STATE_BEFORE_DRAW
+	fimgDumpState(ctx, mode, count, __func__);
+#endif
+
+	do {
+		/* Previous batch (if any) is using the other region */
+		fillVertexBuffer(ctx, region,
+				ctx->vertexData, ctx->vertexDataSize);
+		/* Vertex buffer setup can't be changed under running batch */
+		fimgSelectiveFlush(ctx, FGHI_PIPELINE_FIFO
+				| FGHI_PIPELINE_HOSTIF | FGHI_PIPELINE_HVF);
+		setupVertexBuffer(ctx, region);
+		drawAutoinc(ctx, 0, copied);
+		fimgStreamAddBatch(stream, ctx, copied);
+		region = (region + 1) % VERTEX_BUFFER_REGIONS;
+		copied = primitiveHandler[mode].direct(ctx,
+							arrays, &first, &count);
+	} while (copied);
+
+	/* Release hardware */
+	fimgPutHardware(ctx);
+}
+
+/**
+ * Draws a sequence of vertices described by array descriptors and a sequence
+ * of uint8_t indices.
+ * @param ctx Hardware context.
+ * @param mode Primitive type.
+ * @param arrays Array of attribute array descriptors.
+ * @param count Vertex count.
+ * @param indices Array of vertex indices.
+ * @param stream Vertex stream to record batches to (NULL if none).
+ */
+static void drawElementsUByteIdx(fimgContext *ctx, unsigned int mode,
+		fimgArray *arrays, unsigned int count, const uint8_t *indices,
+		fimgStream *stream)
 {
 	unsigned int copied;
 	unsigned int pos = 0;
+	unsigned int region = 0;
 
 	if (mode >= FGPE_PRIMITIVE_MAX)
 		return;
@@ -1704,13 +2367,7 @@ void fimgDrawElementsUByteIdx(fimgContext *ctx, unsigned int mode,
 		return;
 	}
 
-	if (!ctx->vertexData) {
-		ctx->vertexData = memalign(32, VERTEX_BUFFER_SIZE);
-		if (!ctx->vertexData) {
-			LOGE("Failed to allocate vertex data buffer. Terminating.");
-			exit(ENOMEM);
-		}
-	}
+	allocVertexData(ctx);
 
 	/* Prepare first batch without waiting for hardware */
 	copied = primitiveHandler[mode].indexed_8(ctx,
@@ -1730,11 +2387,16 @@ void fimgDrawElementsUByteIdx(fimgContext *ctx, unsigned int mode,
 #endif
 
 	do {
+		/* Previous batch (if any) is using the other region */
+		fillVertexBuffer(ctx, region,
+				ctx->vertexData, ctx->vertexDataSize);
+		/* Vertex buffer setup can't be changed under running batch */
 		fimgSelectiveFlush(ctx, FGHI_PIPELINE_FIFO
 				| FGHI_PIPELINE_HOSTIF | FGHI_PIPELINE_HVF);
-		fillVertexBuffer(ctx);
-		setupVertexBuffer(ctx);
+		setupVertexBuffer(ctx, region);
 		drawAutoinc(ctx, 0, copied);
+		fimgStreamAddBatch(stream, ctx, copied);
+		region = (region + 1) % VERTEX_BUFFER_REGIONS;
 		copied = primitiveHandler[mode].indexed_8(ctx,
 						arrays, indices, &pos, &count);
 	} while (copied);
@@ -1751,12 +2413,15 @@ void fimgDrawElementsUByteIdx(fimgContext *ctx, unsigned int mode,
  * @param arrays Array of attribute array descriptors.
  * @param count Vertex count.
  * @param indices Array of vertex indices.
+ * @param stream Vertex stream to record batches to (NULL if none).
  */
-void fimgDrawElementsUShortIdx(fimgContext *ctx, unsigned int mode,
-		fimgArray *arrays, unsigned int count, const uint16_t *indices)
+static void drawElementsUShortIdx(fimgContext *ctx, unsigned int mode,
+		fimgArray *arrays, unsigned int count, const uint16_t *indices,
+		fimgStream *stream)
 {
 	unsigned int copied;
 	unsigned int pos = 0;
+	unsigned int region = 0;
 
 	if (mode >= FGPE_PRIMITIVE_MAX)
 		return;
@@ -1766,13 +2431,7 @@ void fimgDrawElementsUShortIdx(fimgContext *ctx, unsigned int mode,
 		return;
 	}
 
-	if (!ctx->vertexData) {
-		ctx->vertexData = memalign(32, VERTEX_BUFFER_SIZE);
-		if (!ctx->vertexData) {
-			LOGE("Failed to allocate vertex data buffer. Terminating.");
-			exit(ENOMEM);
-		}
-	}
+	allocVertexData(ctx);
 
 	/* Prepare first batch without waiting for hardware */
 	copied = primitiveHandler[mode].indexed_16(ctx,
@@ -1792,11 +2451,16 @@ void fimgDrawElementsUShortIdx(fimgContext *ctx, unsigned int mode,
 #endif
 
 	do {
+		/* Previous batch (if any) is using the other region */
+		fillVertexBuffer(ctx, region,
+				ctx->vertexData, ctx->vertexDataSize);
+		/* Vertex buffer setup can't be changed under running batch */
 		fimgSelectiveFlush(ctx, FGHI_PIPELINE_FIFO
 				| FGHI_PIPELINE_HOSTIF | FGHI_PIPELINE_HVF);
-		fillVertexBuffer(ctx);
-		setupVertexBuffer(ctx);
+		setupVertexBuffer(ctx, region);
 		drawAutoinc(ctx, 0, copied);
+		fimgStreamAddBatch(stream, ctx, copied);
+		region = (region + 1) % VERTEX_BUFFER_REGIONS;
 		copied = primitiveHandler[mode].indexed_16(ctx,
 						arrays, indices, &pos, &count);
 	} while (copied);
@@ -1805,6 +2469,460 @@ void fimgDrawElementsUShortIdx(fimgContext *ctx, unsigned int mode,
 	fimgPutHardware(ctx);
 }
 
+/**
+ * Loads batch of recorded vertex stream for sending to hardware.
+ * Constant attributes are not part of the key, so their current values
+ * are patched into the batch.
+ * @param ctx Hardware context.
+ * @param arrays Array of attribute array descriptors.
+ * @param batch Batch of vertex stream.
+ */
+static void loadStreamBatch(fimgContext *ctx, fimgArray *arrays,
+						fimgStreamBatch *batch)
+{
+	unsigned int i;
+
+	for (i = 0; i < ctx->numAttribs; ++i)
+		if (!arrays[i].stride)
+			memcpy(batch->data + CONST_ADDR(i),
+				arrays[i].pointer, arrays[i].width);
+
+	memcpy(ctx->host.vbctrl, batch->vbctrl, sizeof(batch->vbctrl));
+	memcpy(ctx->host.vbbase, batch->vbbase, sizeof(batch->vbbase));
+}
+
+/**
+ * Gets hardware and sets it up for drawing indexed batches.
+ * @param ctx Hardware context.
+ * @param mode Primitive type used to draw the batches.
+ * @param arrays Array of attribute array descriptors.
+ * @param count Index count (for state dumps only).
+ */
+static void beginIndexed(fimgContext *ctx, unsigned int mode,
+				fimgArray *arrays, unsigned int count)
+{
+#ifdef FIMG_INDEXED_FETCH
+	fimgHInterface control;
+#endif
+
+	fimgGetHardware(ctx);
+	fimgFlush(ctx);
+	fimgFlushContext(ctx);
+	fimgSetVertexContext(ctx, mode);
+
+	setupAttributes(ctx, arrays);
+#ifdef FIMG_DUMP_STATE_BEFORE_DRAW
+	fimgDumpState(ctx, mode, count, __func__);
+#endif
+
+#ifdef FIMG_INDEXED_FETCH
+	control = ctx->host.control;
+	control.autoinc = 0;
+	control.idxtype = FGHI_CONTROLIdxTYPE_USHORT;
+	fimgWrite(ctx, control.val, FGHI_CONTROL);
+	ctx->touched |= FIMG_BLOCK_HOST;
+#endif
+}
+
+/**
+ * Sends prepared indexed batch to hardware.
+ * @param ctx Hardware context.
+ * @param region Vertex buffer region to use.
+ * @param data Vertex data of the batch (32-byte aligned).
+ * @param size Size of vertex data in bytes.
+ * @param indices Batch-local indices.
+ * @param count Index count.
+ */
+static void drawIndexedBatch(fimgContext *ctx, unsigned int region,
+			const uint8_t *data, unsigned int size,
+			const uint16_t *indices, unsigned int count)
+{
+	/* Previous batch (if any) is using the other region */
+	fillVertexBuffer(ctx, region, data, size);
+	/* Vertex buffer setup can't be changed under running batch */
+	fimgSelectiveFlush(ctx, FGHI_PIPELINE_FIFO
+			| FGHI_PIPELINE_HOSTIF | FGHI_PIPELINE_HVF);
+	setupVertexBuffer(ctx, region);
+#ifdef FIMG_INDEXED_FETCH
+	drawIndexed(ctx, indices, count);
+#else
+	/* Vertices have been replicated in index order */
+	drawAutoinc(ctx, 0, count);
+#endif
+}
+
+/**
+ * Restores auto increment mode used by other draws and releases hardware.
+ * @param ctx Hardware context.
+ */
+static void endIndexed(fimgContext *ctx)
+{
+#ifdef FIMG_INDEXED_FETCH
+	fimgSelectiveFlush(ctx, FGHI_PIPELINE_FIFO | FGHI_PIPELINE_HOSTIF);
+	fimgWrite(ctx, ctx->host.control.val, FGHI_CONTROL);
+#endif
+
+	fimgPutHardware(ctx);
+}
+
+#ifdef FIMG_INDEXED_FETCH
+/**
+ * Draws a sequence of vertices described by array descriptors and
+ * indices, using hardware index fetch.
+ * @param ctx Hardware context.
+ * @param mode Primitive type.
+ * @param arrays Array of attribute array descriptors.
+ * @param count Index count.
+ * @param indices Array of vertex indices.
+ * @param is16 Non-zero if indices are of uint16_t type.
+ */
+static void drawElementsIndexed(fimgContext *ctx, unsigned int mode,
+		fimgArray *arrays, unsigned int count, const void *indices,
+		int is16)
+{
+	struct _fimgIndexedBatch *b;
+	fimgIndexScan scan;
+	uint32_t maxVertices;
+	unsigned int copied;
+	unsigned int region = 0;
+
+	allocVertexData(ctx);
+	allocIndexedBatch(ctx);
+	b = ctx->indexedBatch;
+
+	maxVertices = calculateBatchSize(arrays, ctx->numAttribs);
+	initIndexScan(&scan, mode, count, indices, is16);
+
+	/* Prepare first batch without waiting for hardware */
+	copied = partitionIndices(b, &scan, maxVertices);
+	if (!copied)
+		return;
+	copyVerticesIndexed(ctx, arrays, b->vertices, b->numVertices,
+							b->indices, copied);
+
+	beginIndexed(ctx, indexedPrimitiveMode(mode), arrays, count);
+
+	do {
+		drawIndexedBatch(ctx, region, ctx->vertexData,
+				ctx->vertexDataSize, b->indices, copied);
+		region = (region + 1) % VERTEX_BUFFER_REGIONS;
+		copied = partitionIndices(b, &scan, maxVertices);
+		if (copied)
+			copyVerticesIndexed(ctx, arrays, b->vertices,
+					b->numVertices, b->indices, copied);
+	} while (copied);
+
+	endIndexed(ctx);
+}
+#endif /* FIMG_INDEXED_FETCH */
+
+/**
+ * Draws index partition using vertex data recorded by previous draw.
+ * @param ctx Hardware context.
+ * @param arrays Array of attribute array descriptors.
+ * @param p Index partition.
+ */
+static void drawPartitionStream(fimgContext *ctx, fimgArray *arrays,
+							fimgIndexPartition *p)
+{
+	fimgIndexPartitionBatch *batch = p->batches;
+	fimgStreamBatch *data = p->stream->batches;
+	unsigned int region = 0;
+	unsigned int i;
+
+	beginIndexed(ctx, p->mode, arrays, batch->numIndices);
+
+	for (i = 0; i < p->numBatches; ++i, ++batch, ++data) {
+		loadStreamBatch(ctx, arrays, data);
+		drawIndexedBatch(ctx, region, data->data, data->size,
+					batch->indices, batch->numIndices);
+		region = (region + 1) % VERTEX_BUFFER_REGIONS;
+	}
+
+	endIndexed(ctx);
+}
+
+/**
+ * Draws index array previously split into indexed batches.
+ * Vertex data packed for the batches is recorded in the partition, so
+ * further draws with the same vertex stream key only upload it.
+ * @param ctx Hardware context.
+ * @param arrays Array of attribute array descriptors.
+ * @param p Index partition.
+ * @param key Vertex stream key describing source of vertex data (NULL if
+ * vertex data must not be recorded).
+ * @return Zero on success, non-zero if the partition can not be used with
+ * current attribute layout and must be recreated.
+ */
+int fimgDrawElementsPartitioned(fimgContext *ctx, fimgArray *arrays,
+			fimgIndexPartition *p, const fimgStreamKey *key)
+{
+	fimgIndexPartitionBatch *batch = p->batches;
+	fimgStream *stream = NULL;
+	unsigned int region = 0;
+	unsigned int vertices;
+	unsigned int i;
+
+	if (calculateBatchSize(arrays, ctx->numAttribs) < p->maxVertices)
+		return -1;
+
+	if (!p->numBatches)
+		return 0;
+
+	if (key && p->stream && !memcmp(&p->stream->key, key, sizeof(*key))) {
+		drawPartitionStream(ctx, arrays, p);
+		return 0;
+	}
+
+	fimgDestroyStream(p->stream);
+	p->stream = NULL;
+	if (key)
+		stream = fimgCreateStream(key);
+
+	allocVertexData(ctx);
+	allocIndexedBatch(ctx);
+
+	/* Prepare first batch without waiting for hardware */
+	vertices = copyVerticesIndexed(ctx, arrays, batch->vertices,
+			batch->numVertices, batch->indices, batch->numIndices);
+
+	beginIndexed(ctx, p->mode, arrays, batch->numIndices);
+
+	for (i = 0; i < p->numBatches; ++i, ++batch) {
+		fimgStreamAddBatch(stream, ctx, vertices);
+		drawIndexedBatch(ctx, region, ctx->vertexData,
+					ctx->vertexDataSize, batch->indices,
+					batch->numIndices);
+		region = (region + 1) % VERTEX_BUFFER_REGIONS;
+		if (i + 1 < p->numBatches)
+			vertices = copyVerticesIndexed(ctx, arrays,
+					batch[1].vertices, batch[1].numVertices,
+					batch[1].indices, batch[1].numIndices);
+	}
+
+	endIndexed(ctx);
+
+	if (stream && !stream->invalid)
+		p->stream = stream;
+	else
+		fimgDestroyStream(stream);
+
+	return 0;
+}
+
+/**
+ * Draws a sequence of vertices described by array descriptors.
+ * @param ctx Hardware context.
+ * @param mode Primitive type.
+ * @param arrays Array of attribute array descriptors.
+ * @param count Vertex count.
+ */
+void fimgDrawArrays(fimgContext *ctx, unsigned int mode,
+					fimgArray *arrays, unsigned int count)
+{
+	drawArrays(ctx, mode, arrays, count, NULL);
+}
+
+/**
+ * Draws a sequence of vertices described by array descriptors and a sequence
+ * of uint8_t indices.
+ * @param ctx Hardware context.
+ * @param mode Primitive type.
+ * @param arrays Array of attribute array descriptors.
+ * @param count Vertex count.
+ * @param indices Array of vertex indices.
+ */
+void fimgDrawElementsUByteIdx(fimgContext *ctx, unsigned int mode,
+		fimgArray *arrays, unsigned int count, const uint8_t *indices)
+{
+#ifdef FIMG_INDEXED_FETCH
+	if (indexedPrimitiveMode(mode) != FGPE_PRIMITIVE_MAX) {
+		drawElementsIndexed(ctx, mode, arrays, count, indices, 0);
+		return;
+	}
+#endif
+	drawElementsUByteIdx(ctx, mode, arrays, count, indices, NULL);
+}
+
+/**
+ * Draws a sequence of vertices described by array descriptors and a sequence
+ * of uint16_t indices.
+ * @param ctx Hardware context.
+ * @param mode Primitive type.
+ * @param arrays Array of attribute array descriptors.
+ * @param count Vertex count.
+ * @param indices Array of vertex indices.
+ */
+void fimgDrawElementsUShortIdx(fimgContext *ctx, unsigned int mode,
+		fimgArray *arrays, unsigned int count, const uint16_t *indices)
+{
+#ifdef FIMG_INDEXED_FETCH
+	if (indexedPrimitiveMode(mode) != FGPE_PRIMITIVE_MAX) {
+		drawElementsIndexed(ctx, mode, arrays, count, indices, 1);
+		return;
+	}
+#endif
+	drawElementsUShortIdx(ctx, mode, arrays, count, indices, NULL);
+}
+
+/*
+ * Cached vertex streams
+ */
+
+/**
+ * Sends vertex stream recorded earlier to hardware.
+ * Constant attributes are not part of the key, so their current values
+ * are patched into every batch before uploading it.
+ * @param ctx Hardware context.
+ * @param mode Primitive type.
+ * @param arrays Array of attribute array descriptors.
+ * @param stream Vertex stream.
+ */
+static void drawStream(fimgContext *ctx, unsigned int mode,
+					fimgArray *arrays, fimgStream *stream)
+{
+	fimgStreamBatch *batch = stream->batches;
+	unsigned int n = stream->numBatches;
+	unsigned int region = 0;
+
+	/* Get hardware */
+	fimgGetHardware(ctx);
+	fimgFlush(ctx);
+	fimgFlushContext(ctx);
+	fimgSetVertexContext(ctx, mode);
+
+	setupAttributes(ctx, arrays);
+#ifdef FIMG_DUMP_STATE_BEFORE_DRAW
+	fimgDumpState(ctx, mode, stream->key.count, __func__);
+#endif
+
+	for (; n--; ++batch) {
+		loadStreamBatch(ctx, arrays, batch);
+		fillVertexBuffer(ctx, region, batch->data, batch->size);
+		/* Vertex buffer setup can't be changed under running batch */
+		fimgSelectiveFlush(ctx, FGHI_PIPELINE_FIFO
+				| FGHI_PIPELINE_HOSTIF | FGHI_PIPELINE_HVF);
+		setupVertexBuffer(ctx, region);
+		drawAutoinc(ctx, 0, batch->vertices);
+		region = (region + 1) % VERTEX_BUFFER_REGIONS;
+	}
+
+	/* Release hardware */
+	fimgPutHardware(ctx);
+}
+
+/**
+ * Draws a sequence of vertices described by array descriptors, reusing
+ * vertex data packed by previous draw with the same key if possible.
+ * @param ctx Hardware context.
+ * @param mode Primitive type.
+ * @param arrays Array of attribute array descriptors.
+ * @param count Vertex count.
+ * @param key Vertex stream key describing source of vertex data.
+ */
+void fimgDrawArraysCached(fimgContext *ctx, unsigned int mode,
+	fimgArray *arrays, unsigned int count, const fimgStreamKey *key)
+{
+	fimgStream *stream;
+
+	if (!ctx->streamCache.stats.budget) {
+		drawArrays(ctx, mode, arrays, count, NULL);
+		return;
+	}
+
+	stream = fimgStreamCacheLookup(ctx, key);
+	if (stream) {
+		drawStream(ctx, mode, arrays, stream);
+		return;
+	}
+
+	stream = fimgCreateStream(key);
+	drawArrays(ctx, mode, arrays, count, stream);
+	fimgStreamCacheInsert(ctx, stream);
+}
+
+/**
+ * Draws a sequence of vertices described by array descriptors and a sequence
+ * of uint8_t indices, reusing vertex data packed by previous draw with
+ * the same key if possible.
+ * @param ctx Hardware context.
+ * @param mode Primitive type.
+ * @param arrays Array of attribute array descriptors.
+ * @param count Vertex count.
+ * @param indices Array of vertex indices.
+ * @param key Vertex stream key describing source of vertex data.
+ */
+void fimgDrawElementsUByteIdxCached(fimgContext *ctx, unsigned int mode,
+	fimgArray *arrays, unsigned int count, const uint8_t *indices,
+	const fimgStreamKey *key)
+{
+	fimgStream *stream;
+
+#ifdef FIMG_INDEXED_FETCH
+	/* Indexed fetch does not repack shared vertices anyway */
+	if (indexedPrimitiveMode(mode) != FGPE_PRIMITIVE_MAX) {
+		drawElementsIndexed(ctx, mode, arrays, count, indices, 0);
+		return;
+	}
+#endif
+
+	if (!ctx->streamCache.stats.budget) {
+		drawElementsUByteIdx(ctx, mode, arrays, count, indices, NULL);
+		return;
+	}
+
+	stream = fimgStreamCacheLookup(ctx, key);
+	if (stream) {
+		drawStream(ctx, mode, arrays, stream);
+		return;
+	}
+
+	stream = fimgCreateStream(key);
+	drawElementsUByteIdx(ctx, mode, arrays, count, indices, stream);
+	fimgStreamCacheInsert(ctx, stream);
+}
+
+/**
+ * Draws a sequence of vertices described by array descriptors and a sequence
+ * of uint16_t indices, reusing vertex data packed by previous draw with
+ * the same key if possible.
+ * @param ctx Hardware context.
+ * @param mode Primitive type.
+ * @param arrays Array of attribute array descriptors.
+ * @param count Vertex count.
+ * @param indices Array of vertex indices.
+ * @param key Vertex stream key describing source of vertex data.
+ */
+void fimgDrawElementsUShortIdxCached(fimgContext *ctx, unsigned int mode,
+	fimgArray *arrays, unsigned int count, const uint16_t *indices,
+	const fimgStreamKey *key)
+{
+	fimgStream *stream;
+
+#ifdef FIMG_INDEXED_FETCH
+	/* Indexed fetch does not repack shared vertices anyway */
+	if (indexedPrimitiveMode(mode) != FGPE_PRIMITIVE_MAX) {
+		drawElementsIndexed(ctx, mode, arrays, count, indices, 1);
+		return;
+	}
+#endif
+
+	if (!ctx->streamCache.stats.budget) {
+		drawElementsUShortIdx(ctx, mode, arrays, count, indices, NULL);
+		return;
+	}
+
+	stream = fimgStreamCacheLookup(ctx, key);
+	if (stream) {
+		drawStream(ctx, mode, arrays, stream);
+		return;
+	}
+
+	stream = fimgCreateStream(key);
+	drawElementsUShortIdx(ctx, mode, arrays, count, indices, stream);
+	fimgStreamCacheInsert(ctx, stream);
+}
+
 /*
  * Context management
  */
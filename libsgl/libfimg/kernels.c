@@ -0,0 +1,896 @@
+/*
+ * fimg/kernels.c
+ *
+ * SAMSUNG S3C6410 FIMG-3DSE OPTIMIZED MEMORY KERNELS
+ *
+ * Copyrights:	2010 by Tomasz Figa < tomasz.figa at gmail.com >
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "fimg_private.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define FIMG_KERNELS_X86
+#endif
+
+/*
+ * Generic C kernels
+ */
+
+/**
+ * Copies 16-byte blocks between two buffers (generic variant).
+ * @param dst Destination buffer (word aligned).
+ * @param src Source buffer (word aligned).
+ * @param cnt Number of 16-byte blocks to copy.
+ */
+static void copy16Generic(void *dst, const void *src, unsigned int cnt)
+{
+	uint32_t *d = (uint32_t *)dst;
+	const uint32_t *s = (const uint32_t *)src;
+
+	while (cnt--) {
+		d[0] = s[0];
+		d[1] = s[1];
+		d[2] = s[2];
+		d[3] = s[3];
+		d += 4;
+		s += 4;
+	}
+}
+
+/**
+ * Fills 32-byte blocks with 32-bit pattern (generic variant).
+ * @param buf Destination buffer (16 byte aligned).
+ * @param val Fill value.
+ * @param cnt Number of 32-byte blocks to set.
+ * @return Pointer to first byte after filled area.
+ */
+static void *fill32Generic(void *buf, uint32_t val, unsigned int cnt)
+{
+	uint32_t *b = (uint32_t *)buf;
+
+	while (cnt--) {
+		b[0] = val;
+		b[1] = val;
+		b[2] = val;
+		b[3] = val;
+		b[4] = val;
+		b[5] = val;
+		b[6] = val;
+		b[7] = val;
+		b += 8;
+	}
+
+	return b;
+}
+
+/**
+ * Fills 32-byte blocks with 32-bit pattern with masking (generic variant).
+ * @param buf Destination buffer (16 byte aligned).
+ * @param val Fill value.
+ * @param mask Bit mask of bits to preserve.
+ * @param cnt Number of 32-byte blocks to set.
+ * @return Pointer to first byte after filled area.
+ */
+static void *fill32MaskedGeneric(void *buf, uint32_t val,
+					uint32_t mask, unsigned int cnt)
+{
+	uint32_t *b = (uint32_t *)buf;
+	unsigned int i;
+
+	while (cnt--) {
+		for (i = 0; i < 8; ++i)
+			b[i] = (b[i] & mask) | val;
+		b += 8;
+	}
+
+	return b;
+}
+
+/**
+ * Loads 32-bit word from memory of any alignment.
+ * @param ptr Address of the word.
+ * @return Loaded word.
+ */
+static inline uint32_t load32(const void *ptr)
+{
+	uint32_t val;
+
+	memcpy(&val, ptr, sizeof(val));
+	return val;
+}
+
+/**
+ * Averages 2x2 blocks of pixels with 8-bit components (generic variant).
+ * Components are summed in 16-bit fields of 32-bit words.
+ * @param dst Destination row.
+ * @param src0 First source row.
+ * @param src1 Second source row.
+ * @param cnt Number of destination pixels.
+ * @param comps Number of components in pixel (1, 2 or 4).
+ */
+static void downscale8Generic(void *dst, const void *src0,
+			const void *src1, unsigned int cnt, unsigned int comps)
+{
+	const uint8_t *s0 = (const uint8_t *)src0;
+	const uint8_t *s1 = (const uint8_t *)src1;
+	uint8_t *d = (uint8_t *)dst;
+	uint32_t w0, w1, w2, w3, lo, hi;
+
+	switch (comps) {
+	case 4:
+		/* Single pixel per word */
+		while (cnt--) {
+			w0 = load32(s0);
+			w1 = load32(s0 + 4);
+			w2 = load32(s1);
+			w3 = load32(s1 + 4);
+			lo = (w0 & 0x00ff00ff) + (w1 & 0x00ff00ff)
+				+ (w2 & 0x00ff00ff) + (w3 & 0x00ff00ff);
+			hi = ((w0 >> 8) & 0x00ff00ff) + ((w1 >> 8) & 0x00ff00ff)
+				+ ((w2 >> 8) & 0x00ff00ff)
+				+ ((w3 >> 8) & 0x00ff00ff);
+			w0 = ((lo >> 2) & 0x00ff00ff)
+				| (((hi >> 2) & 0x00ff00ff) << 8);
+			memcpy(d, &w0, sizeof(w0));
+			s0 += 8;
+			s1 += 8;
+			d += 4;
+		}
+		break;
+	case 2:
+		/* Two pixels per word, summed from both halves */
+		while (cnt--) {
+			w0 = load32(s0);
+			w1 = load32(s1);
+			lo = (w0 & 0x00ff00ff) + (w1 & 0x00ff00ff);
+			hi = ((w0 >> 8) & 0x00ff00ff) + ((w1 >> 8) & 0x00ff00ff);
+			d[0] = ((lo & 0xffff) + (lo >> 16)) >> 2;
+			d[1] = ((hi & 0xffff) + (hi >> 16)) >> 2;
+			s0 += 4;
+			s1 += 4;
+			d += 2;
+		}
+		break;
+	case 1:
+		/* Four pixels per word, giving two destination pixels */
+		for (; cnt >= 2; cnt -= 2) {
+			w0 = load32(s0);
+			w1 = load32(s1);
+			lo = (w0 & 0x00ff00ff) + ((w0 >> 8) & 0x00ff00ff)
+				+ (w1 & 0x00ff00ff) + ((w1 >> 8) & 0x00ff00ff);
+			lo = (lo >> 2) & 0x00ff00ff;
+			d[0] = lo;
+			d[1] = lo >> 16;
+			s0 += 4;
+			s1 += 4;
+			d += 2;
+		}
+		if (cnt)
+			d[0] = (s0[0] + s0[1] + s1[0] + s1[1]) >> 2;
+		break;
+	}
+}
+
+/**
+ * Averages 2x2 blocks of packed 16-bit pixels (generic variant).
+ * Both source pixels of a row are fetched with single word load.
+ * @param dst Destination row.
+ * @param src0 First source row.
+ * @param src1 Second source row.
+ * @param cnt Number of destination pixels.
+ * @param mask0 Mask of first group of components.
+ * @param mask1 Mask of second group of components.
+ */
+static void downscale16Generic(void *dst, const void *src0,
+				const void *src1, unsigned int cnt,
+				uint32_t mask0, uint32_t mask1)
+{
+	const uint16_t *s0 = (const uint16_t *)src0;
+	const uint16_t *s1 = (const uint16_t *)src1;
+	uint16_t *d = (uint16_t *)dst;
+	uint32_t w0, w1, sum0, sum1;
+
+	while (cnt--) {
+		w0 = load32(s0);
+		w1 = load32(s1);
+		sum0 = (w0 & mask0) + ((w0 >> 16) & mask0)
+			+ (w1 & mask0) + ((w1 >> 16) & mask0);
+		sum1 = (w0 & mask1) + ((w0 >> 16) & mask1)
+			+ (w1 & mask1) + ((w1 >> 16) & mask1);
+		*(d++) = ((sum0 >> 2) & mask0) | ((sum1 >> 2) & mask1);
+		s0 += 2;
+		s1 += 2;
+	}
+}
+
+static const fimgKernelSet fimgKernelsGeneric = {
+	.name		= "generic",
+	.copy16		= copy16Generic,
+	.fill32		= fill32Generic,
+	.fill32masked	= fill32MaskedGeneric,
+	.downscale8	= downscale8Generic,
+	.downscale16	= downscale16Generic,
+};
+
+/*
+ * ARM burst kernels
+ */
+
+#ifdef __arm__
+/**
+ * Copies 16-byte blocks between two buffers (ARM burst variant).
+ * @param dst Destination buffer (word aligned).
+ * @param src Source buffer (word aligned).
+ * @param cnt Number of 16-byte blocks to copy.
+ */
+static void copy16Arm(void *dst, const void *src, unsigned int cnt)
+{
+	unsigned int bursts = cnt / 2;
+
+	if (bursts)
+		asm volatile (
+			"1:\n\t"
+			"ldmia %1!, {r0-r7}\n\t"
+			"stmia %0!, {r0-r7}\n\t"
+			"subs %2, %2, $1\n\t"
+			"bne 1b\n\t"
+			: "+r"(dst), "+r"(src), "+r"(bursts)
+			:
+			: "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7",
+			  "cc", "memory"
+		);
+
+	if (cnt & 1)
+		asm volatile (
+			"ldmia %1!, {r0-r3}\n\t"
+			"stmia %0!, {r0-r3}\n\t"
+			: "+r"(dst), "+r"(src)
+			:
+			: "r0", "r1", "r2", "r3", "memory"
+		);
+}
+
+/**
+ * Fills 32-byte blocks with 32-bit pattern (ARM burst variant).
+ * @param buf Destination buffer (16 byte aligned).
+ * @param val Fill value.
+ * @param cnt Number of 32-byte blocks to set.
+ * @return Pointer to first byte after filled area.
+ */
+static void *fill32Arm(void *buf, uint32_t val, unsigned int cnt)
+{
+	asm volatile (
+		"mov r0, %1\n\t"
+		"mov r1, %1\n\t"
+		"mov r2, %1\n\t"
+		"mov r3, %1\n\t"
+		"mov r4, %1\n\t"
+		"mov r5, %1\n\t"
+		"mov r6, %1\n\t"
+		"mov r7, %1\n\t"
+		"1:\n\t"
+		"stmia %0!, {r0-r7}\n\t"
+		"subs %2, %2, $1\n\t"
+		"bne 1b\n\t"
+		: "+r"(buf), "+r"(cnt)
+		: "r"(val)
+		: "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7",
+		  "cc", "memory"
+	);
+
+	return buf;
+}
+
+/**
+ * Fills 32-byte blocks with 32-bit pattern with masking (ARM burst variant).
+ * @param buf Destination buffer (16 byte aligned).
+ * @param val Fill value.
+ * @param mask Bit mask of bits to preserve.
+ * @param cnt Number of 32-byte blocks to set.
+ * @return Pointer to first byte after filled area.
+ */
+static void *fill32MaskedArm(void *buf, uint32_t val,
+					uint32_t mask, unsigned int cnt)
+{
+	asm volatile (
+		"1:\n\t"
+		"ldmia %0, {r0-r7}\n\t"
+		"and r0, r0, %3\n\t"
+		"and r1, r1, %3\n\t"
+		"and r2, r2, %3\n\t"
+		"and r3, r3, %3\n\t"
+		"and r4, r4, %3\n\t"
+		"and r5, r5, %3\n\t"
+		"and r6, r6, %3\n\t"
+		"and r7, r7, %3\n\t"
+		"orr r0, r0, %2\n\t"
+		"orr r1, r1, %2\n\t"
+		"orr r2, r2, %2\n\t"
+		"orr r3, r3, %2\n\t"
+		"orr r4, r4, %2\n\t"
+		"orr r5, r5, %2\n\t"
+		"orr r6, r6, %2\n\t"
+		"orr r7, r7, %2\n\t"
+		"stmia %0!, {r0-r7}\n\t"
+		"subs %1, %1, $1\n\t"
+		"bne 1b\n\t"
+		: "+r"(buf), "+r"(cnt)
+		: "r"(val), "r"(mask)
+		: "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7",
+		  "cc", "memory"
+	);
+
+	return buf;
+}
+
+static const fimgKernelSet fimgKernelsArm = {
+	.name		= "arm",
+	.copy16		= copy16Arm,
+	.fill32		= fill32Arm,
+	.fill32masked	= fill32MaskedArm,
+	.downscale8	= downscale8Generic,
+	.downscale16	= downscale16Generic,
+};
+#endif /* __arm__ */
+
+/*
+ * x86 SIMD kernels
+ */
+
+#ifdef FIMG_KERNELS_X86
+/**
+ * Copies 16-byte blocks between two buffers (SSE2 variant).
+ * @param dst Destination buffer (word aligned).
+ * @param src Source buffer (word aligned).
+ * @param cnt Number of 16-byte blocks to copy.
+ */
+__attribute__((target("sse2")))
+static void copy16Sse2(void *dst, const void *src, unsigned int cnt)
+{
+	__m128i *d = (__m128i *)dst;
+	const __m128i *s = (const __m128i *)src;
+
+	while (cnt--)
+		_mm_storeu_si128(d++, _mm_loadu_si128(s++));
+}
+
+/**
+ * Fills 32-byte blocks with 32-bit pattern (SSE2 variant).
+ * @param buf Destination buffer (16 byte aligned).
+ * @param val Fill value.
+ * @param cnt Number of 32-byte blocks to set.
+ * @return Pointer to first byte after filled area.
+ */
+__attribute__((target("sse2")))
+static void *fill32Sse2(void *buf, uint32_t val, unsigned int cnt)
+{
+	__m128i *b = (__m128i *)buf;
+	__m128i v = _mm_set1_epi32(val);
+
+	while (cnt--) {
+		_mm_store_si128(b++, v);
+		_mm_store_si128(b++, v);
+	}
+
+	return b;
+}
+
+/**
+ * Fills 32-byte blocks with 32-bit pattern with masking (SSE2 variant).
+ * @param buf Destination buffer (16 byte aligned).
+ * @param val Fill value.
+ * @param mask Bit mask of bits to preserve.
+ * @param cnt Number of 32-byte blocks to set.
+ * @return Pointer to first byte after filled area.
+ */
+__attribute__((target("sse2")))
+static void *fill32MaskedSse2(void *buf, uint32_t val,
+					uint32_t mask, unsigned int cnt)
+{
+	__m128i *b = (__m128i *)buf;
+	__m128i v = _mm_set1_epi32(val);
+	__m128i m = _mm_set1_epi32(mask);
+
+	while (cnt--) {
+		_mm_store_si128(b, _mm_or_si128(_mm_and_si128(
+						_mm_load_si128(b), m), v));
+		++b;
+		_mm_store_si128(b, _mm_or_si128(_mm_and_si128(
+						_mm_load_si128(b), m), v));
+		++b;
+	}
+
+	return b;
+}
+
+/**
+ * Sums pairs of neighbouring pixels with 16-bit components (SSE2 variant).
+ * @param lo Components of first half of pixels.
+ * @param hi Components of second half of pixels.
+ * @param comps Number of components in pixel (1, 2 or 4).
+ * @return Components of summed pixels.
+ */
+__attribute__((target("sse2")))
+static inline __m128i sumPairsSse2(__m128i lo, __m128i hi, unsigned int comps)
+{
+	__m128i mask;
+
+	switch (comps) {
+	case 4:
+		return _mm_add_epi16(_mm_unpacklo_epi64(lo, hi),
+					_mm_unpackhi_epi64(lo, hi));
+	case 2:
+		lo = _mm_add_epi16(_mm_shuffle_epi32(lo, _MM_SHUFFLE(2, 0, 2, 0)),
+				_mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 3, 1)));
+		hi = _mm_add_epi16(_mm_shuffle_epi32(hi, _MM_SHUFFLE(2, 0, 2, 0)),
+				_mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 3, 1)));
+		return _mm_unpacklo_epi64(lo, hi);
+	default:
+		mask = _mm_set1_epi32(0xffff);
+		lo = _mm_add_epi32(_mm_and_si128(lo, mask),
+					_mm_srli_epi32(lo, 16));
+		hi = _mm_add_epi32(_mm_and_si128(hi, mask),
+					_mm_srli_epi32(hi, 16));
+		return _mm_packs_epi32(lo, hi);
+	}
+}
+
+/**
+ * Averages 2x2 blocks of pixels with 8-bit components (SSE2 variant).
+ * @param dst Destination row.
+ * @param src0 First source row.
+ * @param src1 Second source row.
+ * @param cnt Number of destination pixels.
+ * @param comps Number of components in pixel (1, 2 or 4).
+ */
+__attribute__((target("sse2")))
+static void downscale8Sse2(void *dst, const void *src0,
+			const void *src1, unsigned int cnt, unsigned int comps)
+{
+	const __m128i *s0 = (const __m128i *)src0;
+	const __m128i *s1 = (const __m128i *)src1;
+	__m128i *d = (__m128i *)dst;
+	__m128i zero = _mm_setzero_si128();
+	unsigned int blocks = cnt * comps / 16;
+	unsigned int done = 16 * blocks / comps;
+
+	/* 32 bytes of each source row per 16 destination bytes */
+	while (blocks--) {
+		__m128i a0 = _mm_loadu_si128(s0++);
+		__m128i a1 = _mm_loadu_si128(s0++);
+		__m128i b0 = _mm_loadu_si128(s1++);
+		__m128i b1 = _mm_loadu_si128(s1++);
+		__m128i lo, hi;
+
+		lo = sumPairsSse2(
+			_mm_add_epi16(_mm_unpacklo_epi8(a0, zero),
+					_mm_unpacklo_epi8(b0, zero)),
+			_mm_add_epi16(_mm_unpackhi_epi8(a0, zero),
+					_mm_unpackhi_epi8(b0, zero)), comps);
+		hi = sumPairsSse2(
+			_mm_add_epi16(_mm_unpacklo_epi8(a1, zero),
+					_mm_unpacklo_epi8(b1, zero)),
+			_mm_add_epi16(_mm_unpackhi_epi8(a1, zero),
+					_mm_unpackhi_epi8(b1, zero)), comps);
+
+		_mm_storeu_si128(d++, _mm_packus_epi16(_mm_srli_epi16(lo, 2),
+						_mm_srli_epi16(hi, 2)));
+	}
+
+	if (cnt > done)
+		downscale8Generic(d, s0, s1, cnt - done, comps);
+}
+
+/**
+ * Averages 2x2 blocks of packed 16-bit pixels (SSE2 variant).
+ * @param src0 Four pairs of pixels from first source row.
+ * @param src1 Four pairs of pixels from second source row.
+ * @param mask0 Mask of first group of components.
+ * @param mask1 Mask of second group of components.
+ * @return Four destination pixels, sign extended to 32 bits.
+ */
+__attribute__((target("sse2")))
+static inline __m128i average16Sse2(__m128i src0, __m128i src1,
+					__m128i mask0, __m128i mask1)
+{
+	__m128i hi0 = _mm_srli_epi32(src0, 16);
+	__m128i hi1 = _mm_srli_epi32(src1, 16);
+	__m128i sum0, sum1;
+
+	sum0 = _mm_add_epi32(
+		_mm_add_epi32(_mm_and_si128(src0, mask0),
+				_mm_and_si128(hi0, mask0)),
+		_mm_add_epi32(_mm_and_si128(src1, mask0),
+				_mm_and_si128(hi1, mask0)));
+	sum1 = _mm_add_epi32(
+		_mm_add_epi32(_mm_and_si128(src0, mask1),
+				_mm_and_si128(hi0, mask1)),
+		_mm_add_epi32(_mm_and_si128(src1, mask1),
+				_mm_and_si128(hi1, mask1)));
+
+	sum0 = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(sum0, 2), mask0),
+				_mm_and_si128(_mm_srli_epi32(sum1, 2), mask1));
+
+	/* Allow signed saturation when packing */
+	return _mm_srai_epi32(_mm_slli_epi32(sum0, 16), 16);
+}
+
+/**
+ * Averages 2x2 blocks of packed 16-bit pixels (SSE2 variant).
+ * @param dst Destination row.
+ * @param src0 First source row.
+ * @param src1 Second source row.
+ * @param cnt Number of destination pixels.
+ * @param mask0 Mask of first group of components.
+ * @param mask1 Mask of second group of components.
+ */
+__attribute__((target("sse2")))
+static void downscale16Sse2(void *dst, const void *src0,
+				const void *src1, unsigned int cnt,
+				uint32_t mask0, uint32_t mask1)
+{
+	const __m128i *s0 = (const __m128i *)src0;
+	const __m128i *s1 = (const __m128i *)src1;
+	__m128i *d = (__m128i *)dst;
+	__m128i m0 = _mm_set1_epi32(mask0);
+	__m128i m1 = _mm_set1_epi32(mask1);
+	unsigned int blocks = cnt / 8;
+
+	/* 16 pixels of each source row per 8 destination pixels */
+	while (blocks--) {
+		__m128i lo = average16Sse2(_mm_loadu_si128(s0),
+					_mm_loadu_si128(s1), m0, m1);
+		__m128i hi = average16Sse2(_mm_loadu_si128(s0 + 1),
+					_mm_loadu_si128(s1 + 1), m0, m1);
+
+		_mm_storeu_si128(d++, _mm_packs_epi32(lo, hi));
+		s0 += 2;
+		s1 += 2;
+	}
+
+	if (cnt % 8)
+		downscale16Generic(d, s0, s1, cnt % 8, mask0, mask1);
+}
+
+static const fimgKernelSet fimgKernelsSse2 = {
+	.name		= "sse2",
+	.copy16		= copy16Sse2,
+	.fill32		= fill32Sse2,
+	.fill32masked	= fill32MaskedSse2,
+	.downscale8	= downscale8Sse2,
+	.downscale16	= downscale16Sse2,
+};
+
+/**
+ * Copies 16-byte blocks between two buffers (AVX2 variant).
+ * @param dst Destination buffer (word aligned).
+ * @param src Source buffer (word aligned).
+ * @param cnt Number of 16-byte blocks to copy.
+ */
+__attribute__((target("avx2")))
+static void copy16Avx2(void *dst, const void *src, unsigned int cnt)
+{
+	__m256i *d = (__m256i *)dst;
+	const __m256i *s = (const __m256i *)src;
+	unsigned int bursts = cnt / 2;
+
+	while (bursts--)
+		_mm256_storeu_si256(d++, _mm256_loadu_si256(s++));
+
+	if (cnt & 1)
+		_mm_storeu_si128((__m128i *)d,
+				_mm_loadu_si128((const __m128i *)s));
+}
+
+/**
+ * Fills 32-byte blocks with 32-bit pattern (AVX2 variant).
+ * @param buf Destination buffer (16 byte aligned).
+ * @param val Fill value.
+ * @param cnt Number of 32-byte blocks to set.
+ * @return Pointer to first byte after filled area.
+ */
+__attribute__((target("avx2")))
+static void *fill32Avx2(void *buf, uint32_t val, unsigned int cnt)
+{
+	__m256i *b = (__m256i *)buf;
+	__m256i v = _mm256_set1_epi32(val);
+
+	while (cnt--)
+		_mm256_storeu_si256(b++, v);
+
+	return b;
+}
+
+/**
+ * Fills 32-byte blocks with 32-bit pattern with masking (AVX2 variant).
+ * @param buf Destination buffer (16 byte aligned).
+ * @param val Fill value.
+ * @param mask Bit mask of bits to preserve.
+ * @param cnt Number of 32-byte blocks to set.
+ * @return Pointer to first byte after filled area.
+ */
+__attribute__((target("avx2")))
+static void *fill32MaskedAvx2(void *buf, uint32_t val,
+					uint32_t mask, unsigned int cnt)
+{
+	__m256i *b = (__m256i *)buf;
+	__m256i v = _mm256_set1_epi32(val);
+	__m256i m = _mm256_set1_epi32(mask);
+
+	while (cnt--) {
+		_mm256_storeu_si256(b, _mm256_or_si256(_mm256_and_si256(
+					_mm256_loadu_si256(b), m), v));
+		++b;
+	}
+
+	return b;
+}
+
+/**
+ * Sums pairs of neighbouring pixels with 16-bit components (AVX2 variant).
+ * Operates on each 128-bit lane separately.
+ * @param lo Components of first half of pixels of each lane.
+ * @param hi Components of second half of pixels of each lane.
+ * @param comps Number of components in pixel (1, 2 or 4).
+ * @return Components of summed pixels.
+ */
+__attribute__((target("avx2")))
+static inline __m256i sumPairsAvx2(__m256i lo, __m256i hi, unsigned int comps)
+{
+	__m256i mask;
+
+	switch (comps) {
+	case 4:
+		return _mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi),
+					_mm256_unpackhi_epi64(lo, hi));
+	case 2:
+		lo = _mm256_add_epi16(
+			_mm256_shuffle_epi32(lo, _MM_SHUFFLE(2, 0, 2, 0)),
+			_mm256_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 3, 1)));
+		hi = _mm256_add_epi16(
+			_mm256_shuffle_epi32(hi, _MM_SHUFFLE(2, 0, 2, 0)),
+			_mm256_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 3, 1)));
+		return _mm256_unpacklo_epi64(lo, hi);
+	default:
+		mask = _mm256_set1_epi32(0xffff);
+		lo = _mm256_add_epi32(_mm256_and_si256(lo, mask),
+					_mm256_srli_epi32(lo, 16));
+		hi = _mm256_add_epi32(_mm256_and_si256(hi, mask),
+					_mm256_srli_epi32(hi, 16));
+		return _mm256_packs_epi32(lo, hi);
+	}
+}
+
+/**
+ * Averages 2x2 blocks of pixels with 8-bit components (AVX2 variant).
+ * @param dst Destination row.
+ * @param src0 First source row.
+ * @param src1 Second source row.
+ * @param cnt Number of destination pixels.
+ * @param comps Number of components in pixel (1, 2 or 4).
+ */
+__attribute__((target("avx2")))
+static void downscale8Avx2(void *dst, const void *src0,
+			const void *src1, unsigned int cnt, unsigned int comps)
+{
+	const __m256i *s0 = (const __m256i *)src0;
+	const __m256i *s1 = (const __m256i *)src1;
+	__m256i *d = (__m256i *)dst;
+	__m256i zero = _mm256_setzero_si256();
+	unsigned int blocks = cnt * comps / 32;
+	unsigned int done = 32 * blocks / comps;
+
+	/* 64 bytes of each source row per 32 destination bytes */
+	while (blocks--) {
+		__m256i a0 = _mm256_loadu_si256(s0++);
+		__m256i a1 = _mm256_loadu_si256(s0++);
+		__m256i b0 = _mm256_loadu_si256(s1++);
+		__m256i b1 = _mm256_loadu_si256(s1++);
+		__m256i lo, hi;
+
+		lo = sumPairsAvx2(
+			_mm256_add_epi16(_mm256_unpacklo_epi8(a0, zero),
+					_mm256_unpacklo_epi8(b0, zero)),
+			_mm256_add_epi16(_mm256_unpackhi_epi8(a0, zero),
+					_mm256_unpackhi_epi8(b0, zero)), comps);
+		hi = sumPairsAvx2(
+			_mm256_add_epi16(_mm256_unpacklo_epi8(a1, zero),
+					_mm256_unpacklo_epi8(b1, zero)),
+			_mm256_add_epi16(_mm256_unpackhi_epi8(a1, zero),
+					_mm256_unpackhi_epi8(b1, zero)), comps);
+
+		/* Packing interleaves 64-bit groups of both lanes */
+		lo = _mm256_packus_epi16(_mm256_srli_epi16(lo, 2),
+						_mm256_srli_epi16(hi, 2));
+		_mm256_storeu_si256(d++,
+			_mm256_permute4x64_epi64(lo, _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+
+	if (cnt > done)
+		downscale8Sse2(d, s0, s1, cnt - done, comps);
+}
+
+/**
+ * Averages 2x2 blocks of packed 16-bit pixels (AVX2 variant).
+ * @param src0 Eight pairs of pixels from first source row.
+ * @param src1 Eight pairs of pixels from second source row.
+ * @param mask0 Mask of first group of components.
+ * @param mask1 Mask of second group of components.
+ * @return Eight destination pixels, sign extended to 32 bits.
+ */
+__attribute__((target("avx2")))
+static inline __m256i average16Avx2(__m256i src0, __m256i src1,
+					__m256i mask0, __m256i mask1)
+{
+	__m256i hi0 = _mm256_srli_epi32(src0, 16);
+	__m256i hi1 = _mm256_srli_epi32(src1, 16);
+	__m256i sum0, sum1;
+
+	sum0 = _mm256_add_epi32(
+		_mm256_add_epi32(_mm256_and_si256(src0, mask0),
+				_mm256_and_si256(hi0, mask0)),
+		_mm256_add_epi32(_mm256_and_si256(src1, mask0),
+				_mm256_and_si256(hi1, mask0)));
+	sum1 = _mm256_add_epi32(
+		_mm256_add_epi32(_mm256_and_si256(src0, mask1),
+				_mm256_and_si256(hi0, mask1)),
+		_mm256_add_epi32(_mm256_and_si256(src1, mask1),
+				_mm256_and_si256(hi1, mask1)));
+
+	sum0 = _mm256_or_si256(
+		_mm256_and_si256(_mm256_srli_epi32(sum0, 2), mask0),
+		_mm256_and_si256(_mm256_srli_epi32(sum1, 2), mask1));
+
+	/* Allow signed saturation when packing */
+	return _mm256_srai_epi32(_mm256_slli_epi32(sum0, 16), 16);
+}
+
+/**
+ * Averages 2x2 blocks of packed 16-bit pixels (AVX2 variant).
+ * @param dst Destination row.
+ * @param src0 First source row.
+ * @param src1 Second source row.
+ * @param cnt Number of destination pixels.
+ * @param mask0 Mask of first group of components.
+ * @param mask1 Mask of second group of components.
+ */
+__attribute__((target("avx2")))
+static void downscale16Avx2(void *dst, const void *src0,
+				const void *src1, unsigned int cnt,
+				uint32_t mask0, uint32_t mask1)
+{
+	const __m256i *s0 = (const __m256i *)src0;
+	const __m256i *s1 = (const __m256i *)src1;
+	__m256i *d = (__m256i *)dst;
+	__m256i m0 = _mm256_set1_epi32(mask0);
+	__m256i m1 = _mm256_set1_epi32(mask1);
+	unsigned int blocks = cnt / 16;
+
+	/* 32 pixels of each source row per 16 destination pixels */
+	while (blocks--) {
+		__m256i lo = average16Avx2(_mm256_loadu_si256(s0),
+					_mm256_loadu_si256(s1), m0, m1);
+		__m256i hi = average16Avx2(_mm256_loadu_si256(s0 + 1),
+					_mm256_loadu_si256(s1 + 1), m0, m1);
+
+		/* Packing interleaves 64-bit groups of both lanes */
+		lo = _mm256_packs_epi32(lo, hi);
+		_mm256_storeu_si256(d++,
+			_mm256_permute4x64_epi64(lo, _MM_SHUFFLE(3, 1, 2, 0)));
+		s0 += 2;
+		s1 += 2;
+	}
+
+	if (cnt % 16)
+		downscale16Sse2(d, s0, s1, cnt % 16, mask0, mask1);
+}
+
+static const fimgKernelSet fimgKernelsAvx2 = {
+	.name		= "avx2",
+	.copy16		= copy16Avx2,
+	.fill32		= fill32Avx2,
+	.fill32masked	= fill32MaskedAvx2,
+	.downscale8	= downscale8Avx2,
+	.downscale16	= downscale16Avx2,
+};
+#endif /* FIMG_KERNELS_X86 */
+
+/*
+ * Kernel selection
+ */
+
+/** Kernel sets available in this build, from the most preferred one. */
+static const fimgKernelSet *fimgKernelSets[] = {
+#ifdef __arm__
+	&fimgKernelsArm,
+#endif
+#ifdef FIMG_KERNELS_X86
+	&fimgKernelsAvx2,
+	&fimgKernelsSse2,
+#endif
+	&fimgKernelsGeneric,
+};
+
+/** Currently used kernel set. */
+const fimgKernelSet *fimgKernels = &fimgKernelsGeneric;
+
+/**
+ * Checks whether given kernel set can run on current CPU.
+ * @param set Kernel set.
+ * @return Non-zero if supported, zero otherwise.
+ */
+static int fimgKernelSetSupported(const fimgKernelSet *set)
+{
+#ifdef FIMG_KERNELS_X86
+	__builtin_cpu_init();
+
+	if (set == &fimgKernelsAvx2)
+		return __builtin_cpu_supports("avx2");
+	if (set == &fimgKernelsSse2)
+		return __builtin_cpu_supports("sse2");
+#endif
+	return 1;
+}
+
+/**
+ * Selects kernel set to use.
+ * @param name Name of requested kernel set or NULL to select the best one
+ * supported by the CPU.
+ * @return 0 on success, negative if requested set is not available.
+ */
+int fimgSelectKernels(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < NELEM(fimgKernelSets); ++i) {
+		const fimgKernelSet *set = fimgKernelSets[i];
+
+		if (name && strcmp(name, set->name))
+			continue;
+
+		if (!fimgKernelSetSupported(set))
+			continue;
+
+		fimgKernels = set;
+		return 0;
+	}
+
+	return -1;
+}
+
+/**
+ * Selects kernel set at library load time.
+ * FIMG_KERNELS environment variable can be used to force particular set.
+ */
+__attribute__((constructor))
+static void fimgInitKernels(void)
+{
+	const char *name = getenv("FIMG_KERNELS");
+
+	if (name && fimgSelectKernels(name) < 0)
+		LOGW("Kernel set %s not available, using default.", name);
+	else if (name)
+		return;
+
+	fimgSelectKernels(NULL);
+}
@@ -0,0 +1,297 @@
+/*
+ * fimg/lock.c
+ *
+ * SAMSUNG S3C6410 FIMG-3DSE HARDWARE LOCK RETENTION
+ *
+ * Copyrights:	2011 by Tomasz Figa < tomasz.figa at gmail.com >
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include "fimg_private.h"
+
+/*
+ * Acquiring the hardware lock costs a system call, which is pure overhead
+ * when there is only one client using the hardware. With FIMG_LAZY_LOCK
+ * the lock is retained when a session ends and reused by the next session.
+ * It is released by fimgReleaseHardware() (called on buffer swap and context
+ * switch), when another client is waiting for it or by a watchdog thread
+ * after FIMG_LAZY_LOCK_TIMEOUT milliseconds of inactivity. Since the kernel
+ * driver does not report waiting clients, the lock is also released when
+ * it has been held for FIMG_LAZY_LOCK_MAX_HOLD milliseconds, so clients
+ * rendering continuously without swapping can not starve other ones.
+ */
+
+#define NSEC_PER_SEC	1000000000ULL
+#define NSEC_PER_MSEC	1000000ULL
+
+/**
+ * Closes statistics period if it lasted for at least one second.
+ * @param lock Lock state.
+ * @param now Current time (in ns).
+ */
+static void updateStats(fimgLockState *lock, uint64_t now)
+{
+	uint64_t elapsed = now - lock->periodStart;
+
+	if (elapsed < NSEC_PER_SEC)
+		return;
+
+	if (elapsed < 2*NSEC_PER_SEC) {
+		lock->stats.acquisitions = lock->acquisitions;
+		lock->stats.restores = lock->restores;
+	} else {
+		/* Nothing happened in last full second */
+		lock->stats.acquisitions = 0;
+		lock->stats.restores = 0;
+	}
+
+	lock->acquisitions = 0;
+	lock->restores = 0;
+	lock->periodStart = now;
+}
+
+/**
+ * Checks whether the lock should be given away to other clients.
+ * @param ctx Hardware context.
+ * @param now Current time (in ns).
+ * @return Non-zero if the lock must not be retained any longer.
+ */
+static int mustRelease(fimgContext *ctx, uint64_t now)
+{
+	if (now - ctx->lock.acquired >= FIMG_LAZY_LOCK_MAX_HOLD*NSEC_PER_MSEC)
+		return 1;
+
+	return fimgHardwareLockContended(ctx);
+}
+
+/**
+ * Releases retained hardware lock.
+ * (Must be called with lock state mutex held.)
+ * @param ctx Hardware context.
+ */
+static void releaseRetained(fimgContext *ctx)
+{
+	if (!ctx->lock.retained)
+		return;
+
+	fimgReleaseHardwareLock(ctx);
+	ctx->lock.retained = 0;
+}
+
+/**
+ * Releases retained hardware lock after period of inactivity.
+ * @param arg Hardware context.
+ * @return Always NULL.
+ */
+static void *watchdogThread(void *arg)
+{
+	fimgContext *ctx = arg;
+	fimgLockState *lock = &ctx->lock;
+	struct timespec ts;
+	uint64_t deadline, maxHold;
+
+	pthread_mutex_lock(&lock->mutex);
+
+	while (!lock->quit) {
+		if (!lock->retained) {
+			pthread_cond_wait(&lock->cond, &lock->mutex);
+			continue;
+		}
+
+		deadline = lock->lastUse + FIMG_LAZY_LOCK_TIMEOUT*NSEC_PER_MSEC;
+		maxHold = lock->acquired + FIMG_LAZY_LOCK_MAX_HOLD*NSEC_PER_MSEC;
+		if (maxHold < deadline)
+			deadline = maxHold;
+
+		if (fimgGetTime() >= deadline) {
+			releaseRetained(ctx);
+			continue;
+		}
+
+		ts.tv_sec = deadline / NSEC_PER_SEC;
+		ts.tv_nsec = deadline % NSEC_PER_SEC;
+		pthread_cond_timedwait(&lock->cond, &lock->mutex, &ts);
+	}
+
+	pthread_mutex_unlock(&lock->mutex);
+
+	return NULL;
+}
+
+/**
+ * Initializes hardware lock state of hardware context.
+ * @param ctx Hardware context.
+ */
+void fimgCreateLockState(fimgContext *ctx)
+{
+	fimgLockState *lock = &ctx->lock;
+	pthread_condattr_t attr;
+
+	memset(lock, 0, sizeof(*lock));
+
+	pthread_mutex_init(&lock->mutex, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&lock->cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	lock->periodStart = fimgGetTime();
+}
+
+/**
+ * Stops the watchdog and releases retained hardware lock.
+ * @param ctx Hardware context.
+ */
+void fimgDestroyLockState(fimgContext *ctx)
+{
+	fimgLockState *lock = &ctx->lock;
+
+	LOGD("Hardware lock: %u acquisitions, %u restores",
+		lock->stats.totalAcquisitions, lock->stats.totalRestores);
+
+	pthread_mutex_lock(&lock->mutex);
+	lock->quit = 1;
+	pthread_cond_signal(&lock->cond);
+	pthread_mutex_unlock(&lock->mutex);
+
+	if (lock->watchdogRunning)
+		pthread_join(lock->watchdog, NULL);
+
+	releaseRetained(ctx);
+
+	pthread_cond_destroy(&lock->cond);
+	pthread_mutex_destroy(&lock->mutex);
+}
+
+/**
+ * Starts new session using retained hardware lock.
+ * The lock is released if another client is waiting for it or it has been
+ * held for too long.
+ * @param ctx Hardware context.
+ * @return Non-zero if the session has been started, otherwise zero.
+ */
+int fimgResumeHardware(fimgContext *ctx)
+{
+	fimgLockState *lock = &ctx->lock;
+	int ret = 0;
+
+	pthread_mutex_lock(&lock->mutex);
+
+	if (lock->retained) {
+		if (mustRelease(ctx, fimgGetTime())) {
+			releaseRetained(ctx);
+		} else {
+			lock->retained = 0;
+			ret = 1;
+		}
+	}
+
+	pthread_mutex_unlock(&lock->mutex);
+
+	/* Let clients waiting for released lock take it */
+	if (!ret)
+		sched_yield();
+
+	return ret;
+}
+
+/**
+ * Ends current session, keeping the hardware lock unless another client
+ * is waiting for it or it has been held for too long.
+ * @param ctx Hardware context.
+ */
+void fimgRetainHardware(fimgContext *ctx)
+{
+	fimgLockState *lock = &ctx->lock;
+
+	if (mustRelease(ctx, fimgGetTime())) {
+		fimgReleaseHardwareLock(ctx);
+		return;
+	}
+
+	pthread_mutex_lock(&lock->mutex);
+
+	lock->retained = 1;
+	lock->lastUse = fimgGetTime();
+
+	if (!lock->watchdogRunning && !pthread_create(&lock->watchdog,
+						NULL, watchdogThread, ctx))
+		lock->watchdogRunning = 1;
+
+	pthread_cond_signal(&lock->cond);
+	pthread_mutex_unlock(&lock->mutex);
+
+	if (!lock->watchdogRunning) {
+		/* Nothing could release the lock later */
+		fimgReleaseHardware(ctx);
+	}
+}
+
+/**
+ * Releases hardware lock retained after last session, if any.
+ * @param ctx Hardware context.
+ */
+void fimgReleaseHardware(fimgContext *ctx)
+{
+	fimgLockState *lock = &ctx->lock;
+
+	pthread_mutex_lock(&lock->mutex);
+	releaseRetained(ctx);
+	pthread_mutex_unlock(&lock->mutex);
+}
+
+/**
+ * Accounts hardware lock acquisition in lock statistics.
+ * @param ctx Hardware context.
+ * @param ret Return value of fimgAcquireHardwareLock().
+ */
+void fimgCountLock(fimgContext *ctx, int ret)
+{
+	fimgLockState *lock = &ctx->lock;
+
+	if (ret < 0)
+		return;
+
+	lock->acquired = fimgGetTime();
+	updateStats(lock, lock->acquired);
+
+	++lock->acquisitions;
+	++lock->stats.totalAcquisitions;
+
+	if (ret > 0) {
+		++lock->restores;
+		++lock->stats.totalRestores;
+	}
+}
+
+/**
+ * Retrieves hardware lock statistics.
+ * @param ctx Hardware context.
+ * @param stats Structure to fill with statistics.
+ */
+void fimgGetLockStats(fimgContext *ctx, fimgLockStats *stats)
+{
+	fimgLockState *lock = &ctx->lock;
+
+	updateStats(lock, fimgGetTime());
+	*stats = lock->stats;
+}
@@ -0,0 +1,355 @@
+/*
+ * fimg/packbench.c
+ *
+ * SAMSUNG S3C6410 FIMG-3DSE VERTEX ATTRIBUTE PACKER BENCHMARK
+ *
+ * Copyrights:	2010 by Tomasz Figa < tomasz.figa at gmail.com >
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmark comparing word aligned attribute packers of host.c with the
+ * scalar loops they replaced, for common attribute layouts, both tightly
+ * packed and interleaved, unindexed and indexed.
+ *
+ * The packers are private to host.c, so it is included here directly.
+ * Cycles are derived from elapsed time and CPU clock, which is read from
+ * cpufreq or given in MHz with -c.
+ *
+ * Usage: packbench [-c MHz]
+ */
+
+#include "host.c"
+
+#include <time.h>
+#include <unistd.h>
+
+/** Number of vertices packed by single call (the range of ubyte indices). */
+#define BENCH_VERTICES		256
+/** Number of bytes packed by each measurement. */
+#define BENCH_BYTES		(64 << 20)
+/** Stride of interleaved vertices. */
+#define BENCH_STRIDE		32
+
+/*
+ * Scalar packers (previous implementation)
+ */
+
+static void packWordsScalar(uint32_t *buf, const uint8_t *base,
+				uint32_t stride, uint32_t width, int cnt)
+{
+	uint32_t len, srcpad = (stride - width) / 4;
+	const uint32_t *data = (const uint32_t *)base;
+
+	while (cnt--) {
+		len = width;
+
+		while (len) {
+			*(buf++) = *(data++);
+			len -= 4;
+		}
+
+		data += srcpad;
+	}
+}
+
+static void packWordsIdx16Scalar(uint32_t *buf, const uint8_t *base,
+				uint32_t stride, uint32_t width,
+				const uint16_t *idx, int cnt)
+{
+	const uint32_t *data, *next_data;
+	uint32_t len;
+
+	next_data = BUF_ADDR_32(base, *(idx++)*stride);
+	--cnt;
+
+	while (cnt--) {
+		data = next_data;
+		next_data = BUF_ADDR_32(base, *(idx++)*stride);
+		len = width;
+
+		while (len) {
+			*(buf++) = *(data++);
+			len -= 4;
+		}
+	}
+
+	data = next_data;
+	len = width;
+
+	while (len) {
+		*(buf++) = *(data++);
+		len -= 4;
+	}
+}
+
+static void packWordsIdx8Scalar(uint32_t *buf, const uint8_t *base,
+				uint32_t stride, uint32_t width,
+				const uint8_t *idx, int cnt)
+{
+	const uint32_t *data, *next_data;
+	uint32_t len;
+
+	next_data = BUF_ADDR_32(base, *(idx++)*stride);
+	--cnt;
+
+	while (cnt--) {
+		data = next_data;
+		next_data = BUF_ADDR_32(base, *(idx++)*stride);
+		len = width;
+
+		while (len) {
+			*(buf++) = *(data++);
+			len -= 4;
+		}
+	}
+
+	data = next_data;
+	len = width;
+
+	while (len) {
+		*(buf++) = *(data++);
+		len -= 4;
+	}
+}
+
+/*
+ * Benchmark
+ */
+
+/** Index types. */
+enum {
+	BENCH_UNINDEXED,
+	BENCH_USHORT,
+	BENCH_UBYTE,
+	BENCH_INDEX_TYPES
+};
+
+static const char *indexTypeName[BENCH_INDEX_TYPES] = {
+	"unindexed",
+	"ushort",
+	"ubyte",
+};
+
+/** Attribute layout. */
+struct benchLayout {
+	const char *name;
+	uint32_t width;
+};
+
+static const struct benchLayout layouts[] = {
+	{ "float4", 16 },
+	{ "float3", 12 },
+	{ "float2", 8 },
+	{ "ubyte4", 4 },
+};
+
+static uint16_t indices16[BENCH_VERTICES];
+static uint8_t indices8[BENCH_VERTICES];
+
+/**
+ * Packs vertices with selected packer.
+ * @param scalar Non-zero to use scalar packer.
+ * @param type Index type.
+ * @param buf Destination buffer.
+ * @param base Data of vertex 0.
+ * @param stride Vertex stride (in bytes).
+ * @param width Attribute width (in bytes).
+ */
+static void pack(int scalar, int type, uint32_t *buf,
+			const uint8_t *base, uint32_t stride, uint32_t width)
+{
+	switch (type) {
+	case BENCH_UNINDEXED:
+		if (scalar)
+			packWordsScalar(buf, base, stride, width,
+							BENCH_VERTICES);
+		else
+			packWords(buf, base, stride, width, BENCH_VERTICES);
+		break;
+	case BENCH_USHORT:
+		if (scalar)
+			packWordsIdx16Scalar(buf, base, stride, width,
+						indices16, BENCH_VERTICES);
+		else
+			packWordsIdx16(buf, base, stride, width,
+						indices16, BENCH_VERTICES);
+		break;
+	case BENCH_UBYTE:
+		if (scalar)
+			packWordsIdx8Scalar(buf, base, stride, width,
+						indices8, BENCH_VERTICES);
+		else
+			packWordsIdx8(buf, base, stride, width,
+						indices8, BENCH_VERTICES);
+		break;
+	}
+}
+
+/**
+ * Returns current monotonic time in nanoseconds.
+ */
+static uint64_t benchTime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Measures packing throughput.
+ * @return Packed bytes per nanosecond.
+ */
+static double measure(int scalar, int type, uint32_t *buf,
+			const uint8_t *base, uint32_t stride, uint32_t width)
+{
+	unsigned int iters = BENCH_BYTES / (BENCH_VERTICES * width);
+	unsigned int i;
+	uint64_t start;
+
+	/* Warm up caches */
+	pack(scalar, type, buf, base, stride, width);
+
+	start = benchTime();
+	for (i = 0; i < iters; ++i) {
+		pack(scalar, type, buf, base, stride, width);
+		/* Keep the compiler from dropping repeated packing */
+		__asm__ __volatile__("" : : "r" (buf) : "memory");
+	}
+
+	return (double)iters * BENCH_VERTICES * width
+					/ (benchTime() - start);
+}
+
+/**
+ * Reads current CPU clock from cpufreq.
+ * @return CPU clock in MHz or 0 if unknown.
+ */
+static double cpuClock(void)
+{
+	FILE *file;
+	unsigned long khz;
+
+	file = fopen("/sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq",
+									"r");
+	if (!file)
+		return 0;
+
+	if (fscanf(file, "%lu", &khz) != 1)
+		khz = 0;
+
+	fclose(file);
+
+	return khz / 1000.0;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t *buf[2];
+	uint8_t *data;
+	double mhz;
+	unsigned int i, l;
+	int type, interleaved, opt;
+
+	mhz = cpuClock();
+
+	while ((opt = getopt(argc, argv, "c:")) != -1) {
+		switch (opt) {
+		case 'c':
+			mhz = atof(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-c MHz]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	data = memalign(32, BENCH_VERTICES * BENCH_STRIDE);
+	buf[0] = memalign(32, BENCH_VERTICES * 16);
+	buf[1] = memalign(32, BENCH_VERTICES * 16);
+	if (!data || !buf[0] || !buf[1]) {
+		fprintf(stderr, "Failed to allocate buffers\n");
+		return 1;
+	}
+
+	for (i = 0; i < BENCH_VERTICES * BENCH_STRIDE; ++i)
+		data[i] = i * 31 + 7;
+
+	/* Neighbouring triangles share vertices, but not in memory order */
+	for (i = 0; i < BENCH_VERTICES; ++i) {
+		indices16[i] = (i * 97 + i / 3) % BENCH_VERTICES;
+		indices8[i] = indices16[i];
+	}
+
+	if (mhz > 0)
+		printf("CPU clock %.0f MHz\n", mhz);
+	else
+		printf("CPU clock unknown, use -c to get bytes per cycle\n");
+
+	printf("%-18s %-10s %13s %13s %8s\n", "layout", "indices",
+		mhz > 0 ? "scalar B/c" : "scalar MB/s",
+		mhz > 0 ? "unrolled B/c" : "unrolled MB/s", "speedup");
+
+	for (interleaved = 0; interleaved < 2; ++interleaved) {
+		for (l = 0; l < sizeof(layouts) / sizeof(layouts[0]); ++l) {
+			uint32_t width = layouts[l].width;
+			uint32_t stride = interleaved ? BENCH_STRIDE : width;
+			char name[32];
+
+			snprintf(name, sizeof(name), "%s %s", layouts[l].name,
+					interleaved ? "interleaved" : "tight");
+
+			for (type = 0; type < BENCH_INDEX_TYPES; ++type) {
+				double scalar, unrolled;
+
+				pack(1, type, buf[0], data, stride, width);
+				pack(0, type, buf[1], data, stride, width);
+				if (memcmp(buf[0], buf[1],
+						BENCH_VERTICES * width)) {
+					fprintf(stderr, "Packers differ for "
+						"%s, %s indices\n", name,
+						indexTypeName[type]);
+					return 1;
+				}
+
+				scalar = measure(1, type, buf[0],
+							data, stride, width);
+				unrolled = measure(0, type, buf[1],
+							data, stride, width);
+
+				if (mhz > 0) {
+					/* Bytes per ns divided by GHz */
+					scalar /= mhz / 1000;
+					unrolled /= mhz / 1000;
+				} else {
+					scalar *= 1000;
+					unrolled *= 1000;
+				}
+
+				printf("%-18s %-10s %13.3f %13.3f %7.2fx\n",
+					name, indexTypeName[type], scalar,
+					unrolled, unrolled / scalar);
+			}
+		}
+	}
+
+	free(data);
+	free(buf[0]);
+	free(buf[1]);
+
+	return 0;
+}
@@ -46,10 +46,14 @@ void fimgSetVertexContext(fimgContext *ctx, unsigned int type)
 #ifdef FIMG_INTERPOLATION_WORKAROUND
 	ctx->primitive.vctx.vsOut = FIMG_ATTRIB_NUM - 1; // WORKAROUND
 #else
-	ctx->primitive.vctx.vsOut = ctx->numAttribs - 1; // Without position
+	ctx->primitive.vctx.vsOut = 1 + FIMG_NUM_TEXTURE_UNITS; // Color and texcoords
+	if ((ctx->compat.vsState.vs & (FGFP_VS_FOG_MASK | FGFP_VS_CLIP_EN_ALL_MASK))
+	    && !(ctx->compat.vsState.vs & FGFP_VS_SCREEN_SPACE_MASK))
+		++ctx->primitive.vctx.vsOut; // Fog factor and clip distances
 #endif
 
 	fimgWrite(ctx, ctx->primitive.vctx.val, FGPE_VERTEX_CONTEXT);
+	ctx->touched |= FIMG_BLOCK_PRIMITIVE;
 }
 
 /**
@@ -0,0 +1,665 @@
+/*
+ * fimg/shadercache.c
+ *
+ * SAMSUNG S3C6410 FIMG-3DSE FIXED PIPELINE SHADER PROGRAM CACHE
+ *
+ * Copyrights:	2011 by Tomasz Figa < tomasz.figa at gmail.com >
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "fimg_private.h"
+
+#ifdef FIMG_FIXED_PIPELINE
+
+/*
+ * Generating and optimizing a shader program for fixed pipeline state is
+ * expensive, so generated programs are kept in a hash table keyed by the
+ * relevant bits of pipeline state. Programs are kept on a LRU list and
+ * evicted when the number of cached programs exceeds cache capacity.
+ */
+
+/** Default capacity of shader program cache (in programs). */
+#define FIMG_SHADER_CACHE_CAPACITY	32
+
+static const char *const shaderTypeName[FIMG_SHADER_TYPES] = {
+	[FIMG_SHADER_VERTEX]	= "Vertex",
+	[FIMG_SHADER_PIXEL]	= "Pixel",
+};
+
+static const uint32_t shaderMaxInstr[FIMG_SHADER_TYPES] = {
+	[FIMG_SHADER_VERTEX]	= FIMG_MAX_VS_INSTR,
+	[FIMG_SHADER_PIXEL]	= FIMG_MAX_PS_INSTR,
+};
+
+/**
+ * Calculates hash of a sequence of words.
+ * @param hash Initial hash value.
+ * @param data Words to hash.
+ * @param len Number of words.
+ * @return Hash value.
+ */
+static uint32_t hashWords(uint32_t hash, const uint32_t *data, size_t len)
+{
+	while (len--) {
+		hash ^= *(data++);
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+/**
+ * Calculates hash of shader program key.
+ * @param key Shader program key.
+ * @return Hash value.
+ */
+static uint32_t hashKey(const uint32_t *key)
+{
+	return hashWords(2166136261U, key, FIMG_SHADER_KEY_LEN);
+}
+
+/**
+ * Removes shader program from the cache.
+ * @param cache Shader program cache.
+ * @param prog Shader program.
+ */
+static void unlinkProgram(fimgShaderCache *cache, fimgShaderProgram *prog)
+{
+	fimgShaderProgram **link = &cache->hash[prog->hash % FIMG_SHADER_CACHE_BUCKETS];
+
+	while (*link != prog)
+		link = &(*link)->hashNext;
+	*link = prog->hashNext;
+
+	if (prog->lruPrev)
+		prog->lruPrev->lruNext = prog->lruNext;
+	else
+		cache->lruHead = prog->lruNext;
+
+	if (prog->lruNext)
+		prog->lruNext->lruPrev = prog->lruPrev;
+	else
+		cache->lruTail = prog->lruPrev;
+
+	if (cache->current == prog)
+		cache->current = NULL;
+
+	--cache->stats.entries;
+}
+
+/**
+ * Evicts least recently used programs until given number of entries is free.
+ * @param cache Shader program cache.
+ * @param count Number of entries required.
+ */
+static void evictPrograms(fimgShaderCache *cache, unsigned int count)
+{
+	fimgShaderProgram *prog;
+
+	while (cache->lruTail
+	    && cache->stats.entries + count > cache->stats.capacity) {
+		prog = cache->lruTail;
+		unlinkProgram(cache, prog);
+		free(prog);
+		++cache->stats.evictions;
+	}
+}
+
+/**
+ * Initializes shader program cache.
+ * @param cache Shader program cache.
+ * @param type Type of cached programs (FIMG_SHADER_*).
+ */
+void fimgCreateShaderCache(fimgShaderCache *cache, unsigned int type)
+{
+	memset(cache, 0, sizeof(*cache));
+	cache->type = type;
+	cache->stats.capacity = FIMG_SHADER_CACHE_CAPACITY;
+}
+
+/**
+ * Frees all programs of shader program cache.
+ * @param cache Shader program cache.
+ */
+void fimgDestroyShaderCache(fimgShaderCache *cache)
+{
+	fimgShaderProgram *prog;
+
+	LOGD("%s shader cache: %u same hits, %u hits, %u misses "
+		"(%u from disk), %u evictions, %u entries, %u uploads, "
+		"%u resident hits, %u of %u built instructions kept",
+		shaderTypeName[cache->type],
+		cache->stats.sameHits, cache->stats.hits, cache->stats.misses,
+		cache->stats.diskHits, cache->stats.evictions,
+		cache->stats.entries, cache->stats.uploads,
+		cache->stats.residentHits, cache->stats.optimizedInstr,
+		cache->stats.builtInstr);
+
+	while ((prog = cache->lruHead) != NULL) {
+		unlinkProgram(cache, prog);
+		free(prog);
+	}
+}
+
+/**
+ * Looks up shader program matching given key.
+ * Found program becomes the most recently used one.
+ * @param cache Shader program cache.
+ * @param key Shader program key.
+ * @return Pointer to cached program or NULL if not found.
+ */
+fimgShaderProgram *fimgShaderCacheLookup(fimgShaderCache *cache,
+							const uint32_t *key)
+{
+	uint32_t hash = hashKey(key);
+	fimgShaderProgram *prog = cache->hash[hash % FIMG_SHADER_CACHE_BUCKETS];
+
+	while (prog) {
+		if (prog->hash == hash
+		    && !memcmp(prog->key, key, sizeof(prog->key)))
+			break;
+		prog = prog->hashNext;
+	}
+
+	if (!prog) {
+		++cache->stats.misses;
+		return NULL;
+	}
+
+	++cache->stats.hits;
+
+	if (prog != cache->lruHead) {
+		prog->lruPrev->lruNext = prog->lruNext;
+		if (prog->lruNext)
+			prog->lruNext->lruPrev = prog->lruPrev;
+		else
+			cache->lruTail = prog->lruPrev;
+
+		prog->lruPrev = NULL;
+		prog->lruNext = cache->lruHead;
+		cache->lruHead->lruPrev = prog;
+		cache->lruHead = prog;
+	}
+
+	return prog;
+}
+
+/**
+ * Inserts generated shader program into the cache.
+ * Least recently used programs are evicted if the cache is full.
+ * @param cache Shader program cache.
+ * @param key Shader program key.
+ * @param code Program code.
+ * @param instrCount Number of instructions in the program.
+ * @return Pointer to cached program or NULL on error.
+ */
+fimgShaderProgram *fimgShaderCacheInsert(fimgShaderCache *cache,
+		const uint32_t *key, const uint32_t *code, uint32_t instrCount)
+{
+	fimgShaderProgram **bucket;
+	fimgShaderProgram *prog;
+
+	if (!instrCount || instrCount > shaderMaxInstr[cache->type])
+		return NULL;
+
+	prog = malloc(sizeof(*prog) + 16*instrCount);
+	if (!prog)
+		return NULL;
+
+	memcpy(prog->key, key, sizeof(prog->key));
+	prog->hash = hashKey(key);
+	prog->memId = 0;
+	prog->instrCount = instrCount;
+	memcpy(prog->code, code, 16*instrCount);
+
+	evictPrograms(cache, 1);
+
+	bucket = &cache->hash[prog->hash % FIMG_SHADER_CACHE_BUCKETS];
+	prog->hashNext = *bucket;
+	*bucket = prog;
+
+	prog->lruPrev = NULL;
+	prog->lruNext = cache->lruHead;
+	if (cache->lruHead)
+		cache->lruHead->lruPrev = prog;
+	else
+		cache->lruTail = prog;
+	cache->lruHead = prog;
+
+	++cache->stats.entries;
+
+	return prog;
+}
+
+/*
+ * Instruction memory can hold several programs at once. Programs are placed
+ * in it one after another, wrapping around to the beginning when the end
+ * is reached, so the least recently uploaded programs are overwritten first.
+ * Each upload is tagged with unique identifier stored in all slots it
+ * occupies. A program is still resident if its first slot is tagged with
+ * its identifier, because overwriting any part of it requires an allocation
+ * starting at or before its first slot.
+ */
+
+/**
+ * Allocates place in instruction memory for shader program, unless it is
+ * already resident.
+ * @param cache Shader program cache.
+ * @param prog Shader program.
+ * @return Non-zero if the program must be uploaded, zero if it is resident.
+ */
+int fimgShaderMakeResident(fimgShaderCache *cache, fimgShaderProgram *prog)
+{
+	fimgShaderMemory *mem = &cache->mem;
+	uint32_t i;
+
+	if (prog->memId && mem->owner[prog->memStart] == prog->memId) {
+		++cache->stats.residentHits;
+		return 0;
+	}
+
+	if (mem->next + prog->instrCount > FIMG_SHADER_INSTR_SLOTS)
+		mem->next = 0;
+
+	if (!++mem->lastId)
+		++mem->lastId;
+
+	prog->memStart = mem->next;
+	prog->memId = mem->lastId;
+
+	for (i = 0; i < prog->instrCount; ++i)
+		mem->owner[prog->memStart + i] = prog->memId;
+
+	mem->next += prog->instrCount;
+	++cache->stats.uploads;
+
+	return 1;
+}
+
+/**
+ * Marks contents of instruction memory as unknown (after context restore).
+ * @param cache Shader program cache.
+ */
+void fimgResetShaderMemory(fimgShaderCache *cache)
+{
+	fimgShaderMemory *mem = &cache->mem;
+
+	memset(mem->owner, 0, sizeof(mem->owner));
+	mem->next = 0;
+	mem->constLoaded = 0;
+}
+
+/**
+ * Sets capacity of shader program caches.
+ * Programs exceeding new capacity are evicted immediately, except currently
+ * used ones, which are always kept.
+ * @param ctx Hardware context.
+ * @param capacity Maximal number of cached programs of each type (at least 1).
+ */
+void fimgSetShaderCacheCapacity(fimgContext *ctx, unsigned int capacity)
+{
+	fimgShaderCache *cache[] = { &ctx->compat.vsCache, &ctx->compat.psCache };
+	fimgShaderProgram *prog;
+	unsigned int i;
+
+	if (!capacity)
+		capacity = 1;
+
+	for (i = 0; i < NELEM(cache); ++i) {
+		cache[i]->stats.capacity = capacity;
+
+		while (cache[i]->stats.entries > capacity) {
+			prog = cache[i]->lruTail;
+			if (prog == cache[i]->current)
+				break;
+
+			unlinkProgram(cache[i], prog);
+			free(prog);
+			++cache[i]->stats.evictions;
+		}
+	}
+}
+
+/**
+ * Retrieves shader program cache statistics.
+ * @param ctx Hardware context.
+ * @param vs Structure to fill with vertex shader cache statistics.
+ * @param ps Structure to fill with pixel shader cache statistics.
+ */
+void fimgGetShaderCacheStats(fimgContext *ctx, fimgShaderCacheStats *vs,
+						fimgShaderCacheStats *ps)
+{
+	*vs = ctx->compat.vsCache.stats;
+	*ps = ctx->compat.psCache.stats;
+}
+
+#ifdef FIMG_SHADER_DISK_CACHE
+
+/*
+ * Programs generated in previous runs are stored in a file, so warm starts
+ * do not have to generate and optimize them again. The file is mapped
+ * read-only at context creation and searched only on cache misses.
+ * It is rewritten when the context is destroyed, if new programs have been
+ * generated. Programs are valid only for the same shader blocks and code
+ * generator, which is verified using build identifier stored in the file.
+ *
+ * Contents of the file are uploaded to the GPU, so only a file owned by
+ * current user and not writable by others is accepted, inside of explicitly
+ * configured directory. Checksum of the file protects only against
+ * accidental corruption.
+ */
+
+#define SHADER_FILE_NAME	"fimg-shaders.bin"
+#define SHADER_FILE_MAGIC	0x43485346	/* "FSHC" */
+#define SHADER_FILE_VERSION	1
+
+/** Header of shader cache file. */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t buildId;
+	uint32_t keyLen;
+	/** Number of programs in the file. */
+	uint32_t count;
+	/** Size of the whole file (in bytes). */
+	uint32_t size;
+	/** Hash of all data following the header. */
+	uint32_t checksum;
+} fimgShaderFileHeader;
+
+/** Header of program stored in shader cache file, followed by its code. */
+typedef struct {
+	uint32_t type;
+	uint32_t key[FIMG_SHADER_KEY_LEN];
+	uint32_t instrCount;
+} fimgShaderFileEntry;
+
+/**
+ * Builds path of shader cache file.
+ * @param buf Buffer to store the path.
+ * @param len Size of the buffer.
+ * @param suffix String appended to the path.
+ * @return Zero on success, negative if no cache directory is configured.
+ */
+static int getShaderFilePath(char *buf, size_t len, const char *suffix)
+{
+	const char *dir = getenv("FIMG_SHADER_CACHE_DIR");
+
+#ifdef FIMG_SHADER_CACHE_DIR
+	if (!dir)
+		dir = FIMG_SHADER_CACHE_DIR;
+#endif
+	if (!dir || !dir[0])
+		return -1;
+
+	if (snprintf(buf, len, "%s/" SHADER_FILE_NAME "%s", dir, suffix)
+							>= (int)len)
+		return -1;
+
+	return 0;
+}
+
+/**
+ * Gets next program entry of shader cache file.
+ * @param disk Persistent shader cache.
+ * @param offset Offset of the entry, updated to point to next entry.
+ * @return Pointer to the entry or NULL if there are no more valid entries.
+ */
+static const fimgShaderFileEntry *nextEntry(fimgShaderDiskCache *disk,
+							size_t *offset)
+{
+	const fimgShaderFileEntry *entry;
+	size_t size;
+
+	if (*offset + sizeof(*entry) > disk->size)
+		return NULL;
+
+	entry = (const fimgShaderFileEntry *)(disk->data + *offset);
+	if (entry->type >= FIMG_SHADER_TYPES || !entry->instrCount
+	    || entry->instrCount > shaderMaxInstr[entry->type])
+		return NULL;
+
+	size = sizeof(*entry) + 16*entry->instrCount;
+	if (*offset + size > disk->size)
+		return NULL;
+
+	*offset += size;
+	return entry;
+}
+
+/**
+ * Maps shader cache file, if it exists and is valid for this build.
+ * @param ctx Hardware context.
+ * @param buildId Identifier of shader blocks and code generator.
+ */
+void fimgOpenShaderDiskCache(fimgContext *ctx, uint32_t buildId)
+{
+	fimgShaderDiskCache *disk = &ctx->compat.diskCache;
+	const fimgShaderFileHeader *hdr;
+	char path[PATH_MAX];
+	struct stat st;
+	void *data;
+	int fd;
+
+	memset(disk, 0, sizeof(*disk));
+	disk->buildId = buildId;
+
+	if (getShaderFilePath(path, sizeof(path), ""))
+		return;
+
+	fd = open(path, O_RDONLY | O_NOFOLLOW);
+	if (fd < 0)
+		return;
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode)
+	    || st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+		LOGW("Ignoring shader cache %s not private to the user.", path);
+		close(fd);
+		return;
+	}
+
+	if (st.st_size < (off_t)sizeof(*hdr)
+	    || st.st_size > FIMG_SHADER_CACHE_MAX_SIZE) {
+		close(fd);
+		return;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return;
+
+	hdr = data;
+	if (hdr->magic != SHADER_FILE_MAGIC
+	    || hdr->version != SHADER_FILE_VERSION
+	    || hdr->buildId != buildId
+	    || hdr->keyLen != FIMG_SHADER_KEY_LEN
+	    || hdr->size != st.st_size || hdr->size % 4
+	    || hdr->checksum != hashWords(2166136261U,
+			(const uint32_t *)(hdr + 1),
+			(hdr->size - sizeof(*hdr)) / 4)) {
+		LOGD("Ignoring stale or corrupted shader cache %s.", path);
+		munmap(data, st.st_size);
+		return;
+	}
+
+	disk->data = data;
+	disk->size = st.st_size;
+}
+
+/**
+ * Looks up program in shader cache file and inserts it into shader cache.
+ * @param ctx Hardware context.
+ * @param cache Shader program cache.
+ * @param key Shader program key.
+ * @return Pointer to cached program or NULL if not found.
+ */
+fimgShaderProgram *fimgShaderDiskCacheLookup(fimgContext *ctx,
+				fimgShaderCache *cache, const uint32_t *key)
+{
+	fimgShaderDiskCache *disk = &ctx->compat.diskCache;
+	const fimgShaderFileEntry *entry;
+	fimgShaderProgram *prog;
+	size_t offset = sizeof(fimgShaderFileHeader);
+
+	if (!disk->data)
+		return NULL;
+
+	while ((entry = nextEntry(disk, &offset)) != NULL) {
+		if (entry->type != cache->type
+		    || memcmp(entry->key, key, sizeof(entry->key)))
+			continue;
+
+		prog = fimgShaderCacheInsert(cache, key,
+				(const uint32_t *)(entry + 1), entry->instrCount);
+		if (prog)
+			++cache->stats.diskHits;
+		return prog;
+	}
+
+	return NULL;
+}
+
+/**
+ * Appends program to shader cache file being written.
+ * @param buf File buffer.
+ * @param pos Write position, updated after appending.
+ * @param type Program type (FIMG_SHADER_*).
+ * @param key Program key.
+ * @param code Program code.
+ * @param instrCount Number of instructions in the program.
+ * @return Non-zero if the program has been appended, zero if it did not fit.
+ */
+static int appendEntry(uint8_t *buf, size_t *pos, uint32_t type,
+	const uint32_t *key, const uint32_t *code, uint32_t instrCount)
+{
+	fimgShaderFileEntry *entry = (fimgShaderFileEntry *)(buf + *pos);
+	size_t size = sizeof(*entry) + 16*instrCount;
+
+	if (*pos + size > FIMG_SHADER_CACHE_MAX_SIZE)
+		return 0;
+
+	entry->type = type;
+	memcpy(entry->key, key, sizeof(entry->key));
+	entry->instrCount = instrCount;
+	memcpy(entry + 1, code, 16*instrCount);
+
+	*pos += size;
+	return 1;
+}
+
+/**
+ * Writes programs of shader caches to shader cache file, merged with
+ * programs already present in the file, and unmaps the file.
+ * Most recently used programs are written first, until the size limit
+ * of the file is reached.
+ * @param ctx Hardware context.
+ */
+void fimgCloseShaderDiskCache(fimgContext *ctx)
+{
+	fimgShaderDiskCache *disk = &ctx->compat.diskCache;
+	fimgShaderCache *cache[] = { &ctx->compat.vsCache, &ctx->compat.psCache };
+	char path[PATH_MAX], tmpPath[PATH_MAX];
+	const fimgShaderFileEntry *entry;
+	fimgShaderFileHeader *hdr;
+	fimgShaderProgram *prog;
+	size_t pos, offset;
+	unsigned int i;
+	uint8_t *buf;
+	int fd, ret;
+
+	if (!disk->dirty)
+		goto unmap;
+
+	if (getShaderFilePath(path, sizeof(path), "")
+	    || getShaderFilePath(tmpPath, sizeof(tmpPath), ".XXXXXX"))
+		goto unmap;
+
+	buf = malloc(FIMG_SHADER_CACHE_MAX_SIZE);
+	if (!buf)
+		goto unmap;
+
+	hdr = (fimgShaderFileHeader *)buf;
+	hdr->count = 0;
+	pos = sizeof(*hdr);
+
+	for (i = 0; i < NELEM(cache); ++i)
+		for (prog = cache[i]->lruHead; prog; prog = prog->lruNext)
+			hdr->count += appendEntry(buf, &pos, cache[i]->type,
+					prog->key, prog->code, prog->instrCount);
+
+	offset = sizeof(*hdr);
+	while (disk->data && (entry = nextEntry(disk, &offset)) != NULL) {
+		for (prog = cache[entry->type]->lruHead; prog;
+							prog = prog->lruNext)
+			if (!memcmp(prog->key, entry->key, sizeof(prog->key)))
+				break;
+		if (prog)
+			continue;
+
+		hdr->count += appendEntry(buf, &pos, entry->type, entry->key,
+				(const uint32_t *)(entry + 1), entry->instrCount);
+	}
+
+	hdr->magic = SHADER_FILE_MAGIC;
+	hdr->version = SHADER_FILE_VERSION;
+	hdr->buildId = disk->buildId;
+	hdr->keyLen = FIMG_SHADER_KEY_LEN;
+	hdr->size = pos;
+	hdr->checksum = hashWords(2166136261U, (const uint32_t *)(hdr + 1),
+						(pos - sizeof(*hdr)) / 4);
+
+	/* Write to a new temporary file and rename it to replace the old one
+	 * atomically, as other processes may be reading it. */
+	fd = mkstemp(tmpPath);
+	if (fd < 0) {
+		LOGD("Couldn't create shader cache %s (%s).",
+						tmpPath, strerror(errno));
+		free(buf);
+		goto unmap;
+	}
+
+	ret = write(fd, buf, pos);
+	close(fd);
+	free(buf);
+
+	if (ret != (int)pos || rename(tmpPath, path)) {
+		LOGD("Couldn't write shader cache %s (%s).",
+						path, strerror(errno));
+		unlink(tmpPath);
+	}
+
+unmap:
+	if (disk->data)
+		munmap((void *)disk->data, disk->size);
+	disk->data = NULL;
+}
+
+#endif /* FIMG_SHADER_DISK_CACHE */
+
+#endif /* FIMG_FIXED_PIPELINE */
@@ -0,0 +1,703 @@
+/*
+ * fimg/shaderopt.c
+ *
+ * SAMSUNG S3C6410 FIMG-3DSE PIXEL SHADER OPTIMIZER STATISTICS
+ *
+ * Copyrights:	2010 by Tomasz Figa < tomasz.figa at gmail.com >
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Offline harness generating pixel shaders for reachable fixed pipeline
+ * states and reporting instruction counts before and after optimization.
+ * Both versions of every program are run by a reference interpreter on
+ * a set of inputs and the harness fails if their outputs differ.
+ *
+ * The shader generator is private to compat.c, so it is included here
+ * directly and the shader cache is replaced with stubs. No hardware is
+ * needed to run it.
+ *
+ * Usage: shaderopt [-q] [-v]
+ *   -q	vary color and alpha combiner states of a texture unit one at a time
+ *	instead of enumerating their full cross product (about 17 million
+ *	programs per unit),
+ *   -v	print instruction counts of every generated program.
+ */
+
+#include "compat.c"
+
+#include <math.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+ * Shader cache stubs
+ */
+
+static fimgShaderProgram program;
+
+void fimgCreateShaderCache(fimgShaderCache *cache, unsigned int type)
+{
+	memset(cache, 0, sizeof(*cache));
+	cache->type = type;
+}
+
+void fimgDestroyShaderCache(fimgShaderCache *cache)
+{
+}
+
+fimgShaderProgram *fimgShaderCacheLookup(fimgShaderCache *cache,
+							const uint32_t *key)
+{
+	return NULL;
+}
+
+fimgShaderProgram *fimgShaderCacheInsert(fimgShaderCache *cache,
+		const uint32_t *key, const uint32_t *code, uint32_t instrCount)
+{
+	return &program;
+}
+
+int fimgShaderMakeResident(fimgShaderCache *cache, fimgShaderProgram *prog)
+{
+	return 0;
+}
+
+void fimgResetShaderMemory(fimgShaderCache *cache)
+{
+}
+
+void fimgOpenShaderDiskCache(fimgContext *ctx, uint32_t buildId)
+{
+}
+
+void fimgCloseShaderDiskCache(fimgContext *ctx)
+{
+}
+
+fimgShaderProgram *fimgShaderDiskCacheLookup(fimgContext *ctx,
+				fimgShaderCache *cache, const uint32_t *key)
+{
+	return NULL;
+}
+
+/*
+ * Hardware access stubs
+ */
+
+void fimgSetupTexture(fimgContext *ctx, fimgTexture *texture, unsigned unit)
+{
+}
+
+int fimgWaitForClear(fimgContext *ctx, uint32_t addr, uint32_t mask)
+{
+	return 0;
+}
+
+#ifdef FIMG_SOFTWARE_BACKEND
+void fimgSwWrite(fimgContext *ctx, unsigned int data, unsigned int addr)
+{
+}
+#endif
+
+/*
+ * Reference interpreter
+ */
+
+/** Number of constant float registers used by fixed pipeline shaders. */
+#define NUM_CONSTS		(FGFP_FOGCOLOR + 1)
+/** Number of input sets each program is run with. */
+#define NUM_INPUTS		4
+/** Maximal difference of output components considered equal. */
+#define OUTPUT_EPSILON		1e-5f
+
+/** Inputs of interpreted program. */
+struct shaderInput {
+	float v[4][4];
+	float c[NUM_CONSTS][4];
+};
+
+/** Outputs of interpreted program. */
+struct shaderOutput {
+	float color[4];
+	int killed;
+};
+
+static struct shaderInput inputs[NUM_INPUTS];
+
+/**
+ * Returns texel fetched by texture unit.
+ * Textures are modelled by a fixed function of coordinates, different
+ * for each unit and component, with results in [0, 1].
+ * @param unit Index of texture unit.
+ * @param coord Texture coordinates.
+ * @param texel Array to store fetched texel.
+ */
+static void sampleTexture(unsigned int unit, const float *coord, float *texel)
+{
+	unsigned int comp;
+
+	for (comp = 0; comp < 4; ++comp) {
+		float val = coord[comp] * (1.25f + 0.5f * unit) + 0.125f * comp;
+		texel[comp] = val - floorf(val);
+	}
+}
+
+/**
+ * Reads source operand of instruction.
+ * @param instr Shader instruction.
+ * @param src Index of source operand.
+ * @param in Program inputs.
+ * @param regs Temporary registers.
+ * @param val Array to store swizzled and modified operand value.
+ * @return 0 on success, negative if the operand is not supported.
+ */
+static int readOperand(const fimgShaderInstruction *instr, unsigned int src,
+		const struct shaderInput *in, float regs[][4], float *val)
+{
+	struct srcOperand op;
+	const float *reg;
+	unsigned int comp;
+
+	getOperand(instr, src, &op);
+	if (op.ar || op.extnum)
+		return -1;
+
+	switch (op.regtype) {
+	case REG_SRC_V:
+		if (op.regnum >= 4)
+			return -1;
+		reg = in->v[op.regnum];
+		break;
+	case REG_SRC_R:
+		reg = regs[op.regnum];
+		break;
+	case REG_SRC_C:
+		if (op.regnum >= NUM_CONSTS)
+			return -1;
+		reg = in->c[op.regnum];
+		break;
+	default:
+		return -1;
+	}
+
+	for (comp = 0; comp < 4; ++comp) {
+		val[comp] = reg[(op.swizzle >> 2*comp) & 3];
+		if (op.modifier & 2)
+			val[comp] = fabsf(val[comp]);
+		if (op.modifier & 1)
+			val[comp] = -val[comp];
+	}
+
+	return 0;
+}
+
+/**
+ * Runs straight line pixel shader program.
+ * Temporary registers start as NaN, so reads of registers not written
+ * by the program show up in its output.
+ * @param code Program code.
+ * @param count Number of instructions.
+ * @param in Program inputs.
+ * @param out Structure to store program outputs.
+ * @return 0 on success, negative if the program is not supported.
+ */
+static int runShader(const uint32_t *code, uint32_t count,
+			const struct shaderInput *in, struct shaderOutput *out)
+{
+	const fimgShaderInstruction *instr =
+				(const fimgShaderInstruction *)code;
+	const fimgShaderInstruction *end = instr + count;
+	float regs[32][4];
+	float src[3][4], res[4];
+	float *dest;
+	unsigned int i, comp;
+
+	for (i = 0; i < 32; ++i)
+		for (comp = 0; comp < 4; ++comp)
+			regs[i][comp] = NAN;
+
+	memset(out, 0, sizeof(*out));
+
+	for (; instr < end; ++instr) {
+		const fimgOpcodeInfo *info = &opcodeMap[instr->opcode];
+
+		if (instr->opcode == OP_NOP)
+			continue;
+		if (info->type <= OP_TYPE_FLOW)
+			return -1;
+
+		for (i = 0; i < info->srcCount; ++i) {
+			if (instr->opcode == OP_TEXLD && i == 1)
+				break;
+			if (readOperand(instr, i, in, regs, src[i]))
+				return -1;
+		}
+
+		switch (instr->opcode) {
+		case OP_MOV:
+			memcpy(res, src[0], sizeof(res));
+			break;
+		case OP_ADD:
+			for (comp = 0; comp < 4; ++comp)
+				res[comp] = src[0][comp] + src[1][comp];
+			break;
+		case OP_MUL:
+			for (comp = 0; comp < 4; ++comp)
+				res[comp] = src[0][comp] * src[1][comp];
+			break;
+		case OP_MAD:
+			for (comp = 0; comp < 4; ++comp)
+				res[comp] = src[0][comp] * src[1][comp]
+							+ src[2][comp];
+			break;
+		case OP_MAX:
+			for (comp = 0; comp < 4; ++comp)
+				res[comp] = src[0][comp] > src[1][comp]
+						? src[0][comp] : src[1][comp];
+			break;
+		case OP_MIN:
+			for (comp = 0; comp < 4; ++comp)
+				res[comp] = src[0][comp] < src[1][comp]
+						? src[0][comp] : src[1][comp];
+			break;
+		case OP_DP3:
+		case OP_DP4:
+			res[0] = src[0][0] * src[1][0] + src[0][1] * src[1][1]
+						+ src[0][2] * src[1][2];
+			if (instr->opcode == OP_DP4)
+				res[0] += src[0][3] * src[1][3];
+			res[1] = res[2] = res[3] = res[0];
+			break;
+		case OP_TEXLD:
+			if (instr->src1_regtype != REG_SRC_S
+			    || instr->src1_regnum >= FIMG_NUM_TEXTURE_UNITS)
+				return -1;
+			sampleTexture(instr->src1_regnum, src[0], res);
+			break;
+		case OP_TEXKILL:
+			for (comp = 0; comp < 4; ++comp)
+				if (src[0][comp] < 0)
+					out->killed = 1;
+			continue;
+		default:
+			return -1;
+		}
+
+		switch (instr->dest_regtype) {
+		case REG_DST_R:
+			dest = regs[instr->dest_regnum];
+			break;
+		case REG_DST_O:
+			/* Fixed pipeline shaders write only oColor */
+			dest = out->color;
+			break;
+		default:
+			return -1;
+		}
+
+		if (instr->dest_a || instr->dest_modifier > 1)
+			return -1;
+
+		for (comp = 0; comp < 4; ++comp) {
+			if (!(instr->dest_mask & (1 << comp)))
+				continue;
+			/* Saturation keeps NaN to expose undefined reads */
+			if (instr->dest_modifier && res[comp] < 0)
+				res[comp] = 0;
+			if (instr->dest_modifier && res[comp] > 1)
+				res[comp] = 1;
+			dest[comp] = res[comp];
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Generates program inputs used for all programs.
+ * Clip distances of consecutive sets have different signs, so programs
+ * with clip planes are checked both for killed and for passing pixels.
+ */
+static void initInputs(void)
+{
+	uint32_t seed = 0x12345678;
+	unsigned int i, reg, comp;
+
+	for (i = 0; i < NUM_INPUTS; ++i) {
+		struct shaderInput *in = &inputs[i];
+
+		for (reg = 0; reg < 4; ++reg) {
+			for (comp = 0; comp < 4; ++comp) {
+				seed = seed * 1103515245 + 12345;
+				in->v[reg][comp] = (seed >> 8) / 16777216.0f;
+			}
+		}
+
+		/* Clip distances (v3.yzw) */
+		for (comp = 1; comp < 4; ++comp)
+			if ((i >> (comp - 1)) & 1)
+				in->v[3][comp] = -in->v[3][comp];
+
+		for (reg = 0; reg < NUM_CONSTS; ++reg) {
+			for (comp = 0; comp < 4; ++comp) {
+				seed = seed * 1103515245 + 12345;
+				in->c[reg][comp] = (seed >> 8) / 16777216.0f;
+			}
+		}
+
+		memcpy(in->c, frag_cfloat, sizeof(frag_cfloat));
+	}
+}
+
+/**
+ * Checks that optimized program computes the same outputs as original one.
+ * @param code Original program code.
+ * @param count Number of instructions of original program.
+ * @param optCode Optimized program code.
+ * @param optCount Number of instructions of optimized program.
+ * @param ones Mask of constant registers assumed to contain 1.0.
+ * @return 0 if outputs are equal, negative otherwise.
+ */
+static int checkShader(const uint32_t *code, uint32_t count,
+		const uint32_t *optCode, uint32_t optCount, uint32_t ones)
+{
+	struct shaderInput in;
+	struct shaderOutput out, optOut;
+	unsigned int i, reg, comp;
+
+	for (i = 0; i < NUM_INPUTS; ++i) {
+		in = inputs[i];
+
+		/* Combiner scales not known to be 1.0 get another value */
+		for (reg = 0; reg < FIMG_NUM_TEXTURE_UNITS; ++reg)
+			for (comp = 0; comp < 4; ++comp)
+				in.c[FGFP_COMBSCALE(reg)][comp] =
+					(ones & (1 << FGFP_COMBSCALE(reg)))
+					? 1.0f : 2.0f;
+
+		if (runShader(code, count, &in, &out)) {
+			fprintf(stderr, "Unsupported original program\n");
+			return -1;
+		}
+		if (runShader(optCode, optCount, &in, &optOut)) {
+			fprintf(stderr, "Unsupported optimized program\n");
+			return -1;
+		}
+
+		if (out.killed != optOut.killed) {
+			fprintf(stderr, "Input set %u: pixel %s only by "
+				"optimized program\n", i,
+				optOut.killed ? "killed" : "passed");
+			return -1;
+		}
+
+		if (out.killed)
+			continue;
+
+		for (comp = 0; comp < 4; ++comp) {
+			if (fabsf(out.color[comp] - optOut.color[comp])
+							<= OUTPUT_EPSILON)
+				continue;
+			fprintf(stderr, "Input set %u: color %f %f %f %f, "
+				"optimized %f %f %f %f\n", i,
+				out.color[0], out.color[1], out.color[2],
+				out.color[3], optOut.color[0], optOut.color[1],
+				optOut.color[2], optOut.color[3]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * State enumeration
+ */
+
+/** Statistics of a group of generated programs. */
+struct stateGroup {
+	const char *name;
+	unsigned long states;
+	unsigned long long built;
+	unsigned long long optimized;
+	unsigned int maxBuilt;
+	unsigned int maxOptimized;
+};
+
+static fimgContext ctx;
+static int verbose;
+
+/** Number of arguments used by each combiner function. */
+static const unsigned int combineArgCount[] = {
+	[FGFP_COMBFUNC_REPLACE]		= 1,
+	[FGFP_COMBFUNC_MODULATE]	= 2,
+	[FGFP_COMBFUNC_ADD]		= 2,
+	[FGFP_COMBFUNC_ADD_SIGNED]	= 2,
+	[FGFP_COMBFUNC_INTERPOLATE]	= 3,
+	[FGFP_COMBFUNC_SUBTRACT]	= 2,
+	[FGFP_COMBFUNC_DOT3_RGB]	= 2,
+	[FGFP_COMBFUNC_DOT3_RGBA]	= 2,
+};
+
+/**
+ * Generates pixel shader for current state, checks that optimization does
+ * not change its outputs and accounts it in given group.
+ * @param grp Group of programs.
+ */
+static void buildState(struct stateGroup *grp)
+{
+	static uint32_t code[4 * MAX_INSTR];
+	static uint32_t optCode[4 * MAX_INSTR];
+	uint32_t ones = 1 << FGFP_CONST_ONE;
+	uint32_t built, optimized;
+	uint32_t *end;
+
+	end = generatePixelShader(&ctx, ctx.compat.psState.val, code, &ones);
+	built = (end - code) / 4;
+
+	memcpy(optCode, code, built * sizeof(fimgShaderInstruction));
+	optimized = optimizeShader(optCode, optCode + 4 * built,
+					ones, 1 << FGFP_CONST_ZERO);
+
+	if (!optimized || optimized > built || optimized > MAX_INSTR
+	    || checkShader(code, built, optCode, optimized, ones)) {
+		fprintf(stderr, "Invalid program for state %08x %08x %08x: "
+			"%u -> %u instructions\n", ctx.compat.psState.tex[0],
+			ctx.compat.psState.tex[1], ctx.compat.psState.ps,
+			built, optimized);
+		exit(1);
+	}
+
+	++grp->states;
+	grp->built += built;
+	grp->optimized += optimized;
+	if (built > grp->maxBuilt)
+		grp->maxBuilt = built;
+	if (optimized > grp->maxOptimized)
+		grp->maxOptimized = optimized;
+
+	if (verbose)
+		printf("%08x %08x %08x %3u %3u\n", ctx.compat.psState.tex[0],
+			ctx.compat.psState.tex[1], ctx.compat.psState.ps,
+			built, optimized);
+}
+
+/**
+ * Sets arguments of color combiner of given texture unit.
+ * @param reg Texture unit state.
+ * @param count Number of arguments to set.
+ * @param val Packed argument sources and modifiers, 4 bits per argument.
+ */
+static uint32_t setColorArgs(uint32_t reg, unsigned int count, uint32_t val)
+{
+	unsigned int arg;
+
+	for (arg = 0; arg < count; ++arg, val >>= 4) {
+		FGFP_BITFIELD_SET_IDX(reg, TEX_COMBC_SRC, arg, val & 3);
+		FGFP_BITFIELD_SET_IDX(reg, TEX_COMBC_MOD, arg, (val >> 2) & 3);
+	}
+
+	return reg;
+}
+
+/**
+ * Sets arguments of alpha combiner of given texture unit.
+ * @param reg Texture unit state.
+ * @param count Number of arguments to set.
+ * @param val Packed argument sources and modifiers, 3 bits per argument.
+ */
+static uint32_t setAlphaArgs(uint32_t reg, unsigned int count, uint32_t val)
+{
+	unsigned int arg;
+
+	for (arg = 0; arg < count; ++arg, val >>= 3) {
+		FGFP_BITFIELD_SET_IDX(reg, TEX_COMBA_SRC, arg, val & 3);
+		FGFP_BITFIELD_SET_IDX(reg, TEX_COMBA_MOD, arg, (val >> 2) & 1);
+	}
+
+	return reg;
+}
+
+/**
+ * Enumerates alpha combiner states of given texture unit.
+ * Arguments not used by combiner function are left at their defaults,
+ * because they only generate code that the optimizer removes as dead.
+ * @param grp Group of programs.
+ * @param unit Index of texture unit.
+ * @param base Texture unit state with color combiner set up.
+ */
+static void enumAlphaCombiner(struct stateGroup *grp, uint32_t unit,
+								uint32_t base)
+{
+	uint32_t func, val;
+
+	for (func = FGFP_COMBFUNC_REPLACE; func <= FGFP_COMBFUNC_SUBTRACT;
+									++func) {
+		unsigned int count = combineArgCount[func];
+
+		for (val = 0; val < 1U << (3 * count); ++val) {
+			uint32_t reg = setAlphaArgs(base, count, val);
+
+			FGFP_BITFIELD_SET(reg, TEX_COMBA_FUNC, func);
+			ctx.compat.psState.tex[unit] = reg;
+			buildState(grp);
+		}
+	}
+}
+
+/**
+ * Enumerates combiner states of given texture unit.
+ * @param grp Group of programs.
+ * @param unit Index of texture unit.
+ * @param full Non-zero to enumerate all pairs of color and alpha combiner
+ * states, zero to vary each of them with the other one left at default.
+ */
+static void enumCombiner(struct stateGroup *grp, uint32_t unit, int full)
+{
+	uint32_t flags, func, val;
+
+	for (flags = 0; flags < 4; ++flags) {
+		uint32_t base = 0;
+
+		FGFP_BITFIELD_SET(base, TEX_MODE, FGFP_TEXFUNC_COMBINE);
+		FGFP_BITFIELD_SET(base, TEX_SWAP, flags & 1);
+		FGFP_BITFIELD_SET(base, TEX_SCALE_ONE, flags >> 1);
+
+		if (!full)
+			enumAlphaCombiner(grp, unit, base);
+
+		for (func = FGFP_COMBFUNC_REPLACE;
+				func <= FGFP_COMBFUNC_DOT3_RGBA; ++func) {
+			unsigned int count = combineArgCount[func];
+
+			for (val = 0; val < 1U << (4 * count); ++val) {
+				uint32_t reg = setColorArgs(base, count, val);
+
+				FGFP_BITFIELD_SET(reg, TEX_COMBC_FUNC, func);
+				if (full && func != FGFP_COMBFUNC_DOT3_RGBA) {
+					enumAlphaCombiner(grp, unit, reg);
+					continue;
+				}
+
+				ctx.compat.psState.tex[unit] = reg;
+				buildState(grp);
+			}
+		}
+	}
+
+	ctx.compat.psState.tex[unit] = 0;
+}
+
+/**
+ * Returns texture unit state for given index of non-combiner function.
+ * @param idx Index from 0 (disabled unit) to 10.
+ * @return Texture unit state.
+ */
+static uint32_t texFuncState(uint32_t idx)
+{
+	uint32_t reg = 0;
+
+	if (!idx)
+		return reg;
+
+	--idx;
+	FGFP_BITFIELD_SET(reg, TEX_MODE, FGFP_TEXFUNC_REPLACE + idx / 2);
+	FGFP_BITFIELD_SET(reg, TEX_SWAP, idx & 1);
+
+	return reg;
+}
+
+static void printGroup(const struct stateGroup *grp)
+{
+	if (!grp->states)
+		return;
+
+	printf("%-24s %9lu %8.2f %8.2f %7.1f%% %5u %5u\n", grp->name,
+		grp->states, (double)grp->built / grp->states,
+		(double)grp->optimized / grp->states,
+		100.0 * (grp->built - grp->optimized) / grp->built,
+		grp->maxBuilt, grp->maxOptimized);
+}
+
+int main(int argc, char **argv)
+{
+	struct stateGroup funcs = { .name = "texture functions" };
+	struct stateGroup combine[FIMG_NUM_TEXTURE_UNITS] = {
+		{ .name = "combiner, unit 0" },
+		{ .name = "combiner, unit 1" },
+	};
+	struct stateGroup total = { .name = "total" };
+	uint32_t ps, tex0, tex1, unit;
+	int full = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "qv")) != -1) {
+		switch (opt) {
+		case 'q':
+			full = 0;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-q] [-v]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	initInputs();
+
+	/* Fog, output swap and clip planes with non-combiner functions */
+	for (ps = 0; ps < 1 << 5; ++ps) {
+		ctx.compat.psState.ps = ps;
+		for (tex0 = 0; tex0 < 11; ++tex0) {
+			ctx.compat.psState.tex[0] = texFuncState(tex0);
+			for (tex1 = 0; tex1 < 11; ++tex1) {
+				ctx.compat.psState.tex[1] = texFuncState(tex1);
+				buildState(&funcs);
+			}
+		}
+	}
+	memset(&ctx.compat.psState, 0, sizeof(ctx.compat.psState));
+
+	/* Combiner of each unit, with the other unit disabled */
+	for (unit = 0; unit < FIMG_NUM_TEXTURE_UNITS; ++unit)
+		enumCombiner(&combine[unit], unit, full);
+
+	printf("%-24s %9s %8s %8s %8s %5s %5s\n", "group", "states",
+		"before", "after", "saved", "max", "max");
+	printGroup(&funcs);
+	for (unit = 0; unit < FIMG_NUM_TEXTURE_UNITS; ++unit)
+		printGroup(&combine[unit]);
+
+	total.states = funcs.states;
+	total.built = funcs.built;
+	total.optimized = funcs.optimized;
+	total.maxBuilt = funcs.maxBuilt;
+	total.maxOptimized = funcs.maxOptimized;
+	for (unit = 0; unit < FIMG_NUM_TEXTURE_UNITS; ++unit) {
+		total.states += combine[unit].states;
+		total.built += combine[unit].built;
+		total.optimized += combine[unit].optimized;
+		if (combine[unit].maxBuilt > total.maxBuilt)
+			total.maxBuilt = combine[unit].maxBuilt;
+		if (combine[unit].maxOptimized > total.maxOptimized)
+			total.maxOptimized = combine[unit].maxOptimized;
+	}
+	printGroup(&total);
+
+	return 0;
+}
@@ -45,6 +45,9 @@ def c3, 4.0, 4.0, 4.0, 4.0
 # Combiner scale 1
 # def c7, 1.0, 1.0, 1.0, 1.0
 
+# Fog color
+# def c8, 0.0, 0.0, 0.0, 0.0
+
 % f header
 
 # Shader header
@@ -648,6 +651,40 @@ label start
 
 ################################################################################
 
+% f fog
+
+# Fog
+#
+# Inputs:	r0 - fragment color
+#		v3.x - fog factor
+#		c8 - fog color
+#
+# Outputs:	r0 - fogged fragment color
+
+# Blend with fog color
+# (r1 written fully, so preceding swap of r1 can be optimized out)
+	add r1, r0.xyzw, -c8.xyzw
+	mad r0.xyz, r1.xyzw, v3.xxxx, c8.xyzw
+
+################################################################################
+
+% f clip0
+
+# Clip plane 0
+	texkill v3.yyyy
+
+% f clip1
+
+# Clip plane 1
+	texkill v3.zzzz
+
+% f clip2
+
+# Clip plane 2
+	texkill v3.wwww
+
+################################################################################
+
 % f out_swap
 
 # Output RGB -> BGR color component swap
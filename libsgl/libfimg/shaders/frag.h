@@ -195,6 +195,23 @@ static const unsigned int frag_combine_dot3[] = {
 	0x03000000, 0x0104e402, 0x037824e4, 0x00000000,
 };
 
+static const unsigned int frag_fog[] = {
+	0x08000000, 0x0100e442, 0x227821e4, 0x00000000,
+	0x03e40208, 0x01010000, 0x0eb820e4, 0x00000000,
+};
+
+static const unsigned int frag_clip0[] = {
+	0x00000000, 0x00030000, 0x13800055, 0x00000000,
+};
+
+static const unsigned int frag_clip1[] = {
+	0x00000000, 0x00030000, 0x138000aa, 0x00000000,
+};
+
+static const unsigned int frag_clip2[] = {
+	0x00000000, 0x00030000, 0x138000ff, 0x00000000,
+};
+
 static const unsigned int frag_out_swap[] = {
 	0x00000000, 0x01000000, 0x00f820c6, 0x00000000,
 };
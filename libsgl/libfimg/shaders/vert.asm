@@ -50,6 +50,35 @@ fimg_version	0x01050000
 # def c14, 0.0, 0.0, 1.0, 0.0
 # def c15, 0.0, 0.0, 0.0, 1.0
 
+# Modelview matrix (used by lighting)
+# def c16, 1.0, 0.0, 0.0, 0.0
+# def c17, 0.0, 1.0, 0.0, 0.0
+# def c18, 0.0, 0.0, 1.0, 0.0
+# def c19, 0.0, 0.0, 0.0, 1.0
+
+# Constant vertex attributes
+# c20 - c28
+
+# Lighting constants
+# def c29, 0.0, 1.0, 1e-20, 0.0
+# c30 - emission + scene ambient * material ambient, material diffuse alpha
+# c31 - scene ambient (color material) or 0.0
+# c32 - material shininess
+# c33 - c39 - light 0 (c40 - c46 - light 1 and so on)
+#	+0 - normalized direction or position
+#	+1 - light ambient (* material ambient)
+#	+2 - light diffuse (* material diffuse)
+#	+3 - light specular * material specular
+#	+4 - constant, linear and quadratic attenuation
+#	+5 - normalized spot direction, cosine of spot cutoff
+#	+6 - normalized halfway vector, spot exponent
+
+# Fog constants
+# c89 - fog factor coefficients (see fog blocks)
+
+# Clip plane constants (in eye coordinates)
+# c90 - c92 - clip planes 0 - 2
+
 % v header
 
 # Shader header
@@ -60,10 +89,157 @@ label start
 	mad r0.xyzw, c2.xyzw, v0.zzzz, r0.xyzw
 	mad o0.xyzw, c3.xyzw, v0.wwww, r0.xyzw
 
+# Code is being inserted here dynamically
+
+################################################################################
+
+% v color
+
+# Vertex color
 	# Pass vertex color
 	mov o1, v2
 
-# Code is being inserted here dynamically
+################################################################################
+
+% v light_header
+
+# Lighting header
+	# Transform normal by inverse transpose of modelview matrix
+	dp3 r3.x, c4.xyzw, v1.xyzw
+	dp3 r3.y, c5.xyzw, v1.xyzw
+	dp3 r3.z, c6.xyzw, v1.xyzw
+
+	# Initialize color accumulators
+	mov r5.xyzw, c30.xyzw
+	mov r6.xyzw, c31.xyzw
+
+% v light_normalize
+
+# Normal normalization
+	dp3 r7.w, r3.xyzw, r3.xyzw
+	rsq r7.w, r7.wwww
+	mul r3.xyz, r3.xyzw, r7.wwww
+
+% v eyepos
+
+# Eye space vertex position (used by lighting, fog and clip planes)
+	mul r4.xyzw, c16.xyzw, v0.xxxx
+	mad r4.xyzw, c17.xyzw, v0.yyyy, r4.xyzw
+	mad r4.xyzw, c18.xyzw, v0.zzzz, r4.xyzw
+	mad r4.xyzw, c19.xyzw, v0.wwww, r4.xyzw
+
+% v light_dir
+
+# Directional light (relocated for each light)
+	# Diffuse factor
+	dp3 r7.x, c33.xyzw, r3.xyzw
+	max r7.x, r7.xxxx, c29.xxxx
+
+	# Ambient and diffuse contribution
+	add r6.xyzw, c34.xyzw, r6.xyzw
+	mad r6.xyzw, c35.xyzw, r7.xxxx, r6.xyzw
+
+% v light_dir_spec
+
+# Directional light specular (relocated for each light)
+	# Specular factor
+	dp3 r7.y, c39.xyzw, r3.xyzw
+	max r7.y, r7.yyyy, c29.zzzz
+	log r7.y, r7.yyyy
+	mul r7.y, c32.xxxx, r7.yyyy
+	exp r7.y, r7.yyyy
+
+	# No specular highlight on unlit side
+	slt r7.z, c29.xxxx, r7.xxxx
+	mul r7.y, r7.yyyy, r7.zzzz
+
+	# Specular contribution
+	mad r5.xyzw, c36.xyzw, r7.yyyy, r5.xyzw
+
+% v light_point
+
+# Point light (relocated for each light)
+	# Light vector and distance
+	add r8.xyz, c33.xyzw, -r4.xyzw
+	dp3 r8.w, r8.xyzw, r8.xyzw
+	rsq r10.x, r8.wwww
+	mul r8.xyz, r8.xyzw, r10.xxxx
+
+	# Diffuse factor
+	dp3 r7.x, r8.xyzw, r3.xyzw
+	max r7.x, r7.xxxx, c29.xxxx
+
+	# Ambient and diffuse color
+	mov r9.xyzw, c34.xyzw
+	mad r9.xyzw, c35.xyzw, r7.xxxx, r9.xyzw
+
+	# Attenuation and spotlight factor
+	mov r10.y, c29.yyyy
+
+% v light_atten
+
+# Distance attenuation (relocated for each light)
+	mov r11.x, c29.yyyy
+	mul r11.y, r8.wwww, r10.xxxx
+	mov r11.z, r8.wwww
+	dp3 r11.w, c37.xyzw, r11.xyzw
+	rcp r11.w, r11.wwww
+	mul r10.y, r10.yyyy, r11.wwww
+
+% v light_spot
+
+# Spotlight (relocated for each light)
+	dp3 r11.x, c38.xyzw, -r8.xyzw
+	slt r11.y, c38.wwww, r11.xxxx
+	max r11.x, r11.xxxx, c29.zzzz
+	log r11.x, r11.xxxx
+	mul r11.x, c39.wwww, r11.xxxx
+	exp r11.x, r11.xxxx
+	mul r11.x, r11.xxxx, r11.yyyy
+	mul r10.y, r10.yyyy, r11.xxxx
+
+% v light_point_end
+
+# Point light contribution
+	mul r9.xyzw, r9.xyzw, r10.yyyy
+	add r6.xyzw, r6.xyzw, r9.xyzw
+
+% v light_point_spec
+
+# Point light specular (relocated for each light)
+	# Halfway vector
+	add r11.xyz, r8.xyzw, c29.xxyx
+	dp3 r11.w, r11.xyzw, r11.xyzw
+	rsq r11.w, r11.wwww
+	mul r11.xyz, r11.xyzw, r11.wwww
+
+	# Specular factor
+	dp3 r7.y, r11.xyzw, r3.xyzw
+	max r7.y, r7.yyyy, c29.zzzz
+	log r7.y, r7.yyyy
+	mul r7.y, c32.xxxx, r7.yyyy
+	exp r7.y, r7.yyyy
+
+	# No specular highlight on unlit side
+	slt r7.z, c29.xxxx, r7.xxxx
+	mul r7.y, r7.yyyy, r7.zzzz
+	mul r7.y, r7.yyyy, r10.yyyy
+
+	# Specular contribution
+	mad r5.xyzw, c36.xyzw, r7.yyyy, r5.xyzw
+
+% v light_footer
+
+# Lighting footer
+	# Output lit color
+	add_sat o1.xyzw, r5.xyzw, r6.xyzw
+
+% v light_footer_cm
+
+# Lighting footer (color material)
+	# Output lit color, ambient and diffuse material taken from vertex color
+	mov_sat o1.w, v2.wwww
+	mad_sat o1.xyz, r6.xyzw, v2.xyzw, r5.xyzw
 
 ################################################################################
 
@@ -87,6 +263,81 @@ label start
 
 ################################################################################
 
+% v screen_header
+
+# Screen space header (glDrawTex)
+label start
+	# Pass position, already in window coordinates
+	mov o0, v0
+
+	# Pass vertex color
+	mov o1, v2
+
+% v screen_texture0
+
+# Screen space texture 0
+	# Pass texture0 coordinates
+	mov o2, v4
+
+% v screen_texture1
+
+# Screen space texture 1
+	# Pass texture1 coordinates
+	mov o3, v5
+
+################################################################################
+
+% v fog_linear
+
+# Linear fog
+	# Fog coordinate (eye space distance approximated by depth)
+	max r12.x, r4.zzzz, -r4.zzzz
+
+	# Fog factor, c89.x = -1 / (end - start), c89.y = end / (end - start)
+	mul r12.x, c89.xxxx, r12.xxxx
+	add_sat o4.x, c89.yyyy, r12.xxxx
+
+% v fog_exp
+
+# Exponential fog
+	# Fog coordinate (eye space distance approximated by depth)
+	max r12.x, r4.zzzz, -r4.zzzz
+
+	# Fog factor, c89.x = -density * log2(e)
+	mul r12.x, c89.xxxx, r12.xxxx
+	exp_sat o4.x, r12.xxxx
+
+% v fog_exp2
+
+# Square exponential fog
+	# Fog coordinate (eye space distance approximated by depth)
+	max r12.x, r4.zzzz, -r4.zzzz
+
+	# Fog factor, c89.x = density, c89.y = -log2(e)
+	mul r12.x, c89.xxxx, r12.xxxx
+	mul r12.x, r12.xxxx, r12.xxxx
+	mul r12.x, c89.yyyy, r12.xxxx
+	exp_sat o4.x, r12.xxxx
+
+################################################################################
+
+% v clip0
+
+# Clip plane 0
+	dp4 o4.y, c90.xyzw, r4.xyzw
+
+% v clip1
+
+# Clip plane 1
+	dp4 o4.z, c91.xyzw, r4.xyzw
+
+% v clip2
+
+# Clip plane 2
+	dp4 o4.w, c92.xyzw, r4.xyzw
+
+################################################################################
+
 % v footer
 
 # Shader footer
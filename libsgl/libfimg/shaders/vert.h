@@ -9,9 +9,113 @@ static const unsigned int vert_header[] = {
 	0x00e40100, 0x02015500, 0x2ef820e4, 0x00000000,
 	0x00e40100, 0x0202aa00, 0x2ef820e4, 0x00000000,
 	0x00e40100, 0x0203ff00, 0x0ef800e4, 0x00000000,
+};
+
+static const unsigned int vert_color[] = {
 	0x00000000, 0x00020000, 0x00f801e4, 0x00000000,
 };
 
+static const unsigned int vert_light_header[] = {
+	0x01000000, 0x0204e400, 0x040823e4, 0x00000000,
+	0x01000000, 0x0205e400, 0x041023e4, 0x00000000,
+	0x01000000, 0x0206e400, 0x042023e4, 0x00000000,
+	0x00000000, 0x021e0000, 0x00f825e4, 0x00000000,
+	0x00000000, 0x021f0000, 0x00f826e4, 0x00000000,
+};
+
+static const unsigned int vert_light_normalize[] = {
+	0x03000000, 0x0103e401, 0x044027e4, 0x00000000,
+	0x00000000, 0x01070000, 0x08c027ff, 0x00000000,
+	0x07000000, 0x0103ff01, 0x033823e4, 0x00000000,
+};
+
+static const unsigned int vert_eyepos[] = {
+	0x00000000, 0x02100000, 0x237824e4, 0x00000000,
+	0x00e40104, 0x02115500, 0x2ef824e4, 0x00000000,
+	0x00e40104, 0x0212aa00, 0x2ef824e4, 0x00000000,
+	0x00e40104, 0x0213ff00, 0x0ef824e4, 0x00000000,
+};
+
+static const unsigned int vert_light_dir[] = {
+	0x03000000, 0x0221e401, 0x040827e4, 0x00000000,
+	0x1d000000, 0x01070002, 0x0a082700, 0x00000000,
+	0x06000000, 0x0222e401, 0x227826e4, 0x00000000,
+	0x07e40106, 0x02230001, 0x0ef826e4, 0x00000000,
+};
+
+static const unsigned int vert_light_dir_spec[] = {
+	0x03000000, 0x0227e401, 0x041027e4, 0x00000000,
+	0x1d000000, 0x0107aa02, 0x0a102755, 0x00000000,
+	0x00000000, 0x01070000, 0x07102755, 0x00000000,
+	0x07000000, 0x02205501, 0x03102700, 0x00000000,
+	0x00000000, 0x01070000, 0x06102755, 0x00000000,
+	0x07000000, 0x021d0001, 0x0ba02700, 0x00000000,
+	0x07000000, 0x0107aa01, 0x23102755, 0x00000000,
+	0x07e40105, 0x02245501, 0x0ef825e4, 0x00000000,
+};
+
+static const unsigned int vert_light_point[] = {
+	0x04000000, 0x0221e441, 0x023828e4, 0x00000000,
+	0x08000000, 0x0108e401, 0x044028e4, 0x00000000,
+	0x00000000, 0x01080000, 0x08882aff, 0x00000000,
+	0x0a000000, 0x01080001, 0x033828e4, 0x00000000,
+	0x03000000, 0x0108e401, 0x040827e4, 0x00000000,
+	0x1d000000, 0x01070002, 0x0a082700, 0x00000000,
+	0x00000000, 0x02220000, 0x20f829e4, 0x00000000,
+	0x07e40109, 0x02230001, 0x0ef829e4, 0x00000000,
+	0x00000000, 0x021d0000, 0x00902a55, 0x00000000,
+};
+
+static const unsigned int vert_light_atten[] = {
+	0x00000000, 0x021d0000, 0x00882b55, 0x00000000,
+	0x0a000000, 0x01080001, 0x03102bff, 0x00000000,
+	0x00000000, 0x01080000, 0x00a02bff, 0x00000000,
+	0x0b000000, 0x0225e401, 0x04402be4, 0x00000000,
+	0x00000000, 0x010b0000, 0x08402bff, 0x00000000,
+	0x0b000000, 0x010aff01, 0x03102a55, 0x00000000,
+};
+
+static const unsigned int vert_light_spot[] = {
+	0x08000000, 0x0226e441, 0x04082be4, 0x00000000,
+	0x0b000000, 0x02260001, 0x0b902bff, 0x00000000,
+	0x1d000000, 0x010baa02, 0x0a082b00, 0x00000000,
+	0x00000000, 0x010b0000, 0x07082b00, 0x00000000,
+	0x0b000000, 0x02270001, 0x03082bff, 0x00000000,
+	0x00000000, 0x010b0000, 0x06082b00, 0x00000000,
+	0x0b000000, 0x010b5501, 0x03082b00, 0x00000000,
+	0x0b000000, 0x010a0001, 0x03102a55, 0x00000000,
+};
+
+static const unsigned int vert_light_point_end[] = {
+	0x0a000000, 0x01095501, 0x037829e4, 0x00000000,
+	0x09000000, 0x0106e401, 0x027826e4, 0x00000000,
+};
+
+static const unsigned int vert_light_point_spec[] = {
+	0x1d000000, 0x01081002, 0x02382be4, 0x00000000,
+	0x0b000000, 0x010be401, 0x04402be4, 0x00000000,
+	0x00000000, 0x010b0000, 0x08c02bff, 0x00000000,
+	0x0b000000, 0x010bff01, 0x03382be4, 0x00000000,
+	0x03000000, 0x010be401, 0x041027e4, 0x00000000,
+	0x1d000000, 0x0107aa02, 0x0a102755, 0x00000000,
+	0x00000000, 0x01070000, 0x07102755, 0x00000000,
+	0x07000000, 0x02205501, 0x03102700, 0x00000000,
+	0x00000000, 0x01070000, 0x06102755, 0x00000000,
+	0x07000000, 0x021d0001, 0x0ba02700, 0x00000000,
+	0x07000000, 0x0107aa01, 0x03102755, 0x00000000,
+	0x0a000000, 0x01075501, 0x23102755, 0x00000000,
+	0x07e40105, 0x02245501, 0x0ef825e4, 0x00000000,
+};
+
+static const unsigned int vert_light_footer[] = {
+	0x06000000, 0x0105e401, 0x027a01e4, 0x00000000,
+};
+
+static const unsigned int vert_light_footer_cm[] = {
+	0x00000000, 0x00020000, 0x20c201ff, 0x00000000,
+	0x02e40105, 0x0106e400, 0x0eba01e4, 0x00000000,
+};
+
 static const unsigned int vert_texture0[] = {
 	0x04000000, 0x02080000, 0x237821e4, 0x00000000,
 	0x04e40101, 0x02095500, 0x2ef821e4, 0x00000000,
@@ -26,6 +130,51 @@ static const unsigned int vert_texture1[] = {
 	0x05e40102, 0x020fff00, 0x0ef803e4, 0x00000000,
 };
 
+static const unsigned int vert_screen_header[] = {
+	0x00000000, 0x00000000, 0x00f800e4, 0x00000000,
+	0x00000000, 0x00020000, 0x00f801e4, 0x00000000,
+};
+
+static const unsigned int vert_screen_texture0[] = {
+	0x00000000, 0x00040000, 0x00f802e4, 0x00000000,
+};
+
+static const unsigned int vert_screen_texture1[] = {
+	0x00000000, 0x00050000, 0x00f803e4, 0x00000000,
+};
+
+static const unsigned int vert_fog_linear[] = {
+	0x04000000, 0x0104aa41, 0x0a082caa, 0x00000000,
+	0x0c000000, 0x02590001, 0x03082c00, 0x00000000,
+	0x0c000000, 0x02590001, 0x020a0455, 0x00000000,
+};
+
+static const unsigned int vert_fog_exp[] = {
+	0x04000000, 0x0104aa41, 0x0a082caa, 0x00000000,
+	0x0c000000, 0x02590001, 0x03082c00, 0x00000000,
+	0x00000000, 0x010c0000, 0x060a0400, 0x00000000,
+};
+
+static const unsigned int vert_fog_exp2[] = {
+	0x04000000, 0x0104aa41, 0x0a082caa, 0x00000000,
+	0x0c000000, 0x02590001, 0x03082c00, 0x00000000,
+	0x0c000000, 0x010c0001, 0x03082c00, 0x00000000,
+	0x0c000000, 0x02590001, 0x03082c55, 0x00000000,
+	0x00000000, 0x010c0000, 0x060a0400, 0x00000000,
+};
+
+static const unsigned int vert_clip0[] = {
+	0x04000000, 0x025ae401, 0x049004e4, 0x00000000,
+};
+
+static const unsigned int vert_clip1[] = {
+	0x04000000, 0x025be401, 0x04a004e4, 0x00000000,
+};
+
+static const unsigned int vert_clip2[] = {
+	0x04000000, 0x025ce401, 0x04c004e4, 0x00000000,
+};
+
 static const unsigned int vert_footer[] = {
 	0x00000000, 0x00000000, 0x1e000000, 0x00000000,
 };
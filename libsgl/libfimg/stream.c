@@ -0,0 +1,322 @@
+/*
+ * fimg/stream.c
+ *
+ * SAMSUNG S3C6410 FIMG-3DSE VERTEX STREAM CACHE
+ *
+ * Copyrights:	2011 by Tomasz Figa < tomasz.figa at gmail.com >
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include "fimg_private.h"
+
+/*
+ * Vertex data of draws sourced from static buffers does not change between
+ * frames, so batches produced by vertex packing code can be recorded once
+ * and replayed directly to hardware vertex buffer on subsequent draws.
+ * Streams are kept on a LRU list and evicted when memory budget is exceeded.
+ */
+
+/** Default memory budget of vertex stream cache (in bytes). */
+#define FIMG_STREAM_CACHE_BUDGET	(2*1024*1024)
+
+/**
+ * Calculates hash of vertex stream key.
+ * @param key Vertex stream key.
+ * @return Hash value.
+ */
+static uint32_t hashKey(const fimgStreamKey *key)
+{
+	const uint32_t *word = (const uint32_t *)key;
+	unsigned int len = sizeof(*key) / sizeof(uint32_t);
+	uint32_t hash = 2166136261U;
+
+	while (len--) {
+		hash ^= *(word++);
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+/**
+ * Frees all memory used by vertex stream.
+ * @param stream Vertex stream (NULL is allowed and ignored).
+ */
+void fimgDestroyStream(fimgStream *stream)
+{
+	unsigned int i;
+
+	if (!stream)
+		return;
+
+	for (i = 0; i < stream->numBatches; ++i)
+		free(stream->batches[i].data);
+
+	free(stream->batches);
+	free(stream);
+}
+
+/**
+ * Removes vertex stream from the cache.
+ * @param cache Vertex stream cache.
+ * @param stream Vertex stream.
+ */
+static void unlinkStream(fimgStreamCache *cache, fimgStream *stream)
+{
+	fimgStream **link = &cache->hash[stream->hash % FIMG_STREAM_CACHE_BUCKETS];
+
+	while (*link != stream)
+		link = &(*link)->hashNext;
+	*link = stream->hashNext;
+
+	if (stream->lruPrev)
+		stream->lruPrev->lruNext = stream->lruNext;
+	else
+		cache->lruHead = stream->lruNext;
+
+	if (stream->lruNext)
+		stream->lruNext->lruPrev = stream->lruPrev;
+	else
+		cache->lruTail = stream->lruPrev;
+
+	--cache->stats.entries;
+	cache->stats.size -= stream->size;
+}
+
+/**
+ * Evicts least recently used streams until given amount of memory is free.
+ * @param cache Vertex stream cache.
+ * @param size Amount of memory required (in bytes).
+ */
+static void evictStreams(fimgStreamCache *cache, size_t size)
+{
+	fimgStream *stream;
+
+	while (cache->lruTail && cache->stats.size + size > cache->stats.budget) {
+		stream = cache->lruTail;
+		unlinkStream(cache, stream);
+		fimgDestroyStream(stream);
+		++cache->stats.evictions;
+	}
+}
+
+/**
+ * Initializes vertex stream cache of hardware context.
+ * @param ctx Hardware context.
+ */
+void fimgCreateStreamCache(fimgContext *ctx)
+{
+	fimgStreamCache *cache = &ctx->streamCache;
+
+	memset(cache, 0, sizeof(*cache));
+	cache->stats.budget = FIMG_STREAM_CACHE_BUDGET;
+}
+
+/**
+ * Frees all streams cached in hardware context.
+ * @param ctx Hardware context.
+ */
+void fimgDestroyStreamCache(fimgContext *ctx)
+{
+	fimgStreamCache *cache = &ctx->streamCache;
+	fimgStream *stream;
+
+	LOGD("Vertex stream cache: %u hits, %u misses, %u evictions, "
+		"%u entries (%u bytes)", cache->stats.hits, cache->stats.misses,
+		cache->stats.evictions, cache->stats.entries,
+		(unsigned int)cache->stats.size);
+
+	while ((stream = cache->lruHead) != NULL) {
+		unlinkStream(cache, stream);
+		fimgDestroyStream(stream);
+	}
+}
+
+/**
+ * Looks up vertex stream matching given key.
+ * Found stream becomes the most recently used one.
+ * @param ctx Hardware context.
+ * @param key Vertex stream key.
+ * @return Pointer to cached stream or NULL if not found.
+ */
+fimgStream *fimgStreamCacheLookup(fimgContext *ctx, const fimgStreamKey *key)
+{
+	fimgStreamCache *cache = &ctx->streamCache;
+	uint32_t hash = hashKey(key);
+	fimgStream *stream = cache->hash[hash % FIMG_STREAM_CACHE_BUCKETS];
+
+	while (stream) {
+		if (stream->hash == hash && !memcmp(&stream->key, key, sizeof(*key)))
+			break;
+		stream = stream->hashNext;
+	}
+
+	if (!stream) {
+		++cache->stats.misses;
+		return NULL;
+	}
+
+	++cache->stats.hits;
+
+	if (stream != cache->lruHead) {
+		stream->lruPrev->lruNext = stream->lruNext;
+		if (stream->lruNext)
+			stream->lruNext->lruPrev = stream->lruPrev;
+		else
+			cache->lruTail = stream->lruPrev;
+
+		stream->lruPrev = NULL;
+		stream->lruNext = cache->lruHead;
+		cache->lruHead->lruPrev = stream;
+		cache->lruHead = stream;
+	}
+
+	return stream;
+}
+
+/**
+ * Creates an empty vertex stream for recording.
+ * @param key Vertex stream key.
+ * @return Pointer to created stream or NULL on error.
+ */
+fimgStream *fimgCreateStream(const fimgStreamKey *key)
+{
+	fimgStream *stream;
+
+	stream = calloc(1, sizeof(*stream));
+	if (!stream)
+		return NULL;
+
+	stream->key = *key;
+	stream->hash = hashKey(key);
+	stream->size = sizeof(*stream);
+
+	return stream;
+}
+
+/**
+ * Records current contents of vertex data buffer as next batch of the stream.
+ * @param stream Vertex stream (NULL is allowed and ignored).
+ * @param ctx Hardware context.
+ * @param vertices Number of vertices in the batch.
+ */
+void fimgStreamAddBatch(fimgStream *stream, fimgContext *ctx,
+							unsigned int vertices)
+{
+	fimgStreamBatch *batch;
+
+	if (!stream || stream->invalid)
+		return;
+
+	if (stream->numBatches == stream->maxBatches) {
+		unsigned int max = stream->maxBatches ? 2*stream->maxBatches : 4;
+
+		batch = realloc(stream->batches, max * sizeof(*batch));
+		if (!batch) {
+			stream->invalid = 1;
+			return;
+		}
+
+		stream->size += (max - stream->maxBatches) * sizeof(*batch);
+		stream->batches = batch;
+		stream->maxBatches = max;
+	}
+
+	batch = &stream->batches[stream->numBatches];
+
+	batch->size = ctx->vertexDataSize;
+	batch->data = memalign(32, (batch->size + 31) & ~31);
+	if (!batch->data) {
+		stream->invalid = 1;
+		return;
+	}
+
+	memcpy(batch->data, ctx->vertexData, batch->size);
+	memcpy(batch->vbctrl, ctx->host.vbctrl, sizeof(batch->vbctrl));
+	memcpy(batch->vbbase, ctx->host.vbbase, sizeof(batch->vbbase));
+	batch->vertices = vertices;
+
+	stream->size += (batch->size + 31) & ~31;
+	++stream->numBatches;
+}
+
+/**
+ * Inserts recorded vertex stream into the cache.
+ * Streams that failed to record or do not fit in the budget are freed.
+ * @param ctx Hardware context.
+ * @param stream Vertex stream (NULL is allowed and ignored).
+ */
+void fimgStreamCacheInsert(fimgContext *ctx, fimgStream *stream)
+{
+	fimgStreamCache *cache = &ctx->streamCache;
+	fimgStream **bucket;
+
+	if (!stream)
+		return;
+
+	if (stream->invalid || !stream->numBatches
+	    || stream->size > cache->stats.budget) {
+		fimgDestroyStream(stream);
+		return;
+	}
+
+	evictStreams(cache, stream->size);
+
+	bucket = &cache->hash[stream->hash % FIMG_STREAM_CACHE_BUCKETS];
+	stream->hashNext = *bucket;
+	*bucket = stream;
+
+	stream->lruPrev = NULL;
+	stream->lruNext = cache->lruHead;
+	if (cache->lruHead)
+		cache->lruHead->lruPrev = stream;
+	else
+		cache->lruTail = stream;
+	cache->lruHead = stream;
+
+	++cache->stats.entries;
+	cache->stats.size += stream->size;
+}
+
+/**
+ * Sets memory budget of vertex stream cache.
+ * Streams exceeding new budget are evicted immediately.
+ * @param ctx Hardware context.
+ * @param budget Memory budget in bytes (0 disables the cache).
+ */
+void fimgSetStreamCacheBudget(fimgContext *ctx, size_t budget)
+{
+	fimgStreamCache *cache = &ctx->streamCache;
+
+	cache->stats.budget = budget;
+	evictStreams(cache, 0);
+}
+
+/**
+ * Retrieves vertex stream cache statistics.
+ * @param ctx Hardware context.
+ * @param stats Structure to fill with statistics.
+ */
+void fimgGetStreamCacheStats(fimgContext *ctx, fimgStreamCacheStats *stats)
+{
+	*stats = ctx->streamCache.stats;
+}
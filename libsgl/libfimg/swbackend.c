@@ -0,0 +1,369 @@
+/*
+ * fimg/swbackend.c
+ *
+ * SAMSUNG S3C6410 FIMG-3DSE IN-PROCESS SOFTWARE BACKEND
+ *
+ * Copyrights:	2010 by Tomasz Figa < tomasz.figa at gmail.com >
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "fimg_private.h"
+
+#ifdef FIMG_SOFTWARE_BACKEND
+
+/*
+ * This backend replaces /dev/s3c-g3d with plain process memory, so the whole
+ * driver can run on machines without FIMG-3DSE hardware. The register file
+ * (including the vertex buffer and FIFO ports) is modeled as memory, the
+ * pipeline is always idle and cache operations complete immediately.
+ * Register writes are counted and, if FIMG_SW_TRACE names a trace file,
+ * recorded with a timestamp for later analysis.
+ */
+
+#define FIMG_SFR_SIZE		0x80000
+
+/** Free FIFO space reported by emulated hardware (always empty). */
+#define FIMG_SW_FIFO_SIZE	32
+
+/** Version reported by emulated hardware (1.5.0). */
+#define FIMG_SW_VERSION		0x01050000
+
+/** Number of trace entries buffered before writing them to trace file. */
+#define FIMG_SW_TRACE_LEN	4096
+
+typedef struct {
+	uint64_t timestamp;
+	uint32_t addr;
+	uint32_t data;
+} fimgSwTraceEntry;
+
+struct _fimgSwBackend {
+	pthread_mutex_t hwLock;
+	pthread_cond_t hwFree;
+	/* Set while a context holds the emulated hardware */
+	int busy;
+	/* Number of contexts waiting for the emulated hardware */
+	unsigned int waiters;
+	pthread_mutex_t traceLock;
+	unsigned int refCount;
+	/* Emulated register file */
+	volatile char *regs;
+	/* Context that owned the hardware most recently */
+	fimgContext *owner;
+	/* Hardware state ownership of emulated clients */
+	fimgSharedState shared;
+	/* Write trace */
+	FILE *traceFile;
+	fimgSwTraceEntry *trace;
+	unsigned int traceLen;
+	/* Statistics */
+	uint64_t writes;
+	uint64_t vbWords;
+	uint64_t fifoWords;
+	uint64_t locks;
+	uint64_t restores;
+};
+
+static fimgSwBackend fimgSw = {
+	.hwLock = PTHREAD_MUTEX_INITIALIZER,
+	.hwFree = PTHREAD_COND_INITIALIZER,
+	.traceLock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static pthread_mutex_t fimgSwOpenLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Returns current monotonic time in nanoseconds.
+ */
+static inline uint64_t fimgSwTimestamp(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Writes buffered trace entries to trace file.
+ * (Must be called with trace lock held.)
+ * @param sw Software backend.
+ */
+static void fimgSwFlushTrace(fimgSwBackend *sw)
+{
+	unsigned int i;
+
+	if (sw->traceFile) {
+		for (i = 0; i < sw->traceLen; ++i)
+			fprintf(sw->traceFile, "%llu %05x %08x\n",
+				(unsigned long long)sw->trace[i].timestamp,
+				sw->trace[i].addr, sw->trace[i].data);
+	}
+
+	sw->traceLen = 0;
+}
+
+/**
+ * Emulates a write to hardware register.
+ * @param ctx Hardware context.
+ * @param data Value to write.
+ * @param addr Register address.
+ */
+void fimgSwWrite(fimgContext *ctx, unsigned int data, unsigned int addr)
+{
+	fimgSwBackend *sw = ctx->sw;
+	volatile uint32_t *reg = (volatile uint32_t *)(ctx->base + addr);
+	fimgSwTraceEntry *entry;
+
+	__sync_add_and_fetch(&sw->writes, 1);
+	if (addr >= FGHI_VB_ENTRY && addr < FGHI_VB_END)
+		__sync_add_and_fetch(&sw->vbWords, 1);
+	else if (addr == FGHI_FIFO_ENTRY)
+		__sync_add_and_fetch(&sw->fifoWords, 1);
+
+	/* Trace file is only opened or closed with no other users */
+	if (sw->traceFile) {
+		pthread_mutex_lock(&sw->traceLock);
+
+		if (sw->traceLen == FIMG_SW_TRACE_LEN)
+			fimgSwFlushTrace(sw);
+
+		entry = &sw->trace[sw->traceLen++];
+		entry->timestamp = fimgSwTimestamp();
+		entry->addr = addr;
+		entry->data = data;
+
+		pthread_mutex_unlock(&sw->traceLock);
+	}
+
+	switch (addr) {
+	case FGGB_PIPESTATE:
+	case FGGB_VERSION:
+	case FGHI_DWSPACE:
+		/* Read-only registers */
+		return;
+	case FGGB_CACHECTL:
+	case FGGB_RST:
+		/* Cache operations and resets complete immediately */
+		*reg = 0;
+		return;
+	}
+
+	*reg = data;
+}
+
+/**
+ * Emulates a read from hardware register.
+ * @param ctx Hardware context.
+ * @param addr Register address.
+ * @return Register value.
+ */
+unsigned int fimgSwRead(fimgContext *ctx, unsigned int addr)
+{
+	volatile uint32_t *reg = (volatile uint32_t *)(ctx->base + addr);
+
+	return *reg;
+}
+
+/**
+ * Initializes the emulated device.
+ * @param ctx Hardware context.
+ * @return 0 on success, negative on error.
+ */
+int fimgDeviceOpen(fimgContext *ctx)
+{
+	fimgSwBackend *sw = &fimgSw;
+	const char *path;
+
+	pthread_mutex_lock(&fimgSwOpenLock);
+
+	if (!sw->refCount) {
+		sw->regs = calloc(1, FIMG_SFR_SIZE);
+		sw->trace = malloc(FIMG_SW_TRACE_LEN * sizeof(*sw->trace));
+		if (!sw->regs || !sw->trace) {
+			LOGE("Couldn't allocate emulated FIMG registers.");
+			free((void *)sw->regs);
+			free(sw->trace);
+			pthread_mutex_unlock(&fimgSwOpenLock);
+			return -ENOMEM;
+		}
+
+		*(volatile uint32_t *)(sw->regs + FGGB_VERSION) =
+							FIMG_SW_VERSION;
+		*(volatile uint32_t *)(sw->regs + FGHI_DWSPACE) =
+							FIMG_SW_FIFO_SIZE;
+
+		path = getenv("FIMG_SW_TRACE");
+		if (path) {
+			sw->traceFile = fopen(path, "w");
+			if (!sw->traceFile)
+				LOGW("Couldn't open trace file %s (%s).",
+							path, strerror(errno));
+		}
+
+		sw->owner = NULL;
+		sw->shared.magic = 0;
+		sw->traceLen = 0;
+		sw->writes = 0;
+		sw->vbWords = 0;
+		sw->fifoWords = 0;
+		sw->locks = 0;
+		sw->restores = 0;
+	}
+
+	++sw->refCount;
+
+	pthread_mutex_unlock(&fimgSwOpenLock);
+
+	ctx->sw = sw;
+	ctx->base = sw->regs;
+	ctx->fd = -1;
+	ctx->shared = &sw->shared;
+
+	LOGD("Opened software FIMG backend.");
+
+	return 0;
+}
+
+/**
+ * Releases the emulated device.
+ * @param ctx Hardware context.
+ */
+void fimgDeviceClose(fimgContext *ctx)
+{
+	fimgSwBackend *sw = ctx->sw;
+
+	pthread_mutex_lock(&fimgSwOpenLock);
+
+	if (sw->owner == ctx)
+		sw->owner = NULL;
+
+	if (--sw->refCount) {
+		pthread_mutex_unlock(&fimgSwOpenLock);
+		return;
+	}
+
+	LOGI("Software FIMG backend: %llu writes (%llu VB, %llu FIFO), "
+		"%llu locks, %llu restores",
+		(unsigned long long)sw->writes,
+		(unsigned long long)sw->vbWords,
+		(unsigned long long)sw->fifoWords,
+		(unsigned long long)sw->locks,
+		(unsigned long long)sw->restores);
+
+	pthread_mutex_lock(&sw->traceLock);
+	fimgSwFlushTrace(sw);
+	if (sw->traceFile) {
+		fclose(sw->traceFile);
+		sw->traceFile = NULL;
+	}
+	pthread_mutex_unlock(&sw->traceLock);
+
+	free((void *)sw->regs);
+	sw->regs = NULL;
+	free(sw->trace);
+	sw->trace = NULL;
+
+	pthread_mutex_unlock(&fimgSwOpenLock);
+}
+
+/**
+ * Claims the emulated hardware for exclusive use.
+ * @param ctx Hardware context.
+ * @return 0 on success, positive if context restore is needed,
+ * negative on error.
+ */
+int fimgAcquireHardwareLock(fimgContext *ctx)
+{
+	fimgSwBackend *sw = ctx->sw;
+	int ret = 0;
+
+	pthread_mutex_lock(&sw->hwLock);
+
+	++sw->waiters;
+	while (sw->busy)
+		pthread_cond_wait(&sw->hwFree, &sw->hwLock);
+	--sw->waiters;
+	sw->busy = 1;
+
+	++sw->locks;
+	if (sw->owner != ctx) {
+		/* Another context used the hardware in the meantime */
+		sw->owner = ctx;
+		++sw->restores;
+		ret = 1;
+	}
+
+	ctx->locked = 1;
+
+	pthread_mutex_unlock(&sw->hwLock);
+
+	return ret;
+}
+
+/**
+ * Releases the emulated hardware.
+ * Unlike a mutex, the hardware can be released by any thread.
+ * @param ctx Hardware context.
+ * @return 0 on success, negative on error.
+ */
+int fimgReleaseHardwareLock(fimgContext *ctx)
+{
+	fimgSwBackend *sw = ctx->sw;
+
+	pthread_mutex_lock(&sw->hwLock);
+
+	ctx->locked = 0;
+	sw->busy = 0;
+	pthread_cond_signal(&sw->hwFree);
+
+	pthread_mutex_unlock(&sw->hwLock);
+
+	return 0;
+}
+
+/**
+ * Checks whether another context is waiting for the emulated hardware.
+ * @param ctx Hardware context.
+ * @return Non-zero if the hardware is contended, otherwise zero.
+ */
+int fimgHardwareLockContended(fimgContext *ctx)
+{
+	return ctx->sw->waiters != 0;
+}
+
+/**
+ * Waits for emulated hardware to flush graphics pipeline.
+ * The emulated pipeline is always idle, so this returns immediately.
+ * @param ctx Hardware context.
+ * @param target Bit mask of pipeline parts to be flushed.
+ * @return 0 on success, negative on error.
+ */
+int fimgWaitForFlush(fimgContext *ctx, uint32_t target)
+{
+	return 0;
+}
+
+#endif /* FIMG_SOFTWARE_BACKEND */
@@ -39,6 +39,67 @@
 
 #define FIMG_SFR_SIZE 0x80000
 
+#ifndef FIMG_SOFTWARE_BACKEND
+/**
+ * Maps hardware state ownership shared with other clients.
+ * The file is accessible only to the group of G3D device, so clients
+ * of the hardware can track their state, but nobody else can tamper with it.
+ * @param devFd File descriptor of G3D device.
+ * @return Pointer to shared state or NULL if not available.
+ */
+static fimgSharedState *openSharedState(int devFd)
+{
+	fimgSharedState *shared;
+	struct stat dev, st;
+	int fd;
+
+	if (fstat(devFd, &dev))
+		return NULL;
+
+	fd = open(FIMG_SHARED_STATE_FILE, O_RDWR | O_CREAT | O_NOFOLLOW, 0660);
+	if (fd < 0) {
+		LOGW("Couldn't open %s (%s), context restores will be full.",
+					FIMG_SHARED_STATE_FILE, strerror(errno));
+		return NULL;
+	}
+
+	/* Newly created file might have wrong group or mode (umask) */
+	if (!fstat(fd, &st) && st.st_uid == geteuid()) {
+		if (st.st_gid != dev.st_gid)
+			fchown(fd, -1, dev.st_gid);
+		fchmod(fd, 0660);
+	}
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode)
+	    || st.st_gid != dev.st_gid || (st.st_mode & 0707) != 0600
+	    || (st.st_uid != geteuid() && st.st_uid != 0)) {
+		LOGW("Wrong owner or mode of %s, context restores will be full.",
+						FIMG_SHARED_STATE_FILE);
+		close(fd);
+		return NULL;
+	}
+
+	if (st.st_size < (off_t)sizeof(*shared)
+	    && ftruncate(fd, sizeof(*shared))) {
+		LOGW("Couldn't resize %s (%s), context restores will be full.",
+					FIMG_SHARED_STATE_FILE, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE,
+							MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (shared == MAP_FAILED) {
+		LOGW("Couldn't mmap %s (%s), context restores will be full.",
+					FIMG_SHARED_STATE_FILE, strerror(errno));
+		return NULL;
+	}
+
+	return shared;
+}
+
 /**
  * Opens G3D device and maps GPU registers into application address space.
  * @param ctx Hardware context.
@@ -62,6 +123,8 @@ int fimgDeviceOpen(fimgContext *ctx)
 #endif
 	LOGD("Opened /dev/s3c-g3d (%d).", ctx->fd);
 
+	ctx->shared = openSharedState(ctx->fd);
+
 	return 0;
 }
 
@@ -71,6 +134,8 @@ int fimgDeviceOpen(fimgContext *ctx)
  */
 void fimgDeviceClose(fimgContext *ctx)
 {
+	if (ctx->shared)
+		munmap(ctx->shared, sizeof(*ctx->shared));
 #ifndef FIMG_DEBUG_IOMEM_ACCESS
 	munmap((void *)ctx->base, FIMG_SFR_SIZE);
 #endif
@@ -78,6 +143,7 @@ void fimgDeviceClose(fimgContext *ctx)
 
 	LOGD("fimg3D: Closed /dev/s3c-g3d (%d).", ctx->fd);
 }
+#endif /* FIMG_SOFTWARE_BACKEND */
 
 /**
 	Context management
@@ -90,20 +156,16 @@ void fimgDeviceClose(fimgContext *ctx)
 fimgContext *fimgCreateContext(void)
 {
 	fimgContext *ctx;
-	uint32_t *queue;
 
 	if ((ctx = malloc(sizeof(*ctx))) == NULL)
 		return NULL;
 
-	if ((queue = malloc(2*(FIMG_MAX_QUEUE_LEN + 1)*sizeof(uint32_t))) == NULL) {
-		free(ctx);
-		return NULL;
-	}
-
 	memset(ctx, 0, sizeof(fimgContext));
 
+	fimgCreateLockState(ctx);
+
 	if(fimgDeviceOpen(ctx)) {
-		free(queue);
+		fimgDestroyLockState(ctx);
 		free(ctx);
 		return NULL;
 	}
@@ -116,10 +178,7 @@ fimgContext *fimgCreateContext(void)
 #ifdef FIMG_FIXED_PIPELINE
 	fimgCreateCompatContext(ctx);
 #endif
-
-	ctx->queue = queue;
-	ctx->queue[0] = 0;
-	ctx->queueStart = queue;
+	fimgCreateStreamCache(ctx);
 
 	return ctx;
 }
@@ -130,46 +189,167 @@ fimgContext *fimgCreateContext(void)
  */
 void fimgDestroyContext(fimgContext *ctx)
 {
+	fimgWaitStats *wait = &ctx->global.waitStats;
+
+	LOGD("Hardware waits: %u spins (%llu us), %u sleeps (%llu us)",
+		wait->spins, (unsigned long long)wait->spinTime / 1000,
+		wait->sleeps, (unsigned long long)wait->sleepTime / 1000);
+
+	fimgDestroyLockState(ctx);
 	fimgDeviceClose(ctx);
-	free(ctx->queueStart);
 	free(ctx->vertexData);
+	free(ctx->indexedBatch);
+	fimgDestroyStreamCache(ctx);
 #ifdef FIMG_FIXED_PIPELINE
-	free(ctx->compat.vshaderBuf);
-	free(ctx->compat.pshaderBuf);
+	fimgDestroyCompatContext(ctx);
 #endif
 	free(ctx);
 }
 
+/**
+ * Restores selected blocks of hardware context to hardware.
+ * @param ctx Hardware context.
+ * @param blocks Bit mask of hardware blocks to restore (FIMG_BLOCK_*).
+ */
+void fimgRestoreBlocks(fimgContext *ctx, uint32_t blocks)
+{
+	if (blocks & FIMG_BLOCK_HOST)
+		fimgRestoreHostState(ctx);
+	if (blocks & FIMG_BLOCK_PRIMITIVE)
+		fimgRestorePrimitiveState(ctx);
+	if (blocks & FIMG_BLOCK_RASTER)
+		fimgRestoreRasterizerState(ctx);
+	if (blocks & FIMG_BLOCK_FRAGMENT)
+		fimgRestoreFragmentState(ctx);
+	if (blocks & FIMG_BLOCK_TEXTURE)
+		fimgRestoreTextureState(ctx);
+#ifdef FIMG_FIXED_PIPELINE
+	fimgRestoreCompatState(ctx, blocks);
+#endif
+
+	fimgResetShadow(ctx, blocks);
+	ctx->touched |= blocks;
+}
+
 /**
  * Restores full hardware context to hardware.
  * @param ctx Hardware context.
  */
 void fimgRestoreContext(fimgContext *ctx)
 {
-//	fprintf(stderr, "fimg: Restoring global state\n"); fflush(stderr);
 	fimgRestoreGlobalState(ctx);
-//	fprintf(stderr, "fimg: Restoring host state\n"); fflush(stderr);
-	fimgRestoreHostState(ctx);
-//	fprintf(stderr, "fimg: Restoring primitive state\n"); fflush(stderr);
-	fimgRestorePrimitiveState(ctx);
-//	fprintf(stderr, "fimg: Restoring rasterizer state\n"); fflush(stderr);
-	fimgRestoreRasterizerState(ctx);
-//	fprintf(stderr, "fimg: Restoring fragment state\n"); fflush(stderr);
-	fimgRestoreFragmentState(ctx);
-#ifdef FIMG_FIXED_PIPELINE
-//	fprintf(stderr, "fimg: Restoring compat state\n"); fflush(stderr);
-	fimgRestoreCompatState(ctx);
-#endif
+	fimgRestoreBlocks(ctx, FIMG_BLOCK_ALL);
+}
 
-	ctx->queue = ctx->queueStart;
-	ctx->queue[0] = 0;
-	ctx->queueLen = 0;
+/*
+ * Every client records in shared state which blocks it has modified during
+ * a session. After another client used the hardware only blocks modified by
+ * other clients since our last session need to be restored. Without shared
+ * state every lock loss requires full restore.
+ */
+
+/**
+ * Validates shared state, initializing it on first use.
+ * (Must be called with hardware lock.)
+ * @param ctx Hardware context.
+ * @return Pointer to shared state or NULL if not available.
+ */
+static fimgSharedState *getSharedState(fimgContext *ctx)
+{
+	fimgSharedState *shared = ctx->shared;
+
+	if (!shared)
+		return NULL;
+
+	if (shared->magic != FIMG_SHARED_STATE_MAGIC
+	    || shared->version != FIMG_SHARED_STATE_VERSION) {
+		memset(shared, 0, sizeof(*shared));
+		shared->magic = FIMG_SHARED_STATE_MAGIC;
+		shared->version = FIMG_SHARED_STATE_VERSION;
+	}
+
+	return shared;
+}
+
+/**
+ * Determines hardware blocks modified by other clients since last session.
+ * Every client taking the hardware from another one bumps shared generation,
+ * so if the kernel reports another client, but the generation is still the
+ * one we left, that client does not publish its state (e.g. older library)
+ * and ownership of all blocks is unknown.
+ * (Must be called with hardware lock.)
+ * @param ctx Hardware context.
+ * @param ret Result of fimgAcquireHardwareLock() (1 or 2).
+ * @return Bit mask of modified hardware blocks (FIMG_BLOCK_*).
+ */
+uint32_t fimgChangedBlocks(fimgContext *ctx, int ret)
+{
+	fimgSharedState *shared = getSharedState(ctx);
+	uint32_t lastClient, owner;
+	uint32_t blocks = 0;
+	unsigned int block;
+
+	if (!shared)
+		return FIMG_BLOCK_ALL;
+
+	if (ret == 2 || shared->generation == ctx->sharedGeneration) {
+		/* Hardware state lost or changed behind our back */
+		memset(shared->owner, 0, sizeof(shared->owner));
+		blocks = FIMG_BLOCK_ALL;
+	}
+
+	ctx->sharedGeneration = ++shared->generation;
+
+	if (blocks || !ctx->clientId)
+		return FIMG_BLOCK_ALL;
+
+	/* Inconsistent shared state can not be trusted */
+	lastClient = shared->lastClient;
+	if (ctx->clientId > lastClient)
+		return FIMG_BLOCK_ALL;
+
+	for (block = 0; block < FIMG_BLOCK_NUM; ++block) {
+		owner = shared->owner[block];
+		if (owner > lastClient)
+			return FIMG_BLOCK_ALL;
+		/* Blocks not loaded by any known client are restored too */
+		if (owner != ctx->clientId)
+			blocks |= 1 << block;
+	}
+
+	return blocks;
+}
+
+/**
+ * Records hardware blocks modified in current session in shared state.
+ * (Must be called with hardware lock.)
+ * @param ctx Hardware context.
+ */
+void fimgPublishBlocks(fimgContext *ctx)
+{
+	fimgSharedState *shared = getSharedState(ctx);
+	uint32_t touched = ctx->touched;
+	unsigned int block;
+
+	ctx->touched = 0;
+
+	if (!shared)
+		return;
+
+	while (!ctx->clientId)
+		ctx->clientId = ++shared->lastClient;
+
+	for (block = 0; block < FIMG_BLOCK_NUM; ++block)
+		if (touched & (1 << block))
+			shared->owner[block] = ctx->clientId;
 }
 
 /**
 	Power management
 */
 
+#ifndef FIMG_SOFTWARE_BACKEND
+
 /**
  * Claims the hardware for exclusive use, possibly powering it up.
  * @param ctx Hardware context.
@@ -219,6 +399,18 @@ int fimgReleaseHardwareLock(fimgContext *ctx)
 	return 0;
 }
 
+/**
+ * Checks whether another client is waiting for the hardware.
+ * The kernel driver does not report lock waiters, so retained lock
+ * is released only on explicit request or after idle timeout.
+ * @param ctx Hardware context.
+ * @return Non-zero if the hardware is contended, otherwise zero.
+ */
+int fimgHardwareLockContended(fimgContext *ctx)
+{
+	return 0;
+}
+
 /**
  * Waits for hardware to flush graphics pipeline.
  * @param ctx Hardware context.
@@ -235,3 +427,4 @@ int fimgWaitForFlush(fimgContext *ctx, uint32_t target)
 
 	return 0;
 }
+#endif /* FIMG_SOFTWARE_BACKEND */
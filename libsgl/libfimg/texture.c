@@ -102,6 +102,7 @@ fimgTexture *fimgCreateTexture(void)
  */
 void fimgDestroyTexture(fimgTexture *texture)
 {
+	free(texture->palette);
 	free(texture);
 }
 
@@ -119,6 +120,68 @@ void fimgInitTexture(fimgTexture *texture, unsigned int flags,
 	texture->control.textureFmt = format;
 	texture->control.alphaFmt = !!(flags & FGTU_TEX_RGBA);
 	texture->baseAddr = addr;
+	texture->paletteSize = 0;
+}
+
+/**
+ * Sets palette of indexed texture.
+ * Palette memory of the hardware is shared by all texture units, so
+ * indexed textures with different palettes can not be used in single draw.
+ * @param texture Texture object.
+ * @param format Format of palette entries (FGTU_TSTA_PAL_TEX_FORMAT_*).
+ * @param palette Palette entries.
+ * @param count Number of palette entries.
+ * @return Zero on success, negative on error.
+ */
+int fimgSetTexPalette(fimgTexture *texture, unsigned int format,
+			const uint32_t *palette, unsigned int count)
+{
+	static uint32_t lastPaletteId;
+
+	if (count > FGTU_MAX_PALETTE_SIZE)
+		return -1;
+
+	if (!texture->palette) {
+		texture->palette =
+			malloc(FGTU_MAX_PALETTE_SIZE * sizeof(*palette));
+		if (!texture->palette)
+			return -1;
+	}
+
+	memcpy(texture->palette, palette, count * sizeof(*palette));
+	texture->paletteSize = count;
+	texture->control.paletteFmt = format;
+	/* Palette contents are identified by global counter */
+	do {
+		texture->paletteId = __sync_add_and_fetch(&lastPaletteId, 1);
+	} while (!texture->paletteId);
+
+	return 0;
+}
+
+/**
+ * Loads palette of texture object to palette memory of the hardware,
+ * unless it is already loaded.
+ * (Must be called with hardware locked.)
+ * @param ctx Hardware context.
+ * @param texture Texture object.
+ */
+static void loadTexPalette(fimgContext *ctx, fimgTexture *texture)
+{
+	unsigned int i;
+
+	if (ctx->texPaletteId == texture->paletteId)
+		return;
+
+	/* Previous draws might still sample from palette memory */
+	fimgFlush(ctx);
+
+	fimgWrite(ctx, 0, FGTU_PALETTE_ADDR);
+	for (i = 0; i < texture->paletteSize; ++i)
+		fimgWrite(ctx, texture->palette[i], FGTU_PALETTE_IN);
+
+	ctx->texPaletteId = texture->paletteId;
+	ctx->touched |= FIMG_BLOCK_TEXTURE;
 }
 
 /**
@@ -168,20 +231,27 @@ void fimgInvalidateTextureCache(fimgContext *ctx)
  */
 void fimgSetupTexture(fimgContext *ctx, fimgTexture *texture, unsigned unit)
 {
-	volatile uint32_t *reg = (volatile uint32_t *)(ctx->base +FGTU_TSTA(unit));
-	uint32_t *data = (uint32_t *)texture;
-	unsigned count = sizeof(fimgTexture) / 4;
-
-	asm volatile (
-		"1:\n\t"
-		"ldmia %1!, {r0-r3}\n\t"
-		"stmia %0!, {r0-r3}\n\t"
-		"subs %4, %4, $1\n\t"
-		"bne 1b\n\t"
-		: "=r"(reg), "=r"(data)
-		: "0"(reg), "1"(data), "r"(count / 4)
-		: "r0", "r1", "r2", "r3"
-	);
+#ifdef FIMG_SOFTWARE_BACKEND
+	fimgWriteBlock(ctx, (uint32_t *)texture, FGTU_TSTA(unit),
+						FGTU_TEX_REGS_SIZE / 4);
+#else
+	fimgKernels->copy16((void *)(ctx->base + FGTU_TSTA(unit)),
+					texture, FGTU_TEX_REGS_SIZE / 16);
+#endif
+
+	if (texture->paletteSize)
+		loadTexPalette(ctx, texture);
+}
+
+/**
+ * Restores hardware context of texture engine.
+ * Texture units are set up before each draw, only contents of palette
+ * memory are tracked.
+ * @param ctx Hardware context.
+ */
+void fimgRestoreTextureState(fimgContext *ctx)
+{
+	ctx->texPaletteId = 0;
 }
 
 /**
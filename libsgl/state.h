@@ -371,6 +371,75 @@ struct FGLRasterizerState {
 		polyOffUnits(0.0f) {};
 };
 
+/** Structure holding lighting parameters. */
+struct FGLLightingState {
+	/** Light source parameters (positions and directions in eye space). */
+	fimgLight light[FGL_MAX_LIGHTS];
+	/** Material parameters (shared by front and back faces). */
+	fimgMaterial material;
+	/** Scene ambient color. */
+	GLfloat ambient[4];
+	/** Two-sided lighting mode (only stored, not supported). */
+	GLboolean twoSide;
+
+	/** Constructor initializing lighting parameters with default values. */
+	FGLLightingState() :
+		twoSide(GL_FALSE)
+	{
+		static const fimgLight defLight = {
+			{ 0.0f, 0.0f, 0.0f, 1.0f },
+			{ 0.0f, 0.0f, 0.0f, 1.0f },
+			{ 0.0f, 0.0f, 0.0f, 1.0f },
+			{ 0.0f, 0.0f, 1.0f, 0.0f },
+			{ 0.0f, 0.0f, -1.0f },
+			0.0f,
+			180.0f,
+			{ 1.0f, 0.0f, 0.0f }
+		};
+		static const fimgMaterial defMaterial = {
+			{ 0.2f, 0.2f, 0.2f, 1.0f },
+			{ 0.8f, 0.8f, 0.8f, 1.0f },
+			{ 0.0f, 0.0f, 0.0f, 1.0f },
+			{ 0.0f, 0.0f, 0.0f, 1.0f },
+			0.0f
+		};
+
+		for (int i = 0; i < FGL_MAX_LIGHTS; ++i)
+			light[i] = defLight;
+		for (int i = 0; i < 3; ++i) {
+			light[0].diffuse[i] = 1.0f;
+			light[0].specular[i] = 1.0f;
+			ambient[i] = 0.2f;
+		}
+		ambient[3] = 1.0f;
+		material = defMaterial;
+	};
+};
+
+/** Structure holding fog state. */
+struct FGLFogState {
+	/** Fog mode (GL_LINEAR, GL_EXP or GL_EXP2). */
+	GLenum mode;
+	/** Fog density used by exponential modes. */
+	GLfloat density;
+	/** Fog start distance used by linear mode. */
+	GLfloat start;
+	/** Fog end distance used by linear mode. */
+	GLfloat end;
+	/** Fog color. */
+	GLfloat color[4];
+
+	/** Constructor initializing fog parameters with default values. */
+	FGLFogState() :
+		mode(GL_EXP),
+		density(1.0f),
+		start(0.0f),
+		end(1.0f)
+	{
+		color[0] = color[1] = color[2] = color[3] = 0.0f;
+	};
+};
+
 /** Structure holding information which capabilities are enabled. */
 struct FGLEnableState {
 	/** Indicates that face culling is enabled. */
@@ -391,6 +460,20 @@ struct FGLEnableState {
 	unsigned colorLogicOp	:1;
 	/** Indicates that alpha test is enabled. */
 	unsigned alphaTest	:1;
+	/** Indicates that lighting is enabled. */
+	unsigned lighting	:1;
+	/** Bit mask of enabled light sources. */
+	unsigned light		:FGL_MAX_LIGHTS;
+	/** Indicates that normal normalization is enabled. */
+	unsigned normalize	:1;
+	/** Indicates that normal rescaling is enabled. */
+	unsigned rescaleNormal	:1;
+	/** Indicates that color material is enabled. */
+	unsigned colorMaterial	:1;
+	/** Indicates that fog is enabled. */
+	unsigned fog		:1;
+	/** Bit mask of enabled user clip planes. */
+	unsigned clipPlane	:FGL_MAX_CLIP_PLANES;
 
 	/** Constructor setting default capability enable state. */
 	FGLEnableState() :
@@ -401,7 +484,14 @@ struct FGLEnableState {
 		depthTest(0),
 		blend(0),
 		dither(1),
-		colorLogicOp(0) {};
+		colorLogicOp(0),
+		lighting(0),
+		light(0),
+		normalize(0),
+		rescaleNormal(0),
+		colorMaterial(0),
+		fog(0),
+		clipPlane(0) {};
 };
 
 /** Structure holding framebuffer state. */
@@ -444,6 +534,60 @@ struct FGLFramebufferState {
 	}
 };
 
+/** Draw merging statistics. */
+struct FGLDrawQueueStats {
+	/** Number of draw calls issued in last frame. */
+	unsigned int draws;
+	/** Number of hardware sessions submitted in last frame. */
+	unsigned int sessions;
+	/** Total number of draw calls issued in finished frames. */
+	unsigned int totalDraws;
+	/** Total number of hardware sessions submitted in finished frames. */
+	unsigned int totalSessions;
+
+	/** Constructor initializing all counters to zero. */
+	FGLDrawQueueStats() :
+		draws(0),
+		sessions(0),
+		totalDraws(0),
+		totalSessions(0) {};
+};
+
+/** Structure holding draws waiting to be merged into single hardware session. */
+struct FGLDrawQueue {
+	/** Storage for vertex data of queued draws. */
+	uint8_t *data;
+	/** Attribute array descriptors pointing to queued vertex data. */
+	fimgArray arrays[4 + FGL_MAX_TEXTURE_UNITS];
+	/** Number of attributes sent to the hardware. */
+	int numArrays;
+	/** Primitive type of queued draws. */
+	uint32_t mode;
+	/** Indicates that queued draws are screen space rectangles (glDrawTex). */
+	bool drawTex;
+	/** Number of queued vertices. */
+	uint32_t count;
+	/** Number of vertices fitting in the storage. */
+	uint32_t maxCount;
+	/** Number of draw calls since the beginning of current frame. */
+	unsigned int draws;
+	/** Session count of libfimg at the beginning of current frame. */
+	unsigned int frameStart;
+	/** Statistics of finished frames. */
+	FGLDrawQueueStats stats;
+
+	/** Constructor initializing draw queue with default values. */
+	FGLDrawQueue() :
+		data(0),
+		numArrays(0),
+		mode(0),
+		drawTex(false),
+		count(0),
+		maxCount(0),
+		draws(0),
+		frameStart(0) {};
+};
+
 /** Structure storing complete state of rendering context. */
 struct FGLContext {
 	/** libfimg hardware context. */
@@ -476,6 +620,12 @@ struct FGLContext {
 	FGLRasterizerState rasterizer;
 	/** Per-fragment state. */
 	FGLPerFragmentState perFragment;
+	/** Lighting state. */
+	FGLLightingState lighting;
+	/** Fog state. */
+	FGLFogState fog;
+	/** User clip planes (in eye coordinates). */
+	GLfloat clipPlane[FGL_MAX_CLIP_PLANES][4];
 	/** Framebuffer clear state. */
 	FGLClearState clear;
 	/** Textures that might be used by GPU at the moment. */
@@ -488,6 +638,8 @@ struct FGLContext {
 	FGLRenderbufferBinding renderbuffer;
 	/** EGL-specific context state. */
 	FGLEGLState egl;
+	/** Draws waiting for submission to the hardware. */
+	FGLDrawQueue drawQueue;
 	/** Indicates that the context does not have any pending operation. */
 	bool finished;
 
@@ -507,6 +659,7 @@ struct FGLContext {
 		finished(true)
 	{
 		memcpy(vertex, defaultVertex, (4 + FGL_MAX_TEXTURE_UNITS) * sizeof(FGLvec4f));
+		memset(clipPlane, 0, sizeof(clipPlane));
 		for (int i = 0; i < FGL_MAX_TEXTURE_UNITS; ++i) {
 			busyTexture[i] = 0;
 			texture[i].defTexture.target = GL_TEXTURE_2D;